@@ -0,0 +1,247 @@
+/*
+    Filename: msh_parser_benchmark.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains a benchmark of the msh parser and writer throughput.
+    The test skin mesh is replicated side by side to build a large input file
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mesh_snapshot.h"
+#include "msh_parser.h"
+#include "utils.h"
+
+#define RUNS 3
+
+static int writeScaledMesh(const Mesh* mesh, size_t copies, FILE* file)
+{
+    float minX, maxX, minY, maxY, minZ, maxZ;
+    getShape(mesh, &minX, &maxX, &minY, &maxY, &minZ, &maxZ);
+    double width = (double)(maxX - minX);
+
+    fprintf(file, "$NOD\n%zu\n", mesh->nNodes * copies);
+    for (size_t k = 0; k < copies; ++k)
+    {
+        for (size_t i = 0; i < mesh->nNodes; ++i)
+        {
+            const Node* node = &mesh->nodes[i];
+            fprintf(file, "%zu %.10g %.10g %.10g\n", k * mesh->nNodes + i + 1,
+                node->x + (double)k * width, node->y, node->z);
+        }
+    }
+    fprintf(file, "$ENDNOD\n$ELM\n%zu\n", mesh->nElems * copies);
+    for (size_t k = 0; k < copies; ++k)
+    {
+        for (size_t i = 0; i < mesh->nElems; ++i)
+        {
+            size_t first = mesh->elemOffsets[i];
+            size_t last = mesh->elemOffsets[i + 1];
+            fprintf(file, "%zu %u %u %u %zu", k * mesh->nElems + i + 1, mesh->elemTypes[i],
+                mesh->elemRegPhys[i], mesh->elemRegElem[i], last - first);
+            for (size_t j = first; j < last; ++j)
+            {
+                fprintf(file, " %zu", k * mesh->nNodes + mesh->elemNodes[j] + 1);
+            }
+            fprintf(file, "\n");
+        }
+    }
+    fprintf(file, "$ENDELM\n");
+
+    return ferror(file) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <project_root_directory> [copies]\n", argv[0]);
+        return 1;
+    }
+    size_t copies = argc > 2 ? (size_t)atoll(argv[2]) : 100;
+
+    char meshFile[256];
+    combinePaths(meshFile, argv[1], "tests/test_skin.msh");
+    Mesh mesh = { 0 };
+    if (!readMshFile(meshFile, &mesh))
+    {
+        printf("Failed to read MSH file %s\n", meshFile);
+        return 1;
+    }
+
+    int result = 0;
+    char scaledFile[] = "/tmp/amgem_msh_benchmark_XXXXXX";
+    int fd = mkstemp(scaledFile);
+    FILE* file = fd == -1 ? NULL : fdopen(fd, "w");
+    if (file == NULL)
+    {
+        printf("Failed to create temporary MSH file\n");
+        freeMesh(&mesh);
+        return 1;
+    }
+    int written = writeScaledMesh(&mesh, copies, file);
+    fclose(file);
+    freeMesh(&mesh);
+    if (!written)
+    {
+        printf("Failed to write scaled MSH file %s\n", scaledFile);
+        result = 1;
+        goto out_remove_file;
+    }
+
+    Mesh scaled = { 0 };
+    double best = 0.0;
+    for (int run = 0; run < RUNS; ++run)
+    {
+        freeMesh(&scaled);
+        double start = wallClock();
+        if (!readMshFile(scaledFile, &scaled))
+        {
+            printf("Failed to read scaled MSH file %s\n", scaledFile);
+            result = 1;
+            goto out_free_mesh;
+        }
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+        printf("Run %d: %zu nodes, %zu elements in %.3f s\n",
+            run + 1, scaled.nNodes, scaled.nElems, elapsed);
+    }
+    printf("Best of %d read runs: %.3f s\n", RUNS, best);
+
+    // Per element: tag, type, both regions and offset, plus the node indexes
+    size_t elementBytes = scaled.nElems * (2 * sizeof(size_t) + 3 * sizeof(unsigned int))
+        + scaled.elemOffsets[scaled.nElems] * sizeof(size_t);
+    printf("Element storage: %.1f MB\n", (double)elementBytes / (1024.0 * 1024.0));
+
+    for (int run = 0; run < RUNS; ++run)
+    {
+        double start = wallClock();
+        if (!writeMshFile(scaledFile, &scaled, MSH_V1))
+        {
+            printf("Failed to write scaled MSH file %s\n", scaledFile);
+            result = 1;
+            goto out_free_mesh;
+        }
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    printf("Best of %d write runs: %.3f s\n", RUNS, best);
+
+    // Only the nodes are formatted, the elements are copied from the file itself
+    MshWriteOptions patchOptions = { MSH_V1, SHORTEST_PRECISION, scaledFile, 0 };
+    for (int run = 0; run < RUNS; ++run)
+    {
+        double start = wallClock();
+        if (!writeMshFileWithOptions(scaledFile, &scaled, &patchOptions))
+        {
+            printf("Failed to patch scaled MSH file %s\n", scaledFile);
+            result = 1;
+            goto out_free_mesh;
+        }
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    printf("Best of %d node patch runs: %.3f s\n", RUNS, best);
+
+    // Every record has a fixed width, so the threads fill the mapped file at once
+    MshWriteOptions fixedOptions = { MSH_V1, SHORTEST_PRECISION, NULL, 1 };
+    for (int run = 0; run < RUNS; ++run)
+    {
+        double start = wallClock();
+        if (!writeMshFileWithOptions(scaledFile, &scaled, &fixedOptions))
+        {
+            printf("Failed to write scaled MSH file %s with fixed-width records\n", scaledFile);
+            result = 1;
+            goto out_free_mesh;
+        }
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    printf("Best of %d fixed-width write runs: %.3f s\n", RUNS, best);
+
+    // Only the coordinates of the fixed-width file are formatted again
+    for (int run = 0; run < RUNS; ++run)
+    {
+        double start = wallClock();
+        if (!updateMshNodes(scaledFile, &scaled, SHORTEST_PRECISION))
+        {
+            printf("Failed to update the nodes of scaled MSH file %s\n", scaledFile);
+            result = 1;
+            goto out_free_mesh;
+        }
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    printf("Best of %d in-place node update runs: %.3f s\n", RUNS, best);
+
+    // Only the tri elements of two faces are decoded, the others are kept as text
+    ElementFilter filter = { 1ULL << MSH_TRI_3, 2, { 1, 6 } };
+    MshReadOptions filterOptions = { 0, &filter };
+    for (int run = 0; run < RUNS; ++run)
+    {
+        freeMesh(&scaled);
+        double start = wallClock();
+        if (!readMshFileWithOptions(scaledFile, &scaled, &filterOptions))
+        {
+            printf("Failed to read scaled MSH file %s with an element filter\n", scaledFile);
+            result = 1;
+            goto out_free_mesh;
+        }
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    printf("Best of %d filtered read runs: %.3f s, %zu decoded and %zu raw elements\n",
+        RUNS, best, scaled.nElems, scaled.nRawElems);
+
+    // The file is read through the bounded buffer of a stream, as from a pipe
+    for (int run = 0; run < RUNS; ++run)
+    {
+        freeMesh(&scaled);
+        double start = wallClock();
+        int fd = open(scaledFile, O_RDONLY);
+        int read = fd != -1 && readMshStream(fd, scaledFile, &scaled);
+        if (fd != -1) close(fd);
+        if (!read)
+        {
+            printf("Failed to read scaled MSH file %s as a stream\n", scaledFile);
+            result = 1;
+            goto out_free_mesh;
+        }
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    printf("Best of %d stream read runs: %.3f s\n", RUNS, best);
+
+    // The first read parses the file and writes its snapshot, the next ones map it
+    MshReadOptions options = { 1, NULL };
+    for (int run = 0; run <= RUNS; ++run)
+    {
+        freeMesh(&scaled);
+        double start = wallClock();
+        if (!readMshFileWithOptions(scaledFile, &scaled, &options))
+        {
+            printf("Failed to read scaled MSH file %s with its snapshot\n", scaledFile);
+            result = 1;
+            goto out_free_mesh;
+        }
+        double elapsed = wallClock() - start;
+        if (run == 1 || elapsed < best) best = elapsed;
+        printf("Snapshot run %d: %s in %.3f s\n",
+            run + 1, scaled.snapshot != NULL ? "mapped" : "parsed and saved", elapsed);
+    }
+    printf("Best of %d snapshot loads: %.3f s\n", RUNS, best);
+
+out_free_mesh:
+    freeMesh(&scaled);
+out_remove_file:
+    remove(scaledFile);
+    char snapshotFile[sizeof(scaledFile) + sizeof(SNAPSHOT_EXTENSION)];
+    snprintf(snapshotFile, sizeof(snapshotFile), "%s%s", scaledFile, SNAPSHOT_EXTENSION);
+    remove(snapshotFile);
+    return result;
+}
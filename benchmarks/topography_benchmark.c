@@ -0,0 +1,286 @@
+/*
+    Filename: topography_benchmark.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains a benchmark of the high-resolution topography grid
+    evaluation. The spline of a synthetic DEM is sampled on a large grid with
+    an increasing number of threads, then each bicubic kernel samples it on
+    one thread. The DEM is also written as an XYZ file to time its reading,
+    and random soundings of it to time their gridding
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bicubic.h"
+#include "parallel.h"
+#include "topography.h"
+#include "topography_parser.h"
+#include "utils.h"
+
+#define RUNS 3
+
+static int buildSyntheticDem(size_t size, Topography* grid)
+{
+    // Rolling hills with a ridge, 25 m apart, as a bathymetry survey grid
+    grid->nx = size;
+    grid->ny = size;
+    grid->xGrid = (double*)malloc(size * sizeof(double));
+    grid->yGrid = (double*)malloc(size * sizeof(double));
+    grid->values = (double*)malloc(size * size * sizeof(double));
+    if (grid->xGrid == NULL || grid->yGrid == NULL || grid->values == NULL)
+    {
+        freeTopography(grid);
+        return 0;
+    }
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        grid->xGrid[i] = 700000.0 + 25.0 * (double)i;
+        grid->yGrid[i] = 1150000.0 + 25.0 * (double)i;
+    }
+    for (size_t j = 0; j < size; ++j)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            double x = 25.0 * (double)i;
+            double y = 25.0 * (double)j;
+            grid->values[j * size + i] = -3000.0 + 400.0 * sin(x / 1700.0) * cos(y / 2300.0)
+                + 150.0 * exp(-pow((x - y) / 4000.0, 2.0));
+        }
+    }
+
+    return 1;
+}
+
+static int benchmarkXYZReader(const Topography* grid)
+{
+    char filename[] = "/tmp/amgem_topography_benchmark_XXXXXX";
+    int fd = mkstemp(filename);
+    FILE* file = fd == -1 ? NULL : fdopen(fd, "w");
+    if (file == NULL)
+    {
+        printf("Failed to create temporary XYZ file\n");
+        return 0;
+    }
+    fprintf(file, "# x y z\n");
+    for (size_t j = 0; j < grid->ny; ++j)
+    {
+        for (size_t i = 0; i < grid->nx; ++i)
+        {
+            fprintf(file, "%.3f %.3f %.6f\n", grid->xGrid[i], grid->yGrid[j],
+                grid->values[j * grid->nx + i]);
+        }
+    }
+    long size = ftell(file);
+    int result = ferror(file) == 0;
+    fclose(file);
+    if (!result)
+    {
+        printf("Failed to write temporary XYZ file %s\n", filename);
+        goto out_remove_file;
+    }
+
+    double best = 0.0;
+    for (int run = 0; run < RUNS && result; ++run)
+    {
+        Node* nodes = NULL;
+        size_t nNodes = 0;
+        double start = wallClock();
+        result = readXYZFile(filename, &nodes, &nNodes) && nNodes == grid->nx * grid->ny;
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+        free(nodes);
+    }
+    if (!result)
+    {
+        printf("Failed to read XYZ file %s\n", filename);
+        goto out_remove_file;
+    }
+    printf("XYZ file of %zu points, %zu threads: best of %d reads %.3f s, %.0f MB/s\n",
+        grid->nx * grid->ny, getThreadCount(), RUNS, best,
+        best > 0.0 ? (double)size / best / (1024.0 * 1024.0) : 0.0);
+
+out_remove_file:
+    remove(filename);
+    return result;
+}
+
+static int benchmarkScatteredGridding(const Topography* grid)
+{
+    // As many random soundings as DEM samples, taken at the nearest sample
+    char filename[] = "/tmp/amgem_topography_benchmark_XXXXXX";
+    int fd = mkstemp(filename);
+    FILE* file = fd == -1 ? NULL : fdopen(fd, "w");
+    if (file == NULL)
+    {
+        printf("Failed to create temporary XYZ file\n");
+        return 0;
+    }
+    size_t nPoints = grid->nx * grid->ny;
+    unsigned long long state = 1;
+    for (size_t k = 0; k < nPoints; ++k)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t i = (size_t)(state >> 33) % grid->nx;
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t j = (size_t)(state >> 33) % grid->ny;
+        double dx = (double)(state >> 53) / 2048.0;
+        fprintf(file, "%.3f %.3f %.6f\n", grid->xGrid[i] + dx, grid->yGrid[j] - dx,
+            grid->values[j * grid->nx + i]);
+    }
+    int result = ferror(file) == 0;
+    fclose(file);
+    if (!result)
+    {
+        printf("Failed to write temporary XYZ file %s\n", filename);
+        goto out_remove_file;
+    }
+
+    double best = 0.0;
+    size_t nx = 0;
+    size_t ny = 0;
+    for (int run = 0; run < RUNS && result; ++run)
+    {
+        Topography gridded = { 0 };
+        double start = wallClock();
+        result = readTopographyGrid(filename, NULL, &gridded);
+        double elapsed = wallClock() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+        nx = gridded.nx;
+        ny = gridded.ny;
+        freeTopography(&gridded);
+    }
+    if (!result)
+    {
+        printf("Failed to grid scattered XYZ file %s\n", filename);
+        goto out_remove_file;
+    }
+    printf("%zu scattered soundings read and gridded on %zu x %zu points, %zu threads: "
+        "best of %d runs %.3f s\n", nPoints, nx, ny, getThreadCount(), RUNS, best);
+
+out_remove_file:
+    remove(filename);
+    return result;
+}
+
+static unsigned long long hashValues(const Topography* topo)
+{
+    // FNV-1a over the bytes, any difference between two runs changes it
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned char* bytes = (const unsigned char*)topo->values;
+    for (size_t i = 0; i < topo->nx * topo->ny * sizeof(double); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+int main(int argc, char** argv)
+{
+    size_t gridSize = argc > 1 ? (size_t)atoll(argv[1]) : 10000;
+    size_t demSize = argc > 2 ? (size_t)atoll(argv[2]) : 1000;
+    if (gridSize < 2 || demSize < 4)
+    {
+        printf("Usage: %s [grid size >= 2] [DEM size >= 4] [max threads]\n", argv[0]);
+        return 1;
+    }
+
+    Topography dem = { 0 };
+    if (!buildSyntheticDem(demSize, &dem))
+    {
+        printf("Failed to build a synthetic DEM of %zu x %zu samples\n", demSize, demSize);
+        return 1;
+    }
+    setThreadCount(0);
+    size_t maxThreads = argc > 3 ? (size_t)atoll(argv[3]) : getThreadCount();
+    if (maxThreads == 0) maxThreads = 1;
+
+    int result = 0;
+    double serial = 0.0;
+    unsigned long long serialHash = 0;
+    for (size_t nThreads = 1; ; nThreads *= 2)
+    {
+        if (nThreads > maxThreads) nThreads = maxThreads;
+        setThreadCount(nThreads);
+        double best = 0.0;
+        unsigned long long hash = 0;
+        for (int run = 0; run < RUNS; ++run)
+        {
+            Topography topo = { 0 };
+            double start = wallClock();
+            if (!resampleTopography(&dem, NULL, gridSize, gridSize, &topo))
+            {
+                printf("Failed to sample a %zu x %zu grid\n", gridSize, gridSize);
+                result = 1;
+                goto out_free_dem;
+            }
+            double elapsed = wallClock() - start;
+            if (run == 0 || elapsed < best) best = elapsed;
+            hash = hashValues(&topo);
+            freeTopography(&topo);
+        }
+        if (nThreads == 1)
+        {
+            serial = best;
+            serialHash = hash;
+        }
+        printf("%zu x %zu grid from a %zu x %zu DEM, %zu threads: best of %d runs %.3f s, "
+            "speedup %.2f, %s\n", gridSize, gridSize, demSize, demSize, nThreads, RUNS, best,
+            best > 0.0 ? serial / best : 0.0,
+            hash == serialHash ? "same values as serial" : "VALUES DIFFER FROM SERIAL");
+        if (hash != serialHash) result = 1;
+        if (nThreads == maxThreads) break;
+    }
+
+    // The kernels only differ in how they evaluate a row, so one thread compares them
+    setThreadCount(1);
+    Topography topo = { 0 };
+    BicubicSurface surface = { 0 };
+    if (!resampleTopography(&dem, NULL, gridSize, gridSize, &topo)
+        || !initBicubicSurface(&dem, &surface))
+    {
+        printf("Failed to build the bicubic surface\n");
+        result = 1;
+        goto out_free_surface;
+    }
+    const char* names[2] = { "scalar", "AVX2" };
+    BicubicKernel kernels[2] = { BICUBIC_KERNEL_SCALAR, BICUBIC_KERNEL_AVX2 };
+    for (int k = 0; k < 2; ++k)
+    {
+        if (!isBicubicKernelAvailable(kernels[k]))
+        {
+            printf("%s kernel: not available on this CPU\n", names[k]);
+            continue;
+        }
+        double best = 0.0;
+        for (int run = 0; run < RUNS; ++run)
+        {
+            double start = wallClock();
+            if (!sampleBicubicSurface(&surface, kernels[k], &topo))
+            {
+                printf("Failed to sample the grid with the %s kernel\n", names[k]);
+                result = 1;
+                goto out_free_surface;
+            }
+            double elapsed = wallClock() - start;
+            if (run == 0 || elapsed < best) best = elapsed;
+        }
+        printf("%s kernel, 1 thread: best of %d runs %.3f s, %.1f Mpoints/s\n", names[k], RUNS,
+            best, best > 0.0 ? (double)(gridSize * gridSize) / best / 1e6 : 0.0);
+    }
+
+    setThreadCount(maxThreads);
+    if (!benchmarkXYZReader(&dem) || !benchmarkScatteredGridding(&dem)) result = 1;
+
+out_free_surface:
+    freeBicubicSurface(&surface);
+    freeTopography(&topo);
+out_free_dem:
+    freeTopography(&dem);
+    return result;
+}
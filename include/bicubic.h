@@ -0,0 +1,65 @@
+/*
+    Filename: bicubic.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the bicubic surface used to sample
+    topography grids on regular high-resolution grids without GSL
+*/
+
+#ifndef BICUBIC_H
+#define BICUBIC_H
+
+#include "topography.h"
+
+typedef enum
+{
+    BICUBIC_KERNEL_AUTO,        // AVX2 and FMA when the CPU has them, scalar otherwise
+    BICUBIC_KERNEL_SCALAR,      // portable C
+    BICUBIC_KERNEL_AVX2         // AVX2 and FMA, x86-64 only
+} BicubicKernel;
+
+typedef struct
+{
+    const Topography* grid;     // grid the surface goes through, not owned
+    double* zx;                 // x-derivative at each grid point, in the layout of the values
+    double* zy;                 // y-derivative at each grid point
+    double* zxy;                // cross derivative at each grid point
+} BicubicSurface;
+
+/**
+ * Builds the surface through a grid. The derivatives are those of natural
+ * cubic splines along the rows and the columns, as gsl_interp2d_bicubic
+ * computes them, so both surfaces are the same
+ *
+ * @param grid Pointer to a grid of at least 2 × 2 points, it must outlive the surface
+ * @param surface Pointer to the BicubicSurface structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int initBicubicSurface(const Topography* grid, BicubicSurface* surface);
+
+void freeBicubicSurface(BicubicSurface* surface);
+
+/**
+ * Tells if a kernel can run on this CPU
+ *
+ * @param kernel The kernel
+ * @return 1 if it can run, 0 otherwise
+ */
+int isBicubicKernelAvailable(BicubicKernel kernel);
+
+/**
+ * Evaluates the surface at every point of a grid whose x and y values are
+ * filled and increasing. The weights and cells of every column and row are
+ * computed once, then bands of rows are evaluated in parallel. Points beyond
+ * the grid of the surface extend its border cells
+ *
+ * @param surface Pointer to the surface
+ * @param kernel Kernel evaluating the rows, an unavailable one falls back to scalar
+ * @param topo Pointer to the grid, its values are filled
+ * @return 1 on success, 0 on failure
+ */
+int sampleBicubicSurface(const BicubicSurface* surface, BicubicKernel kernel, Topography* topo);
+
+#endif // BICUBIC_H
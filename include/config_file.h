@@ -15,6 +15,7 @@
 #include <stdint.h>
 
 #include "constants.h"
+#include "msh_constants.h"
 
 enum ConfigMode : uint8_t
 {
@@ -23,14 +24,30 @@ enum ConfigMode : uint8_t
     MODE_ALL = MODE_INTERPOLATE | MODE_BACKGROUND_MESH
 };
 
+enum TopoInterpolation
+{
+    TOPO_INTERPOLATION_GRID,    // bilinear in a nx × ny grid sampled from the spline
+    TOPO_INTERPOLATION_NODES    // spline evaluated at each surface node
+};
+
 typedef struct
 {
     enum ConfigMode mode;                       // the mode of operation
+    size_t nThreads;                            // default value = 0, use all the processors
     char skinMeshFileIn[MAX_PATH_LENGTH];       // the input mesh file name
+    int skinMeshSnapshot;                       // default value = 0, always parse the input mesh
     char skinMeshFileOut[MAX_PATH_LENGTH];      // the output mesh file name
+    MSHVersion skinMeshFormatOut;               // default value = same format as the input mesh
+    int skinMeshPrecisionOut;                   // default value = SHORTEST_PRECISION, shortest exact decimals
+    int skinMeshPatchOut;                       // default value = 0, write every section of the output mesh
+    int skinMeshFixedWidthOut;                  // default value = 0, write the msh1 records with their natural widths
     char topoFiles[MAXSURF][MAX_PATH_LENGTH];   // the topography files (grid) names
     size_t nx;                                  // number of x-values to use on the grid
     size_t ny;                                  // number of y-values to use on the grid
+    enum TopoInterpolation topoInterpolation;   // default value = TOPO_INTERPOLATION_GRID
+    size_t topoTileCacheMB;                     // default value = 1024, memory budget of the tiles of a tiled topography
+    char topoCacheDir[MAX_PATH_LENGTH];         // default value = "", resampled topographies are not cached
+    size_t topoCacheMB;                         // default value = 1024, size limit of the topography cache
     int surfaceMeshFaces[MAXSURF];              // the face #(s) corresponding to the surface
     int meshFacesToSmooth[MAXSMOOTH];           // the face #(s) where barycentric smoothing will be applied if desired
 
@@ -15,5 +15,7 @@
 #define MAXSURF 100         // max. number of faces on the surface
 #define MAXSMOOTH 100       // max. number of faces for which a mesh smoothing is required
 #define MAXCN 100           // max. number of node-node connections
+#define SHORTEST_PRECISION -1   // write the shortest decimals that read back the same double
+#define MAX_PRECISION 17        // max. number of decimals written for a double
 
 #endif
\ No newline at end of file
@@ -0,0 +1,54 @@
+/*
+    Filename: kd_tree.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the 2D k-d tree used to find the
+    nearest scattered points of a location in the horizontal plane
+*/
+
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <stddef.h>
+
+#include "mesh.h"
+
+typedef struct
+{
+    Node* points;               // points in tree order, not owned
+    unsigned char* axes;        // split axis of the node at each index, 0 for x and 1 for y
+    size_t nPoints;
+} KdTree;
+
+/**
+ * Builds a balanced tree over the x and y coordinates of the points. The
+ * points are reordered in place, each node being the median of its range
+ * along the widest side of that range. The subtrees below the first levels
+ * are built in parallel
+ *
+ * @param points Pointer to the points, they must outlive the tree
+ * @param nPoints Number of points
+ * @param tree Pointer to the KdTree structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int buildKdTree(Node* points, size_t nPoints, KdTree* tree);
+
+void freeKdTree(KdTree* tree);
+
+/**
+ * Finds the k points of the tree nearest to a location, in no particular order
+ *
+ * @param tree Pointer to the tree
+ * @param x X-coordinate of the location
+ * @param y Y-coordinate of the location
+ * @param k Maximum number of points to find
+ * @param indexes Array of k indexes into tree->points that will be filled
+ * @param distances Array of k squared distances that will be filled
+ * @return Number of points found, k unless the tree has fewer points
+ */
+size_t findNearestPoints(const KdTree* tree, double x, double y, size_t k,
+    size_t* indexes, double* distances);
+
+#endif // KD_TREE_H
@@ -0,0 +1,35 @@
+/*
+    Filename: mapped_file.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the read-only memory mapped files
+    used to access large input files without copying them into memory
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+typedef struct
+{
+    const char* data;       // content of the file, always followed by a '\0'
+    size_t size;            // size of the file in bytes
+    size_t mapSize;         // size of the mapped region in bytes
+} MappedFile;
+
+/**
+ * Maps a regular file read-only into memory. The mapping is always followed
+ * by at least one zero byte, so the content can be used as a C string
+ *
+ * @param filename The path to the file to map
+ * @param file Pointer to a MappedFile structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int openMappedFile(const char* filename, MappedFile* file);
+
+void closeMappedFile(MappedFile* file);
+
+#endif // MAPPED_FILE_H
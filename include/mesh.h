@@ -13,9 +13,11 @@
 #include <stddef.h>
 
 #include "config_file.h"
+#include "mapped_file.h"
+#include "msh_constants.h"
 #include "topography.h"
 
-#define MAX_ELEM_NODES 32
+#define MAX_ELEM_NODES 32    // maximum number of nodes of an element
 
 typedef struct
 {
@@ -26,28 +28,90 @@ typedef struct
 
 typedef struct
 {
-    unsigned int type;              // geometrical type of the element
-    unsigned int regPhys;           // tag of the physical region
-    unsigned int regElem;           // tag of the element region
-    size_t nNodes;                  // number of nodes of the element
-    size_t nodes[MAX_ELEM_NODES];   // indexes of the nodes of the element
-} Element;
+    int dim;                    // dimension of the entity, 0 for points to 3 for volumes
+    int tag;                    // tag of the entity
+    double box[6];              // min x, y, z and max x, y, z of the entity
+    size_t nPhysicals;          // number of physical tags of the entity
+    int* physicals;             // physical tags of the entity
+    size_t nBounding;           // number of bounding entities, always 0 for points
+    int* bounding;              // signed tags of the bounding entities
+} Entity;
 
 typedef struct
 {
+    int dim;                    // dimension of the entity of the nodes
+    int tag;                    // tag of the entity of the nodes
+    size_t count;               // number of consecutive node records in the block
+} NodeBlock;
+
+typedef struct
+{
+    size_t element;             // number of decoded elements before the span
+    size_t count;               // number of element records in the span
+    const char* start;          // raw text of the records, line breaks included
+    size_t length;
+} RawSpan;
+
+typedef struct
+{
+    unsigned long long types;   // bit t is set to decode the elements of type t
+    size_t nRegions;            // number of element regions to decode
+    unsigned int regions[MAXSURF + MAXSMOOTH]; // element regions to decode
+} ElementFilter;
+
+typedef struct
+{
+    MSHVersion version;         // version of the file the mesh was read from
     size_t nNodes;              // number of nodes in the mesh
     size_t* nodeIndex;          // index of each node in the mesh
     Node* nodes;                // array of nodes in the mesh
+    size_t* nodeTags;           // tag of each node, NULL when node i has tag i + 1
     size_t nElems;              // number of elements
-    size_t* elemIndex;          // index of each element in the mesh
-    Element* elements;          // array of elements in the mesh
-    unsigned char* mark;        // work array for marking nodes
+
+    // Elements are stored in file order, the nodes of element i are
+    // elemNodes[elemOffsets[i]] to elemNodes[elemOffsets[i + 1] - 1]
+    size_t* elemIndex;          // 0-based tag of each element
+    unsigned int* elemTypes;    // geometrical type of each element
+    unsigned int* elemRegPhys;  // tag of the physical region of each element
+    unsigned int* elemRegElem;  // tag of the element region of each element
+    size_t* elemOffsets;        // nElems + 1 offsets of the nodes of each element
+    size_t* elemNodes;          // node indexes of all the elements
+    unsigned char* mark;        // work array for marking nodes, cleared after each use
+    size_t* faceNodes;          // nodes of the last marked face, each one once
+    size_t nFaceNodes;          // number of nodes of the last marked face
+    size_t faceNodesCapacity;   // number of nodes faceNodes can hold
     size_t triQuadCount;        // number of tri and quad elements
     unsigned int maxElemNodes;  // maximum number of nodes per element
+
+    // Only filled by the MSH 4.1 reader and kept to write the same layout back
+    size_t nEntities;           // number of geometrical entities
+    Entity* entities;           // geometrical entities sorted by dimension
+    size_t nNodeBlocks;         // number of node blocks
+    NodeBlock* nodeBlocks;      // node blocks in file order, covering nodeIndex
+    char* physicalNames;        // raw content of the $PhysicalNames section
+
+    // Elements left out by an element filter, kept as text to write them back
+    size_t nRawElems;           // number of elements that were not decoded
+    size_t nRawSpans;           // number of runs of consecutive raw elements
+    RawSpan* rawSpans;          // runs of raw elements in file order
+    MappedFile rawSource;       // mapped input file the spans point into
+
+    // Set when the node and element arrays live in a mapped mesh snapshot
+    void* snapshot;             // start of the private mapping of the snapshot
+    size_t snapshotSize;        // size of the mapping in bytes
 } Mesh;
 
 void freeMesh(Mesh* mesh);
 
+/**
+ * Selects the elements a run reads: the tri and quad elements of the surface
+ * faces and of the faces to smooth, or none when the mesh is not interpolated
+ *
+ * @param config Pointer to the configuration
+ * @param filter Pointer to the ElementFilter structure that will be filled
+ */
+void getElementFilter(const ConfigFile* config, ElementFilter* filter);
+
 void getShape(const Mesh* mesh, float* minX, float* maxX, float* minY, float* maxY,
     float* minZ, float* maxZ);
 
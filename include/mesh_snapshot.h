@@ -0,0 +1,70 @@
+/*
+    Filename: mesh_snapshot.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the binary mesh snapshots (.amgem)
+    that are written next to a parsed .msh file and mapped back into memory
+    on the next runs instead of parsing the file again
+*/
+
+#ifndef MESH_SNAPSHOT_H
+#define MESH_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "mesh.h"
+
+#define SNAPSHOT_EXTENSION ".amgem"
+
+typedef struct
+{
+    uint64_t size;              // size of the source file in bytes
+    int64_t mtimeSec;           // modification time of the source file
+    int64_t mtimeNsec;
+    uint64_t hash;              // hash of the content of the source file
+} SnapshotSource;
+
+/**
+ * Identifies the current content of a source file by its size, its
+ * modification time and a hash of its content
+ *
+ * @param filename The path to the source file
+ * @param source Pointer to a SnapshotSource structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int getSnapshotSource(const char* filename, SnapshotSource* source);
+
+/**
+ * Maps a snapshot into memory if it was made from the given source. The
+ * node and element arrays of the mesh point into a private copy-on-write
+ * mapping, so the mesh can be modified without changing the snapshot
+ *
+ * @param filename The path to the snapshot
+ * @param source Identification of the source file the snapshot must match
+ * @param mesh Pointer to an empty Mesh structure that will be filled
+ * @return 1 if the snapshot was loaded, 0 if it is missing, stale or invalid
+ */
+int loadMeshSnapshot(const char* filename, const SnapshotSource* source, Mesh* mesh);
+
+/**
+ * Writes the snapshot of a mesh. The snapshot is written to a temporary file
+ * that replaces the previous one once complete
+ *
+ * @param filename The path to the snapshot
+ * @param source Identification of the source file the mesh was read from
+ * @param mesh Pointer to the mesh
+ * @return 1 on success, 0 on failure
+ */
+int saveMeshSnapshot(const char* filename, const SnapshotSource* source, const Mesh* mesh);
+
+/**
+ * Unmaps the snapshot of a mesh, if any. The arrays that lived in the
+ * mapping are set to NULL
+ *
+ * @param mesh Pointer to the mesh
+ */
+void closeMeshSnapshot(Mesh* mesh);
+
+#endif // MESH_SNAPSHOT_H
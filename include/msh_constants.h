@@ -10,12 +10,24 @@
 #ifndef MSH_CONSTANTS_H
 #define MSH_CONSTANTS_H
 
+typedef enum
+{
+    MSH_V1,
+    MSH_V41,
+    MSH_V41_BINARY,
+    MSH_UNKNOWN_VERSION
+} MSHVersion;
+
 // Element types in .msh file format
 // This list is incomplete. Add more element types as needed
+#define MSH_LIN_2    1
 #define MSH_TRI_3    2
 #define MSH_QUA_4    3
 #define MSH_TRI_6    9
 #define MSH_QUA_9    10
+#define MSH_PNT      15
 #define MSH_QUA_8    16
 
+#define MSH_MAX_TYPE 31     // largest element type with a known number of nodes
+
 #endif // MSH_CONSTANTS_H
\ No newline at end of file
@@ -14,8 +14,110 @@
 #include "mesh.h"
 #include "msh_tokenizer.h"
 
+#define MSH_STREAM_PATH "-"     // path of the standard input or output
+
+typedef struct
+{
+    MSHVersion version;         // format of the file
+    int precision;              // decimals of the fractional coordinates, or SHORTEST_PRECISION
+    const char* patchSource;    // MSH 1 file the mesh was read from, only its nodes are
+                                // written again, NULL to write the whole mesh
+    int fixedWidth;             // pad the MSH 1 records to fixed widths
+} MshWriteOptions;
+
+typedef struct
+{
+    int useSnapshot;            // load the mesh from a snapshot next to the file when valid
+    const ElementFilter* elementFilter; // MSH 1 elements to decode, NULL to decode all of them
+} MshReadOptions;
+
 int readMshFile(const char* filename, Mesh* mesh);
 
+/**
+ * Reads a mesh. With useSnapshot, the snapshot '<filename>.amgem' is mapped
+ * instead of parsing the file when it was made from the same content, and it
+ * is written after parsing otherwise. With an element filter, the MSH 1
+ * elements it leaves out are kept as raw text that is only written back as
+ * MSH 1. The filter is ignored when a snapshot is used.
+ * The path "-" reads the standard input. It and the other paths that are not
+ * regular files, e.g. FIFOs, are read as streams, without snapshot or filter
+ *
+ * @param filename Path of the file to read
+ * @param mesh Pointer to an empty Mesh structure that will be filled
+ * @param options Pointer to the read options
+ * @return 1 on success, 0 on failure
+ */
+int readMshFileWithOptions(const char* filename, Mesh* mesh, const MshReadOptions* options);
+
+/**
+ * Writes a mesh with the shortest exact decimals for the fractional coordinates
+ *
+ * @param filename Path of the file to write
+ * @param mesh Pointer to the mesh
+ * @param version Format of the file
+ * @return 1 on success, 0 on failure
+ */
 int writeMshFile(const char* filename, const Mesh* mesh, MSHVersion version);
 
+/**
+ * Writes a mesh. The path "-" writes the standard output, and the paths that
+ * are not regular files, e.g. FIFOs, are written in place.
+ * With fixedWidth, every field of the MSH 1 records is right aligned on the
+ * width of its largest value and the coordinates on FIXED_DOUBLE_WIDTH
+ * characters. The offset of each record is then known in advance: a regular
+ * file is sized once, mapped and filled by the threads in parallel, and its
+ * nodes can later be rewritten in place with updateMshNodes
+ *
+ * @param filename Path of the file to write
+ * @param mesh Pointer to the mesh
+ * @param options Pointer to the write options
+ * @return 1 on success, 0 on failure
+ */
+int writeMshFileWithOptions(const char* filename, const Mesh* mesh,
+    const MshWriteOptions* options);
+
+/**
+ * Rewrites the coordinates of the nodes of a fixed-width MSH 1 file in place,
+ * leaving every other byte as is. The file must hold the node records of the
+ * mesh, in its order and with its tags, as written with fixedWidth or read
+ * into the mesh. Nothing is written when it does not
+ *
+ * @param filename Path of the file to update
+ * @param mesh Pointer to the mesh
+ * @param precision Decimals of the fractional coordinates, or SHORTEST_PRECISION
+ * @return 1 on success, 0 if the file could not be updated
+ */
+int updateMshNodes(const char* filename, const Mesh* mesh, int precision);
+
+/**
+ * Tells if a path is read and written as a stream: "-" or any path that is
+ * not a regular file, e.g. a FIFO
+ *
+ * @param filename The path
+ * @return 1 for a stream, 0 otherwise
+ */
+int isMshStream(const char* filename);
+
+/**
+ * Reads a mesh from a file descriptor, e.g. a pipe, through a buffer of
+ * bounded size. MSH 1 and ASCII MSH 4.1 can be streamed
+ *
+ * @param fd File descriptor to read, it is not closed
+ * @param name Name of the stream in the messages
+ * @param mesh Pointer to an empty Mesh structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int readMshStream(int fd, const char* name, Mesh* mesh);
+
+/**
+ * Writes a mesh to a file descriptor, e.g. a pipe, in one pass
+ *
+ * @param fd File descriptor to write, it is not closed
+ * @param name Name of the stream in the messages
+ * @param mesh Pointer to the mesh
+ * @param options Pointer to the write options
+ * @return 1 on success, 0 on failure
+ */
+int writeMshStream(int fd, const char* name, const Mesh* mesh, const MshWriteOptions* options);
+
 #endif // MSH_PARSER_H
\ No newline at end of file
@@ -11,14 +11,10 @@
 #ifndef MSH_TOKENIZER_H
 #define MSH_TOKENIZER_H
 
-#include <regex.h>
 #include <stddef.h>
 
-typedef enum
-{
-    MSH_V1,
-    MSH_UNKNOWN_VERSION
-} MSHVersion;
+#include "msh_constants.h"
+#include "number_parser.h"
 
 typedef enum
 {
@@ -28,6 +24,17 @@ typedef enum
     TOKEN_V1_ELM_START,         // $ELM
     TOKEN_V1_ELM_END,           // $ENDELM
     TOKEN_NUMBER,
+    TOKEN_V4_MESH_FORMAT_START,     // $MeshFormat
+    TOKEN_V4_MESH_FORMAT_END,       // $EndMeshFormat
+    TOKEN_V4_PHYSICAL_NAMES_START,  // $PhysicalNames
+    TOKEN_V4_PHYSICAL_NAMES_END,    // $EndPhysicalNames
+    TOKEN_V4_ENTITIES_START,        // $Entities
+    TOKEN_V4_ENTITIES_END,          // $EndEntities
+    TOKEN_V4_NODES_START,           // $Nodes
+    TOKEN_V4_NODES_END,             // $EndNodes
+    TOKEN_V4_ELEMENTS_START,        // $Elements
+    TOKEN_V4_ELEMENTS_END,          // $EndElements
+    TOKEN_SECTION,                  // any other $Section keyword
     // add new token types above this line
     MSH_SPEC_SIZE,              // number of token types in the spec
     TOKEN_END_OF_FILE,
@@ -40,19 +47,70 @@ typedef struct
     const char* start;
     size_t length;
     size_t line;
+    Number number;              // value of a TOKEN_NUMBER token
 } Token;
 
+#define TOKENIZER_ERROR_SIZE 128    // longest error message of a tokenizer
+#define TOKENIZER_STREAM_SIZE (1 << 22) // default buffer size of a stream
+
+// A tokenizer only reads its source and writes its own fields, so any number
+// of them can run at the same time on different threads.
+// A tokenizer either reads a buffer holding the whole input, or a stream,
+// e.g. a pipe, through a buffer it refills. In a stream, the text of a token
+// is only valid until the next token is read
 typedef struct
 {
     const char* source;
     const char* start;
     const char* current;
+    const char* end;
     size_t line;
-    regex_t specRegex[MSH_SPEC_SIZE];
+    char error[TOKENIZER_ERROR_SIZE]; // message of the last TOKEN_ERROR token
+    int fd;                     // stream read into the buffer, -1 for a whole input
+    char* buffer;               // buffer of the stream, source points to it
+    size_t capacity;            // size of the buffer of the stream
+    size_t position;            // offset of the source in the input
+    int ended;                  // set once the end of the stream is read
 } Tokenizer;
 
 void initTokenizer(Tokenizer* tokenizer, const char* source);
 
+void initTokenizerBuffer(Tokenizer* tokenizer, const char* source, size_t length);
+
+/**
+ * Initializes a tokenizer that reads a file descriptor, e.g. the standard
+ * input or a FIFO, through a buffer, and fills the buffer. The memory used
+ * is bounded by the buffer size, it only grows for a text longer than the
+ * buffer that has to be kept whole
+ *
+ * @param tokenizer Pointer to the tokenizer
+ * @param fd File descriptor to read, it is not closed by the tokenizer
+ * @param capacity Size of the buffer in bytes
+ * @return 1 on success, 0 on failure
+ */
+int initTokenizerStream(Tokenizer* tokenizer, int fd, size_t capacity);
+
+/**
+ * Moves the text from the start of the last token to the front of the
+ * buffer of a stream and reads the stream until the buffer is full
+ *
+ * @param tokenizer Pointer to the tokenizer
+ * @return 1 if bytes were read, 0 at the end of a stream or for a whole input
+ */
+int refillTokenizer(Tokenizer* tokenizer);
+
+/**
+ * Moves the tokenizer to the first line that starts with the keyword, the
+ * current position counting as the start of a line. The text skipped from
+ * the start of the tokenizer stays in the buffer when keep is set
+ *
+ * @param tokenizer Pointer to the tokenizer
+ * @param keyword The keyword to find
+ * @param keep 1 to keep the skipped text in the buffer, 0 to drop it
+ * @return 1 if the keyword was found, 0 at the end of the input
+ */
+int skipToLine(Tokenizer* tokenizer, const char* keyword, int keep);
+
 void freeTokenizer(Tokenizer* tokenizer);
 
 void resetTokenizer(Tokenizer* tokenizer, const char* source);
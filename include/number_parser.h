@@ -0,0 +1,36 @@
+/*
+    Filename: number_parser.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the functions to scan numbers from
+    text buffers in a single pass
+*/
+
+#ifndef NUMBER_PARSER_H
+#define NUMBER_PARSER_H
+
+#include <stddef.h>
+
+typedef struct
+{
+    double value;           // value of the number
+    long long integer;      // value of the number, only valid if isInteger is set
+    int isInteger;          // 1 if the number has no fraction nor exponent part
+} Number;
+
+/**
+ * Scans a decimal number ([-+]digits[.digits][(e|E)[-+]digits]) without
+ * reading past the end of the buffer. Both the integer and the floating point
+ * values are computed from the same pass over the bytes
+ *
+ * @param start Pointer to the first character of the number
+ * @param end Pointer past the last character that can be read
+ * @param number Pointer to a Number structure that will be filled
+ * @return Pointer past the last character of the number, or start if there
+ *         is no number at start
+ */
+const char* scanNumber(const char* start, const char* end, Number* number);
+
+#endif // NUMBER_PARSER_H
@@ -0,0 +1,55 @@
+/*
+    Filename: parallel.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the functions to run independent
+    tasks on a pool of worker threads
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+/**
+ * Function executed for each task of a parallel loop
+ *
+ * @param context Pointer to the data shared by all the tasks
+ * @param task Index of the task to execute
+ * @return 1 on success, 0 on failure
+ */
+typedef int (*ParallelTask)(void* context, size_t task);
+
+/**
+ * Sets the number of worker threads used by parallelFor
+ *
+ * @param nThreads Number of threads, 0 to use all the online processors
+ */
+void setThreadCount(size_t nThreads);
+
+/**
+ * Caps the number of workers of the parallel loops started by the calling
+ * thread, e.g. for two stages sharing the threads while they overlap. The
+ * other threads keep their own cap
+ *
+ * @param nThreads Maximum number of workers, 0 to remove the cap
+ */
+void setThreadLimit(size_t nThreads);
+
+size_t getThreadCount(void);
+
+/**
+ * Runs the tasks 0 to nTasks - 1 on a pool of worker threads. Each worker
+ * takes the next pending task until all of them are done. The calling thread
+ * is one of the workers
+ *
+ * @param nTasks Number of tasks to run
+ * @param task Function executed for each task
+ * @param context Pointer passed to every task
+ * @return 1 if all the tasks succeeded, 0 otherwise
+ */
+int parallelFor(size_t nTasks, ParallelTask task, void* context);
+
+#endif // PARALLEL_H
@@ -0,0 +1,107 @@
+/*
+    Filename: section_file.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the binary files made of a header
+    followed by sections at aligned offsets, such as the mesh snapshots and
+    the topography cache entries, which are mapped back into memory as is
+*/
+
+#ifndef SECTION_FILE_H
+#define SECTION_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SECTION_ALIGNMENT 64            // every section starts on a cache line
+
+typedef struct
+{
+    char magic[8];              // magic of the format without the '\0'
+    uint32_t formatVersion;     // version of the format
+    uint32_t byteOrder;         // SECTION_BYTE_ORDER as stored by the writer
+    uint64_t size;              // size of the file in bytes
+} SectionFileHeader;
+
+typedef struct
+{
+    const void* data;
+    size_t size;                // size of the section in bytes
+    int present;                // 0 for a section that is not stored at all
+} FileSection;
+
+/**
+ * Fills the common part of the header of a file
+ *
+ * @param header Pointer to the common part, at the start of the full header
+ * @param magic The 8 characters identifying the format
+ * @param formatVersion Version of the format
+ */
+void initSectionFileHeader(SectionFileHeader* header, const char* magic,
+    uint32_t formatVersion);
+
+/**
+ * Places the present sections one after the other, after the header, at
+ * aligned offsets
+ *
+ * @param headerSize Size of the full header in bytes
+ * @param sections Array of nSections sections
+ * @param nSections Number of sections
+ * @param offsets Receives the offset of each section, 0 for a missing one
+ * @return The size of the file in bytes
+ */
+size_t placeSections(size_t headerSize, const FileSection* sections, int nSections,
+    uint64_t* offsets);
+
+/**
+ * Checks the common part of a header and that every present section lies
+ * within the file. The fields of the format are checked by the caller
+ *
+ * @param header Pointer to the common part of the mapped header
+ * @param magic The 8 characters identifying the format
+ * @param formatVersion Version of the format
+ * @param fileSize Size of the mapped file in bytes
+ * @param headerSize Size of the full header in bytes
+ * @param offsets Offset of each section, 0 for a missing one
+ * @param sizes Size of each section in bytes, computed from counts bounded
+ *        by the file size
+ * @param nSections Number of sections
+ * @return 1 if the file is valid, 0 otherwise
+ */
+int validSectionFile(const SectionFileHeader* header, const char* magic,
+    uint32_t formatVersion, size_t fileSize, size_t headerSize, const uint64_t* offsets,
+    const size_t* sizes, int nSections);
+
+/**
+ * Maps a whole file into memory. A private writable mapping is copy on write,
+ * its changes never reach the file
+ *
+ * @param filename The path to the file
+ * @param writable 1 for a private writable mapping, 0 for a read-only one
+ * @param headerSize Size of the full header, smaller files are not mapped
+ * @param data Receives the start of the mapping, released with munmap
+ * @param size Receives the size of the mapping in bytes
+ * @return 1 on success, 0 if the file is missing, too small or not mapped
+ */
+int mapSectionFile(const char* filename, int writable, size_t headerSize, char** data,
+    size_t* size);
+
+/**
+ * Writes a file to a temporary file that replaces the previous one once it
+ * is complete. A file cut short by a crash does not match the size in its
+ * header
+ *
+ * @param filename The path to the file
+ * @param header Pointer to the full header, its common part filled
+ * @param headerSize Size of the full header in bytes
+ * @param sections Array of nSections sections
+ * @param offsets Offset of each section from placeSections
+ * @param nSections Number of sections
+ * @return 1 on success, 0 on failure
+ */
+int writeSectionFile(const char* filename, const void* header, size_t headerSize,
+    const FileSection* sections, const uint64_t* offsets, int nSections);
+
+#endif // SECTION_FILE_H
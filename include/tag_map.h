@@ -0,0 +1,62 @@
+/*
+    Filename: tag_map.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the hash map from the tags of a
+    .msh file to the position of their records in the mesh arrays
+*/
+
+#ifndef TAG_MAP_H
+#define TAG_MAP_H
+
+#include <stddef.h>
+
+typedef struct
+{
+    size_t tag;                 // tag of the entry, 0 for an empty entry
+    size_t index;               // position of the tagged record
+} TagEntry;
+
+typedef struct
+{
+    TagEntry* entries;          // open addressing table with linear probing
+    size_t capacity;            // number of entries, a power of 2
+    int shift;                  // bits dropped from the hash to get an entry
+} TagMap;
+
+/**
+ * Allocates an empty map sized for the given number of tags. The table is
+ * kept at most half full so the probe sequences stay short
+ *
+ * @param map Pointer to the TagMap structure to initialize
+ * @param count Number of tags that will be inserted
+ * @return 1 on success, 0 on failure
+ */
+int initTagMap(TagMap* map, size_t count);
+
+void freeTagMap(TagMap* map);
+
+/**
+ * Inserts a tag in the map
+ *
+ * @param map Pointer to the map
+ * @param tag Tag to insert, must be greater than 0
+ * @param index Position of the tagged record
+ * @return 1 on success, 0 if the tag is already in the map
+ */
+int insertTag(TagMap* map, size_t tag, size_t index);
+
+/**
+ * Finds the position of a tag. The map is only read, so several threads can
+ * look up tags at the same time
+ *
+ * @param map Pointer to the map
+ * @param tag Tag to find
+ * @param index Pointer to a size_t that will be set to the position of the tag
+ * @return 1 if the tag was found, 0 otherwise
+ */
+int findTag(const TagMap* map, size_t tag, size_t* index);
+
+#endif // TAG_MAP_H
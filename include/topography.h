@@ -21,11 +21,126 @@ typedef struct
     double* xGrid;              // x-topography grid
     double* yGrid;              // y-topography grid
     double* values;             // topography values
+    int uniform;                // 1 when both grids are evenly spaced, cells found by a multiply
+
+    // Set when the arrays live in a read-only mapping of a cached topography
+    void* mapping;              // start of the mapping
+    size_t mappingSize;         // size of the mapping in bytes
 } Topography;
 
+typedef struct
+{
+    double xMin;                // extent of the region where the topography is needed
+    double xMax;
+    double yMin;
+    double yMax;
+} TopographyWindow;
+
+typedef struct
+{
+    Topography grid;            // original grid of the topography file
+    void* spline;               // bicubic spline through the grid values
+} TopographySpline;
+
 void freeTopography(Topography* topo);
 
-int increaseTopographyResolution(const ConfigFile* config,
-    const char* filename, Topography* topo);
+/**
+ * Reads an XYZ topography file and builds the bicubic spline through its grid
+ *
+ * @param filename The path to the XYZ topography file
+ * @param spline Pointer to an empty TopographySpline structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int readTopographySpline(const char* filename, TopographySpline* spline);
+
+/**
+ * Reads an XYZ topography file into its grid, cropped around a window when it
+ * is given, without fitting a spline
+ *
+ * @param filename The path to the XYZ topography file
+ * @param window The region where the grid is needed, NULL for the whole grid
+ * @param grid Pointer to an empty Topography structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int readTopographyGrid(const char* filename, const TopographyWindow* window, Topography* grid);
+
+/**
+ * Reads an XYZ topography file and builds the bicubic spline through the part
+ * of its grid around a window, e.g. the footprint of the mesh in a large DEM
+ *
+ * @param filename The path to the XYZ topography file
+ * @param window The region where the spline is evaluated, NULL for the whole grid
+ * @param spline Pointer to an empty TopographySpline structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int readTopographySplineInWindow(const char* filename, const TopographyWindow* window,
+    TopographySpline* spline);
+
+/**
+ * Keeps the grid cells holding a window and a margin of points around them.
+ * The natural spline through the cropped grid differs from the one through
+ * the whole grid by a small fraction of the data within the window. A grid
+ * missing the window is left whole
+ *
+ * @param grid Pointer to an increasing grid, cropped in place
+ * @param window The region to keep
+ */
+void cropTopography(Topography* grid, const TopographyWindow* window);
+
+/**
+ * Builds the bicubic spline through the grid of a spline structure, e.g. a
+ * grid made in memory
+ *
+ * @param spline Pointer to a TopographySpline structure whose grid is filled
+ * @return 1 on success, 0 on failure, the grid is then freed
+ */
+int buildTopographySpline(TopographySpline* spline);
+
+void freeTopographySpline(TopographySpline* spline);
+
+/**
+ * Evaluates the spline at each point, in parallel. The values do not depend
+ * on the number of threads
+ *
+ * @param spline Pointer to the spline
+ * @param nPoints Number of points
+ * @param x x-coordinates of the points
+ * @param y y-coordinates of the points
+ * @param z Receives the value at each point, NAN for the points outside the grid
+ * @return 1 on success, 0 on failure
+ */
+int evaluateTopographySpline(const TopographySpline* spline, size_t nPoints,
+    const double* x, const double* y, double* z);
+
+/**
+ * Samples the natural bicubic spline through a grid on a regular nx × ny grid
+ * spanning it, or only its cells holding a window.
+ * The separable bicubic kernel evaluates bands of rows in parallel, with the
+ * same values for any thread count
+ *
+ * @param grid Pointer to the original grid
+ * @param window The region to sample, NULL for the whole grid
+ * @param nx Number of x-values of the grid
+ * @param ny Number of y-values of the grid
+ * @param topo Pointer to an empty Topography structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int resampleTopography(const Topography* grid, const TopographyWindow* window,
+    size_t nx, size_t ny, Topography* topo);
+
+/**
+ * Reads an XYZ topography file and samples its spline on the config->nx ×
+ * config->ny grid, over a window cropped out of the file when it is given.
+ * With a config->topoCacheDir, the grid is mapped from the cache when it
+ * holds the same file content, resolution and window, and stored otherwise
+ *
+ * @param config Pointer to the configuration with the resolution of the grid
+ * @param filename The path to the XYZ topography file
+ * @param window The region to sample, NULL for the whole grid
+ * @param topo Pointer to an empty Topography structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int increaseTopographyResolution(const ConfigFile* config, const char* filename,
+    const TopographyWindow* window, Topography* topo);
 
 #endif // TOPOGRAPHY_H
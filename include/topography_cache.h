@@ -0,0 +1,73 @@
+/*
+    Filename: topography_cache.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the persistent cache of resampled
+    topographies. Each entry is a binary file named after the hash of its key
+    and mapped back into memory on the next runs
+*/
+
+#ifndef TOPOGRAPHY_CACHE_H
+#define TOPOGRAPHY_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config_file.h"
+#include "topography.h"
+
+#define TOPOGRAPHY_CACHE_EXTENSION ".topo"
+
+typedef struct
+{
+    uint64_t fileHash;          // hash of the content of the topography file
+    uint64_t fileSize;          // size of the topography file in bytes
+    uint64_t nx;                // resolution of the resampled grid
+    uint64_t ny;
+    uint32_t method;            // enum TopoInterpolation of the resampling
+    uint32_t hasWindow;         // 1 when the topography was cropped to the window
+    double window[4];           // xMin, xMax, yMin and yMax of the window
+} TopographyCacheKey;
+
+/**
+ * Builds the key of a topography resampled from a file. The file is
+ * identified by its content only, so a copy or a touched file still hits
+ *
+ * @param filename The path to the topography file
+ * @param config Pointer to the configuration with the resolution and method
+ * @param window The window the topography is cropped to, NULL for none
+ * @param key Pointer to a TopographyCacheKey structure that will be filled
+ * @return 1 on success, 0 if the file cannot be read
+ */
+int getTopographyCacheKey(const char* filename, const ConfigFile* config,
+    const TopographyWindow* window, TopographyCacheKey* key);
+
+/**
+ * Maps the cached topography of a key read-only into memory. The entry is
+ * touched, so that it is evicted last
+ *
+ * @param directory The directory of the cache
+ * @param key Pointer to the key of the topography
+ * @param topo Pointer to an empty Topography structure that will be filled,
+ *        freeTopography unmaps it
+ * @return 1 on a hit, 0 if the entry is missing or invalid
+ */
+int loadCachedTopography(const char* directory, const TopographyCacheKey* key, Topography* topo);
+
+/**
+ * Stores a topography in the cache. The least recently used entries are
+ * removed first so that the cache stays within its size limit, and an entry
+ * larger than the limit is not stored
+ *
+ * @param directory The directory of the cache, created if needed
+ * @param maxSize Size limit of all the entries in bytes
+ * @param key Pointer to the key of the topography
+ * @param topo Pointer to the topography
+ * @return 1 on success, 0 on failure
+ */
+int saveCachedTopography(const char* directory, size_t maxSize, const TopographyCacheKey* key,
+    const Topography* topo);
+
+#endif // TOPOGRAPHY_CACHE_H
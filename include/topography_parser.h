@@ -22,7 +22,9 @@
 int readTopographyFile(const char* filename, Topography* topo);
 
 /**
- * Reads a file containing only coordinate (x, y, z) data for nodes
+ * Reads a file containing only coordinate (x, y, z) data for nodes. Blank
+ * lines and lines starting with '#' are skipped. The file is mapped and its
+ * newline aligned chunks are counted, then parsed, in parallel
  *
  * @param filename The path to the file to read
  * @param nodes Pointer to a Node pointer that will be allocated and filled with node data
@@ -0,0 +1,87 @@
+/*
+    Filename: topography_tiles.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the tiled topography store used for
+    DEMs larger than the memory. The tiles are binary files of a common
+    regular lattice, listed by an index file, and only the tiles under the
+    queried points are read, through a cache with a memory budget
+*/
+
+#ifndef TOPOGRAPHY_TILES_H
+#define TOPOGRAPHY_TILES_H
+
+#include <stddef.h>
+
+#define TILES_EXTENSION ".tiles"    // extension of the tile index files
+#define DEFAULT_TILE_SIZE 1024      // points along each side of a tile written from a grid
+
+typedef struct
+{
+    double x0;                  // x-coordinate of the lattice point (0, 0)
+    double y0;                  // y-coordinate of the lattice point (0, 0)
+    double dx;                  // spacing of the lattice along x
+    double dy;                  // spacing of the lattice along y
+    size_t nTiles;              // number of tiles of the index
+    size_t cacheSize;           // memory budget of the cached tile values in bytes
+    size_t nLoads;              // number of tile reads so far
+    size_t nBlocks;             // blocks of the directory that finds the tile of a point
+    void* store;                // tiles, their directory and their cache
+} TiledTopography;
+
+/**
+ * Tells if a topography file is a tile index, from its extension
+ *
+ * @param filename The path to the topography file
+ * @return 1 if it is a tile index, 0 otherwise
+ */
+int isTiledTopographyFile(const char* filename);
+
+/**
+ * Opens a tile index: a text file listing one tile file per line, relative
+ * to the directory of the index, with '#' comments. Only the headers of the
+ * tiles are read. The tiles must share their spacing and lie on a common
+ * lattice, they can be adjacent, overlap or leave holes
+ *
+ * @param filename The path to the tile index
+ * @param cacheSize Memory budget of the cached tile values in bytes, always
+ *        exceeded by the tiles in use at once if it is too small for them
+ * @param tiles Pointer to the TiledTopography structure that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int openTiledTopography(const char* filename, size_t cacheSize, TiledTopography* tiles);
+
+void closeTiledTopography(TiledTopography* tiles);
+
+/**
+ * Interpolates the topography bilinearly at points. The points are grouped
+ * by tile and evaluated in parallel, each tile being read at most once
+ * while it stays in the cache. Points whose cell is not covered by the
+ * tiles get NAN
+ *
+ * @param tiles Pointer to the tiled topography
+ * @param nPoints Number of points
+ * @param x Array of nPoints x-coordinates
+ * @param y Array of nPoints y-coordinates
+ * @param z Array of nPoints heights that will be filled
+ * @return 1 on success, 0 on failure
+ */
+int sampleTiledTopography(TiledTopography* tiles, size_t nPoints,
+    const double* x, const double* y, double* z);
+
+/**
+ * Splits a topography file in the grid format into tiles and writes their
+ * index. The grid must be regular and is read a band of tiles at a time,
+ * so it never needs to fit in memory
+ *
+ * @param gridFile The path to the topography file in the grid format
+ * @param tileSize Number of points along each side of a tile, at least 2
+ * @param indexFile The path to the tile index to write, the tiles are
+ *        written next to it
+ * @return 1 on success, 0 on failure
+ */
+int writeTopographyTiles(const char* gridFile, size_t tileSize, const char* indexFile);
+
+#endif // TOPOGRAPHY_TILES_H
@@ -25,4 +25,26 @@ int clampi(int value, int min, int max);
 
 float clampf(float value, float min, float max);
 
+double wallClock(void);
+
+/**
+ * Makes the path of a temporary file next to the given file. The path is
+ * unique per process and per call, so concurrent writers never share it
+ *
+ * @param dest Buffer that receives the path
+ * @param size Size of the buffer
+ * @param filename The path of the file the temporary file will replace
+ * @return 1 on success, 0 if the path does not fit in the buffer
+ */
+int temporaryPath(char* dest, size_t size, const char* filename);
+
+/**
+ * Tells if two paths name the same existing file, e.g. through a link
+ *
+ * @param a The first path
+ * @param b The second path
+ * @return 1 if both exist and are the same file, 0 otherwise
+ */
+int isSameFile(const char* a, const char* b);
+
 #endif
\ No newline at end of file
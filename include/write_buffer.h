@@ -0,0 +1,127 @@
+/*
+    Filename: write_buffer.h
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the declaration of the buffers used to format text in
+    memory and write it to files with a few large write calls
+*/
+
+#ifndef WRITE_BUFFER_H
+#define WRITE_BUFFER_H
+
+#include <stddef.h>
+
+#define WRITE_BUFFER_SIZE (1 << 20)     // default capacity of a buffer
+#define MAX_DOUBLE_LENGTH 384           // longest text written for a double
+#define FIXED_DOUBLE_WIDTH 24           // width of a double in a fixed-width record
+
+typedef struct
+{
+    int fd;                 // file the buffer is flushed to, -1 to keep the data in memory
+    char* data;             // formatted bytes not written yet
+    size_t size;            // number of bytes in data
+    size_t capacity;        // number of bytes allocated for data
+    size_t written;         // number of bytes written to the file so far
+    int failed;             // set when an allocation or a write fails
+} WriteBuffer;
+
+/**
+ * Initializes a buffer. Buffers with a file descriptor are flushed to it when
+ * they are full, memory buffers grow instead
+ *
+ * @param buffer Pointer to the buffer
+ * @param fd File descriptor to write to, -1 for a memory buffer
+ * @param capacity Initial number of bytes of the buffer
+ * @return 1 on success, 0 if the memory could not be allocated
+ */
+int initWriteBuffer(WriteBuffer* buffer, int fd, size_t capacity);
+
+void freeWriteBuffer(WriteBuffer* buffer);
+
+/**
+ * Writes the content of the buffer to its file and empties it
+ *
+ * @param buffer Pointer to the buffer
+ * @return 1 if every append and write so far succeeded, 0 otherwise
+ */
+int flushWriteBuffer(WriteBuffer* buffer);
+
+void appendBytes(WriteBuffer* buffer, const char* bytes, size_t length);
+
+/**
+ * Appends a range of another file. Buffers with a file descriptor are flushed
+ * and the range is copied by the kernel, with copy_file_range or sendfile,
+ * without going through user space when the files allow it
+ *
+ * @param buffer Pointer to the buffer
+ * @param fd File descriptor of the file to copy from
+ * @param offset Offset of the first byte to copy
+ * @param length Number of bytes to copy
+ */
+void appendFileRange(WriteBuffer* buffer, int fd, size_t offset, size_t length);
+
+/**
+ * Appends bytes the caller fills through the returned pointer, e.g. a record
+ * formatted in place
+ *
+ * @param buffer Pointer to the buffer
+ * @param length Number of bytes to append
+ * @return Pointer to the appended bytes, NULL if the buffer failed
+ */
+char* appendUninitialized(WriteBuffer* buffer, size_t length);
+
+void appendString(WriteBuffer* buffer, const char* string);
+
+void appendChar(WriteBuffer* buffer, char c);
+
+void appendSize(WriteBuffer* buffer, size_t value);
+
+void appendInt(WriteBuffer* buffer, long long value);
+
+/**
+ * Appends a double. Integral values are written without decimals, as
+ * printf("%.0f") does, and the other ones with the given number of decimals
+ * or, with SHORTEST_PRECISION, with the fewest decimals that read back as
+ * the same double
+ *
+ * @param buffer Pointer to the buffer
+ * @param value Value to write
+ * @param precision Number of decimals from 0 to MAX_PRECISION, or SHORTEST_PRECISION
+ */
+void appendDouble(WriteBuffer* buffer, double value, int precision);
+
+/**
+ * Formats a double as appendDouble does
+ *
+ * @param text Pointer to at least MAX_DOUBLE_LENGTH characters, not NUL terminated
+ * @param value Value to format
+ * @param precision Number of decimals from 0 to MAX_PRECISION, or SHORTEST_PRECISION
+ * @return Number of characters written
+ */
+size_t formatDouble(char* text, double value, int precision);
+
+size_t countDigits(size_t value);
+
+/**
+ * Formats an unsigned integer right aligned on a given width
+ *
+ * @param text Pointer to width characters, not NUL terminated
+ * @param value Value to format, it must have at most width digits
+ * @param width Number of characters written
+ */
+void formatPaddedSize(char* text, size_t value, size_t width);
+
+/**
+ * Formats a double as formatDouble does, right aligned on FIXED_DOUBLE_WIDTH
+ * characters. Values that would be longer, e.g. huge integral ones, are
+ * written with 17 significant digits in the exponent notation instead
+ *
+ * @param text Pointer to FIXED_DOUBLE_WIDTH characters, not NUL terminated
+ * @param value Value to format
+ * @param precision Number of decimals from 0 to MAX_PRECISION, or SHORTEST_PRECISION
+ */
+void formatPaddedDouble(char* text, double value, int precision);
+
+#endif // WRITE_BUFFER_H
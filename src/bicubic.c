@@ -0,0 +1,481 @@
+/*
+    Filename: bicubic.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the bicubic surface used to sample
+    topography grids on regular high-resolution grids without GSL. The
+    surface is separable: the weights of every output column and row are
+    computed once, each output row combines two rows of the source grid, and
+    each output point then takes four values of that combination
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bicubic.h"
+#include "parallel.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#else
+#define HAVE_AVX2_KERNEL 0
+#endif
+
+#define BANDS_PER_THREAD 4          // bands of rows per thread when sampling a grid
+#define COLUMNS_PER_STRIP 256       // columns of a task when deriving along y
+
+typedef struct
+{
+    size_t n;                   // number of knots
+    const double* knots;        // increasing knot coordinates
+    double* h;                  // n - 1 knot spacings
+    double* pivot;              // pivot of each interior equation of the natural spline
+    double* factor;             // elimination factor of each interior equation
+} AxisSpline;
+
+typedef struct
+{
+    size_t m;                   // number of output coordinates
+    size_t* cells;              // cell of the surface grid of each output coordinate
+    double* weights;            // 4 arrays of m Hermite weights: h00, h10 * h, h01, h11 * h
+} AxisWeights;
+
+static void freeAxisSpline(AxisSpline* axis)
+{
+    free(axis->h);
+    axis->h = NULL;
+}
+
+static int initAxisSpline(const double* knots, size_t n, AxisSpline* axis)
+{
+    // The tridiagonal system of the second derivatives of a natural cubic
+    // spline only depends on the knots, so its elimination is shared by all
+    // the rows or columns of values
+    axis->n = n;
+    axis->knots = knots;
+    axis->h = (double*)malloc(3 * n * sizeof(double));
+    if (axis->h == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a spline axis of %zu knots\n", n);
+        return 0;
+    }
+    axis->pivot = axis->h + n;
+    axis->factor = axis->pivot + n;
+
+    for (size_t k = 0; k + 1 < n; ++k)
+    {
+        axis->h[k] = knots[k + 1] - knots[k];
+    }
+    for (size_t k = 1; k + 1 < n; ++k)
+    {
+        double diagonal = 2.0 * (axis->h[k - 1] + axis->h[k]);
+        axis->pivot[k] = k == 1 ? diagonal : diagonal - axis->h[k - 1] * axis->factor[k - 1];
+        axis->factor[k] = axis->h[k] / axis->pivot[k];
+    }
+
+    return 1;
+}
+
+static void splineDerivatives(const AxisSpline* axis, const double* values, size_t step,
+    size_t count, double* out, double* scratch)
+{
+    // Derivatives at the knots of count series, the value of series s at
+    // knot k being values[k * step + s]. out receives the second derivative
+    // halves c first, then the derivatives b - h (c' + 2 c) / 3, as GSL does
+    size_t n = axis->n;
+    const double* h = axis->h;
+    if (n == 2)
+    {
+        for (size_t s = 0; s < count; ++s)
+        {
+            out[s] = out[step + s] = (values[step + s] - values[s]) / h[0];
+        }
+        return;
+    }
+
+    for (size_t k = 1; k + 1 < n; ++k)
+    {
+        const double* previous = values + (k - 1) * step;
+        const double* current = values + k * step;
+        const double* next = values + (k + 1) * step;
+        double* row = out + k * step;
+        const double* above = row - step;
+        for (size_t s = 0; s < count; ++s)
+        {
+            double r = 3.0 * ((next[s] - current[s]) / h[k] - (current[s] - previous[s]) / h[k - 1]);
+            if (k > 1) r -= h[k - 1] * above[s];
+            row[s] = r / axis->pivot[k];
+        }
+    }
+    memset(out, 0, count * sizeof(double));
+    memset(out + (n - 1) * step, 0, count * sizeof(double));
+    for (size_t k = n - 2; k-- > 1;)
+    {
+        double* row = out + k * step;
+        for (size_t s = 0; s < count; ++s)
+        {
+            row[s] -= axis->factor[k] * row[s + step];
+        }
+    }
+
+    for (size_t k = 0; k + 1 < n; ++k)
+    {
+        const double* current = values + k * step;
+        const double* next = values + (k + 1) * step;
+        double* row = out + k * step;
+        for (size_t s = 0; s < count; ++s)
+        {
+            double c = row[s];
+            scratch[s] = c;
+            row[s] = (next[s] - current[s]) / h[k] - h[k] * (row[s + step] + 2.0 * c) / 3.0;
+        }
+    }
+    double* last = out + (n - 1) * step;
+    const double* beforeLast = last - step;
+    for (size_t s = 0; s < count; ++s)
+    {
+        last[s] = beforeLast[s] + h[n - 2] * (scratch[s] + last[s]);
+    }
+}
+
+typedef struct
+{
+    const AxisSpline* axis;
+    const double* values;
+    double* out;
+    size_t nx;
+    size_t ny;
+    size_t itemsPerTask;
+} DerivativeTasks;
+
+static int deriveRowsTask(void* context, size_t task)
+{
+    const DerivativeTasks* tasks = (const DerivativeTasks*)context;
+    size_t first = task * tasks->itemsPerTask;
+    size_t last = first + tasks->itemsPerTask < tasks->ny ? first + tasks->itemsPerTask : tasks->ny;
+    double scratch;
+    for (size_t j = first; j < last; ++j)
+    {
+        splineDerivatives(tasks->axis, tasks->values + j * tasks->nx, 1, 1,
+            tasks->out + j * tasks->nx, &scratch);
+    }
+
+    return 1;
+}
+
+static int deriveColumnsTask(void* context, size_t task)
+{
+    // A strip of columns is swept down the rows at once, on contiguous values
+    const DerivativeTasks* tasks = (const DerivativeTasks*)context;
+    size_t first = task * tasks->itemsPerTask;
+    size_t last = first + tasks->itemsPerTask < tasks->nx ? first + tasks->itemsPerTask : tasks->nx;
+    double scratch[COLUMNS_PER_STRIP];
+    splineDerivatives(tasks->axis, tasks->values + first, tasks->nx, last - first,
+        tasks->out + first, scratch);
+
+    return 1;
+}
+
+void freeBicubicSurface(BicubicSurface* surface)
+{
+    free(surface->zx);
+    surface->zx = NULL;
+    surface->zy = NULL;
+    surface->zxy = NULL;
+}
+
+int initBicubicSurface(const Topography* grid, BicubicSurface* surface)
+{
+    size_t nx = grid->nx;
+    size_t ny = grid->ny;
+    surface->grid = grid;
+    surface->zx = NULL;
+    if (nx < 2 || ny < 2)
+    {
+        fprintf(stderr, "A bicubic surface needs a grid of at least 2 x 2 points, not %zu x %zu\n",
+            nx, ny);
+        return 0;
+    }
+
+    int result = 0;
+    AxisSpline xAxis = { 0 };
+    AxisSpline yAxis = { 0 };
+    surface->zx = (double*)malloc(3 * nx * ny * sizeof(double));
+    if (surface->zx == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for the derivatives of a %zu x %zu grid\n",
+            nx, ny);
+        return 0;
+    }
+    surface->zy = surface->zx + nx * ny;
+    surface->zxy = surface->zy + nx * ny;
+    if (!initAxisSpline(grid->xGrid, nx, &xAxis) || !initAxisSpline(grid->yGrid, ny, &yAxis))
+    {
+        goto out_free_axes;
+    }
+
+    // The cross derivative derives the x-derivatives along y, once they are done
+    size_t nThreads = getThreadCount();
+    DerivativeTasks rows = { &xAxis, grid->values, surface->zx, nx, ny, 0 };
+    rows.itemsPerTask = (ny + nThreads * BANDS_PER_THREAD - 1) / (nThreads * BANDS_PER_THREAD);
+    DerivativeTasks columns = { &yAxis, grid->values, surface->zy, nx, ny, COLUMNS_PER_STRIP };
+    DerivativeTasks crossColumns = { &yAxis, surface->zx, surface->zxy, nx, ny,
+        COLUMNS_PER_STRIP };
+    size_t nColumnTasks = (nx + COLUMNS_PER_STRIP - 1) / COLUMNS_PER_STRIP;
+    result = parallelFor((ny + rows.itemsPerTask - 1) / rows.itemsPerTask, deriveRowsTask, &rows)
+        && parallelFor(nColumnTasks, deriveColumnsTask, &columns)
+        && parallelFor(nColumnTasks, deriveColumnsTask, &crossColumns);
+
+out_free_axes:
+    freeAxisSpline(&xAxis);
+    freeAxisSpline(&yAxis);
+    if (!result) freeBicubicSurface(surface);
+    return result;
+}
+
+static void freeAxisWeights(AxisWeights* weights)
+{
+    free(weights->cells);
+    weights->cells = NULL;
+    free(weights->weights);
+    weights->weights = NULL;
+}
+
+static int initAxisWeights(const double* knots, size_t n, const double* coordinates, size_t m,
+    AxisWeights* weights)
+{
+    weights->m = m;
+    weights->cells = (size_t*)malloc(m * sizeof(size_t));
+    weights->weights = (double*)malloc(4 * m * sizeof(double));
+    if (weights->cells == NULL || weights->weights == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for the weights of %zu coordinates\n", m);
+        freeAxisWeights(weights);
+        return 0;
+    }
+
+    // Each coordinate takes the cell it falls in, the last cell for the
+    // last knot, as GSL does
+    size_t cell = 0;
+    for (size_t i = 0; i < m; ++i)
+    {
+        double x = coordinates[i];
+        if (x < knots[cell]) cell = 0;
+        while (cell + 2 < n && x >= knots[cell + 1]) ++cell;
+
+        double h = knots[cell + 1] - knots[cell];
+        double t = (x - knots[cell]) / h;
+        double t2 = t * t;
+        double t3 = t2 * t;
+        weights->cells[i] = cell;
+        weights->weights[i] = 2.0 * t3 - 3.0 * t2 + 1.0;
+        weights->weights[m + i] = (t3 - 2.0 * t2 + t) * h;
+        weights->weights[2 * m + i] = -2.0 * t3 + 3.0 * t2;
+        weights->weights[3 * m + i] = (t3 - t2) * h;
+    }
+
+    return 1;
+}
+
+typedef struct
+{
+    const BicubicSurface* surface;
+    const AxisWeights* columns;
+    const AxisWeights* rows;
+    Topography* topo;
+    void (*sampleRow)(const BicubicSurface* surface, const AxisWeights* columns,
+        const double wy[4], size_t cell, double* pq, double* out);
+    size_t rowsPerTask;
+} SampleTasks;
+
+static void sampleRowScalar(const BicubicSurface* surface, const AxisWeights* columns,
+    const double wy[4], size_t cell, double* pq, double* out)
+{
+    // pq interleaves, for each source column, the values and the
+    // x-derivatives of the surface interpolated along y at the output row
+    size_t nx = surface->grid->nx;
+    const double* z0 = surface->grid->values + cell * nx;
+    const double* z1 = z0 + nx;
+    const double* zx0 = surface->zx + cell * nx;
+    const double* zx1 = zx0 + nx;
+    const double* zy0 = surface->zy + cell * nx;
+    const double* zy1 = zy0 + nx;
+    const double* zxy0 = surface->zxy + cell * nx;
+    const double* zxy1 = zxy0 + nx;
+    for (size_t k = 0; k < nx; ++k)
+    {
+        pq[2 * k] = z0[k] * wy[0] + zy0[k] * wy[1] + z1[k] * wy[2] + zy1[k] * wy[3];
+        pq[2 * k + 1] = zx0[k] * wy[0] + zxy0[k] * wy[1] + zx1[k] * wy[2] + zxy1[k] * wy[3];
+    }
+
+    size_t m = columns->m;
+    const double* w = columns->weights;
+    for (size_t i = 0; i < m; ++i)
+    {
+        const double* p = pq + 2 * columns->cells[i];
+        out[i] = p[0] * w[i] + p[1] * w[m + i] + p[2] * w[2 * m + i] + p[3] * w[3 * m + i];
+    }
+}
+
+#if HAVE_AVX2_KERNEL
+__attribute__((target("avx2,fma")))
+static void sampleRowAvx2(const BicubicSurface* surface, const AxisWeights* columns,
+    const double wy[4], size_t cell, double* pq, double* out)
+{
+    // Same sums as the scalar kernel, four source columns or four output
+    // points at a time
+    size_t nx = surface->grid->nx;
+    const double* z0 = surface->grid->values + cell * nx;
+    const double* z1 = z0 + nx;
+    const double* zx0 = surface->zx + cell * nx;
+    const double* zx1 = zx0 + nx;
+    const double* zy0 = surface->zy + cell * nx;
+    const double* zy1 = zy0 + nx;
+    const double* zxy0 = surface->zxy + cell * nx;
+    const double* zxy1 = zxy0 + nx;
+    __m256d w0 = _mm256_set1_pd(wy[0]);
+    __m256d w1 = _mm256_set1_pd(wy[1]);
+    __m256d w2 = _mm256_set1_pd(wy[2]);
+    __m256d w3 = _mm256_set1_pd(wy[3]);
+    size_t k = 0;
+    for (; k + 4 <= nx; k += 4)
+    {
+        __m256d p = _mm256_mul_pd(_mm256_loadu_pd(z0 + k), w0);
+        p = _mm256_fmadd_pd(_mm256_loadu_pd(zy0 + k), w1, p);
+        p = _mm256_fmadd_pd(_mm256_loadu_pd(z1 + k), w2, p);
+        p = _mm256_fmadd_pd(_mm256_loadu_pd(zy1 + k), w3, p);
+        __m256d q = _mm256_mul_pd(_mm256_loadu_pd(zx0 + k), w0);
+        q = _mm256_fmadd_pd(_mm256_loadu_pd(zxy0 + k), w1, q);
+        q = _mm256_fmadd_pd(_mm256_loadu_pd(zx1 + k), w2, q);
+        q = _mm256_fmadd_pd(_mm256_loadu_pd(zxy1 + k), w3, q);
+        __m256d low = _mm256_unpacklo_pd(p, q);
+        __m256d high = _mm256_unpackhi_pd(p, q);
+        _mm256_storeu_pd(pq + 2 * k, _mm256_permute2f128_pd(low, high, 0x20));
+        _mm256_storeu_pd(pq + 2 * k + 4, _mm256_permute2f128_pd(low, high, 0x31));
+    }
+    for (; k < nx; ++k)
+    {
+        pq[2 * k] = z0[k] * wy[0] + zy0[k] * wy[1] + z1[k] * wy[2] + zy1[k] * wy[3];
+        pq[2 * k + 1] = zx0[k] * wy[0] + zxy0[k] * wy[1] + zx1[k] * wy[2] + zxy1[k] * wy[3];
+    }
+
+    // The four values of each output point are contiguous in pq, the 4 x 4
+    // block of four points is transposed to meet the weight arrays
+    size_t m = columns->m;
+    const double* w = columns->weights;
+    const size_t* cells = columns->cells;
+    size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        __m256d r0 = _mm256_loadu_pd(pq + 2 * cells[i]);
+        __m256d r1 = _mm256_loadu_pd(pq + 2 * cells[i + 1]);
+        __m256d r2 = _mm256_loadu_pd(pq + 2 * cells[i + 2]);
+        __m256d r3 = _mm256_loadu_pd(pq + 2 * cells[i + 3]);
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+        __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+        __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+        __m256d v = _mm256_mul_pd(_mm256_permute2f128_pd(t0, t2, 0x20), _mm256_loadu_pd(w + i));
+        v = _mm256_fmadd_pd(_mm256_permute2f128_pd(t1, t3, 0x20), _mm256_loadu_pd(w + m + i), v);
+        v = _mm256_fmadd_pd(_mm256_permute2f128_pd(t0, t2, 0x31),
+            _mm256_loadu_pd(w + 2 * m + i), v);
+        v = _mm256_fmadd_pd(_mm256_permute2f128_pd(t1, t3, 0x31),
+            _mm256_loadu_pd(w + 3 * m + i), v);
+        _mm256_storeu_pd(out + i, v);
+    }
+    for (; i < m; ++i)
+    {
+        const double* p = pq + 2 * cells[i];
+        out[i] = p[0] * w[i] + p[1] * w[m + i] + p[2] * w[2 * m + i] + p[3] * w[3 * m + i];
+    }
+}
+#endif
+
+int isBicubicKernelAvailable(BicubicKernel kernel)
+{
+    switch (kernel)
+    {
+    case BICUBIC_KERNEL_AUTO:
+    case BICUBIC_KERNEL_SCALAR:
+        return 1;
+    case BICUBIC_KERNEL_AVX2:
+#if HAVE_AVX2_KERNEL
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+        return 0;
+#endif
+    default:
+        return 0;
+    }
+}
+
+static int sampleBandTask(void* context, size_t task)
+{
+    const SampleTasks* tasks = (const SampleTasks*)context;
+    Topography* topo = tasks->topo;
+    const AxisWeights* rows = tasks->rows;
+    double* pq = (double*)malloc(2 * tasks->surface->grid->nx * sizeof(double));
+    if (pq == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a row of %zu points\n",
+            tasks->surface->grid->nx);
+        return 0;
+    }
+
+    size_t first = task * tasks->rowsPerTask;
+    size_t last = first + tasks->rowsPerTask < topo->ny ? first + tasks->rowsPerTask : topo->ny;
+    for (size_t j = first; j < last; ++j)
+    {
+        double wy[4] = { rows->weights[j], rows->weights[rows->m + j],
+            rows->weights[2 * rows->m + j], rows->weights[3 * rows->m + j] };
+        tasks->sampleRow(tasks->surface, tasks->columns, wy, rows->cells[j], pq,
+            topo->values + j * topo->nx);
+    }
+
+    free(pq);
+    return 1;
+}
+
+int sampleBicubicSurface(const BicubicSurface* surface, BicubicKernel kernel, Topography* topo)
+{
+    const Topography* grid = surface->grid;
+    AxisWeights columns = { 0 };
+    AxisWeights rows = { 0 };
+    if (!initAxisWeights(grid->xGrid, grid->nx, topo->xGrid, topo->nx, &columns)) return 0;
+    if (!initAxisWeights(grid->yGrid, grid->ny, topo->yGrid, topo->ny, &rows))
+    {
+        freeAxisWeights(&columns);
+        return 0;
+    }
+
+    SampleTasks tasks;
+    tasks.surface = surface;
+    tasks.columns = &columns;
+    tasks.rows = &rows;
+    tasks.topo = topo;
+    tasks.sampleRow = sampleRowScalar;
+#if HAVE_AVX2_KERNEL
+    if (kernel != BICUBIC_KERNEL_SCALAR && isBicubicKernelAvailable(BICUBIC_KERNEL_AVX2))
+    {
+        tasks.sampleRow = sampleRowAvx2;
+    }
+#else
+    (void)kernel;
+#endif
+
+    // A few bands per thread balance the threads
+    size_t nBands = getThreadCount() * BANDS_PER_THREAD;
+    tasks.rowsPerTask = (topo->ny + nBands - 1) / nBands;
+    if (tasks.rowsPerTask == 0) tasks.rowsPerTask = 1;
+    int result = parallelFor((topo->ny + tasks.rowsPerTask - 1) / tasks.rowsPerTask,
+        sampleBandTask, &tasks);
+
+    freeAxisWeights(&columns);
+    freeAxisWeights(&rows);
+    return result;
+}
@@ -16,6 +16,7 @@
 #include <string.h>
 
 #include "config_file.h"
+#include "topography_tiles.h"
 #include "utils.h"
 
 static int parseLine(const char* restrict line, char* restrict key, char* restrict value)
@@ -83,6 +84,10 @@ static void storeValue(const char* restrict key, char* restrict value, ConfigFil
             exit(EXIT_FAILURE);
         }
     }
+    else if (strcmp("nThreads", key) == 0)
+    {
+        config->nThreads = (size_t)atoll(value);
+    }
     else if (strcmp("skinMeshFileIn", key) == 0)
     {
         strcpy(config->skinMeshFileIn, value);
@@ -91,6 +96,95 @@ static void storeValue(const char* restrict key, char* restrict value, ConfigFil
     {
         strcpy(config->skinMeshFileOut, value);
     }
+    else if (strcmp("skinMeshSnapshot", key) == 0)
+    {
+        if (strcmp(value, "yes") == 0)
+        {
+            config->skinMeshSnapshot = 1;
+        }
+        else if (strcmp(value, "no") == 0)
+        {
+            config->skinMeshSnapshot = 0;
+        }
+        else
+        {
+            printf("Error: unrecognized skinMeshSnapshot value '%s'\n", value);
+            printf("Valid values are: 'yes', 'no'\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (strcmp("skinMeshFormatOut", key) == 0)
+    {
+        if (strcmp(value, "msh1") == 0)
+        {
+            config->skinMeshFormatOut = MSH_V1;
+        }
+        else if (strcmp(value, "msh41") == 0)
+        {
+            config->skinMeshFormatOut = MSH_V41;
+        }
+        else if (strcmp(value, "msh41_binary") == 0)
+        {
+            config->skinMeshFormatOut = MSH_V41_BINARY;
+        }
+        else
+        {
+            printf("Error: unrecognized skinMeshFormatOut value '%s'\n", value);
+            printf("Valid values are: 'msh1', 'msh41', 'msh41_binary'\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (strcmp("skinMeshPrecisionOut", key) == 0)
+    {
+        if (strcmp(value, "shortest") == 0)
+        {
+            config->skinMeshPrecisionOut = SHORTEST_PRECISION;
+        }
+        else
+        {
+            config->skinMeshPrecisionOut = atoi(value);
+            if (config->skinMeshPrecisionOut < 0 || config->skinMeshPrecisionOut > MAX_PRECISION)
+            {
+                printf("Error: skinMeshPrecisionOut must be 'shortest' or between 0 and %d\n",
+                    MAX_PRECISION);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    else if (strcmp("skinMeshPatchOut", key) == 0)
+    {
+        if (strcmp(value, "yes") == 0)
+        {
+            config->skinMeshPatchOut = 1;
+        }
+        else if (strcmp(value, "no") == 0)
+        {
+            config->skinMeshPatchOut = 0;
+        }
+        else
+        {
+            printf("Error: unrecognized skinMeshPatchOut value '%s'\n", value);
+            printf("Valid values are: 'yes', 'no'\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (strcmp("skinMeshFixedWidthOut", key) == 0)
+    {
+        if (strcmp(value, "yes") == 0)
+        {
+            config->skinMeshFixedWidthOut = 1;
+        }
+        else if (strcmp(value, "no") == 0)
+        {
+            config->skinMeshFixedWidthOut = 0;
+        }
+        else
+        {
+            printf("Error: unrecognized skinMeshFixedWidthOut value '%s'\n", value);
+            printf("Valid values are: 'yes', 'no'\n");
+            exit(EXIT_FAILURE);
+        }
+    }
     else if (strcmp("topoFiles", key) == 0)
     {
         parseStringArray(value, config->topoFiles);
@@ -103,6 +197,35 @@ static void storeValue(const char* restrict key, char* restrict value, ConfigFil
     {
         config->ny = (size_t)atoll(value);
     }
+    else if (strcmp("topoInterpolation", key) == 0)
+    {
+        if (strcmp(value, "grid") == 0)
+        {
+            config->topoInterpolation = TOPO_INTERPOLATION_GRID;
+        }
+        else if (strcmp(value, "nodes") == 0)
+        {
+            config->topoInterpolation = TOPO_INTERPOLATION_NODES;
+        }
+        else
+        {
+            printf("Error: unrecognized topoInterpolation value '%s'\n", value);
+            printf("Valid values are: 'grid', 'nodes'\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (strcmp("topoTileCacheMB", key) == 0)
+    {
+        config->topoTileCacheMB = (size_t)atoll(value);
+    }
+    else if (strcmp("topoCacheDir", key) == 0)
+    {
+        strcpy(config->topoCacheDir, value);
+    }
+    else if (strcmp("topoCacheMB", key) == 0)
+    {
+        config->topoCacheMB = (size_t)atoll(value);
+    }
     else if (strcmp("surfaceMeshFaces", key) == 0)
     {
         parseArray(value, config->surfaceMeshFaces, MAXSURF);
@@ -182,10 +305,12 @@ void validateConfigFile(const ConfigFile* config)
         }
 
         int topoFileCount = 0;
+        int tiledFileCount = 0;
         for (int i = 0; i < MAXSURF; ++i)
         {
             if (config->topoFiles[i][0] == '\0') break;
             ++topoFileCount;
+            if (isTiledTopographyFile(config->topoFiles[i])) ++tiledFileCount;
         }
         int surfaceFaceCount = 0;
         for (int i = 0; i < MAXSURF; ++i)
@@ -211,16 +336,29 @@ void validateConfigFile(const ConfigFile* config)
             fprintf(stderr, "Error: surfaceMeshFaces not defined in config file\n");
             exit(EXIT_FAILURE);
         }
-        if (config->nx == 0)
+        // Tiled topographies are sampled at their own resolution
+        int needsGrid = config->topoInterpolation == TOPO_INTERPOLATION_GRID
+            && tiledFileCount < topoFileCount;
+        if (config->nx == 0 && needsGrid)
         {
             fprintf(stderr, "Error: nx not defined in config file\n");
             exit(EXIT_FAILURE);
         }
-        if (config->ny == 0)
+        if (config->ny == 0 && needsGrid)
         {
             fprintf(stderr, "Error: ny not defined in config file\n");
             exit(EXIT_FAILURE);
         }
+        if (config->topoTileCacheMB == 0 && tiledFileCount > 0)
+        {
+            fprintf(stderr, "Error: topoTileCacheMB must be greater than 0\n");
+            exit(EXIT_FAILURE);
+        }
+        if (config->topoCacheMB == 0 && config->topoCacheDir[0] != '\0')
+        {
+            fprintf(stderr, "Error: topoCacheMB must be greater than 0\n");
+            exit(EXIT_FAILURE);
+        }
         if (config->iterMaxSmooth <= 0)
         {
             fprintf(stderr, "Error: iterMaxSmooth must be greater than 0\n");
@@ -287,8 +425,12 @@ void readConfigFile(const char* filename, ConfigFile* config)
 {
     // set default values in case they are not defined
     config->mode = MODE_ALL;
+    config->skinMeshFormatOut = MSH_UNKNOWN_VERSION;
+    config->skinMeshPrecisionOut = SHORTEST_PRECISION;
     config->iterMaxSmooth = 200;
     config->tolerSmooth = 0.01;
+    config->topoTileCacheMB = 1024;
+    config->topoCacheMB = 1024;
     config->minResistivity = DBL_SNAN;
     config->frequency = 1.0;
     config->rSkinDepth = 2.0;
@@ -327,8 +469,19 @@ void printConfigFile(const ConfigFile* config)
     if (config->mode == MODE_ALL) printf("all\n");
     else if (config->mode == MODE_INTERPOLATE) printf("interpolate\n");
     else if (config->mode == MODE_BACKGROUND_MESH) printf("background_mesh\n");
+    printf("nThreads = %zu\n", config->nThreads);
     printf("skinMeshFileIn = %s\n", config->skinMeshFileIn);
+    printf("skinMeshSnapshot = %s\n", config->skinMeshSnapshot ? "yes" : "no");
     printf("skinMeshFileOut = %s\n", config->skinMeshFileOut);
+    printf("skinMeshFormatOut = ");
+    if (config->skinMeshFormatOut == MSH_V1) printf("msh1\n");
+    else if (config->skinMeshFormatOut == MSH_V41) printf("msh41\n");
+    else if (config->skinMeshFormatOut == MSH_V41_BINARY) printf("msh41_binary\n");
+    else printf("same as input\n");
+    if (config->skinMeshPrecisionOut == SHORTEST_PRECISION) printf("skinMeshPrecisionOut = shortest\n");
+    else printf("skinMeshPrecisionOut = %d\n", config->skinMeshPrecisionOut);
+    printf("skinMeshPatchOut = %s\n", config->skinMeshPatchOut ? "yes" : "no");
+    printf("skinMeshFixedWidthOut = %s\n", config->skinMeshFixedWidthOut ? "yes" : "no");
     printf("topoFiles = ");
     for (int i = 0; i < MAXSURF; ++i)
     {
@@ -338,6 +491,11 @@ void printConfigFile(const ConfigFile* config)
     }
     printf("\nnx = %zu\n", config->nx);
     printf("ny = %zu\n", config->ny);
+    printf("topoInterpolation = %s\n",
+        config->topoInterpolation == TOPO_INTERPOLATION_NODES ? "nodes" : "grid");
+    printf("topoTileCacheMB = %zu\n", config->topoTileCacheMB);
+    printf("topoCacheDir = %s\n", config->topoCacheDir);
+    printf("topoCacheMB = %zu\n", config->topoCacheMB);
     printf("surfaceMeshFaces = ");
     for (int i = 0; i < MAXSURF; ++i)
     {
@@ -0,0 +1,272 @@
+/*
+    Filename: kd_tree.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the 2D k-d tree used to find the
+    nearest scattered points of a location in the horizontal plane. The tree
+    is implicit: the node of a range of points is the point at its middle
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kd_tree.h"
+#include "parallel.h"
+
+#define LEAF_SIZE 8                 // ranges of at most this many points are scanned
+#define TASKS_PER_THREAD 4          // subtrees per thread built in parallel
+
+typedef struct
+{
+    size_t first;
+    size_t last;                // past the last point of the range
+} KdRange;
+
+typedef struct
+{
+    KdTree* tree;
+    const KdRange* ranges;
+} KdBuild;
+
+typedef struct
+{
+    size_t k;
+    size_t count;
+    size_t* indexes;
+    double* distances;          // max-heap of the squared distances found so far
+} Neighbours;
+
+static double coordinate(const Node* point, int axis)
+{
+    return axis ? point->y : point->x;
+}
+
+static void swapPoints(Node* points, ptrdiff_t a, ptrdiff_t b)
+{
+    Node swap = points[a];
+    points[a] = points[b];
+    points[b] = swap;
+}
+
+static int widestAxis(const Node* points, size_t nPoints)
+{
+    double minX = points[0].x;
+    double maxX = points[0].x;
+    double minY = points[0].y;
+    double maxY = points[0].y;
+    for (size_t i = 1; i < nPoints; ++i)
+    {
+        if (points[i].x < minX) minX = points[i].x;
+        if (points[i].x > maxX) maxX = points[i].x;
+        if (points[i].y < minY) minY = points[i].y;
+        if (points[i].y > maxY) maxY = points[i].y;
+    }
+
+    return maxY - minY > maxX - minX;
+}
+
+static void selectMedian(Node* points, size_t nPoints, size_t median, int axis)
+{
+    // Quickselect with a three-way partition, so that the many equal
+    // coordinates of survey lines do not degrade it
+    ptrdiff_t first = 0;
+    ptrdiff_t last = (ptrdiff_t)nPoints - 1;
+    ptrdiff_t k = (ptrdiff_t)median;
+    while (first < last)
+    {
+        double pivot = coordinate(&points[first + (last - first) / 2], axis);
+        ptrdiff_t below = first;
+        ptrdiff_t above = last;
+        ptrdiff_t i = first;
+        while (i <= above)
+        {
+            double value = coordinate(&points[i], axis);
+            if (value < pivot) swapPoints(points, below++, i++);
+            else if (value > pivot) swapPoints(points, i, above--);
+            else ++i;
+        }
+        if (k < below) last = below - 1;
+        else if (k > above) first = above + 1;
+        else return;
+    }
+}
+
+static size_t splitRange(KdTree* tree, const KdRange* range)
+{
+    // The middle point becomes the node, with no point after it lower
+    // along its axis and no point before it higher
+    size_t nPoints = range->last - range->first;
+    size_t middle = range->first + nPoints / 2;
+    Node* points = tree->points + range->first;
+    int axis = widestAxis(points, nPoints);
+    selectMedian(points, nPoints, middle - range->first, axis);
+    tree->axes[middle] = (unsigned char)axis;
+    return middle;
+}
+
+static void buildRange(KdTree* tree, KdRange range)
+{
+    while (range.last - range.first > LEAF_SIZE)
+    {
+        size_t middle = splitRange(tree, &range);
+        buildRange(tree, (KdRange){ range.first, middle });
+        range.first = middle + 1;
+    }
+}
+
+static int buildRangeTask(void* context, size_t task)
+{
+    const KdBuild* build = (const KdBuild*)context;
+    buildRange(build->tree, build->ranges[task]);
+    return 1;
+}
+
+void freeKdTree(KdTree* tree)
+{
+    free(tree->axes);
+    tree->axes = NULL;
+    tree->points = NULL;
+    tree->nPoints = 0;
+}
+
+int buildKdTree(Node* points, size_t nPoints, KdTree* tree)
+{
+    tree->points = points;
+    tree->nPoints = nPoints;
+    tree->axes = (unsigned char*)calloc(nPoints > 0 ? nPoints : 1, 1);
+    size_t target = getThreadCount() * TASKS_PER_THREAD;
+    KdRange* buffer = (KdRange*)malloc(4 * target * sizeof(KdRange));
+    if (tree->axes == NULL || buffer == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a k-d tree of %zu points\n", nPoints);
+        free(buffer);
+        freeKdTree(tree);
+        return 0;
+    }
+
+    // The first levels are split serially until there are enough subtrees
+    // to keep every thread busy
+    KdRange* ranges = buffer;
+    KdRange* children = buffer + 2 * target;
+    size_t nRanges = 1;
+    ranges[0] = (KdRange){ 0, nPoints };
+    int split = 1;
+    while (nRanges < target && split)
+    {
+        size_t nChildren = 0;
+        split = 0;
+        for (size_t i = 0; i < nRanges; ++i)
+        {
+            if (ranges[i].last - ranges[i].first <= LEAF_SIZE)
+            {
+                children[nChildren++] = ranges[i];
+                continue;
+            }
+            size_t middle = splitRange(tree, &ranges[i]);
+            children[nChildren++] = (KdRange){ ranges[i].first, middle };
+            children[nChildren++] = (KdRange){ middle + 1, ranges[i].last };
+            split = 1;
+        }
+        KdRange* swap = ranges;
+        ranges = children;
+        children = swap;
+        nRanges = nChildren;
+    }
+
+    KdBuild build = { tree, ranges };
+    int result = parallelFor(nRanges, buildRangeTask, &build);
+    free(buffer);
+    if (!result) freeKdTree(tree);
+    return result;
+}
+
+static void addNeighbour(Neighbours* neighbours, size_t index, double distance)
+{
+    size_t* indexes = neighbours->indexes;
+    double* distances = neighbours->distances;
+    size_t i;
+    if (neighbours->count < neighbours->k)
+    {
+        // Sift the new point up from the end of the heap
+        i = neighbours->count++;
+        while (i > 0 && distances[(i - 1) / 2] < distance)
+        {
+            distances[i] = distances[(i - 1) / 2];
+            indexes[i] = indexes[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    }
+    else if (distance < distances[0])
+    {
+        // Sift the new point down from the root, replacing the farthest one
+        i = 0;
+        size_t count = neighbours->count;
+        for (;;)
+        {
+            size_t child = 2 * i + 1;
+            if (child >= count) break;
+            if (child + 1 < count && distances[child + 1] > distances[child]) ++child;
+            if (distances[child] <= distance) break;
+            distances[i] = distances[child];
+            indexes[i] = indexes[child];
+            i = child;
+        }
+    }
+    else
+    {
+        return;
+    }
+    distances[i] = distance;
+    indexes[i] = index;
+}
+
+static void searchRange(const KdTree* tree, size_t first, size_t last, double x, double y,
+    Neighbours* neighbours)
+{
+    while (last - first > LEAF_SIZE)
+    {
+        size_t middle = first + (last - first) / 2;
+        const Node* node = &tree->points[middle];
+        double dx = x - node->x;
+        double dy = y - node->y;
+        addNeighbour(neighbours, middle, dx * dx + dy * dy);
+
+        // The near side first, the far one only if it can hold a nearer point
+        double delta = tree->axes[middle] ? dy : dx;
+        if (delta < 0.0)
+        {
+            searchRange(tree, first, middle, x, y, neighbours);
+            if (neighbours->count == neighbours->k && delta * delta >= neighbours->distances[0])
+            {
+                return;
+            }
+            first = middle + 1;
+        }
+        else
+        {
+            searchRange(tree, middle + 1, last, x, y, neighbours);
+            if (neighbours->count == neighbours->k && delta * delta >= neighbours->distances[0])
+            {
+                return;
+            }
+            last = middle;
+        }
+    }
+
+    for (size_t i = first; i < last; ++i)
+    {
+        double dx = x - tree->points[i].x;
+        double dy = y - tree->points[i].y;
+        addNeighbour(neighbours, i, dx * dx + dy * dy);
+    }
+}
+
+size_t findNearestPoints(const KdTree* tree, double x, double y, size_t k,
+    size_t* indexes, double* distances)
+{
+    Neighbours neighbours = { k, 0, indexes, distances };
+    if (k > 0) searchRange(tree, 0, tree->nPoints, x, y, &neighbours);
+    return neighbours.count;
+}
@@ -1,28 +1,76 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "background_mesh.h"
 #include "config_file.h"
 #include "msh_parser.h"
+#include "parallel.h"
 #include "topography_parser.h"
+#include "topography_tiles.h"
+#include "utils.h"
 
 int main(int argc, char** argv)
 {
     if (argc < 2)
     {
         printf("usage: amgem <config file>\n");
+        printf("       amgem --tiles <topography file> <tile index> [tile size]\n");
         exit(EXIT_FAILURE);
     }
 
+    // Split a topography grid into tiles, for topographies larger than the memory
+    if (strcmp(argv[1], "--tiles") == 0)
+    {
+        if (argc < 4)
+        {
+            printf("usage: amgem --tiles <topography file> <tile index> [tile size]\n");
+            exit(EXIT_FAILURE);
+        }
+        size_t tileSize = argc > 4 ? (size_t)atoll(argv[4]) : DEFAULT_TILE_SIZE;
+        if (!writeTopographyTiles(argv[2], tileSize, argv[3]))
+        {
+            fprintf(stderr, "Failed to split '%s' into tiles\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        printf("Topography tiles listed in '%s'\n", argv[3]);
+        return EXIT_SUCCESS;
+    }
+
     int result = EXIT_SUCCESS;
 
     // Read the configuration file
     ConfigFile config = { 0 };
     readConfigFile(argv[1], &config);
+    setThreadCount(config.nThreads);
 
-    // Parse the .msh file
+    // When the mesh is written to the standard output, e.g. to pipe it into
+    // Gmsh, the messages go to the standard error instead
+    int meshFd = -1;
+    if ((config.mode & MODE_INTERPOLATE) && strcmp(config.skinMeshFileOut, MSH_STREAM_PATH) == 0)
+    {
+        fflush(stdout);
+        meshFd = dup(STDOUT_FILENO);
+        if (meshFd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+        {
+            fprintf(stderr, "Failed to redirect the messages to the standard error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Parse the .msh file, or map its snapshot when enabled. Unless the mesh
+    // is converted to another format, the elements the run does not read are
+    // kept as text and copied to the output
     Mesh mesh = { 0 };
-    if (!readMshFile(config.skinMeshFileIn, &mesh))
+    ElementFilter elementFilter;
+    getElementFilter(&config, &elementFilter);
+    MshReadOptions readOptions = { config.skinMeshSnapshot, NULL };
+    if (config.skinMeshFormatOut == MSH_UNKNOWN_VERSION || config.skinMeshFormatOut == MSH_V1)
+    {
+        readOptions.elementFilter = &elementFilter;
+    }
+    if (!readMshFileWithOptions(config.skinMeshFileIn, &mesh, &readOptions))
     {
         fprintf(stderr, "Failed to parse .msh file '%s'\n", config.skinMeshFileIn);
         exit(EXIT_FAILURE);
@@ -47,8 +95,37 @@ int main(int argc, char** argv)
         }
         fprintf(stdout, "Successfully interpolated topography and smoothed the mesh\n");
 
-        // Write the mesh to a .msh file
-        if (!writeMshFile(config.skinMeshFileOut, &mesh, MSH_V1))
+        // Write the mesh to a .msh file, in the input format unless another is set
+        MshWriteOptions options;
+        options.version = config.skinMeshFormatOut != MSH_UNKNOWN_VERSION
+            ? config.skinMeshFormatOut
+            : mesh.version;
+        options.precision = config.skinMeshPrecisionOut;
+        options.patchSource = NULL;
+        options.fixedWidth = config.skinMeshFixedWidthOut && options.version == MSH_V1;
+        if (config.skinMeshPatchOut && !options.fixedWidth && options.version == MSH_V1
+            && mesh.version == MSH_V1 && !isMshStream(config.skinMeshFileIn))
+        {
+            // Only the nodes moved, the rest of the input is copied as is
+            options.patchSource = config.skinMeshFileIn;
+        }
+
+        // A fixed-width input that is also the output only gets its
+        // coordinates rewritten, any other file is written whole
+        int written = 0;
+        if (options.fixedWidth && meshFd == -1 && mesh.version == MSH_V1
+            && !isMshStream(config.skinMeshFileIn)
+            && isSameFile(config.skinMeshFileIn, config.skinMeshFileOut))
+        {
+            written = updateMshNodes(config.skinMeshFileOut, &mesh, options.precision);
+        }
+        if (!written)
+        {
+            written = meshFd != -1
+                ? writeMshStream(meshFd, "standard output", &mesh, &options)
+                : writeMshFileWithOptions(config.skinMeshFileOut, &mesh, &options);
+        }
+        if (!written)
         {
             fprintf(stderr, "Failed to write the resulting .msh file '%s'\n",
                 config.skinMeshFileOut);
@@ -72,6 +149,7 @@ int main(int argc, char** argv)
     }
 
 out_free_mesh:
+    if (meshFd != -1) close(meshFd);
     freeMesh(&mesh);
     return result;
 }
@@ -0,0 +1,89 @@
+/*
+    Filename: mapped_file.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the functions to map files into memory
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+int openMappedFile(const char* filename, MappedFile* file)
+{
+    int result = 1;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not open file '%s': %s\n", filename, strerror(errno));
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        fprintf(stderr, "Could not get file size for '%s': %s\n", filename, strerror(errno));
+        result = 0;
+        goto out_close_file;
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "Could not map '%s': not a regular file\n", filename);
+        result = 0;
+        goto out_close_file;
+    }
+
+    // Reserve the file size rounded up to the next page, plus a full page when
+    // the size is already aligned. The bytes past the end of the file are zero
+    // either way, which gives the content a terminating '\0' for free
+    size_t size = (size_t)st.st_size;
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapSize = (size / pageSize + 1) * pageSize;
+    void* base = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not reserve %zu bytes to map '%s': %s\n",
+            mapSize, filename, strerror(errno));
+        result = 0;
+        goto out_close_file;
+    }
+
+    if (size > 0)
+    {
+        void* data = mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            fprintf(stderr, "Could not map file '%s': %s\n", filename, strerror(errno));
+            munmap(base, mapSize);
+            result = 0;
+            goto out_close_file;
+        }
+
+        // Only an advice, the mapping is still valid if it is ignored
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+
+    file->data = (const char*)base;
+    file->size = size;
+    file->mapSize = mapSize;
+
+out_close_file:
+    close(fd);
+    return result;
+}
+
+void closeMappedFile(MappedFile* file)
+{
+    if (file->data != NULL) munmap((void*)file->data, file->mapSize);
+    file->data = NULL;
+    file->size = 0;
+    file->mapSize = 0;
+}
@@ -8,13 +8,20 @@
 */
 
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "constants.h"
 #include "mesh.h"
+#include "mesh_snapshot.h"
 #include "msh_constants.h"
+#include "parallel.h"
+#include "topography_tiles.h"
+
+#define NODES_PER_TASK 4096         // face nodes moved by a task of a parallel loop
+#define NODE_BATCH 256              // face nodes whose cells are found before they move
 
 typedef struct
 {
@@ -25,6 +32,8 @@ typedef struct
 
 static int markFaceNodes(unsigned int face, Mesh* mesh)
 {
+    // The mask only keeps each node once in the list, it is cleared through
+    // the list afterwards instead of over all the nodes
     if (mesh->mark == NULL)
     {
         mesh->mark = (unsigned char*)calloc(mesh->nNodes, sizeof(unsigned char));
@@ -35,36 +44,58 @@ static int markFaceNodes(unsigned int face, Mesh* mesh)
             return 0;
         }
     }
-    else
-    {
-        memset(mesh->mark, 0, mesh->nNodes * sizeof(unsigned char));
-    }
 
+    int result = 1;
+    mesh->nFaceNodes = 0;
     mesh->triQuadCount = 0;
     mesh->maxElemNodes = 0;
     for (size_t index = 0; index < mesh->nElems; ++index)
     {
-        unsigned int type = mesh->elements[index].type;
+        unsigned int type = mesh->elemTypes[index];
         if (type == MSH_TRI_3 || type == MSH_TRI_6 || type == MSH_QUA_4
             || type == MSH_QUA_8 || type == MSH_QUA_9)
         {
             mesh->triQuadCount += 1;
-            if (mesh->elements[index].nNodes > mesh->maxElemNodes)
+            size_t first = mesh->elemOffsets[index];
+            size_t last = mesh->elemOffsets[index + 1];
+            if (last - first > mesh->maxElemNodes)
             {
-                mesh->maxElemNodes = mesh->elements[index].nNodes;
+                mesh->maxElemNodes = (unsigned int)(last - first);
             }
-            if (face == mesh->elements[index].regElem)
+            if (face != mesh->elemRegElem[index] || !result) continue;
+
+            for (size_t j = first; j < last; ++j)
             {
-                for (size_t j = 0; j < mesh->elements[index].nNodes; ++j)
+                size_t node = mesh->elemNodes[j];
+                if (mesh->mark[node] != 0) continue;
+                if (mesh->nFaceNodes == mesh->faceNodesCapacity)
                 {
-                    size_t node = mesh->elements[index].nodes[j];
-                    mesh->mark[node] = 1;
+                    size_t capacity = mesh->faceNodesCapacity == 0
+                        ? 1024
+                        : 2 * mesh->faceNodesCapacity;
+                    size_t* grown = (size_t*)realloc(mesh->faceNodes, capacity * sizeof(size_t));
+                    if (grown == NULL)
+                    {
+                        fprintf(stderr, "Could not allocate memory for %zu face nodes\n",
+                            capacity);
+                        result = 0;
+                        break;
+                    }
+                    mesh->faceNodes = grown;
+                    mesh->faceNodesCapacity = capacity;
                 }
+                mesh->mark[node] = 1;
+                mesh->faceNodes[mesh->nFaceNodes++] = node;
             }
         }
     }
 
-    return 1;
+    for (size_t i = 0; i < mesh->nFaceNodes; ++i)
+    {
+        mesh->mark[mesh->faceNodes[i]] = 0;
+    }
+    if (!result) mesh->nFaceNodes = 0;
+    return result;
 }
 
 static int findInterval(const double* grid, size_t nGrid, double value, size_t* minIndex)
@@ -90,42 +121,161 @@ static int findInterval(const double* grid, size_t nGrid, double value, size_t*
     return 1;
 }
 
+static size_t findUniformInterval(const double* grid, size_t nGrid, double scale, double value)
+{
+    // One multiply gives the cell, corrected when rounding puts the value on
+    // the other side of a grid line, so it is the cell of findInterval
+    size_t i = (size_t)((value - grid[0]) * scale);
+    if (i > nGrid - 2) i = nGrid - 2;
+    if (i > 0 && value < grid[i]) --i;
+    else if (i < nGrid - 2 && value >= grid[i + 1]) ++i;
+    return i;
+}
+
+typedef struct
+{
+    const Topography* topo;
+    Mesh* mesh;
+    double xScale;              // cells per unit length of a uniform grid
+    double yScale;
+} NodeMoves;
+
+static int moveNodesTask(void* context, size_t task)
+{
+    // The cells of a batch of nodes are found first, then their heights are
+    // interpolated in a loop without searches
+    const NodeMoves* moves = (const NodeMoves*)context;
+    const Topography* topo = moves->topo;
+    Mesh* mesh = moves->mesh;
+    size_t cellX[NODE_BATCH];
+    size_t cellY[NODE_BATCH];
+    unsigned char inside[NODE_BATCH];
+    size_t first = task * NODES_PER_TASK;
+    size_t last = first + NODES_PER_TASK < mesh->nFaceNodes
+        ? first + NODES_PER_TASK
+        : mesh->nFaceNodes;
+    for (size_t start = first; start < last; start += NODE_BATCH)
+    {
+        const size_t* ids = &mesh->faceNodes[start];
+        size_t n = last - start < NODE_BATCH ? last - start : NODE_BATCH;
+        for (size_t k = 0; k < n; ++k)
+        {
+            const Node* node = &mesh->nodes[ids[k]];
+            inside[k] = node->x >= topo->xGrid[0] && node->x <= topo->xGrid[topo->nx - 1]
+                && node->y >= topo->yGrid[0] && node->y <= topo->yGrid[topo->ny - 1];
+            if (!inside[k]) continue;
+            if (topo->uniform)
+            {
+                cellX[k] = findUniformInterval(topo->xGrid, topo->nx, moves->xScale, node->x);
+                cellY[k] = findUniformInterval(topo->yGrid, topo->ny, moves->yScale, node->y);
+            }
+            else
+            {
+                findInterval(topo->xGrid, topo->nx, node->x, &cellX[k]);
+                findInterval(topo->yGrid, topo->ny, node->y, &cellY[k]);
+            }
+        }
+
+        for (size_t k = 0; k < n; ++k)
+        {
+            if (!inside[k]) continue;
+            Node* node = &mesh->nodes[ids[k]];
+            size_t ix = cellX[k];
+            size_t iy = cellY[k];
+
+            // Perform Q1 interpolation
+            double dx = topo->xGrid[ix + 1] - topo->xGrid[ix];
+            double dy = topo->yGrid[iy + 1] - topo->yGrid[iy];
+            double exi = 2.0 * ((node->x - topo->xGrid[ix]) / dx) - 1.0;
+            double eta = 2.0 * ((node->y - topo->yGrid[iy]) / dy) - 1.0;
+            double s1 = 1.0 - exi;
+            double s2 = 1.0 + exi;
+            double t1 = 1.0 - eta;
+            double t2 = 1.0 + eta;
+            double sh1 = s1 * t1;
+            double sh2 = s2 * t1;
+            double sh3 = s2 * t2;
+            double sh4 = s1 * t2;
+            const double* row = &topo->values[iy * topo->nx + ix];
+            double hi = (row[0] * sh1 + row[1] * sh2
+                + row[topo->nx + 1] * sh3 + row[topo->nx] * sh4) * 0.25;
+
+            //TODO need both options? should be an execution flag or be in the config file?
+            node->z = node->z + hi;
+            //node->z = hi;
+        }
+    }
+
+    return 1;
+}
+
 static void moveNodes(const Topography* topo, Mesh* mesh)
 {
-    for (size_t i = 0; i < mesh->nNodes; ++i)
-    {
-        if (mesh->mark[i] == 0) continue;
-
-        Node* node = &mesh->nodes[i];
-        // Localize the node in the topography grid
-        size_t ix, iy;
-        if (!findInterval(topo->xGrid, topo->nx, node->x, &ix)) continue;
-        if (!findInterval(topo->yGrid, topo->ny, node->y, &iy)) continue;
-
-        // Perform Q1 interpolation
-        double dx = topo->xGrid[ix + 1] - topo->xGrid[ix];
-        double dy = topo->yGrid[iy + 1] - topo->yGrid[iy];
-        double exi = 2.0 * ((node->x - topo->xGrid[ix]) / dx) - 1.0;
-        double eta = 2.0 * ((node->y - topo->yGrid[iy]) / dy) - 1.0;
-        double s1 = 1.0 - exi;
-        double s2 = 1.0 + exi;
-        double t1 = 1.0 - eta;
-        double t2 = 1.0 + eta;
-        double sh1 = s1 * t1;
-        double sh2 = s2 * t1;
-        double sh3 = s2 * t2;
-        double sh4 = s1 * t2;
-        double hi = (topo->values[iy * topo->nx + ix] * sh1
-            + topo->values[iy * topo->nx + (ix + 1)] * sh2
-            + topo->values[(iy + 1) * topo->nx + (ix + 1)] * sh3
-            + topo->values[(iy + 1) * topo->nx + ix] * sh4) * 0.25;
-
-        //TODO need both options? should be an execution flag or be in the config file?
-        node->z = node->z + hi;
-        //node->z = hi;
+    // Each node of the face is listed once, so the tasks move disjoint nodes
+    if (topo->nx < 2 || topo->ny < 2) return;
+    NodeMoves moves = { topo, mesh, 0.0, 0.0 };
+    if (topo->uniform)
+    {
+        moves.xScale = (double)(topo->nx - 1) / (topo->xGrid[topo->nx - 1] - topo->xGrid[0]);
+        moves.yScale = (double)(topo->ny - 1) / (topo->yGrid[topo->ny - 1] - topo->yGrid[0]);
     }
+    parallelFor((mesh->nFaceNodes + NODES_PER_TASK - 1) / NODES_PER_TASK, moveNodesTask, &moves);
+}
+
+typedef int (*HeightSampler)(void* source, size_t nPoints, const double* x, const double* y,
+    double* z);
+
+static int sampleSpline(void* source, size_t nPoints, const double* x, const double* y, double* z)
+{
+    return evaluateTopographySpline((const TopographySpline*)source, nPoints, x, y, z);
+}
+
+static int sampleTiles(void* source, size_t nPoints, const double* x, const double* y, double* z)
+{
+    return sampleTiledTopography((TiledTopography*)source, nPoints, x, y, z);
 }
 
+static int moveNodesBySampling(HeightSampler sample, void* source, Mesh* mesh)
+{
+    // The topography is sampled at the marked nodes only, so the cost follows
+    // the number of surface nodes instead of the grid resolution
+    size_t nMarked = mesh->nFaceNodes;
+    if (nMarked == 0) return 1;
+
+    int result = 1;
+    const size_t* indexes = mesh->faceNodes;
+    double* coordinates = (double*)malloc(3 * nMarked * sizeof(double));
+    if (coordinates == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu surface nodes\n", nMarked);
+        result = 0;
+        goto out_free_arrays;
+    }
+
+    double* x = coordinates;
+    double* y = coordinates + nMarked;
+    double* heights = coordinates + 2 * nMarked;
+    for (size_t i = 0; i < nMarked; ++i)
+    {
+        x[i] = mesh->nodes[indexes[i]].x;
+        y[i] = mesh->nodes[indexes[i]].y;
+    }
+    if (!sample(source, nMarked, x, y, heights))
+    {
+        result = 0;
+        goto out_free_arrays;
+    }
+
+    // Nodes outside the topography are left in place, as in moveNodes
+    for (size_t i = 0; i < nMarked; ++i)
+    {
+        if (!isnan(heights[i])) mesh->nodes[indexes[i]].z += heights[i];
+    }
+
+out_free_arrays:
+    free(coordinates);
+    return result;
+}
 
 static int findNode(const size_t* arr, size_t size, size_t value)
 {
@@ -157,17 +307,18 @@ static int getNodeConnections(unsigned int face, Mesh* mesh, NodeConnections* no
     for (size_t index = 0; index < mesh->nElems; ++index)
     {
         // Skip elements that are not tri or quad
-        unsigned int type = mesh->elements[index].type;
+        unsigned int type = mesh->elemTypes[index];
         if (type != MSH_TRI_3 && type != MSH_TRI_6 && type != MSH_QUA_4
             && type != MSH_QUA_8 && type != MSH_QUA_9) continue;
 
         // Skip elements that doesn't belong to the face
-        if (face != mesh->elements[index].regElem) continue;
+        if (face != mesh->elemRegElem[index]) continue;
 
-        size_t nNodes = mesh->elements[index].nNodes;
+        const size_t* elemNodes = &mesh->elemNodes[mesh->elemOffsets[index]];
+        size_t nNodes = mesh->elemOffsets[index + 1] - mesh->elemOffsets[index];
         for (size_t i = 0; i < nNodes; ++i)
         {
-            size_t node = mesh->elements[index].nodes[i];
+            size_t node = elemNodes[i];
             mesh->mark[node] = 1;
             nodeConns[node].totalConnections += 1;
             for (size_t j = 0; j < nNodes; ++j)
@@ -175,7 +326,7 @@ static int getNodeConnections(unsigned int face, Mesh* mesh, NodeConnections* no
                 // same node, skip
                 if (i == j) continue;
 
-                size_t n = mesh->elements[index].nodes[j];
+                size_t n = elemNodes[j];
                 if (!findNode(nodeConns[node].nodes, nodeConns[node].nConnections, n))
                 {
                     nodeConns[node].nodes[nodeConns[node].nConnections] = n;
@@ -259,16 +410,78 @@ static void smoothFace(int face, int nIterMax, double toler,
 
 void freeMesh(Mesh* mesh)
 {
+    // The arrays that live in a snapshot are released with its mapping
+    closeMeshSnapshot(mesh);
     free(mesh->nodeIndex);
     mesh->nodeIndex = NULL;
     free(mesh->nodes);
     mesh->nodes = NULL;
+    free(mesh->nodeTags);
+    mesh->nodeTags = NULL;
     free(mesh->elemIndex);
     mesh->elemIndex = NULL;
-    free(mesh->elements);
-    mesh->elements = NULL;
+    free(mesh->elemTypes);
+    mesh->elemTypes = NULL;
+    free(mesh->elemRegPhys);
+    mesh->elemRegPhys = NULL;
+    free(mesh->elemRegElem);
+    mesh->elemRegElem = NULL;
+    free(mesh->elemOffsets);
+    mesh->elemOffsets = NULL;
+    free(mesh->elemNodes);
+    mesh->elemNodes = NULL;
     free(mesh->mark);
     mesh->mark = NULL;
+    free(mesh->faceNodes);
+    mesh->faceNodes = NULL;
+    mesh->nFaceNodes = 0;
+    mesh->faceNodesCapacity = 0;
+    for (size_t i = 0; i < mesh->nEntities; ++i)
+    {
+        free(mesh->entities[i].physicals);
+        free(mesh->entities[i].bounding);
+    }
+    free(mesh->entities);
+    mesh->entities = NULL;
+    mesh->nEntities = 0;
+    free(mesh->nodeBlocks);
+    mesh->nodeBlocks = NULL;
+    mesh->nNodeBlocks = 0;
+    free(mesh->physicalNames);
+    mesh->physicalNames = NULL;
+    free(mesh->rawSpans);
+    mesh->rawSpans = NULL;
+    mesh->nRawSpans = 0;
+    mesh->nRawElems = 0;
+    closeMappedFile(&mesh->rawSource);
+}
+
+static void addFilterRegion(ElementFilter* filter, int region)
+{
+    for (size_t i = 0; i < filter->nRegions; ++i)
+    {
+        if (filter->regions[i] == (unsigned int)region) return;
+    }
+    filter->regions[filter->nRegions++] = (unsigned int)region;
+}
+
+void getElementFilter(const ConfigFile* config, ElementFilter* filter)
+{
+    // interpolate and smoothMesh only read the tri and quad elements of their faces
+    filter->types = 0;
+    filter->nRegions = 0;
+    if (!(config->mode & MODE_INTERPOLATE)) return;
+
+    filter->types = (1ULL << MSH_TRI_3) | (1ULL << MSH_TRI_6) | (1ULL << MSH_QUA_4)
+        | (1ULL << MSH_QUA_8) | (1ULL << MSH_QUA_9);
+    for (int i = 0; i < MAXSURF && config->surfaceMeshFaces[i] != 0; ++i)
+    {
+        addFilterRegion(filter, config->surfaceMeshFaces[i]);
+    }
+    for (int i = 0; i < MAXSMOOTH && config->meshFacesToSmooth[i] != 0; ++i)
+    {
+        addFilterRegion(filter, config->meshFacesToSmooth[i]);
+    }
 }
 
 void getShape(const Mesh* mesh, float* minX, float* maxX, float* minY, float* maxY,
@@ -291,6 +504,101 @@ void getShape(const Mesh* mesh, float* minX, float* maxX, float* minY, float* ma
     }
 }
 
+static void extendWindow(const Mesh* mesh, TopographyWindow* window)
+{
+    for (size_t i = 0; i < mesh->nFaceNodes; ++i)
+    {
+        const Node* node = &mesh->nodes[mesh->faceNodes[i]];
+        if (node->x < window->xMin) window->xMin = node->x;
+        if (node->x > window->xMax) window->xMax = node->x;
+        if (node->y < window->yMin) window->yMin = node->y;
+        if (node->y > window->yMax) window->yMax = node->y;
+    }
+}
+
+typedef struct
+{
+    const ConfigFile* config;
+    const char* filename;
+    TopographyWindow window;    // footprint of the faces of the file, empty without nodes
+    int onTiles;                // tile index, sampled at the resolution of its tiles
+    int onNodes;                // spline evaluated at the nodes
+    Topography topo;
+    TopographySpline spline;
+    TiledTopography tiles;
+    pthread_t thread;
+    size_t nThreads;            // workers of the loops of its own thread
+    int started;                // loaded by its own thread, which must be joined
+    int result;
+} TopographyLoad;
+
+static int findTopographyWindows(const ConfigFile* config, int nFaces, int nLoads,
+    TopographyLoad* loads, Mesh* mesh)
+{
+    // Face i uses file i, and the last file also serves the faces after it
+    for (int k = 0; k < nLoads; ++k)
+    {
+        loads[k].window.xMin = INFINITY;
+        loads[k].window.xMax = -INFINITY;
+        loads[k].window.yMin = INFINITY;
+        loads[k].window.yMax = -INFINITY;
+    }
+    for (int i = 0; i < nFaces; ++i)
+    {
+        if (!markFaceNodes(config->surfaceMeshFaces[i], mesh)) return 0;
+        extendWindow(mesh, &loads[i < nLoads ? i : nLoads - 1].window);
+    }
+
+    return 1;
+}
+
+static int loadTopography(TopographyLoad* load)
+{
+    // Other files are cropped to the footprint of their faces before the spline fit
+    const TopographyWindow* footprint = load->window.xMin <= load->window.xMax
+        ? &load->window
+        : NULL;
+    if (load->onTiles)
+    {
+        return openTiledTopography(load->filename, load->config->topoTileCacheMB << 20,
+            &load->tiles);
+    }
+    if (load->onNodes)
+    {
+        return readTopographySplineInWindow(load->filename, footprint, &load->spline);
+    }
+
+    return increaseTopographyResolution(load->config, load->filename, footprint, &load->topo);
+}
+
+static void* loadTopographyThread(void* arg)
+{
+    TopographyLoad* load = (TopographyLoad*)arg;
+    setThreadLimit(load->nThreads);
+    load->result = loadTopography(load);
+    return NULL;
+}
+
+static int finishTopographyLoad(TopographyLoad* load)
+{
+    // A load whose thread could not be created runs on the calling thread
+    if (load->started)
+    {
+        pthread_join(load->thread, NULL);
+        load->started = 0;
+        return load->result;
+    }
+
+    return loadTopography(load);
+}
+
+static void freeTopographyLoad(TopographyLoad* load)
+{
+    closeTiledTopography(&load->tiles);
+    freeTopographySpline(&load->spline);
+    freeTopography(&load->topo);
+}
+
 int interpolateTopography(const ConfigFile* config, const Topography* topo, Mesh* mesh)
 {
     for (size_t i = 0; i < MAXSURF; ++i)
@@ -307,40 +615,84 @@ int interpolateTopography(const ConfigFile* config, const Topography* topo, Mesh
 
 int interpolate(const ConfigFile* config, Mesh* mesh)
 {
-    int topoFilesCount = 0;
-    for (int i = 0; i < MAXSURF; ++i)
+    int nFiles = 0;
+    while (nFiles < MAXSURF && config->topoFiles[nFiles][0] != '\0') ++nFiles;
+    int nFaces = 0;
+    while (nFaces < MAXSURF && config->surfaceMeshFaces[nFaces] != 0) ++nFaces;
+    int nLoads = nFiles < nFaces ? nFiles : nFaces;
+    if (nLoads == 0) return 1;
+
+    TopographyLoad* loads = (TopographyLoad*)calloc((size_t)nLoads, sizeof(TopographyLoad));
+    if (loads == NULL)
     {
-        if (config->topoFiles[i][0] == '\0') break;
-        ++topoFilesCount;
+        fprintf(stderr, "Could not allocate memory for %d topographies\n", nLoads);
+        return 0;
+    }
+    for (int k = 0; k < nLoads; ++k)
+    {
+        loads[k].config = config;
+        loads[k].filename = config->topoFiles[k];
+        loads[k].onTiles = isTiledTopographyFile(config->topoFiles[k]);
+        loads[k].onNodes = config->topoInterpolation == TOPO_INTERPOLATION_NODES;
     }
 
-    int result = 1;
-    Topography topo = { 0 };
-    for (int i = 0; i < MAXSURF; ++i)
+    // The footprints are found first, so that the next topography is read
+    // and resampled by its own thread while the nodes of a face move. At most
+    // two topographies are in memory at a time, and the two stages split the
+    // worker threads while they overlap. A single thread loads in turn
+    size_t nThreads = getThreadCount();
+    int result = findTopographyWindows(config, nFaces, nLoads, loads, mesh);
+    for (int i = 0; result && i < nFaces; ++i)
     {
-        if (config->surfaceMeshFaces[i] == 0) break;
+        TopographyLoad* load = &loads[i < nLoads ? i : nLoads - 1];
+        if (i < nLoads)
+        {
+            setThreadLimit(0);
+            if (i > 0) freeTopographyLoad(&loads[i - 1]);
+            if (!finishTopographyLoad(load))
+            {
+                result = 0;
+                break;
+            }
+            if (i + 1 < nLoads && nThreads > 1)
+            {
+                TopographyLoad* next = &loads[i + 1];
+                next->nThreads = nThreads / 2;
+                next->started = pthread_create(&next->thread, NULL, loadTopographyThread,
+                    next) == 0;
+                if (next->started) setThreadLimit(nThreads - next->nThreads);
+            }
+        }
 
         if (!markFaceNodes(config->surfaceMeshFaces[i], mesh))
         {
             result = 0;
-            goto out_free_topo;
+            break;
         }
-
-        if (i < topoFilesCount)
+        if (load->onTiles || load->onNodes)
         {
-            freeTopography(&topo);
-            if (!increaseTopographyResolution(config, config->topoFiles[i], &topo))
-            {
-                result = 0;
-                goto out_free_topo;
-            }
+            HeightSampler sample = load->onTiles ? sampleTiles : sampleSpline;
+            void* source = load->onTiles ? (void*)&load->tiles : (void*)&load->spline;
+            result = moveNodesBySampling(sample, source, mesh);
+        }
+        else
+        {
+            moveNodes(&load->topo, mesh);
         }
-
-        moveNodes(&topo, mesh);
     }
 
-out_free_topo:
-    freeTopography(&topo);
+    // A failure can leave the next topography loading
+    setThreadLimit(0);
+    for (int k = 0; k < nLoads; ++k)
+    {
+        if (loads[k].started)
+        {
+            pthread_join(loads[k].thread, NULL);
+            loads[k].started = 0;
+        }
+        freeTopographyLoad(&loads[k]);
+    }
+    free(loads);
     return result;
 }
 
@@ -377,6 +729,9 @@ int smoothMesh(const ConfigFile* config, Mesh* mesh)
         smoothFace(faceNum, nIterMax, toler, lNodes, mesh);
     }
 
+    // The smoothing marks whole faces, markFaceNodes expects a clear mask
+    memset(mesh->mark, 0, mesh->nNodes * sizeof(unsigned char));
+
     free(lNodes);
 
     return 1;
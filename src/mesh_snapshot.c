@@ -0,0 +1,492 @@
+/*
+    Filename: mesh_snapshot.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the binary mesh snapshots (.amgem).
+    A snapshot is a header followed by the raw node and element arrays of the
+    mesh at aligned offsets, so loading it is a single mapping of the file
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+#include "mesh_snapshot.h"
+#include "parallel.h"
+#include "section_file.h"
+
+#define SNAPSHOT_MAGIC "AMGEMSNP"
+#define SNAPSHOT_FORMAT_VERSION 2
+#define HASH_CHUNK_SIZE (1 << 20)       // bytes hashed by each parallel task
+#define HASH_MULTIPLIER_1 0x87C37B91114253D5ULL
+#define HASH_MULTIPLIER_2 0x4CF5AD432745937FULL
+
+enum SnapshotSection
+{
+    SECTION_NODE_INDEX,
+    SECTION_NODES,
+    SECTION_NODE_TAGS,
+    SECTION_ELEM_INDEX,
+    SECTION_ELEM_TYPES,
+    SECTION_ELEM_REG_PHYS,
+    SECTION_ELEM_REG_ELEM,
+    SECTION_ELEM_OFFSETS,
+    SECTION_ELEM_NODES,
+    SECTION_ENTITIES,
+    SECTION_ENTITY_TAGS,
+    SECTION_NODE_BLOCKS,
+    SECTION_PHYSICAL_NAMES,
+    SECTION_COUNT
+};
+
+typedef struct
+{
+    SectionFileHeader file;     // SNAPSHOT_MAGIC, SNAPSHOT_FORMAT_VERSION and the size
+    uint32_t sizeofSize;        // sizes of the stored types on the writer
+    uint32_t sizeofNode;
+    uint32_t sizeofNodeBlock;
+    uint32_t mshVersion;        // version of the source file
+    SnapshotSource source;      // source file the snapshot was made from
+    uint64_t nNodes;
+    uint64_t nElems;
+    uint64_t nElemNodes;        // number of node indexes of all the elements
+    uint64_t nEntities;
+    uint64_t nEntityTags;       // physical and bounding tags of all the entities
+    uint64_t nNodeBlocks;
+    uint64_t physicalNamesSize; // including the '\0', 0 without $PhysicalNames
+    uint64_t offsets[SECTION_COUNT]; // offset of each section, 0 for a missing section
+} SnapshotHeader;
+
+typedef struct
+{
+    int32_t dim;
+    int32_t tag;
+    double box[6];
+    uint64_t nPhysicals;
+    uint64_t nBounding;
+} SnapshotEntity;
+
+typedef struct
+{
+    const char* data;
+    size_t size;
+    uint64_t* hashes;           // hash of each chunk
+} HashContext;
+
+static uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t mixHash(uint64_t hash)
+{
+    // Final mix of MurmurHash3, every input bit affects every output bit
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static uint64_t hashWord(uint64_t hash, uint64_t word)
+{
+    word *= HASH_MULTIPLIER_1;
+    word = rotateLeft(word, 31);
+    word *= HASH_MULTIPLIER_2;
+    hash ^= word;
+    return rotateLeft(hash, 27) * 5 + 0x52DCE729;
+}
+
+static uint64_t hashBytes(const char* data, size_t size, uint64_t seed)
+{
+    uint64_t hash = seed;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(word));
+        hash = hashWord(hash, word);
+    }
+    if (i < size)
+    {
+        uint64_t word = 0;
+        memcpy(&word, &data[i], size - i);
+        hash = hashWord(hash, word);
+    }
+
+    return mixHash(hash ^ size);
+}
+
+static int hashChunkTask(void* context, size_t task)
+{
+    HashContext* hashContext = (HashContext*)context;
+    size_t start = task * HASH_CHUNK_SIZE;
+    size_t size = hashContext->size - start;
+    if (size > HASH_CHUNK_SIZE) size = HASH_CHUNK_SIZE;
+    hashContext->hashes[task] = hashBytes(&hashContext->data[start], size, task);
+    return 1;
+}
+
+static int hashContent(const char* data, size_t size, uint64_t* hash)
+{
+    // The chunks are hashed in parallel and their hashes are combined in
+    // order, so the result does not depend on the number of threads
+    size_t nChunks = (size + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE;
+    HashContext context = { data, size, NULL };
+    if (nChunks > 0)
+    {
+        context.hashes = (uint64_t*)malloc(nChunks * sizeof(uint64_t));
+        if (context.hashes == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory for %zu chunk hashes\n", nChunks);
+            return 0;
+        }
+        parallelFor(nChunks, hashChunkTask, &context);
+    }
+
+    *hash = hashBytes((const char*)context.hashes, nChunks * sizeof(uint64_t), size);
+    free(context.hashes);
+    return 1;
+}
+
+static int sameSource(const SnapshotSource* a, const SnapshotSource* b)
+{
+    return a->size == b->size && a->mtimeSec == b->mtimeSec
+        && a->mtimeNsec == b->mtimeNsec && a->hash == b->hash;
+}
+
+static int packEntities(const Mesh* mesh, SnapshotEntity** entities, int** tags, size_t* nTags)
+{
+    *entities = NULL;
+    *tags = NULL;
+    *nTags = 0;
+    for (size_t i = 0; i < mesh->nEntities; ++i)
+    {
+        *nTags += mesh->entities[i].nPhysicals + mesh->entities[i].nBounding;
+    }
+    if (mesh->nEntities == 0) return 1;
+
+    *entities = (SnapshotEntity*)calloc(mesh->nEntities, sizeof(SnapshotEntity));
+    *tags = (int*)malloc((*nTags > 0 ? *nTags : 1) * sizeof(int));
+    if (*entities == NULL || *tags == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu entities\n", mesh->nEntities);
+        free(*entities);
+        free(*tags);
+        *entities = NULL;
+        *tags = NULL;
+        return 0;
+    }
+
+    size_t position = 0;
+    for (size_t i = 0; i < mesh->nEntities; ++i)
+    {
+        const Entity* entity = &mesh->entities[i];
+        SnapshotEntity* packed = &(*entities)[i];
+        packed->dim = entity->dim;
+        packed->tag = entity->tag;
+        memcpy(packed->box, entity->box, sizeof(packed->box));
+        packed->nPhysicals = entity->nPhysicals;
+        packed->nBounding = entity->nBounding;
+        if (entity->nPhysicals > 0)
+        {
+            memcpy(&(*tags)[position], entity->physicals, entity->nPhysicals * sizeof(int));
+            position += entity->nPhysicals;
+        }
+        if (entity->nBounding > 0)
+        {
+            memcpy(&(*tags)[position], entity->bounding, entity->nBounding * sizeof(int));
+            position += entity->nBounding;
+        }
+    }
+
+    return 1;
+}
+
+static int unpackEntities(const SnapshotEntity* packed, size_t nEntities, const int* tags,
+    size_t nTags, Mesh* mesh)
+{
+    mesh->entities = (Entity*)calloc(nEntities, sizeof(Entity));
+    if (mesh->entities == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu entities\n", nEntities);
+        return 0;
+    }
+    mesh->nEntities = nEntities;
+
+    size_t position = 0;
+    for (size_t i = 0; i < nEntities; ++i)
+    {
+        Entity* entity = &mesh->entities[i];
+        entity->dim = packed[i].dim;
+        entity->tag = packed[i].tag;
+        memcpy(entity->box, packed[i].box, sizeof(entity->box));
+        if (packed[i].nPhysicals > nTags - position
+            || packed[i].nBounding > nTags - position - packed[i].nPhysicals)
+        {
+            fprintf(stderr, "Invalid entity tags in mesh snapshot\n");
+            return 0;
+        }
+
+        if (packed[i].nPhysicals > 0)
+        {
+            entity->physicals = (int*)malloc(packed[i].nPhysicals * sizeof(int));
+            if (entity->physicals == NULL) goto out_no_memory;
+            memcpy(entity->physicals, &tags[position], packed[i].nPhysicals * sizeof(int));
+            entity->nPhysicals = packed[i].nPhysicals;
+            position += packed[i].nPhysicals;
+        }
+        if (packed[i].nBounding > 0)
+        {
+            entity->bounding = (int*)malloc(packed[i].nBounding * sizeof(int));
+            if (entity->bounding == NULL) goto out_no_memory;
+            memcpy(entity->bounding, &tags[position], packed[i].nBounding * sizeof(int));
+            entity->nBounding = packed[i].nBounding;
+            position += packed[i].nBounding;
+        }
+    }
+
+    return 1;
+
+out_no_memory:
+    fprintf(stderr, "Could not allocate memory for the tags of %zu entities\n", nEntities);
+    return 0;
+}
+
+static void getSectionSizes(const SnapshotHeader* header, size_t sizes[SECTION_COUNT])
+{
+    sizes[SECTION_NODE_INDEX] = header->nNodes * sizeof(size_t);
+    sizes[SECTION_NODES] = header->nNodes * sizeof(Node);
+    sizes[SECTION_NODE_TAGS] = header->nNodes * sizeof(size_t);
+    sizes[SECTION_ELEM_INDEX] = header->nElems * sizeof(size_t);
+    sizes[SECTION_ELEM_TYPES] = header->nElems * sizeof(unsigned int);
+    sizes[SECTION_ELEM_REG_PHYS] = header->nElems * sizeof(unsigned int);
+    sizes[SECTION_ELEM_REG_ELEM] = header->nElems * sizeof(unsigned int);
+    sizes[SECTION_ELEM_OFFSETS] = (header->nElems + 1) * sizeof(size_t);
+    sizes[SECTION_ELEM_NODES] = header->nElemNodes * sizeof(size_t);
+    sizes[SECTION_ENTITIES] = header->nEntities * sizeof(SnapshotEntity);
+    sizes[SECTION_ENTITY_TAGS] = header->nEntityTags * sizeof(int);
+    sizes[SECTION_NODE_BLOCKS] = header->nNodeBlocks * sizeof(NodeBlock);
+    sizes[SECTION_PHYSICAL_NAMES] = header->physicalNamesSize;
+}
+
+static int validHeader(const SnapshotHeader* header, size_t fileSize,
+    const SnapshotSource* source)
+{
+    if (header->sizeofSize != sizeof(size_t)
+        || header->sizeofNode != sizeof(Node)
+        || header->sizeofNodeBlock != sizeof(NodeBlock)
+        || !sameSource(&header->source, source))
+    {
+        return 0;
+    }
+
+    // The counts are bounded by the file size before any size is computed,
+    // so the products below cannot overflow
+    if (header->nNodes > fileSize || header->nElems >= fileSize
+        || header->nElemNodes > fileSize || header->nEntities > fileSize
+        || header->nEntityTags > fileSize || header->nNodeBlocks > fileSize
+        || header->physicalNamesSize > fileSize)
+    {
+        return 0;
+    }
+
+    size_t sizes[SECTION_COUNT];
+    getSectionSizes(header, sizes);
+    if (!validSectionFile(&header->file, SNAPSHOT_MAGIC, SNAPSHOT_FORMAT_VERSION, fileSize,
+        sizeof(SnapshotHeader), header->offsets, sizes, SECTION_COUNT))
+    {
+        return 0;
+    }
+
+    // The mesh cannot be used without its nodes and elements
+    return header->offsets[SECTION_NODE_INDEX] != 0 && header->offsets[SECTION_NODES] != 0
+        && header->offsets[SECTION_ELEM_INDEX] != 0 && header->offsets[SECTION_ELEM_TYPES] != 0
+        && header->offsets[SECTION_ELEM_REG_PHYS] != 0
+        && header->offsets[SECTION_ELEM_REG_ELEM] != 0
+        && header->offsets[SECTION_ELEM_OFFSETS] != 0
+        && header->offsets[SECTION_ELEM_NODES] != 0;
+}
+
+int getSnapshotSource(const char* filename, SnapshotSource* source)
+{
+    struct stat st;
+    if (stat(filename, &st) == -1) return 0;
+
+    MappedFile file;
+    if (!openMappedFile(filename, &file)) return 0;
+    source->size = (uint64_t)file.size;
+    source->mtimeSec = (int64_t)st.st_mtim.tv_sec;
+    source->mtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+    int result = hashContent(file.data, file.size, &source->hash);
+    closeMappedFile(&file);
+
+    // A size that changed between the stat and the mapping means the file is
+    // being written, it cannot be identified yet
+    return result && source->size == (uint64_t)st.st_size;
+}
+
+int loadMeshSnapshot(const char* filename, const SnapshotSource* source, Mesh* mesh)
+{
+    // Private writable mapping: the pages are shared with the page cache until
+    // the mesh is modified, and the changes never reach the snapshot
+    char* data;
+    size_t size;
+    if (!mapSectionFile(filename, 1, sizeof(SnapshotHeader), &data, &size)) return 0;
+
+    const SnapshotHeader* header = (const SnapshotHeader*)data;
+    if (!validHeader(header, size, source)) goto out_unmap;
+
+    const uint64_t* offsets = header->offsets;
+    const size_t* elemOffsets = (const size_t*)&data[offsets[SECTION_ELEM_OFFSETS]];
+    if (elemOffsets[0] != 0 || elemOffsets[header->nElems] != header->nElemNodes)
+    {
+        goto out_unmap;
+    }
+
+    mesh->snapshot = data;
+    mesh->snapshotSize = size;
+    mesh->version = (MSHVersion)header->mshVersion;
+    mesh->nNodes = header->nNodes;
+    mesh->nodeIndex = (size_t*)&data[offsets[SECTION_NODE_INDEX]];
+    mesh->nodes = (Node*)&data[offsets[SECTION_NODES]];
+    if (offsets[SECTION_NODE_TAGS] != 0)
+    {
+        mesh->nodeTags = (size_t*)&data[offsets[SECTION_NODE_TAGS]];
+    }
+    mesh->nElems = header->nElems;
+    mesh->elemIndex = (size_t*)&data[offsets[SECTION_ELEM_INDEX]];
+    mesh->elemTypes = (unsigned int*)&data[offsets[SECTION_ELEM_TYPES]];
+    mesh->elemRegPhys = (unsigned int*)&data[offsets[SECTION_ELEM_REG_PHYS]];
+    mesh->elemRegElem = (unsigned int*)&data[offsets[SECTION_ELEM_REG_ELEM]];
+    mesh->elemOffsets = (size_t*)&data[offsets[SECTION_ELEM_OFFSETS]];
+    mesh->elemNodes = (size_t*)&data[offsets[SECTION_ELEM_NODES]];
+
+    // The small MSH 4.1 sections are copied, they are owned by the mesh
+    if (header->nEntities > 0)
+    {
+        if (offsets[SECTION_ENTITIES] == 0 || offsets[SECTION_ENTITY_TAGS] == 0) goto out_free_mesh;
+        const SnapshotEntity* entities = (const SnapshotEntity*)&data[offsets[SECTION_ENTITIES]];
+        const int* tags = (const int*)&data[offsets[SECTION_ENTITY_TAGS]];
+        if (!unpackEntities(entities, header->nEntities, tags, header->nEntityTags, mesh))
+        {
+            goto out_free_mesh;
+        }
+    }
+    if (header->nNodeBlocks > 0)
+    {
+        if (offsets[SECTION_NODE_BLOCKS] == 0) goto out_free_mesh;
+        mesh->nodeBlocks = (NodeBlock*)malloc(header->nNodeBlocks * sizeof(NodeBlock));
+        if (mesh->nodeBlocks == NULL) goto out_free_mesh;
+        memcpy(mesh->nodeBlocks, &data[offsets[SECTION_NODE_BLOCKS]],
+            header->nNodeBlocks * sizeof(NodeBlock));
+        mesh->nNodeBlocks = header->nNodeBlocks;
+    }
+    if (header->physicalNamesSize > 0)
+    {
+        const char* names = &data[offsets[SECTION_PHYSICAL_NAMES]];
+        if (offsets[SECTION_PHYSICAL_NAMES] == 0 || names[header->physicalNamesSize - 1] != '\0')
+        {
+            goto out_free_mesh;
+        }
+        mesh->physicalNames = strdup(names);
+        if (mesh->physicalNames == NULL) goto out_free_mesh;
+    }
+
+    return 1;
+
+out_free_mesh:
+    fprintf(stderr, "Could not load mesh snapshot '%s'\n", filename);
+    freeMesh(mesh);
+    return 0;
+
+out_unmap:
+    munmap(data, size);
+    return 0;
+}
+
+int saveMeshSnapshot(const char* filename, const SnapshotSource* source, const Mesh* mesh)
+{
+    if (mesh->nRawElems > 0)
+    {
+        fprintf(stderr, "Could not save a snapshot of a mesh with raw elements\n");
+        return 0;
+    }
+
+    SnapshotEntity* entities = NULL;
+    int* entityTags = NULL;
+    size_t nEntityTags = 0;
+    if (!packEntities(mesh, &entities, &entityTags, &nEntityTags)) return 0;
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    initSectionFileHeader(&header.file, SNAPSHOT_MAGIC, SNAPSHOT_FORMAT_VERSION);
+    header.sizeofSize = sizeof(size_t);
+    header.sizeofNode = sizeof(Node);
+    header.sizeofNodeBlock = sizeof(NodeBlock);
+    header.mshVersion = (uint32_t)mesh->version;
+    header.source = *source;
+    header.nNodes = mesh->nNodes;
+    header.nElems = mesh->nElems;
+    header.nElemNodes = mesh->elemOffsets != NULL ? mesh->elemOffsets[mesh->nElems] : 0;
+    header.nEntities = mesh->nEntities;
+    header.nEntityTags = nEntityTags;
+    header.nNodeBlocks = mesh->nNodeBlocks;
+    header.physicalNamesSize = mesh->physicalNames != NULL ? strlen(mesh->physicalNames) + 1 : 0;
+
+    size_t zero = 0;
+    FileSection sections[SECTION_COUNT] = {
+        [SECTION_NODE_INDEX] = { mesh->nodeIndex, 0, 1 },
+        [SECTION_NODES] = { mesh->nodes, 0, 1 },
+        [SECTION_NODE_TAGS] = { mesh->nodeTags, 0, mesh->nodeTags != NULL },
+        [SECTION_ELEM_INDEX] = { mesh->elemIndex, 0, 1 },
+        [SECTION_ELEM_TYPES] = { mesh->elemTypes, 0, 1 },
+        [SECTION_ELEM_REG_PHYS] = { mesh->elemRegPhys, 0, 1 },
+        [SECTION_ELEM_REG_ELEM] = { mesh->elemRegElem, 0, 1 },
+        [SECTION_ELEM_OFFSETS] = { mesh->elemOffsets != NULL ? mesh->elemOffsets : &zero, 0, 1 },
+        [SECTION_ELEM_NODES] = { mesh->elemNodes, 0, 1 },
+        [SECTION_ENTITIES] = { entities, 0, entities != NULL },
+        [SECTION_ENTITY_TAGS] = { entityTags, 0, entityTags != NULL },
+        [SECTION_NODE_BLOCKS] = { mesh->nodeBlocks, 0, mesh->nodeBlocks != NULL },
+        [SECTION_PHYSICAL_NAMES] = { mesh->physicalNames, 0, mesh->physicalNames != NULL }
+    };
+    size_t sizes[SECTION_COUNT];
+    getSectionSizes(&header, sizes);
+    for (int i = 0; i < SECTION_COUNT; ++i)
+    {
+        sections[i].size = sizes[i];
+    }
+    header.file.size = placeSections(sizeof(SnapshotHeader), sections, SECTION_COUNT,
+        header.offsets);
+
+    int result = writeSectionFile(filename, &header, sizeof(header), sections, header.offsets,
+        SECTION_COUNT);
+
+    free(entities);
+    free(entityTags);
+    return result;
+}
+
+void closeMeshSnapshot(Mesh* mesh)
+{
+    if (mesh->snapshot == NULL) return;
+
+    munmap(mesh->snapshot, mesh->snapshotSize);
+    mesh->snapshot = NULL;
+    mesh->snapshotSize = 0;
+    mesh->nodeIndex = NULL;
+    mesh->nodes = NULL;
+    mesh->nodeTags = NULL;
+    mesh->elemIndex = NULL;
+    mesh->elemTypes = NULL;
+    mesh->elemRegPhys = NULL;
+    mesh->elemRegElem = NULL;
+    mesh->elemOffsets = NULL;
+    mesh->elemNodes = NULL;
+}
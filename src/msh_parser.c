@@ -8,14 +8,71 @@
     MSH file format is the native mesh file format used by Gmsh
 */
 
+#include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "mapped_file.h"
+#include "mesh_snapshot.h"
 #include "msh_parser.h"
 #include "msh_tokenizer.h"
+#include "parallel.h"
+#include "tag_map.h"
+#include "utils.h"
+#include "write_buffer.h"
+
+#define CHUNKS_PER_THREAD 4          // chunks per thread to balance uneven records
+#define MIN_CHUNK_SIZE (64 * 1024)    // minimum number of bytes of a chunk
+#define MAX_SECTION_NAME 64          // maximum length of a section keyword
+#define RECORDS_PER_CHUNK 16384      // records formatted by a task when writing
+#define RAW_ELEMENT ((size_t)-1)     // node count of an element kept as raw text
+
+typedef struct
+{
+    unsigned int nNodes;        // number of nodes of the element type
+    int dim;                    // dimension of the element type, -1 if unknown
+} ElementType;
+
+// Number of nodes and dimension of the element types, indexed by type
+static const ElementType elementTypes[MSH_MAX_TYPE + 1] = {
+    { 0, -1 },
+    { 2, 1 }, { 3, 2 }, { 4, 2 }, { 4, 3 }, { 8, 3 }, { 6, 3 }, { 5, 3 }, { 3, 1 },
+    { 6, 2 }, { 9, 2 }, { 10, 3 }, { 27, 3 }, { 18, 3 }, { 14, 3 }, { 1, 0 }, { 8, 2 },
+    { 20, 3 }, { 15, 3 }, { 13, 3 }, { 9, 2 }, { 10, 2 }, { 12, 2 }, { 15, 2 }, { 15, 2 },
+    { 21, 2 }, { 4, 1 }, { 5, 1 }, { 6, 1 }, { 20, 3 }, { 35, 3 }, { 56, 3 }
+};
+
+// Binary node coordinates are copied straight into the nodes array
+static_assert(sizeof(Node) == 3 * sizeof(double), "Node must be three packed doubles");
+
+typedef struct
+{
+    size_t* nodes;              // node indexes of the elements, one after the other
+    size_t count;               // number of node indexes stored
+    size_t capacity;            // number of node indexes allocated
+} Connectivity;
+
+typedef struct
+{
+    RawSpan* spans;             // runs of raw elements, element is the first record
+    size_t count;
+    size_t capacity;
+} RawSpans;
+
+typedef struct
+{
+    const char* current;        // next byte to read
+    const char* end;            // past the last byte of the file
+    int swapBytes;              // 1 if the file was written with the other byte order
+} BinaryReader;
 
 typedef struct
 {
@@ -23,71 +80,219 @@ typedef struct
     MSHVersion version;
     Token lookAhead;
     Token token;
+    BinaryReader binary;        // data of the sections of binary files
+    Connectivity connectivity;  // nodes of the elements read so far
+    TagMap nodeMap;             // index of each node tag when the tags are sparse
+    int sparseTags;             // set when a node tag does not fit the dense layout
+    int chunk;                  // set for the parser of a chunk, the chunks share the mesh
+    const ElementFilter* elementFilter; // elements to decode, NULL to decode all of them
+    RawSpans rawSpans;          // elements left out by the filter
 } Parser;
 
-static int readFileContent(const char* filename, char** content)
+typedef int (*RecordParser)(Parser* parser, Mesh* mesh, size_t record);
+
+typedef struct
 {
-    int result = 1;
-    FILE* file = fopen(filename, "rb");
-    if (file == NULL)
+    const char* start;          // first character of the chunk
+    const char* end;            // past the last character of the chunk
+    size_t line;                // line number of the first character
+    size_t nLines;              // number of line breaks in the chunk
+    size_t firstRecord;         // index of the first record in the chunk
+    size_t nRecords;            // number of records in the chunk
+    Connectivity connectivity;  // nodes of the elements of the chunk
+    int sparseTags;             // set when a node tag does not fit the dense layout
+    RawSpans rawSpans;          // elements of the chunk left out by the filter
+} Chunk;
+
+typedef struct
+{
+    const char* start;          // first character of the first record
+    const char* end;            // first character of the end keyword, or of the
+                                // line after the last complete line in a stream
+    size_t line;                // line number of the first character
+    size_t nLines;              // number of line breaks in the section
+    size_t firstRecord;         // index of the first record of the section
+    size_t nRecords;            // number of records in the section
+    int complete;               // set when the section ends with the end keyword
+    MSHVersion version;
+    Chunk* chunks;              // newline aligned chunks of the section
+    size_t nChunks;
+    const TagMap* nodeMap;      // index of each node tag when the tags are sparse
+    const ElementFilter* elementFilter;
+    Mesh* mesh;
+    RecordParser parseRecord;
+} Section;
+
+static int elementTypeDim(unsigned int type)
+{
+    return type <= MSH_MAX_TYPE ? elementTypes[type].dim : -1;
+}
+
+static size_t* reserveConnectivity(Connectivity* connectivity, size_t count)
+{
+    if (count > connectivity->capacity - connectivity->count)
     {
-        fprintf(stderr, "Could not open .msh file '%s': %s\n", filename, strerror(errno));
-        return 0;
+        size_t capacity = connectivity->capacity > 0 ? connectivity->capacity : 1024;
+        while (capacity - connectivity->count < count) capacity *= 2;
+        size_t* nodes = (size_t*)realloc(connectivity->nodes, capacity * sizeof(size_t));
+        if (nodes == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory for %zu element nodes\n", capacity);
+            return NULL;
+        }
+        connectivity->nodes = nodes;
+        connectivity->capacity = capacity;
     }
 
-    if (fseek(file, 0, SEEK_END) != 0)
+    size_t* nodes = &connectivity->nodes[connectivity->count];
+    connectivity->count += count;
+    return nodes;
+}
+
+static void freeConnectivity(Connectivity* connectivity)
+{
+    free(connectivity->nodes);
+    connectivity->nodes = NULL;
+    connectivity->count = 0;
+    connectivity->capacity = 0;
+}
+
+static int addRawSpan(RawSpans* spans, size_t record, size_t count, const char* start,
+    size_t length)
+{
+    // Consecutive raw records on consecutive lines share a single span
+    if (spans->count > 0)
     {
-        fprintf(stderr, "Could not seek to end of file '%s': %s\n", filename, strerror(errno));
-        result = 0;
-        goto out_close_file;
+        RawSpan* last = &spans->spans[spans->count - 1];
+        if (last->element + last->count == record && last->start + last->length == start)
+        {
+            last->count += count;
+            last->length += length;
+            return 1;
+        }
     }
 
-    long fileSize = ftell(file);
-    if (fileSize == -1)
+    if (spans->count == spans->capacity)
     {
-        fprintf(stderr, "Could not get file size for '%s': %s\n", filename, strerror(errno));
-        result = 0;
-        goto out_close_file;
+        size_t capacity = spans->capacity > 0 ? 2 * spans->capacity : 64;
+        RawSpan* data = (RawSpan*)realloc(spans->spans, capacity * sizeof(RawSpan));
+        if (data == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory for %zu raw element spans\n", capacity);
+            return 0;
+        }
+        spans->spans = data;
+        spans->capacity = capacity;
     }
+    RawSpan* span = &spans->spans[spans->count++];
+    span->element = record;
+    span->count = count;
+    span->start = start;
+    span->length = length;
+    return 1;
+}
 
-    rewind(file);
-    char* buffer = (char*)malloc(fileSize + 1);
-    if (buffer == NULL)
+static void freeRawSpans(RawSpans* spans)
+{
+    free(spans->spans);
+    spans->spans = NULL;
+    spans->count = 0;
+    spans->capacity = 0;
+}
+
+static int decodesElement(const ElementFilter* filter, long long type, long long regElem)
+{
+    if (filter == NULL) return 1;
+    if (type < 0 || type > MSH_MAX_TYPE || !(filter->types & (1ULL << type))) return 0;
+    for (size_t i = 0; i < filter->nRegions; ++i)
     {
-        fprintf(stderr, "Could not allocate memory for file content of '%s'\n", filename);
-        result = 0;
-        goto out_close_file;
+        if ((long long)filter->regions[i] == regElem) return 1;
     }
 
-    size_t bytesRead = fread(buffer, 1, fileSize, file);
-    if (bytesRead != (unsigned long)fileSize)
+    return 0;
+}
+
+static int allocateElements(Mesh* mesh, size_t nElems)
+{
+    mesh->nElems = nElems;
+    mesh->elemIndex = (size_t*)malloc(nElems * sizeof(size_t));
+    mesh->elemTypes = (unsigned int*)malloc(nElems * sizeof(unsigned int));
+    mesh->elemRegPhys = (unsigned int*)malloc(nElems * sizeof(unsigned int));
+    mesh->elemRegElem = (unsigned int*)malloc(nElems * sizeof(unsigned int));
+    mesh->elemOffsets = (size_t*)malloc((nElems + 1) * sizeof(size_t));
+    if (mesh->elemIndex == NULL || mesh->elemTypes == NULL || mesh->elemRegPhys == NULL
+        || mesh->elemRegElem == NULL || mesh->elemOffsets == NULL)
     {
-        fprintf(stderr, "Could not read file content of '%s'\n", filename);
-        free(buffer);
-        result = 0;
-        goto out_close_file;
+        fprintf(stderr, "Could not allocate memory for %zu elements\n", nElems);
+        return 0;
     }
 
-    buffer[bytesRead] = '\0';
-    *content = buffer;
+    mesh->elemOffsets[0] = 0;
+    return 1;
+}
+
+static void compactElements(Parser* parser, Mesh* mesh)
+{
+    // Raw records are removed from the element arrays, the spans then count
+    // the decoded elements before them instead of their first record
+    RawSpans* spans = &parser->rawSpans;
+    size_t nElems = 0;
+    size_t span = 0;
+    for (size_t i = 0; i < mesh->nElems; ++i)
+    {
+        if (span < spans->count && spans->spans[span].element == i)
+        {
+            spans->spans[span++].element = nElems;
+        }
+        if (mesh->elemOffsets[i + 1] == RAW_ELEMENT) continue;
 
-out_close_file:
-    fclose(file);
-    return result;
+        mesh->elemIndex[nElems] = mesh->elemIndex[i];
+        mesh->elemTypes[nElems] = mesh->elemTypes[i];
+        mesh->elemRegPhys[nElems] = mesh->elemRegPhys[i];
+        mesh->elemRegElem[nElems] = mesh->elemRegElem[i];
+        mesh->elemOffsets[nElems + 1] = mesh->elemOffsets[i + 1];
+        ++nElems;
+    }
+    mesh->nRawElems = mesh->nElems - nElems;
+    mesh->nElems = nElems;
+    mesh->rawSpans = spans->spans;
+    mesh->nRawSpans = spans->count;
+    spans->spans = NULL;
+    spans->count = 0;
+    spans->capacity = 0;
 }
 
-static void writeDouble(const FILE* file, double value)
+static int finishElements(Parser* parser, Mesh* mesh)
 {
-    double intPart;
-    double fracPart = modf(value, &intPart);
-    if (fracPart == 0.0)
+    if (parser->elementFilter != NULL) compactElements(parser, mesh);
+
+    // The record parsers store the number of nodes of each element in the
+    // next offset, the running sum gives the start of every element
+    for (size_t i = 0; i < mesh->nElems; ++i)
     {
-        fprintf((FILE*)file, "%.0f", value);
+        mesh->elemOffsets[i + 1] += mesh->elemOffsets[i];
     }
-    else
+
+    Connectivity* connectivity = &parser->connectivity;
+    if (mesh->elemOffsets[mesh->nElems] != connectivity->count)
+    {
+        fprintf(stderr, "Expected %zu element nodes but found %zu\n",
+            mesh->elemOffsets[mesh->nElems], connectivity->count);
+        return 0;
+    }
+
+    // Give back the unused capacity, a failed shrink keeps the larger array
+    mesh->elemNodes = connectivity->nodes;
+    if (connectivity->count > 0 && connectivity->count < connectivity->capacity)
     {
-        fprintf((FILE*)file, "%lf", value);
+        size_t* nodes = (size_t*)realloc(connectivity->nodes,
+            connectivity->count * sizeof(size_t));
+        if (nodes != NULL) mesh->elemNodes = nodes;
     }
+    connectivity->nodes = NULL;
+    connectivity->count = 0;
+    connectivity->capacity = 0;
+    return 1;
 }
 
 static MSHVersion detectMshVersion(Tokenizer* tokenizer)
@@ -100,302 +305,3079 @@ static MSHVersion detectMshVersion(Tokenizer* tokenizer)
     {
         return MSH_V1;
     }
+    if (token.type == TOKEN_V4_MESH_FORMAT_START)
+    {
+        // Version number followed by the file type, 0 for ASCII
+        Token version = nextToken(tokenizer, TOKEN_NUMBER);
+        Token fileType = nextToken(tokenizer, TOKEN_NUMBER);
+        if (version.type == TOKEN_NUMBER && version.number.value == 4.1
+            && fileType.type == TOKEN_NUMBER && fileType.number.isInteger)
+        {
+            if (fileType.number.integer == 0) return MSH_V41;
+            if (fileType.number.integer == 1) return MSH_V41_BINARY;
+        }
+    }
     return MSH_UNKNOWN_VERSION;
 }
 
-static int eatToken(Parser* parser, TokenType expectedType, TokenType nextTypeHint)
+static int useSparseTags(Mesh* mesh)
 {
-    if (parser->lookAhead.type != expectedType)
+    mesh->nodeTags = (size_t*)malloc(mesh->nNodes * sizeof(size_t));
+    if (mesh->nodeTags == NULL)
     {
-        fprintf(stderr, "Expected %s at line %zu but found %s\n",
-            tokenTypeToValue(expectedType),
-            parser->lookAhead.line,
-            tokenTypeToValue(parser->lookAhead.type));
+        fprintf(stderr, "Could not allocate memory for %zu node tags\n", mesh->nNodes);
         return 0;
     }
 
-    parser->token = parser->lookAhead;
-    parser->lookAhead = nextToken(parser->tokenizer, nextTypeHint);
     return 1;
 }
 
-static int parseNodStart(Parser* parser, Mesh* mesh)
+static int switchToSparseTags(Mesh* mesh, size_t nRecords)
 {
-    if (!eatToken(parser, TOKEN_V1_NOD_START, TOKEN_NUMBER)) return 0;
-
-    // Read number of nodes
-    if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER))
+    // The nodes read so far move from the index given by their tag to their
+    // position in the file
+    Node* nodes = (Node*)malloc(nRecords * sizeof(Node));
+    if ((nRecords > 0 && nodes == NULL) || !useSparseTags(mesh))
     {
-        fprintf(stderr, "Expected number of nodes at line %zu but found %.*s\n",
-            parser->lookAhead.line,
-            (int)parser->lookAhead.length,
-            parser->lookAhead.start);
+        free(nodes);
         return 0;
     }
-    size_t nNodes = (size_t)atoll(parser->token.start);
-
-    // Allocate memory for nodes
-    mesh->nNodes = nNodes;
-    mesh->nodeIndex = (size_t*)malloc(nNodes * sizeof(size_t));
-    if (mesh->nodeIndex == NULL)
+    for (size_t i = 0; i < nRecords; ++i)
     {
-        fprintf(stderr, "Could not allocate memory for %zu node indexes\n", nNodes);
-        return 0;
+        nodes[i] = mesh->nodes[mesh->nodeIndex[i]];
+        mesh->nodeTags[i] = mesh->nodeIndex[i] + 1;
+        mesh->nodeIndex[i] = i;
     }
-    mesh->nodes = (Node*)malloc(nNodes * sizeof(Node));
-    if (mesh->nodes == NULL)
+    if (nRecords > 0) memcpy(mesh->nodes, nodes, nRecords * sizeof(Node));
+    free(nodes);
+    return 1;
+}
+
+static int storeNodeTag(Mesh* mesh, size_t record, size_t tag)
+{
+    // Dense tags give the index of the node, sparse tags keep the file order
+    if (tag == 0) return 0;
+    if (mesh->nodeTags != NULL)
     {
-        fprintf(stderr, "Could not allocate memory for %zu nodes\n", nNodes);
-        return 0;
+        mesh->nodeTags[record] = tag;
+        mesh->nodeIndex[record] = record;
+        return 1;
     }
 
-    // Read node data
-    for (size_t i = 0; i < nNodes; ++i)
-    {
-        // Read node index
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
+    // Subtract 1 to convert to 0-based index
+    mesh->nodeIndex[record] = tag - 1;
+    return tag <= mesh->nNodes;
+}
 
-        // Subtract 1 to convert to 0-based index
-        size_t nodeIndex = (size_t)atoll(parser->token.start) - 1;
-        if (nodeIndex >= nNodes)
+static int buildNodeMap(Parser* parser, const Mesh* mesh)
+{
+    if (!initTagMap(&parser->nodeMap, mesh->nNodes)) return 0;
+    for (size_t i = 0; i < mesh->nNodes; ++i)
+    {
+        if (!insertTag(&parser->nodeMap, mesh->nodeTags[i], i))
         {
-            fprintf(stderr, "Node index %zu out of bounds at line %zu\n",
-                nodeIndex + 1,
-                parser->token.line);
+            fprintf(stderr, "Duplicate node tag %zu\n", mesh->nodeTags[i]);
             return 0;
         }
-
-        // Read x coordinate
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-        double x = atof(parser->token.start);
-
-        // Read y coordinate
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-        double y = atof(parser->token.start);
-
-        // Read z coordinate
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-        double z = atof(parser->token.start);
-
-        // Store node data
-        mesh->nodeIndex[i] = nodeIndex;
-        mesh->nodes[nodeIndex].x = x;
-        mesh->nodes[nodeIndex].y = y;
-        mesh->nodes[nodeIndex].z = z;
-    }
-
-    if (!eatToken(parser, TOKEN_V1_NOD_END, TOKEN_NULL))
-    {
-        return 0;
     }
 
     return 1;
 }
 
-static int parseElmStart(Parser* parser, Mesh* mesh)
+static int findNode(const Parser* parser, const Mesh* mesh, size_t tag, size_t* index)
 {
-    if (!eatToken(parser, TOKEN_V1_ELM_START, TOKEN_NUMBER)) return 0;
+    if (mesh->nodeTags != NULL) return findTag(&parser->nodeMap, tag, index);
 
-    // Read number of elements
-    if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER))
+    // Subtract 1 to convert to 0-based index
+    *index = tag - 1;
+    return tag >= 1 && tag <= mesh->nNodes;
+}
+
+static int eatToken(Parser* parser, TokenType expectedType, TokenType nextTypeHint)
+{
+    if (parser->lookAhead.type == TOKEN_ERROR && expectedType != TOKEN_ERROR)
     {
-        fprintf(stderr, "Expected number of elements at line %zu but found %.*s\n",
-            parser->lookAhead.line,
+        fprintf(stderr, "Expected %s but found error: %.*s\n",
+            tokenTypeToValue(expectedType),
             (int)parser->lookAhead.length,
             parser->lookAhead.start);
         return 0;
     }
-    size_t nElems = (size_t)atoll(parser->token.start);
-
-    // Allocate memory for elements
-    mesh->nElems = nElems;
-    mesh->elemIndex = (size_t*)malloc(nElems * sizeof(size_t));
-    if (mesh->elemIndex == NULL)
+    if (parser->lookAhead.type != expectedType)
     {
-        fprintf(stderr, "Could not allocate memory for %zu element indexes\n", nElems);
+        fprintf(stderr, "Expected %s at line %zu but found %s\n",
+            tokenTypeToValue(expectedType),
+            parser->lookAhead.line,
+            tokenTypeToValue(parser->lookAhead.type));
         return 0;
     }
-    mesh->elements = (Element*)malloc(nElems * sizeof(Element));
-    if (mesh->elements == NULL)
+
+    parser->token = parser->lookAhead;
+    parser->lookAhead = nextToken(parser->tokenizer, nextTypeHint);
+    return 1;
+}
+
+static int eatInteger(Parser* parser, TokenType nextTypeHint, long long* value)
+{
+    // The number is checked before the next token is read, which may replace
+    // its text in the buffer of a stream
+    const Token* token = &parser->lookAhead;
+    if (token->type == TOKEN_NUMBER && !token->number.isInteger)
     {
-        fprintf(stderr, "Could not allocate memory for %zu elements\n", nElems);
+        fprintf(stderr, "Expected an integer at line %zu but found %.*s\n",
+            token->line,
+            (int)token->length,
+            token->start);
         return 0;
     }
+    if (!eatToken(parser, TOKEN_NUMBER, nextTypeHint)) return 0;
 
-    // Read element data
-    for (size_t i = 0; i < nElems; ++i)
-    {
-        // Read element index
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-
-        // Subtract 1 to convert to 0-based index
-        size_t elemIndex = (size_t)atoll(parser->token.start) - 1;
-        if (elemIndex >= nElems)
-        {
-            fprintf(stderr, "Element index %zu out of bounds at line %zu\n",
-                elemIndex + 1,
-                parser->token.line);
-            return 0;
-        }
+    *value = parser->token.number.integer;
+    return 1;
+}
 
-        // Read element type
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-        unsigned int type = atoi(parser->token.start);
+static int eatDouble(Parser* parser, TokenType nextTypeHint, double* value)
+{
+    if (!eatToken(parser, TOKEN_NUMBER, nextTypeHint)) return 0;
+    *value = parser->token.number.value;
+    return 1;
+}
 
-        // Read physical region
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-        unsigned int regPhys = atoi(parser->token.start);
+static int parseNode(Parser* parser, Mesh* mesh, size_t record)
+{
+    // Read node index
+    long long tag;
+    if (!eatInteger(parser, TOKEN_NUMBER, &tag)) return 0;
 
-        // Read element region
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-        unsigned int regElem = atoi(parser->token.start);
+    // Tags larger than the number of nodes need the sparse layout. The mesh
+    // switches to it in place, but the chunks share the mesh so their
+    // section is read again once it switched
+    if (tag >= 1 && !storeNodeTag(mesh, record, (size_t)tag))
+    {
+        parser->sparseTags = 1;
+        if (parser->chunk || mesh->nodeTags != NULL || !switchToSparseTags(mesh, record)) return 0;
+        storeNodeTag(mesh, record, (size_t)tag);
+    }
+    if (tag < 1)
+    {
+        fprintf(stderr, "Node index %lld out of bounds at line %zu\n",
+            tag,
+            parser->token.line);
+        return 0;
+    }
 
-        // Read number of nodes
-        if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-        size_t nNodes = (size_t)atoll(parser->token.start);
+    // Read x, y and z coordinates
+    Node* node = &mesh->nodes[mesh->nodeIndex[record]];
+    if (!eatDouble(parser, TOKEN_NUMBER, &node->x)) return 0;
+    if (!eatDouble(parser, TOKEN_NUMBER, &node->y)) return 0;
+    if (!eatDouble(parser, TOKEN_NUMBER, &node->z)) return 0;
 
-        // Read node indexes
-        for (size_t j = 0; j < nNodes; ++j)
-        {
-            if (!eatToken(parser, TOKEN_NUMBER, TOKEN_NUMBER)) return 0;
-            // Subtract 1 to convert to 0-based index
-            mesh->elements[elemIndex].nodes[j] = (size_t)atoll(parser->token.start) - 1;
-        }
+    return 1;
+}
 
-        // Store element data
-        mesh->elemIndex[i] = elemIndex;
-        mesh->elements[elemIndex].type = type;
-        mesh->elements[elemIndex].regPhys = regPhys;
-        mesh->elements[elemIndex].regElem = regElem;
-        mesh->elements[elemIndex].nNodes = nNodes;
+static int skipElement(Parser* parser, Mesh* mesh, size_t record, const char* start,
+    long long tag)
+{
+    // The node tags are only counted, not converted, and the record is kept
+    // as raw text. It must end on the line of its number of nodes
+    const Token* count = &parser->lookAhead;
+    if (count->type != TOKEN_NUMBER || !count->number.isInteger || count->number.integer < 0)
+    {
+        fprintf(stderr, "Expected the number of nodes of element %lld at line %zu\n",
+            tag, count->line);
+        return 0;
     }
-
-    if (!eatToken(parser, TOKEN_V1_ELM_END, TOKEN_NULL))
+    long long nNodes = count->number.integer;
+    size_t line = count->line;
+    Tokenizer* tokenizer = parser->tokenizer;
+    const char* c = count->start + count->length;
+    long long nFields = 0;
+    int blank = 1;
+    for (; c < tokenizer->end && *c != '\n'; ++c)
+    {
+        int space = *c == ' ' || *c == '\t' || *c == '\r';
+        if (!space && blank) ++nFields;
+        blank = space;
+    }
+    if (nFields != nNodes)
     {
+        fprintf(stderr, "Expected %lld node indexes on the line of element %lld at line %zu\n",
+            nNodes, tag, line);
         return 0;
     }
+    if (c < tokenizer->end) ++c;
 
+    tokenizer->current = c;
+    tokenizer->line = line + 1;
+    parser->lookAhead = nextToken(tokenizer, TOKEN_NUMBER);
+    if (!addRawSpan(&parser->rawSpans, record, 1, start, (size_t)(c - start))) return 0;
+    mesh->elemOffsets[record + 1] = RAW_ELEMENT;
     return 1;
 }
 
-static int parseMshV1(Parser* parser, Mesh* mesh)
+static int parseElement(Parser* parser, Mesh* mesh, size_t record)
 {
-    parser->lookAhead = nextToken(parser->tokenizer, TOKEN_NULL);
-    while (parser->lookAhead.type != TOKEN_END_OF_FILE)
+    // Read element index
+    long long tag;
+    if (!eatInteger(parser, TOKEN_NUMBER, &tag)) return 0;
+
+    // Element tags may have gaps, they are only kept for the output
+    if (tag < 1)
     {
-        switch (parser->lookAhead.type)
+        fprintf(stderr, "Element index %lld out of bounds at line %zu\n",
+            tag,
+            parser->token.line);
+        return 0;
+    }
+
+    // Read element type, physical region, element region and number of nodes
+    const char* start = parser->token.start;
+    long long type, regPhys, regElem, nNodes;
+    if (!eatInteger(parser, TOKEN_NUMBER, &type)) return 0;
+    if (!eatInteger(parser, TOKEN_NUMBER, &regPhys)) return 0;
+    if (!eatInteger(parser, TOKEN_NUMBER, &regElem)) return 0;
+    if (!decodesElement(parser->elementFilter, type, regElem))
+    {
+        return skipElement(parser, mesh, record, start, tag);
+    }
+    if (!eatInteger(parser, TOKEN_NUMBER, &nNodes)) return 0;
+    if (nNodes < 0 || nNodes > MAX_ELEM_NODES)
+    {
+        fprintf(stderr, "Invalid number of nodes %lld for element %lld at line %zu\n",
+            nNodes, tag, parser->token.line);
+        return 0;
+    }
+
+    // Read node indexes
+    size_t* nodes = reserveConnectivity(&parser->connectivity, (size_t)nNodes);
+    if (nodes == NULL) return 0;
+    for (long long j = 0; j < nNodes; ++j)
+    {
+        long long node;
+        if (!eatInteger(parser, TOKEN_NUMBER, &node)) return 0;
+        if (!findNode(parser, mesh, (size_t)node, &nodes[j]))
         {
-        case TOKEN_V1_NOD_START:
-            if (!parseNodStart(parser, mesh)) return 0;
-            break;
-        case TOKEN_V1_ELM_START:
-            if (!parseElmStart(parser, mesh)) return 0;
-            break;
-        default:
-            fprintf(stderr, "Expected %s or %s at line %zu but found %s\n",
-                tokenTypeToValue(TOKEN_V1_NOD_START),
-                tokenTypeToValue(TOKEN_V1_ELM_START),
-                parser->lookAhead.line,
-                tokenTypeToValue(parser->lookAhead.type));
+            fprintf(stderr, "Node index %lld of element %lld out of bounds at line %zu\n",
+                node, tag, parser->token.line);
             return 0;
         }
     }
 
+    // Store element data, the offsets are summed once all the records are read
+    mesh->elemIndex[record] = (size_t)tag - 1;
+    mesh->elemTypes[record] = (unsigned int)type;
+    mesh->elemRegPhys[record] = (unsigned int)regPhys;
+    mesh->elemRegElem[record] = (unsigned int)regElem;
+    mesh->elemOffsets[record + 1] = (size_t)nNodes;
     return 1;
 }
 
-static int writeMshV1(FILE* file, const Mesh* mesh)
+static int countChunkTask(void* context, size_t task)
 {
-    fprintf(file, "%s\n", tokenTypeToValue(TOKEN_V1_NOD_START));
-    fprintf(file, "%zu\n", mesh->nNodes);
-    for (size_t i = 0; i < mesh->nNodes; ++i)
-    {
-        size_t nodeIndex = mesh->nodeIndex[i];
-        Node* node = &mesh->nodes[nodeIndex];
-        fprintf(file, "%zu ", nodeIndex + 1);
-        writeDouble(file, node->x);
-        fprintf(file, " ");
-        writeDouble(file, node->y);
-        fprintf(file, " ");
-        writeDouble(file, node->z);
-        fprintf(file, "\n");
-    }
-    fprintf(file, "%s\n", tokenTypeToValue(TOKEN_V1_NOD_END));
-
-    fprintf(file, "%s\n", tokenTypeToValue(TOKEN_V1_ELM_START));
-    fprintf(file, "%zu\n", mesh->nElems);
-    for (size_t i = 0; i < mesh->nElems; ++i)
+    Section* section = (Section*)context;
+    Chunk* chunk = &section->chunks[task];
+
+    // A record is a line with at least one non whitespace character
+    size_t nLines = 0;
+    size_t nRecords = 0;
+    int blank = 1;
+    for (const char* c = chunk->start; c < chunk->end; ++c)
     {
-        size_t elemIndex = mesh->elemIndex[i];
-        Element* elem = &mesh->elements[elemIndex];
-        fprintf(file, "%zu %u %u %u %zu", elemIndex + 1, elem->type,
-            elem->regPhys, elem->regElem, elem->nNodes);
-        for (size_t j = 0; j < elem->nNodes; ++j)
+        if (*c == '\n')
         {
-            fprintf(file, " %zu", elem->nodes[j] + 1);
+            ++nLines;
+            nRecords += !blank;
+            blank = 1;
+        }
+        else if (*c != ' ' && *c != '\t' && *c != '\r')
+        {
+            blank = 0;
         }
-        fprintf(file, "\n");
     }
-    fprintf(file, "%s\n", tokenTypeToValue(TOKEN_V1_ELM_END));
+    nRecords += !blank;
 
-    fclose(file);
+    chunk->nLines = nLines;
+    chunk->nRecords = nRecords;
     return 1;
 }
 
-
-int readMshFile(const char* filename, Mesh* mesh)
+static int parseChunkTask(void* context, size_t task)
 {
-    char* buffer = NULL;
-    if (!readFileContent(filename, &buffer))
-    {
-        return 0;
-    }
+    Section* section = (Section*)context;
+    Chunk* chunk = &section->chunks[task];
 
     Tokenizer tokenizer;
-    initTokenizer(&tokenizer, buffer);
+    initTokenizerBuffer(&tokenizer, chunk->start, (size_t)(chunk->end - chunk->start));
+    tokenizer.line = chunk->line;
 
-    Parser parser;
+    // The element nodes of the chunk are appended to the section once all
+    // the chunks are done, in record order
+    Parser parser = { 0 };
     parser.tokenizer = &tokenizer;
-    parser.version = detectMshVersion(&tokenizer);
-    resetTokenizer(&tokenizer, buffer);
-    int result = 0;
-    switch (parser.version)
+    parser.version = section->version;
+    parser.chunk = 1;
+    parser.nodeMap = *section->nodeMap;
+    parser.elementFilter = section->elementFilter;
+    parser.lookAhead = nextToken(&tokenizer, TOKEN_NUMBER);
+    int result = 1;
+    for (size_t i = 0; result && i < chunk->nRecords; ++i)
     {
-    case MSH_V1:
-        result = parseMshV1(&parser, mesh);
-        break;
-    case MSH_UNKNOWN_VERSION:
-    default:
-        fprintf(stderr, "Unsupported or unknown MSH version in file '%s'\n", filename);
+        result = section->parseRecord(&parser, section->mesh, chunk->firstRecord + i);
     }
+    chunk->connectivity = parser.connectivity;
+    chunk->sparseTags = parser.sparseTags;
+    chunk->rawSpans = parser.rawSpans;
+    if (!result) return 0;
 
-    if (!result) freeMesh(mesh);
-    free(buffer);
-    freeTokenizer(&tokenizer);
-    return result;
+    if (parser.lookAhead.type != TOKEN_END_OF_FILE)
+    {
+        fprintf(stderr, "Unexpected %.*s at line %zu\n",
+            (int)parser.lookAhead.length,
+            parser.lookAhead.start,
+            parser.lookAhead.line);
+        return 0;
+    }
+
+    return 1;
 }
 
-int writeMshFile(const char* filename, const Mesh* mesh, MSHVersion version)
+static int joinChunks(Parser* parser, Section* section)
 {
-    FILE* file = fopen(filename, "w");
-    if (file == NULL)
+    size_t count = 0;
+    for (size_t i = 0; i < section->nChunks; ++i)
     {
-        fprintf(stderr, "Could not create or open .msh file '%s': %s\n",
-            filename, strerror(errno));
-        return 0;
+        count += section->chunks[i].connectivity.count;
     }
 
-    int result = 0;
-    switch (version)
+    size_t* nodes = count > 0 ? reserveConnectivity(&parser->connectivity, count) : NULL;
+    int result = count == 0 || nodes != NULL;
+    for (size_t i = 0; i < section->nChunks; ++i)
     {
-    case MSH_V1:
-        result = writeMshV1(file, mesh);
-        break;
-    case MSH_UNKNOWN_VERSION:
-    default:
-        fprintf(stderr, "Unsupported or unknown MSH version for writing file '%s'\n",
-            filename);
+        parser->sparseTags |= section->chunks[i].sparseTags;
+        Connectivity* connectivity = &section->chunks[i].connectivity;
+        if (result && connectivity->count > 0)
+        {
+            memcpy(nodes, connectivity->nodes, connectivity->count * sizeof(size_t));
+            nodes += connectivity->count;
+        }
+        freeConnectivity(connectivity);
+
+        // The spans of each chunk start with their first record, consecutive
+        // spans merge when a chunk boundary splits a run of raw records
+        RawSpans* spans = &section->chunks[i].rawSpans;
+        for (size_t j = 0; result && j < spans->count; ++j)
+        {
+            const RawSpan* span = &spans->spans[j];
+            result = addRawSpan(&parser->rawSpans, span->element, span->count, span->start,
+                span->length);
+        }
+        freeRawSpans(spans);
     }
 
     return result;
 }
+
+static int splitSection(Parser* parser, size_t nRecords, TokenType endToken, Section* section)
+{
+    if (getThreadCount() < 2 || parser->lookAhead.type != TOKEN_NUMBER) return 0;
+
+    // The records start with the look ahead token
+    Tokenizer* tokenizer = parser->tokenizer;
+    const char* start = parser->lookAhead.start;
+    const char* end = tokenizer->end;
+
+    // Records never contain a '$', so the first one marks the end of the
+    // section. A stream is split up to the last complete line of its buffer
+    const char* keyword = tokenTypeToValue(endToken);
+    size_t keywordLength = strlen(keyword);
+    const char* sectionEnd = (const char*)memchr(start, '$', (size_t)(end - start));
+    int complete = sectionEnd != NULL;
+    if (sectionEnd == NULL && tokenizer->fd != -1)
+    {
+        const char* lineEnd = end;
+        while (lineEnd > start && lineEnd[-1] != '\n') --lineEnd;
+        if (lineEnd > start) sectionEnd = lineEnd;
+    }
+    if (sectionEnd == NULL || (complete && ((size_t)(end - sectionEnd) < keywordLength
+        || memcmp(sectionEnd, keyword, keywordLength) != 0)))
+    {
+        return 0;
+    }
+
+    size_t size = (size_t)(sectionEnd - start);
+    size_t nChunks = getThreadCount() * CHUNKS_PER_THREAD;
+    if (nChunks > size / MIN_CHUNK_SIZE) nChunks = size / MIN_CHUNK_SIZE;
+    if (nChunks < 2) return 0;
+
+    section->chunks = (Chunk*)calloc(nChunks, sizeof(Chunk));
+    if (section->chunks == NULL) return 0;
+    section->nChunks = nChunks;
+    section->start = start;
+    section->end = sectionEnd;
+    section->line = parser->lookAhead.line;
+    section->complete = complete;
+    section->version = parser->version;
+
+    // Align the chunk boundaries to the start of a line
+    const char* chunkStart = start;
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        const char* chunkEnd = sectionEnd;
+        if (i + 1 < nChunks)
+        {
+            chunkEnd = start + (i + 1) * (size / nChunks);
+            if (chunkEnd < chunkStart) chunkEnd = chunkStart;
+            const char* newLine = (const char*)memchr(chunkEnd, '\n',
+                (size_t)(sectionEnd - chunkEnd));
+            chunkEnd = newLine == NULL ? sectionEnd : newLine + 1;
+        }
+        section->chunks[i].start = chunkStart;
+        section->chunks[i].end = chunkEnd;
+        chunkStart = chunkEnd;
+    }
+
+    parallelFor(nChunks, countChunkTask, section);
+
+    // The chunks can only be parsed independently if every record is on its
+    // own line, otherwise the sequential parser handles the section
+    size_t firstRecord = section->firstRecord;
+    size_t line = section->line;
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        section->chunks[i].firstRecord = firstRecord;
+        section->chunks[i].line = line;
+        firstRecord += section->chunks[i].nRecords;
+        line += section->chunks[i].nLines;
+    }
+    section->nLines = line - section->line;
+    section->nRecords = firstRecord - section->firstRecord;
+    if (complete ? section->nRecords != nRecords : section->nRecords > nRecords)
+    {
+        free(section->chunks);
+        section->chunks = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+static int parseRecords(Parser* parser, Mesh* mesh, size_t nRecords, TokenType endToken,
+    RecordParser parseRecord)
+{
+    // A file is split in chunks at once. A stream is split batch by batch,
+    // each one made of the complete lines of a full buffer
+    Tokenizer* tokenizer = parser->tokenizer;
+    size_t record = 0;
+    while (record < nRecords)
+    {
+        if (tokenizer->fd != -1 && (size_t)(tokenizer->end - tokenizer->start)
+            < tokenizer->capacity / 2 && refillTokenizer(tokenizer))
+        {
+            parser->lookAhead.start = tokenizer->start;
+        }
+
+        Section section = { 0 };
+        section.firstRecord = record;
+        if (!splitSection(parser, nRecords - record, endToken, &section)) break;
+        section.nodeMap = &parser->nodeMap;
+        section.elementFilter = parser->elementFilter;
+        section.mesh = mesh;
+        section.parseRecord = parseRecord;
+        int result = parallelFor(section.nChunks, parseChunkTask, &section);
+        result = joinChunks(parser, &section) && result;
+        free(section.chunks);
+        if (!result)
+        {
+            // The batch is parsed again once the nodes switched to sparse tags
+            if (!parser->sparseTags || mesh->nodeTags != NULL
+                || !switchToSparseTags(mesh, record))
+            {
+                return 0;
+            }
+            continue;
+        }
+
+        // Continue with the end keyword of the section, or the next batch
+        record += section.nRecords;
+        tokenizer->current = section.end;
+        tokenizer->line = section.line + section.nLines;
+        parser->lookAhead = nextToken(tokenizer, section.complete ? endToken : TOKEN_NUMBER);
+        if (section.complete) return 1;
+    }
+
+    for (; record < nRecords; ++record)
+    {
+        if (!parseRecord(parser, mesh, record)) return 0;
+    }
+
+    return 1;
+}
+
+static int parseNodStart(Parser* parser, Mesh* mesh)
+{
+    if (!eatToken(parser, TOKEN_V1_NOD_START, TOKEN_NUMBER)) return 0;
+
+    // Read number of nodes
+    long long count;
+    if (parser->lookAhead.type != TOKEN_NUMBER)
+    {
+        fprintf(stderr, "Expected number of nodes at line %zu but found %.*s\n",
+            parser->lookAhead.line,
+            (int)parser->lookAhead.length,
+            parser->lookAhead.start);
+        return 0;
+    }
+    if (!eatInteger(parser, TOKEN_NUMBER, &count)) return 0;
+    if (count < 0)
+    {
+        fprintf(stderr, "Invalid number of nodes %lld at line %zu\n", count, parser->token.line);
+        return 0;
+    }
+    size_t nNodes = (size_t)count;
+
+    // Allocate memory for nodes
+    mesh->nNodes = nNodes;
+    mesh->nodeIndex = (size_t*)malloc(nNodes * sizeof(size_t));
+    if (mesh->nodeIndex == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu node indexes\n", nNodes);
+        return 0;
+    }
+    mesh->nodes = (Node*)malloc(nNodes * sizeof(Node));
+    if (mesh->nodes == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu nodes\n", nNodes);
+        return 0;
+    }
+
+    // Read node data. Dense tags are read straight into place, the first tag
+    // larger than the number of nodes switches to the nodes kept in file order
+    if (!parseRecords(parser, mesh, nNodes, TOKEN_V1_NOD_END, parseNode)) return 0;
+    if (mesh->nodeTags != NULL && !buildNodeMap(parser, mesh)) return 0;
+
+    if (!eatToken(parser, TOKEN_V1_NOD_END, TOKEN_NULL))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int parseElmStart(Parser* parser, Mesh* mesh)
+{
+    if (!eatToken(parser, TOKEN_V1_ELM_START, TOKEN_NUMBER)) return 0;
+
+    // Read number of elements
+    long long count;
+    if (parser->lookAhead.type != TOKEN_NUMBER)
+    {
+        fprintf(stderr, "Expected number of elements at line %zu but found %.*s\n",
+            parser->lookAhead.line,
+            (int)parser->lookAhead.length,
+            parser->lookAhead.start);
+        return 0;
+    }
+    if (!eatInteger(parser, TOKEN_NUMBER, &count)) return 0;
+    if (count < 0)
+    {
+        fprintf(stderr, "Invalid number of elements %lld at line %zu\n",
+            count, parser->token.line);
+        return 0;
+    }
+    size_t nElems = (size_t)count;
+
+    // Allocate memory for elements
+    if (!allocateElements(mesh, nElems)) return 0;
+
+    // Read element data
+    if (!parseRecords(parser, mesh, nElems, TOKEN_V1_ELM_END, parseElement)) return 0;
+    if (!finishElements(parser, mesh)) return 0;
+
+    if (!eatToken(parser, TOKEN_V1_ELM_END, TOKEN_NULL))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int parseMshV1(Parser* parser, Mesh* mesh)
+{
+    parser->lookAhead = nextToken(parser->tokenizer, TOKEN_NULL);
+    while (parser->lookAhead.type != TOKEN_END_OF_FILE)
+    {
+        switch (parser->lookAhead.type)
+        {
+        case TOKEN_V1_NOD_START:
+            if (!parseNodStart(parser, mesh)) return 0;
+            break;
+        case TOKEN_V1_ELM_START:
+            if (!parseElmStart(parser, mesh)) return 0;
+            break;
+        default:
+            fprintf(stderr, "Expected %s or %s at line %zu but found %s\n",
+                tokenTypeToValue(TOKEN_V1_NOD_START),
+                tokenTypeToValue(TOKEN_V1_ELM_START),
+                parser->lookAhead.line,
+                tokenTypeToValue(parser->lookAhead.type));
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int eatCount(Parser* parser, TokenType nextTypeHint, const char* what, size_t* count)
+{
+    long long value;
+    if (!eatInteger(parser, nextTypeHint, &value)) return 0;
+    if (value < 0)
+    {
+        fprintf(stderr, "Invalid number of %s %lld at line %zu\n",
+            what, value, parser->token.line);
+        return 0;
+    }
+
+    *count = (size_t)value;
+    return 1;
+}
+
+static int eatTag(Parser* parser, TokenType nextTypeHint, int* tag)
+{
+    long long value;
+    if (!eatInteger(parser, nextTypeHint, &value)) return 0;
+    if (value < -2147483647LL || value > 2147483647LL)
+    {
+        fprintf(stderr, "Tag %lld out of range at line %zu\n", value, parser->token.line);
+        return 0;
+    }
+
+    *tag = (int)value;
+    return 1;
+}
+
+static int eatTags(Parser* parser, TokenType nextTypeHint, const char* what, size_t* count,
+    int** tags)
+{
+    if (!eatCount(parser, TOKEN_NUMBER, what, count)) return 0;
+    if (*count == 0) return 1;
+
+    *tags = (int*)malloc(*count * sizeof(int));
+    if (*tags == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu %s\n", *count, what);
+        return 0;
+    }
+    for (size_t i = 0; i < *count; ++i)
+    {
+        if (!eatTag(parser, i + 1 < *count ? TOKEN_NUMBER : nextTypeHint, &(*tags)[i])) return 0;
+    }
+
+    return 1;
+}
+
+static const Entity* findEntity(const Entity* entities, size_t nEntities, int dim, int tag)
+{
+    for (size_t i = 0; i < nEntities; ++i)
+    {
+        if (entities[i].dim == dim && entities[i].tag == tag) return &entities[i];
+    }
+
+    return NULL;
+}
+
+static int findSectionEnd(Parser* parser, const char* keyword, TokenType endToken,
+    char** text)
+{
+    // The end keyword is the first one at the start of a line, the content of
+    // the section, e.g. physical names, may contain any other character. It
+    // starts right after the keyword of the section
+    Tokenizer* tokenizer = parser->tokenizer;
+    tokenizer->start = tokenizer->current;
+    if (!skipToLine(tokenizer, keyword, text != NULL))
+    {
+        fprintf(stderr, "Expected %s for the section at line %zu but found end of file\n",
+            keyword, parser->lookAhead.line);
+        return 0;
+    }
+
+    if (text != NULL)
+    {
+        // The line break after the keyword of the section is not kept
+        const char* body = tokenizer->start;
+        if (body < tokenizer->current && *body == '\r') ++body;
+        if (body < tokenizer->current && *body == '\n') ++body;
+        size_t length = (size_t)(tokenizer->current - body);
+        *text = (char*)malloc(length + 1);
+        if (*text == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory for %zu bytes of section text\n", length);
+            return 0;
+        }
+        memcpy(*text, body, length);
+        (*text)[length] = '\0';
+    }
+
+    tokenizer->start = tokenizer->current;
+    parser->lookAhead = nextToken(tokenizer, endToken);
+    return 1;
+}
+
+static void swapBytes(void* data, size_t size, size_t count)
+{
+    unsigned char* bytes = (unsigned char*)data;
+    for (size_t i = 0; i < count; ++i, bytes += size)
+    {
+        for (size_t j = 0; j < size / 2; ++j)
+        {
+            unsigned char byte = bytes[j];
+            bytes[j] = bytes[size - 1 - j];
+            bytes[size - 1 - j] = byte;
+        }
+    }
+}
+
+static int beginBinaryData(Parser* parser, const Token* token)
+{
+    // The binary data starts on the line after the token
+    const char* current = token->start + token->length;
+    if (current < parser->tokenizer->end && *current == '\r') ++current;
+    if (current >= parser->tokenizer->end || *current != '\n')
+    {
+        fprintf(stderr, "Expected a line break after %.*s at line %zu\n",
+            (int)token->length, token->start, token->line);
+        return 0;
+    }
+
+    parser->binary.current = current + 1;
+    parser->binary.end = parser->tokenizer->end;
+    return 1;
+}
+
+static void endBinaryData(Parser* parser, TokenType endToken)
+{
+    // Line numbers are not tracked in binary data, the tokenizer continues
+    // with the end keyword of the section
+    parser->tokenizer->current = parser->binary.current;
+    parser->lookAhead = nextToken(parser->tokenizer, endToken);
+}
+
+static int readBinary(Parser* parser, void* values, size_t size, size_t count)
+{
+    // Values in the file are not aligned, so they are always copied
+    BinaryReader* binary = &parser->binary;
+    size_t available = (size_t)(binary->end - binary->current);
+    if (count > available / size)
+    {
+        fprintf(stderr, "Unexpected end of file reading %zu values of %zu bytes at byte %zu\n",
+            count, size, (size_t)(binary->current - parser->tokenizer->source));
+        return 0;
+    }
+
+    memcpy(values, binary->current, count * size);
+    binary->current += count * size;
+    if (binary->swapBytes) swapBytes(values, size, count);
+    return 1;
+}
+
+static int readBinaryCount(Parser* parser, const char* what, size_t* count)
+{
+    if (!readBinary(parser, count, sizeof(size_t), 1)) return 0;
+
+    // Every item takes at least one byte, larger counts come from corrupted files
+    if (*count > (size_t)(parser->binary.end - parser->binary.current))
+    {
+        fprintf(stderr, "Invalid number of %s %zu at byte %zu\n", what, *count,
+            (size_t)(parser->binary.current - parser->tokenizer->source));
+        return 0;
+    }
+
+    return 1;
+}
+
+static int parseMeshFormat(Parser* parser)
+{
+    if (!eatToken(parser, TOKEN_V4_MESH_FORMAT_START, TOKEN_NUMBER)) return 0;
+
+    // Version number, file type and size of the floating point numbers
+    double version;
+    long long fileType, dataSize;
+    if (!eatDouble(parser, TOKEN_NUMBER, &version)) return 0;
+    if (!eatInteger(parser, TOKEN_NUMBER, &fileType)) return 0;
+    if (!eatInteger(parser, TOKEN_V4_MESH_FORMAT_END, &dataSize)) return 0;
+    if (version != 4.1 || fileType != (parser->version == MSH_V41_BINARY))
+    {
+        fprintf(stderr, "Unsupported MSH format %g with file type %lld at line %zu\n",
+            version, fileType, parser->token.line);
+        return 0;
+    }
+
+    if (parser->version == MSH_V41_BINARY)
+    {
+        // The sizes are written as size_t, followed by the integer 1 to find
+        // out the byte order of the file
+        if (dataSize != (long long)sizeof(size_t))
+        {
+            fprintf(stderr, "Unsupported data size %lld at line %zu\n",
+                dataSize, parser->token.line);
+            return 0;
+        }
+        if (!beginBinaryData(parser, &parser->token)) return 0;
+
+        int one;
+        if (!readBinary(parser, &one, sizeof(int), 1)) return 0;
+        if (one != 1)
+        {
+            swapBytes(&one, sizeof(int), 1);
+            if (one != 1)
+            {
+                fprintf(stderr, "Invalid byte order mark after line %zu\n", parser->token.line);
+                return 0;
+            }
+            parser->binary.swapBytes = 1;
+        }
+        endBinaryData(parser, TOKEN_V4_MESH_FORMAT_END);
+    }
+
+    return eatToken(parser, TOKEN_V4_MESH_FORMAT_END, TOKEN_NULL);
+}
+
+static int parsePhysicalNames(Parser* parser, Mesh* mesh)
+{
+    // The names are quoted strings the tokenizer does not handle, the content
+    // is kept verbatim to write it back
+    char* names;
+    if (!findSectionEnd(parser, tokenTypeToValue(TOKEN_V4_PHYSICAL_NAMES_END),
+        TOKEN_V4_PHYSICAL_NAMES_END, &names))
+    {
+        return 0;
+    }
+    free(mesh->physicalNames);
+    mesh->physicalNames = names;
+
+    return eatToken(parser, TOKEN_V4_PHYSICAL_NAMES_END, TOKEN_NULL);
+}
+
+static int skipSection(Parser* parser)
+{
+    // Sections not used by amgem, e.g. $NodeData or $Periodic, end with the
+    // same name prefixed by End
+    char keyword[MAX_SECTION_NAME + 4];
+    size_t length = parser->lookAhead.length - 1;
+    if (length > MAX_SECTION_NAME)
+    {
+        fprintf(stderr, "Section name %.*s too long at line %zu\n",
+            (int)parser->lookAhead.length, parser->lookAhead.start, parser->lookAhead.line);
+        return 0;
+    }
+    snprintf(keyword, sizeof(keyword), "$End%.*s", (int)length, parser->lookAhead.start + 1);
+
+    if (!findSectionEnd(parser, keyword, TOKEN_SECTION, NULL)) return 0;
+
+    return eatToken(parser, TOKEN_SECTION, TOKEN_NULL);
+}
+
+static int parseEntity(Parser* parser, int dim, Entity* entity)
+{
+    entity->dim = dim;
+    if (!eatTag(parser, TOKEN_NUMBER, &entity->tag)) return 0;
+
+    // Points have a position, the other entities a bounding box
+    size_t nCoords = dim == 0 ? 3 : 6;
+    for (size_t i = 0; i < nCoords; ++i)
+    {
+        if (!eatDouble(parser, TOKEN_NUMBER, &entity->box[i])) return 0;
+    }
+    if (dim == 0)
+    {
+        for (size_t i = 0; i < 3; ++i) entity->box[i + 3] = entity->box[i];
+    }
+
+    if (!eatTags(parser, TOKEN_NUMBER, "physical tags", &entity->nPhysicals,
+        &entity->physicals))
+    {
+        return 0;
+    }
+    if (dim > 0 && !eatTags(parser, TOKEN_NUMBER, "bounding entities", &entity->nBounding,
+        &entity->bounding))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int parseEntities(Parser* parser, Mesh* mesh)
+{
+    if (!eatToken(parser, TOKEN_V4_ENTITIES_START, TOKEN_NUMBER)) return 0;
+
+    // Number of points, curves, surfaces and volumes
+    size_t counts[4];
+    size_t nEntities = 0;
+    for (int dim = 0; dim < 4; ++dim)
+    {
+        if (!eatCount(parser, TOKEN_NUMBER, "entities", &counts[dim])) return 0;
+        nEntities += counts[dim];
+    }
+
+    mesh->entities = (Entity*)calloc(nEntities > 0 ? nEntities : 1, sizeof(Entity));
+    if (mesh->entities == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu entities\n", nEntities);
+        return 0;
+    }
+    for (int dim = 0; dim < 4; ++dim)
+    {
+        for (size_t i = 0; i < counts[dim]; ++i)
+        {
+            // Count the entity first so freeMesh releases its tags on failure
+            Entity* entity = &mesh->entities[mesh->nEntities++];
+            if (!parseEntity(parser, dim, entity)) return 0;
+        }
+    }
+
+    return eatToken(parser, TOKEN_V4_ENTITIES_END, TOKEN_NULL);
+}
+
+static int parseNodes(Parser* parser, Mesh* mesh)
+{
+    if (!eatToken(parser, TOKEN_V4_NODES_START, TOKEN_NUMBER)) return 0;
+
+    // Number of blocks, number of nodes and range of the node tags
+    size_t nBlocks, nNodes;
+    long long minTag, maxTag;
+    if (!eatCount(parser, TOKEN_NUMBER, "node blocks", &nBlocks)) return 0;
+    if (!eatCount(parser, TOKEN_NUMBER, "nodes", &nNodes)) return 0;
+    if (!eatInteger(parser, TOKEN_NUMBER, &minTag)) return 0;
+    if (!eatInteger(parser, TOKEN_NUMBER, &maxTag)) return 0;
+
+    // Allocate memory for nodes
+    mesh->nNodes = nNodes;
+    mesh->nodeIndex = (size_t*)malloc(nNodes * sizeof(size_t));
+    if (mesh->nodeIndex == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu node indexes\n", nNodes);
+        return 0;
+    }
+    mesh->nodes = (Node*)malloc(nNodes * sizeof(Node));
+    if (mesh->nodes == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu nodes\n", nNodes);
+        return 0;
+    }
+    mesh->nodeBlocks = (NodeBlock*)malloc(nBlocks * sizeof(NodeBlock));
+    if (nBlocks > 0 && mesh->nodeBlocks == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu node blocks\n", nBlocks);
+        return 0;
+    }
+    mesh->nNodeBlocks = nBlocks;
+
+    // The range of the tags tells if they are dense before any node is read
+    if (nNodes > 0 && (minTag != 1 || maxTag != (long long)nNodes) && !useSparseTags(mesh))
+    {
+        return 0;
+    }
+
+    size_t record = 0;
+    for (size_t i = 0; i < nBlocks; ++i)
+    {
+        // Entity dimension, entity tag, parametric flag and number of nodes
+        NodeBlock* block = &mesh->nodeBlocks[i];
+        long long dim, parametric;
+        if (!eatInteger(parser, TOKEN_NUMBER, &dim)) return 0;
+        if (!eatTag(parser, TOKEN_NUMBER, &block->tag)) return 0;
+        if (!eatInteger(parser, TOKEN_NUMBER, &parametric)) return 0;
+        if (!eatCount(parser, TOKEN_NUMBER, "nodes", &block->count)) return 0;
+        if (dim < 0 || dim > 3 || block->count > nNodes - record)
+        {
+            fprintf(stderr, "Invalid node block of dimension %lld with %zu nodes at line %zu\n",
+                dim, block->count, parser->token.line);
+            return 0;
+        }
+        block->dim = (int)dim;
+
+        // All the tags of the block come first, followed by the coordinates.
+        // Parametric coordinates are not used and are dropped
+        size_t* nodeIndex = &mesh->nodeIndex[record];
+        for (size_t j = 0; j < block->count; ++j)
+        {
+            long long tag;
+            if (!eatInteger(parser, TOKEN_NUMBER, &tag)) return 0;
+            if (tag < 1 || !storeNodeTag(mesh, record + j, (size_t)tag))
+            {
+                fprintf(stderr, "Node index %lld out of bounds at line %zu\n",
+                    tag, parser->token.line);
+                return 0;
+            }
+        }
+        size_t nParametric = parametric ? (size_t)dim : 0;
+        for (size_t j = 0; j < block->count; ++j)
+        {
+            Node* node = &mesh->nodes[nodeIndex[j]];
+            if (!eatDouble(parser, TOKEN_NUMBER, &node->x)) return 0;
+            if (!eatDouble(parser, TOKEN_NUMBER, &node->y)) return 0;
+            if (!eatDouble(parser, TOKEN_NUMBER, &node->z)) return 0;
+            for (size_t k = 0; k < nParametric; ++k)
+            {
+                double value;
+                if (!eatDouble(parser, TOKEN_NUMBER, &value)) return 0;
+            }
+        }
+        record += block->count;
+    }
+
+    if (record != nNodes)
+    {
+        fprintf(stderr, "Expected %zu nodes but found %zu at line %zu\n",
+            nNodes, record, parser->token.line);
+        return 0;
+    }
+    if (mesh->nodeTags != NULL && !buildNodeMap(parser, mesh)) return 0;
+
+    return eatToken(parser, TOKEN_V4_NODES_END, TOKEN_NULL);
+}
+
+static int parseElements(Parser* parser, Mesh* mesh)
+{
+    if (!eatToken(parser, TOKEN_V4_ELEMENTS_START, TOKEN_NUMBER)) return 0;
+
+    // Number of blocks, number of elements and range of the element tags
+    size_t nBlocks, nElems;
+    long long minTag, maxTag;
+    if (!eatCount(parser, TOKEN_NUMBER, "element blocks", &nBlocks)) return 0;
+    if (!eatCount(parser, TOKEN_NUMBER, "elements", &nElems)) return 0;
+    if (!eatInteger(parser, TOKEN_NUMBER, &minTag)) return 0;
+    if (!eatInteger(parser, TOKEN_NUMBER, &maxTag)) return 0;
+
+    // Allocate memory for elements
+    if (!allocateElements(mesh, nElems)) return 0;
+
+    size_t record = 0;
+    for (size_t i = 0; i < nBlocks; ++i)
+    {
+        // Entity dimension, entity tag, element type and number of elements
+        long long dim, type;
+        int entityTag;
+        size_t count;
+        if (!eatInteger(parser, TOKEN_NUMBER, &dim)) return 0;
+        if (!eatTag(parser, TOKEN_NUMBER, &entityTag)) return 0;
+        if (!eatInteger(parser, TOKEN_NUMBER, &type)) return 0;
+        if (!eatCount(parser, TOKEN_NUMBER, "elements", &count)) return 0;
+        if (type < 1 || type > MSH_MAX_TYPE || elementTypes[type].nNodes > MAX_ELEM_NODES)
+        {
+            fprintf(stderr, "Unsupported element type %lld at line %zu\n",
+                type, parser->token.line);
+            return 0;
+        }
+        if (count > nElems - record)
+        {
+            fprintf(stderr, "Expected %zu elements but found more at line %zu\n",
+                nElems, parser->token.line);
+            return 0;
+        }
+
+        // The type, the number of nodes and the regions are the same for the
+        // whole block, so only the tags and the nodes are read per element.
+        // The physical region is the first physical tag of the entity
+        const Entity* entity = findEntity(mesh->entities, mesh->nEntities, (int)dim, entityTag);
+        unsigned int regPhys = entity != NULL && entity->nPhysicals > 0
+            ? (unsigned int)entity->physicals[0]
+            : 0;
+        size_t nNodes = elementTypes[type].nNodes;
+        for (size_t j = 0; j < count; ++j)
+        {
+            long long tag;
+            if (!eatInteger(parser, TOKEN_NUMBER, &tag)) return 0;
+
+            if (tag < 1)
+            {
+                fprintf(stderr, "Element index %lld out of bounds at line %zu\n",
+                    tag, parser->token.line);
+                return 0;
+            }
+
+            size_t* nodes = reserveConnectivity(&parser->connectivity, nNodes);
+            if (nodes == NULL) return 0;
+            for (size_t k = 0; k < nNodes; ++k)
+            {
+                long long node;
+                if (!eatInteger(parser, TOKEN_NUMBER, &node)) return 0;
+                if (!findNode(parser, mesh, (size_t)node, &nodes[k]))
+                {
+                    fprintf(stderr, "Node index %lld out of bounds at line %zu\n",
+                        node, parser->token.line);
+                    return 0;
+                }
+            }
+
+            // Store element data, subtracting 1 to convert to 0-based index
+            mesh->elemIndex[record + j] = (size_t)tag - 1;
+            mesh->elemTypes[record + j] = (unsigned int)type;
+            mesh->elemRegPhys[record + j] = regPhys;
+            mesh->elemRegElem[record + j] = (unsigned int)entityTag;
+            mesh->elemOffsets[record + j + 1] = nNodes;
+        }
+        record += count;
+    }
+
+    if (record != nElems)
+    {
+        fprintf(stderr, "Expected %zu elements but found %zu at line %zu\n",
+            nElems, record, parser->token.line);
+        return 0;
+    }
+    if (!finishElements(parser, mesh)) return 0;
+
+    return eatToken(parser, TOKEN_V4_ELEMENTS_END, TOKEN_NULL);
+}
+
+static int readBinaryTags(Parser* parser, const char* what, size_t* count, int** tags)
+{
+    if (!readBinaryCount(parser, what, count)) return 0;
+    if (*count == 0) return 1;
+
+    *tags = (int*)malloc(*count * sizeof(int));
+    if (*tags == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu %s\n", *count, what);
+        return 0;
+    }
+
+    return readBinary(parser, *tags, sizeof(int), *count);
+}
+
+static int parseEntitiesBinary(Parser* parser, Mesh* mesh)
+{
+    if (!beginBinaryData(parser, &parser->lookAhead)) return 0;
+
+    // Number of points, curves, surfaces and volumes
+    size_t counts[4];
+    if (!readBinary(parser, counts, sizeof(size_t), 4)) return 0;
+    size_t nEntities = 0;
+    for (int dim = 0; dim < 4; ++dim)
+    {
+        if (counts[dim] > (size_t)(parser->binary.end - parser->binary.current))
+        {
+            fprintf(stderr, "Invalid number of entities %zu of dimension %d\n", counts[dim], dim);
+            return 0;
+        }
+        nEntities += counts[dim];
+    }
+
+    mesh->entities = (Entity*)calloc(nEntities > 0 ? nEntities : 1, sizeof(Entity));
+    if (mesh->entities == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu entities\n", nEntities);
+        return 0;
+    }
+    for (int dim = 0; dim < 4; ++dim)
+    {
+        for (size_t i = 0; i < counts[dim]; ++i)
+        {
+            // Count the entity first so freeMesh releases its tags on failure
+            Entity* entity = &mesh->entities[mesh->nEntities++];
+            entity->dim = dim;
+            if (!readBinary(parser, &entity->tag, sizeof(int), 1)) return 0;
+
+            // Points have a position, the other entities a bounding box
+            if (!readBinary(parser, entity->box, sizeof(double), dim == 0 ? 3 : 6)) return 0;
+            if (dim == 0) memcpy(&entity->box[3], entity->box, 3 * sizeof(double));
+
+            if (!readBinaryTags(parser, "physical tags", &entity->nPhysicals,
+                &entity->physicals))
+            {
+                return 0;
+            }
+            if (dim > 0 && !readBinaryTags(parser, "bounding entities", &entity->nBounding,
+                &entity->bounding))
+            {
+                return 0;
+            }
+        }
+    }
+
+    endBinaryData(parser, TOKEN_V4_ENTITIES_END);
+    return eatToken(parser, TOKEN_V4_ENTITIES_END, TOKEN_NULL);
+}
+
+static int parseNodesBinary(Parser* parser, Mesh* mesh)
+{
+    if (!beginBinaryData(parser, &parser->lookAhead)) return 0;
+
+    // Number of blocks, number of nodes and range of the node tags
+    size_t header[4];
+    if (!readBinary(parser, header, sizeof(size_t), 4)) return 0;
+    size_t nBlocks = header[0];
+    size_t nNodes = header[1];
+    size_t available = (size_t)(parser->binary.end - parser->binary.current);
+    if (nBlocks > available || nNodes > available)
+    {
+        fprintf(stderr, "Invalid number of node blocks %zu or nodes %zu\n", nBlocks, nNodes);
+        return 0;
+    }
+
+    // Allocate memory for nodes
+    mesh->nNodes = nNodes;
+    mesh->nodeIndex = (size_t*)malloc(nNodes * sizeof(size_t));
+    if (mesh->nodeIndex == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu node indexes\n", nNodes);
+        return 0;
+    }
+    mesh->nodes = (Node*)malloc(nNodes * sizeof(Node));
+    if (mesh->nodes == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu nodes\n", nNodes);
+        return 0;
+    }
+    mesh->nodeBlocks = (NodeBlock*)malloc(nBlocks * sizeof(NodeBlock));
+    if (nBlocks > 0 && mesh->nodeBlocks == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu node blocks\n", nBlocks);
+        return 0;
+    }
+    mesh->nNodeBlocks = nBlocks;
+
+    // The range of the tags tells if they are dense before any node is read
+    if (nNodes > 0 && (header[2] != 1 || header[3] != nNodes) && !useSparseTags(mesh)) return 0;
+
+    size_t record = 0;
+    for (size_t i = 0; i < nBlocks; ++i)
+    {
+        // Entity dimension, entity tag, parametric flag and number of nodes
+        NodeBlock* block = &mesh->nodeBlocks[i];
+        int blockHeader[3];
+        if (!readBinary(parser, blockHeader, sizeof(int), 3)) return 0;
+        if (!readBinary(parser, &block->count, sizeof(size_t), 1)) return 0;
+        if (blockHeader[0] < 0 || blockHeader[0] > 3 || block->count > nNodes - record)
+        {
+            fprintf(stderr, "Invalid node block of dimension %d with %zu nodes\n",
+                blockHeader[0], block->count);
+            return 0;
+        }
+        block->dim = blockHeader[0];
+        block->tag = blockHeader[1];
+
+        // The tags are read straight into the node indexes, then replaced by
+        // the index of each node
+        size_t* nodeIndex = &mesh->nodeIndex[record];
+        if (!readBinary(parser, nodeIndex, sizeof(size_t), block->count)) return 0;
+        int consecutive = 1;
+        for (size_t j = 0; j < block->count; ++j)
+        {
+            size_t tag = nodeIndex[j];
+            if (!storeNodeTag(mesh, record + j, tag))
+            {
+                fprintf(stderr, "Node index %zu out of bounds\n", tag);
+                return 0;
+            }
+            consecutive &= nodeIndex[j] == nodeIndex[0] + j;
+        }
+
+        // Blocks of consecutive tags without parametric coordinates are
+        // copied with a single memcpy, Node being three packed doubles
+        size_t nParametric = blockHeader[2] ? (size_t)block->dim : 0;
+        if (consecutive && nParametric == 0 && block->count > 0)
+        {
+            if (!readBinary(parser, &mesh->nodes[nodeIndex[0]], sizeof(double),
+                3 * block->count))
+            {
+                return 0;
+            }
+        }
+        else
+        {
+            for (size_t j = 0; j < block->count; ++j)
+            {
+                double values[6];
+                if (!readBinary(parser, values, sizeof(double), 3 + nParametric)) return 0;
+                memcpy(&mesh->nodes[nodeIndex[j]], values, sizeof(Node));
+            }
+        }
+        record += block->count;
+    }
+
+    if (record != nNodes)
+    {
+        fprintf(stderr, "Expected %zu nodes but found %zu\n", nNodes, record);
+        return 0;
+    }
+    if (mesh->nodeTags != NULL && !buildNodeMap(parser, mesh)) return 0;
+
+    endBinaryData(parser, TOKEN_V4_NODES_END);
+    return eatToken(parser, TOKEN_V4_NODES_END, TOKEN_NULL);
+}
+
+static int parseElementsBinary(Parser* parser, Mesh* mesh)
+{
+    if (!beginBinaryData(parser, &parser->lookAhead)) return 0;
+
+    // Number of blocks, number of elements and range of the element tags
+    size_t header[4];
+    if (!readBinary(parser, header, sizeof(size_t), 4)) return 0;
+    size_t nBlocks = header[0];
+    size_t nElems = header[1];
+    size_t available = (size_t)(parser->binary.end - parser->binary.current);
+    if (nBlocks > available || nElems > available)
+    {
+        fprintf(stderr, "Invalid number of element blocks %zu or elements %zu\n",
+            nBlocks, nElems);
+        return 0;
+    }
+
+    // Allocate memory for elements
+    if (!allocateElements(mesh, nElems)) return 0;
+
+    size_t record = 0;
+    for (size_t i = 0; i < nBlocks; ++i)
+    {
+        // Entity dimension, entity tag, element type and number of elements
+        int blockHeader[3];
+        size_t count;
+        if (!readBinary(parser, blockHeader, sizeof(int), 3)) return 0;
+        if (!readBinary(parser, &count, sizeof(size_t), 1)) return 0;
+        int type = blockHeader[2];
+        if (type < 1 || type > MSH_MAX_TYPE || elementTypes[type].nNodes > MAX_ELEM_NODES)
+        {
+            fprintf(stderr, "Unsupported element type %d\n", type);
+            return 0;
+        }
+        if (count > nElems - record)
+        {
+            fprintf(stderr, "Expected %zu elements but found more\n", nElems);
+            return 0;
+        }
+
+        // Each element is its tag followed by the tags of its nodes, all of
+        // them size_t, with the number of nodes fixed by the block type
+        const Entity* entity = findEntity(mesh->entities, mesh->nEntities, blockHeader[0],
+            blockHeader[1]);
+        unsigned int regPhys = entity != NULL && entity->nPhysicals > 0
+            ? (unsigned int)entity->physicals[0]
+            : 0;
+        size_t nNodes = elementTypes[type].nNodes;
+        for (size_t j = 0; j < count; ++j)
+        {
+            size_t values[MAX_ELEM_NODES + 1];
+            if (!readBinary(parser, values, sizeof(size_t), nNodes + 1)) return 0;
+
+            if (values[0] < 1)
+            {
+                fprintf(stderr, "Element index %zu out of bounds\n", values[0]);
+                return 0;
+            }
+
+            size_t* nodes = reserveConnectivity(&parser->connectivity, nNodes);
+            if (nodes == NULL) return 0;
+            for (size_t k = 0; k < nNodes; ++k)
+            {
+                if (!findNode(parser, mesh, values[k + 1], &nodes[k]))
+                {
+                    fprintf(stderr, "Node index %zu of element %zu out of bounds\n",
+                        values[k + 1], values[0]);
+                    return 0;
+                }
+            }
+
+            // Store element data, subtracting 1 to convert to 0-based index
+            mesh->elemIndex[record + j] = values[0] - 1;
+            mesh->elemTypes[record + j] = (unsigned int)type;
+            mesh->elemRegPhys[record + j] = regPhys;
+            mesh->elemRegElem[record + j] = (unsigned int)blockHeader[1];
+            mesh->elemOffsets[record + j + 1] = nNodes;
+        }
+        record += count;
+    }
+
+    if (record != nElems)
+    {
+        fprintf(stderr, "Expected %zu elements but found %zu\n", nElems, record);
+        return 0;
+    }
+    if (!finishElements(parser, mesh)) return 0;
+
+    endBinaryData(parser, TOKEN_V4_ELEMENTS_END);
+    return eatToken(parser, TOKEN_V4_ELEMENTS_END, TOKEN_NULL);
+}
+
+static int parseMshV41(Parser* parser, Mesh* mesh)
+{
+    parser->lookAhead = nextToken(parser->tokenizer, TOKEN_V4_MESH_FORMAT_START);
+    if (!parseMeshFormat(parser)) return 0;
+
+    // The section keywords and the physical names are text in binary files too
+    int binary = parser->version == MSH_V41_BINARY;
+
+    while (parser->lookAhead.type != TOKEN_END_OF_FILE)
+    {
+        switch (parser->lookAhead.type)
+        {
+        case TOKEN_V4_PHYSICAL_NAMES_START:
+            if (!parsePhysicalNames(parser, mesh)) return 0;
+            break;
+        case TOKEN_V4_ENTITIES_START:
+            if (mesh->entities != NULL)
+            {
+                fprintf(stderr, "Unexpected second %s at line %zu\n",
+                    tokenTypeToValue(TOKEN_V4_ENTITIES_START), parser->lookAhead.line);
+                return 0;
+            }
+            if (!(binary ? parseEntitiesBinary : parseEntities)(parser, mesh)) return 0;
+            break;
+        case TOKEN_V4_NODES_START:
+            if (mesh->nodes != NULL)
+            {
+                fprintf(stderr, "Unexpected second %s at line %zu\n",
+                    tokenTypeToValue(TOKEN_V4_NODES_START), parser->lookAhead.line);
+                return 0;
+            }
+            if (!(binary ? parseNodesBinary : parseNodes)(parser, mesh)) return 0;
+            break;
+        case TOKEN_V4_ELEMENTS_START:
+            // The node tags of the elements are checked against the nodes
+            if (mesh->nodes == NULL || mesh->elemIndex != NULL)
+            {
+                fprintf(stderr, "Expected one %s after %s at line %zu\n",
+                    tokenTypeToValue(TOKEN_V4_ELEMENTS_START),
+                    tokenTypeToValue(TOKEN_V4_NODES_START),
+                    parser->lookAhead.line);
+                return 0;
+            }
+            if (!(binary ? parseElementsBinary : parseElements)(parser, mesh)) return 0;
+            break;
+        case TOKEN_SECTION:
+            if (!skipSection(parser)) return 0;
+            break;
+        default:
+            fprintf(stderr, "Expected a section at line %zu but found %s\n",
+                parser->lookAhead.line,
+                tokenTypeToValue(parser->lookAhead.type));
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static const char* findKeyword(const char* start, const char* end, const char* keyword)
+{
+    // Section keywords start a line and end with a blank or a line break
+    size_t length = strlen(keyword);
+    const char* c = start;
+    while (c < end && (c = (const char*)memchr(c, '$', (size_t)(end - c))) != NULL)
+    {
+        if ((c == start || c[-1] == '\n') && (size_t)(end - c) >= length
+            && memcmp(c, keyword, length) == 0
+            && (c + length == end || isspace((unsigned char)c[length])))
+        {
+            return c;
+        }
+        ++c;
+    }
+
+    return NULL;
+}
+
+typedef struct
+{
+    size_t nodeTag;             // characters of the node tags
+    size_t elementTag;          // characters of the element tags
+    size_t type;                // characters of the element types
+    size_t regPhys;             // characters of the physical regions
+    size_t regElem;             // characters of the elementary regions
+    size_t nNodes;              // characters of the node counts of the elements
+    size_t nodeRecord;          // bytes of a node record
+    size_t elementRecord;       // bytes of an element record without its node tags
+} FixedWidths;
+
+typedef struct
+{
+    const Mesh* mesh;
+    const size_t* indexes;      // node indexes of the records
+    size_t firstElement;        // element of the first record of an element block
+    int precision;              // decimals of the fractional coordinates
+    const FixedWidths* widths;  // widths of the fixed-width MSH 1 records, NULL otherwise
+} WriteContext;
+
+typedef void (*RecordWriter)(WriteBuffer* buffer, const WriteContext* context, size_t record);
+
+typedef struct
+{
+    const WriteContext* context;
+    RecordWriter writeRecord;
+    size_t firstRecord;         // first record of the round
+    size_t lastRecord;          // past the last record of the round
+    WriteBuffer* buffers;       // memory buffer of each chunk of the round
+} WriteRound;
+
+static int writeChunkTask(void* context, size_t task)
+{
+    WriteRound* round = (WriteRound*)context;
+    WriteBuffer* buffer = &round->buffers[task];
+    size_t first = round->firstRecord + task * RECORDS_PER_CHUNK;
+    size_t last = first + RECORDS_PER_CHUNK < round->lastRecord
+        ? first + RECORDS_PER_CHUNK
+        : round->lastRecord;
+
+    buffer->size = 0;
+    for (size_t i = first; i < last; ++i)
+    {
+        round->writeRecord(buffer, round->context, i);
+    }
+
+    return !buffer->failed;
+}
+
+static int writeRecords(WriteBuffer* buffer, const WriteContext* context, size_t nRecords,
+    RecordWriter writeRecord)
+{
+    size_t nThreads = getThreadCount();
+    if (nThreads < 2 || nRecords < 2 * RECORDS_PER_CHUNK)
+    {
+        for (size_t i = 0; i < nRecords; ++i)
+        {
+            writeRecord(buffer, context, i);
+        }
+        return !buffer->failed;
+    }
+
+    // The threads format rounds of chunks into their own memory buffers,
+    // which are then written in order
+    int result = 1;
+    size_t nChunks = nThreads * CHUNKS_PER_THREAD;
+    WriteRound round;
+    round.context = context;
+    round.writeRecord = writeRecord;
+    round.buffers = (WriteBuffer*)calloc(nChunks, sizeof(WriteBuffer));
+    if (round.buffers == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu write buffers\n", nChunks);
+        return 0;
+    }
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        if (!initWriteBuffer(&round.buffers[i], -1, WRITE_BUFFER_SIZE))
+        {
+            result = 0;
+            goto out_free_buffers;
+        }
+    }
+
+    for (size_t first = 0; first < nRecords; first += nChunks * RECORDS_PER_CHUNK)
+    {
+        round.firstRecord = first;
+        round.lastRecord = nRecords - first > nChunks * RECORDS_PER_CHUNK
+            ? first + nChunks * RECORDS_PER_CHUNK
+            : nRecords;
+        size_t nTasks = (round.lastRecord - first + RECORDS_PER_CHUNK - 1) / RECORDS_PER_CHUNK;
+        if (!parallelFor(nTasks, writeChunkTask, &round))
+        {
+            result = 0;
+            goto out_free_buffers;
+        }
+        for (size_t i = 0; i < nTasks; ++i)
+        {
+            appendBytes(buffer, round.buffers[i].data, round.buffers[i].size);
+        }
+    }
+    result = !buffer->failed;
+
+out_free_buffers:
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        freeWriteBuffer(&round.buffers[i]);
+    }
+    free(round.buffers);
+    return result;
+}
+
+static size_t nodeTag(const Mesh* mesh, size_t index)
+{
+    return mesh->nodeTags != NULL ? mesh->nodeTags[index] : index + 1;
+}
+
+static void writeNodeV1(WriteBuffer* buffer, const WriteContext* context, size_t record)
+{
+    size_t nodeIndex = context->mesh->nodeIndex[record];
+    const Node* node = &context->mesh->nodes[nodeIndex];
+    appendSize(buffer, nodeTag(context->mesh, nodeIndex));
+    appendChar(buffer, ' ');
+    appendDouble(buffer, node->x, context->precision);
+    appendChar(buffer, ' ');
+    appendDouble(buffer, node->y, context->precision);
+    appendChar(buffer, ' ');
+    appendDouble(buffer, node->z, context->precision);
+    appendChar(buffer, '\n');
+}
+
+static void writeElementV1(WriteBuffer* buffer, const WriteContext* context, size_t record)
+{
+    const Mesh* mesh = context->mesh;
+    record += context->firstElement;
+    size_t first = mesh->elemOffsets[record];
+    size_t last = mesh->elemOffsets[record + 1];
+    appendSize(buffer, mesh->elemIndex[record] + 1);
+    appendChar(buffer, ' ');
+    appendSize(buffer, mesh->elemTypes[record]);
+    appendChar(buffer, ' ');
+    appendSize(buffer, mesh->elemRegPhys[record]);
+    appendChar(buffer, ' ');
+    appendSize(buffer, mesh->elemRegElem[record]);
+    appendChar(buffer, ' ');
+    appendSize(buffer, last - first);
+    for (size_t j = first; j < last; ++j)
+    {
+        appendChar(buffer, ' ');
+        appendSize(buffer, nodeTag(mesh, mesh->elemNodes[j]));
+    }
+    appendChar(buffer, '\n');
+}
+
+// In fixed-width records every field is right aligned on the width of its
+// largest value and followed by one blank, or by the line break for the last
+// one, so the offset of each record follows from the counts before it
+
+static size_t fixedElementLength(const FixedWidths* widths, const Mesh* mesh, size_t element)
+{
+    size_t nNodes = mesh->elemOffsets[element + 1] - mesh->elemOffsets[element];
+    return widths->elementRecord + nNodes * (widths->nodeTag + 1);
+}
+
+static void formatNodeFixed(char* text, const WriteContext* context, size_t record)
+{
+    const FixedWidths* widths = context->widths;
+    size_t nodeIndex = context->mesh->nodeIndex[record];
+    const Node* node = &context->mesh->nodes[nodeIndex];
+    formatPaddedSize(text, nodeTag(context->mesh, nodeIndex), widths->nodeTag);
+    text += widths->nodeTag;
+    *text++ = ' ';
+    formatPaddedDouble(text, node->x, context->precision);
+    text += FIXED_DOUBLE_WIDTH;
+    *text++ = ' ';
+    formatPaddedDouble(text, node->y, context->precision);
+    text += FIXED_DOUBLE_WIDTH;
+    *text++ = ' ';
+    formatPaddedDouble(text, node->z, context->precision);
+    text[FIXED_DOUBLE_WIDTH] = '\n';
+}
+
+static char* formatFixedField(char* text, size_t value, size_t width)
+{
+    formatPaddedSize(text, value, width);
+    text[width] = ' ';
+    return text + width + 1;
+}
+
+static void formatElementFixed(char* text, const WriteContext* context, size_t element)
+{
+    const FixedWidths* widths = context->widths;
+    const Mesh* mesh = context->mesh;
+    size_t first = mesh->elemOffsets[element];
+    size_t last = mesh->elemOffsets[element + 1];
+    text = formatFixedField(text, mesh->elemIndex[element] + 1, widths->elementTag);
+    text = formatFixedField(text, mesh->elemTypes[element], widths->type);
+    text = formatFixedField(text, mesh->elemRegPhys[element], widths->regPhys);
+    text = formatFixedField(text, mesh->elemRegElem[element], widths->regElem);
+    text = formatFixedField(text, last - first, widths->nNodes);
+    for (size_t j = first; j < last; ++j)
+    {
+        text = formatFixedField(text, nodeTag(mesh, mesh->elemNodes[j]), widths->nodeTag);
+    }
+    text[-1] = '\n';
+}
+
+static void writeNodeFixed(WriteBuffer* buffer, const WriteContext* context, size_t record)
+{
+    char* text = appendUninitialized(buffer, context->widths->nodeRecord);
+    if (text != NULL) formatNodeFixed(text, context, record);
+}
+
+static void writeElementFixed(WriteBuffer* buffer, const WriteContext* context, size_t record)
+{
+    record += context->firstElement;
+    char* text = appendUninitialized(buffer,
+        fixedElementLength(context->widths, context->mesh, record));
+    if (text != NULL) formatElementFixed(text, context, record);
+}
+
+static void computeFixedWidths(const Mesh* mesh, FixedWidths* widths)
+{
+    size_t maxNodeTag = mesh->nNodes;
+    if (mesh->nodeTags != NULL)
+    {
+        for (size_t i = 0; i < mesh->nNodes; ++i)
+        {
+            if (mesh->nodeTags[i] > maxNodeTag) maxNodeTag = mesh->nodeTags[i];
+        }
+    }
+    size_t maxElementTag = 0, maxType = 0, maxRegPhys = 0, maxRegElem = 0, maxNodes = 0;
+    for (size_t i = 0; i < mesh->nElems; ++i)
+    {
+        size_t nNodes = mesh->elemOffsets[i + 1] - mesh->elemOffsets[i];
+        if (mesh->elemIndex[i] + 1 > maxElementTag) maxElementTag = mesh->elemIndex[i] + 1;
+        if (mesh->elemTypes[i] > maxType) maxType = mesh->elemTypes[i];
+        if (mesh->elemRegPhys[i] > maxRegPhys) maxRegPhys = mesh->elemRegPhys[i];
+        if (mesh->elemRegElem[i] > maxRegElem) maxRegElem = mesh->elemRegElem[i];
+        if (nNodes > maxNodes) maxNodes = nNodes;
+    }
+
+    widths->nodeTag = countDigits(maxNodeTag);
+    widths->elementTag = countDigits(maxElementTag);
+    widths->type = countDigits(maxType);
+    widths->regPhys = countDigits(maxRegPhys);
+    widths->regElem = countDigits(maxRegElem);
+    widths->nNodes = countDigits(maxNodes);
+    widths->nodeRecord = widths->nodeTag + 3 * (FIXED_DOUBLE_WIDTH + 1) + 1;
+    widths->elementRecord = widths->elementTag + widths->type + widths->regPhys
+        + widths->regElem + widths->nNodes + 5;
+}
+
+static void writeLine(WriteBuffer* buffer, const char* text)
+{
+    appendString(buffer, text);
+    appendChar(buffer, '\n');
+}
+
+static void writeCountLine(WriteBuffer* buffer, size_t count)
+{
+    appendSize(buffer, count);
+    appendChar(buffer, '\n');
+}
+
+static int writeMshV1(WriteBuffer* buffer, const Mesh* mesh, int precision,
+    const FixedWidths* widths)
+{
+    WriteContext context = { mesh, NULL, 0, precision, widths };
+    RecordWriter writeNode = widths != NULL ? writeNodeFixed : writeNodeV1;
+    RecordWriter writeElement = widths != NULL ? writeElementFixed : writeElementV1;
+
+    writeLine(buffer, tokenTypeToValue(TOKEN_V1_NOD_START));
+    writeCountLine(buffer, mesh->nNodes);
+    if (!writeRecords(buffer, &context, mesh->nNodes, writeNode)) return 0;
+    writeLine(buffer, tokenTypeToValue(TOKEN_V1_NOD_END));
+
+    // The raw elements are copied between the decoded ones, in file order
+    writeLine(buffer, tokenTypeToValue(TOKEN_V1_ELM_START));
+    writeCountLine(buffer, mesh->nElems + mesh->nRawElems);
+    for (size_t i = 0; i <= mesh->nRawSpans; ++i)
+    {
+        size_t last = i < mesh->nRawSpans ? mesh->rawSpans[i].element : mesh->nElems;
+        if (!writeRecords(buffer, &context, last - context.firstElement, writeElement)) return 0;
+        if (i < mesh->nRawSpans)
+        {
+            appendBytes(buffer, mesh->rawSpans[i].start, mesh->rawSpans[i].length);
+        }
+        context.firstElement = last;
+    }
+    writeLine(buffer, tokenTypeToValue(TOKEN_V1_ELM_END));
+
+    return !buffer->failed;
+}
+
+typedef struct
+{
+    const WriteContext* context;
+    char* nodes;                // first node record in the mapped file
+    char* elements;             // first element record in the mapped file
+    const size_t* rawOffsets;   // bytes of the raw spans before each span
+    size_t nNodeTasks;
+    size_t nElementTasks;
+} FixedFill;
+
+static size_t fixedElementOffset(const FixedFill* fill, size_t element, size_t nRawBefore)
+{
+    const FixedWidths* widths = fill->context->widths;
+    return element * widths->elementRecord
+        + fill->context->mesh->elemOffsets[element] * (widths->nodeTag + 1)
+        + fill->rawOffsets[nRawBefore];
+}
+
+static int fillFixedTask(void* context, size_t task)
+{
+    // The tasks fill the node records, then the decoded element records,
+    // then copy one raw span each, in disjoint ranges of the file
+    const FixedFill* fill = (const FixedFill*)context;
+    const Mesh* mesh = fill->context->mesh;
+    if (task < fill->nNodeTasks)
+    {
+        size_t first = task * RECORDS_PER_CHUNK;
+        size_t last = first + RECORDS_PER_CHUNK < mesh->nNodes
+            ? first + RECORDS_PER_CHUNK
+            : mesh->nNodes;
+        for (size_t i = first; i < last; ++i)
+        {
+            formatNodeFixed(fill->nodes + i * fill->context->widths->nodeRecord,
+                fill->context, i);
+        }
+        return 1;
+    }
+
+    task -= fill->nNodeTasks;
+    if (task < fill->nElementTasks)
+    {
+        size_t first = task * RECORDS_PER_CHUNK;
+        size_t last = first + RECORDS_PER_CHUNK < mesh->nElems
+            ? first + RECORDS_PER_CHUNK
+            : mesh->nElems;
+        size_t span = 0;
+        while (span < mesh->nRawSpans && mesh->rawSpans[span].element <= first) ++span;
+        size_t offset = fixedElementOffset(fill, first, span);
+        for (size_t i = first; i < last; ++i)
+        {
+            while (span < mesh->nRawSpans && mesh->rawSpans[span].element == i)
+            {
+                offset += mesh->rawSpans[span++].length;
+            }
+            formatElementFixed(fill->elements + offset, fill->context, i);
+            offset += fixedElementLength(fill->context->widths, mesh, i);
+        }
+        return 1;
+    }
+
+    // A raw span comes before the decoded element it was read before
+    size_t span = task - fill->nElementTasks;
+    size_t element = mesh->rawSpans[span].element;
+    size_t offset = fixedElementOffset(fill, element, span);
+    memcpy(fill->elements + offset, mesh->rawSpans[span].start, mesh->rawSpans[span].length);
+    return 1;
+}
+
+static size_t writeFixedHeader(char* text, size_t size, const char* keyword, size_t count)
+{
+    return (size_t)snprintf(text, size, "%s\n%zu\n", keyword, count);
+}
+
+static int writeMshV1Fixed(WriteBuffer* buffer, const Mesh* mesh, int precision)
+{
+    FixedWidths widths;
+    computeFixedWidths(mesh, &widths);
+
+    // Only a regular file written from its start can be sized and mapped,
+    // streams get the same bytes in one pass
+    struct stat status;
+    if (buffer->fd < 0 || buffer->size > 0 || buffer->written > 0
+        || fstat(buffer->fd, &status) != 0 || !S_ISREG(status.st_mode)
+        || lseek(buffer->fd, 0, SEEK_CUR) != 0)
+    {
+        return writeMshV1(buffer, mesh, precision, &widths);
+    }
+
+    int result = 0;
+    size_t* rawOffsets = (size_t*)malloc((mesh->nRawSpans + 1) * sizeof(size_t));
+    if (rawOffsets == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu raw element spans\n",
+            mesh->nRawSpans);
+        return 0;
+    }
+    rawOffsets[0] = 0;
+    for (size_t i = 0; i < mesh->nRawSpans; ++i)
+    {
+        rawOffsets[i + 1] = rawOffsets[i] + mesh->rawSpans[i].length;
+    }
+
+    char nodHeader[MAX_SECTION_NAME + 32];
+    char elmHeader[2 * MAX_SECTION_NAME + 32];
+    char elmFooter[MAX_SECTION_NAME];
+    size_t nodHeaderLength = writeFixedHeader(nodHeader, sizeof(nodHeader),
+        tokenTypeToValue(TOKEN_V1_NOD_START), mesh->nNodes);
+    size_t elmHeaderLength = (size_t)snprintf(elmHeader, sizeof(elmHeader), "%s\n",
+        tokenTypeToValue(TOKEN_V1_NOD_END));
+    elmHeaderLength += writeFixedHeader(elmHeader + elmHeaderLength,
+        sizeof(elmHeader) - elmHeaderLength, tokenTypeToValue(TOKEN_V1_ELM_START),
+        mesh->nElems + mesh->nRawElems);
+    size_t elmFooterLength = (size_t)snprintf(elmFooter, sizeof(elmFooter), "%s\n",
+        tokenTypeToValue(TOKEN_V1_ELM_END));
+    size_t nodeBytes = mesh->nNodes * widths.nodeRecord;
+    size_t elementBytes = mesh->nElems * widths.elementRecord
+        + mesh->elemOffsets[mesh->nElems] * (widths.nodeTag + 1) + rawOffsets[mesh->nRawSpans];
+    size_t size = nodHeaderLength + nodeBytes + elmHeaderLength + elementBytes
+        + elmFooterLength;
+
+    // The blocks are allocated up front, so a full disk fails here instead of
+    // faulting while the threads fill the mapping
+    int error = posix_fallocate(buffer->fd, 0, (off_t)size);
+    if (error != 0)
+    {
+        fprintf(stderr, "Could not allocate %zu bytes for the .msh file: %s\n", size,
+            strerror(error));
+        goto out_free_offsets;
+    }
+    char* data = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %zu bytes of the .msh file: %s\n", size,
+            strerror(errno));
+        goto out_free_offsets;
+    }
+
+    WriteContext context = { mesh, NULL, 0, precision, &widths };
+    FixedFill fill;
+    fill.context = &context;
+    fill.nodes = data + nodHeaderLength;
+    fill.elements = fill.nodes + nodeBytes + elmHeaderLength;
+    fill.rawOffsets = rawOffsets;
+    fill.nNodeTasks = (mesh->nNodes + RECORDS_PER_CHUNK - 1) / RECORDS_PER_CHUNK;
+    fill.nElementTasks = (mesh->nElems + RECORDS_PER_CHUNK - 1) / RECORDS_PER_CHUNK;
+    memcpy(data, nodHeader, nodHeaderLength);
+    memcpy(fill.nodes + nodeBytes, elmHeader, elmHeaderLength);
+    memcpy(fill.elements + elementBytes, elmFooter, elmFooterLength);
+    result = parallelFor(fill.nNodeTasks + fill.nElementTasks + mesh->nRawSpans,
+        fillFixedTask, &fill);
+    if (munmap(data, size) != 0)
+    {
+        fprintf(stderr, "Could not unmap the .msh file: %s\n", strerror(errno));
+        result = 0;
+    }
+    if (result) buffer->written += size;
+
+out_free_offsets:
+    free(rawOffsets);
+    return result;
+}
+
+static int writeMshV1Patch(WriteBuffer* buffer, const Mesh* mesh, int precision,
+    const char* source)
+{
+    // Only the node records are formatted, the bytes before $NOD and from
+    // $ENDNOD on are copied from the input file
+    if (mesh->version != MSH_V1)
+    {
+        fprintf(stderr, "Only meshes read from MSH 1 files can be written by patching '%s'\n",
+            source);
+        return 0;
+    }
+    MappedFile file;
+    if (!openMappedFile(source, &file)) return 0;
+    int fd = open(source, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not open file '%s': %s\n", source, strerror(errno));
+        closeMappedFile(&file);
+        return 0;
+    }
+
+    int result = 0;
+    const char* end = file.data + file.size;
+    const char* nodStart = findKeyword(file.data, end, tokenTypeToValue(TOKEN_V1_NOD_START));
+    const char* nodEnd = nodStart != NULL
+        ? findKeyword(nodStart, end, tokenTypeToValue(TOKEN_V1_NOD_END))
+        : NULL;
+    size_t nNodes = nodStart != NULL
+        ? (size_t)strtoull(nodStart + strlen(tokenTypeToValue(TOKEN_V1_NOD_START)), NULL, 10)
+        : 0;
+    if (nodEnd == NULL || nNodes != mesh->nNodes)
+    {
+        fprintf(stderr, "File '%s' does not hold a $NOD section of %zu nodes to patch\n",
+            source, mesh->nNodes);
+        goto out_close_file;
+    }
+
+    WriteContext context = { mesh, NULL, 0, precision, NULL };
+    appendFileRange(buffer, fd, 0, (size_t)(nodStart - file.data));
+    writeLine(buffer, tokenTypeToValue(TOKEN_V1_NOD_START));
+    writeCountLine(buffer, mesh->nNodes);
+    if (!writeRecords(buffer, &context, mesh->nNodes, writeNodeV1)) goto out_close_file;
+    appendFileRange(buffer, fd, (size_t)(nodEnd - file.data), (size_t)(end - nodEnd));
+    result = !buffer->failed;
+
+out_close_file:
+    close(fd);
+    closeMappedFile(&file);
+    return result;
+}
+
+typedef struct
+{
+    size_t nEntities;
+    const Entity* entities;     // entities sorted by dimension
+    Entity* ownEntities;        // entities built from the elements, if any
+    double (*boxes)[6];         // bounding boxes of the entities around the nodes
+    size_t nBlocks;
+    const NodeBlock* blocks;
+    NodeBlock* ownBlocks;       // node blocks built from the elements, if any
+    const size_t* order;        // node indexes in the order of the node blocks
+    size_t* ownOrder;
+} Layout;
+
+static void freeLayout(Layout* layout)
+{
+    for (size_t i = 0; layout->ownEntities != NULL && i < layout->nEntities; ++i)
+    {
+        free(layout->ownEntities[i].physicals);
+    }
+    free(layout->ownEntities);
+    free(layout->boxes);
+    free(layout->ownBlocks);
+    free(layout->ownOrder);
+}
+
+static int compareEntities(const void* a, const void* b)
+{
+    const Entity* entityA = (const Entity*)a;
+    const Entity* entityB = (const Entity*)b;
+    if (entityA->dim != entityB->dim) return entityA->dim < entityB->dim ? -1 : 1;
+    if (entityA->tag != entityB->tag) return entityA->tag < entityB->tag ? -1 : 1;
+    return 0;
+}
+
+static Entity* addEntity(Layout* layout, size_t* capacity, int dim, int tag)
+{
+    if (layout->nEntities == *capacity)
+    {
+        size_t newCapacity = *capacity > 0 ? 2 * *capacity : 16;
+        Entity* entities = (Entity*)realloc(layout->ownEntities, newCapacity * sizeof(Entity));
+        if (entities == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory for %zu entities\n", newCapacity);
+            return NULL;
+        }
+        layout->ownEntities = entities;
+        layout->entities = entities;
+        *capacity = newCapacity;
+    }
+
+    Entity* entity = &layout->ownEntities[layout->nEntities++];
+    memset(entity, 0, sizeof(Entity));
+    entity->dim = dim;
+    entity->tag = tag;
+    return entity;
+}
+
+static int addPhysical(Entity* entity, int physical)
+{
+    for (size_t i = 0; i < entity->nPhysicals; ++i)
+    {
+        if (entity->physicals[i] == physical) return 1;
+    }
+
+    int* physicals = (int*)realloc(entity->physicals, (entity->nPhysicals + 1) * sizeof(int));
+    if (physicals == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu physical tags\n",
+            entity->nPhysicals + 1);
+        return 0;
+    }
+    physicals[entity->nPhysicals++] = physical;
+    entity->physicals = physicals;
+    return 1;
+}
+
+static int buildEntities(const Mesh* mesh, Layout* layout)
+{
+    // Meshes read from MSH v1 have no entities, one is created for each pair
+    // of element dimension and element region, with the physical regions of
+    // its elements as physical tags
+    size_t capacity = 0;
+    Entity* entity = NULL;
+    for (size_t i = 0; i < mesh->nElems; ++i)
+    {
+        unsigned int type = mesh->elemTypes[i];
+        size_t nNodes = mesh->elemOffsets[i + 1] - mesh->elemOffsets[i];
+        int dim = elementTypeDim(type);
+        if (dim < 0 || nNodes != elementTypes[type].nNodes)
+        {
+            fprintf(stderr, "Element type %u with %zu nodes not supported by MSH 4.1\n",
+                type, nNodes);
+            return 0;
+        }
+
+        int tag = (int)mesh->elemRegElem[i];
+        if (entity == NULL || entity->dim != dim || entity->tag != tag)
+        {
+            entity = (Entity*)findEntity(layout->ownEntities, layout->nEntities, dim, tag);
+            if (entity == NULL) entity = addEntity(layout, &capacity, dim, tag);
+            if (entity == NULL) return 0;
+        }
+        unsigned int regPhys = mesh->elemRegPhys[i];
+        if (regPhys != 0 && !addPhysical(entity, (int)regPhys)) return 0;
+    }
+
+    // Every node belongs to an entity, nodes without elements go to the last one
+    if (layout->nEntities == 0 && mesh->nNodes > 0 && addEntity(layout, &capacity, 3, 1) == NULL)
+    {
+        return 0;
+    }
+
+    if (layout->nEntities > 0)
+    {
+        qsort(layout->ownEntities, layout->nEntities, sizeof(Entity), compareEntities);
+    }
+    return 1;
+}
+
+static int buildNodeBlocks(const Mesh* mesh, Layout* layout)
+{
+    // Each node is classified on the lowest dimension entity of its elements,
+    // as Gmsh does for the nodes on the boundary of an entity
+    int result = 1;
+    size_t* nodeEntity = (size_t*)malloc(mesh->nNodes * sizeof(size_t));
+    size_t* offsets = (size_t*)calloc(layout->nEntities + 1, sizeof(size_t));
+    layout->ownBlocks = (NodeBlock*)malloc((layout->nEntities + 1) * sizeof(NodeBlock));
+    layout->ownOrder = (size_t*)malloc((mesh->nNodes + 1) * sizeof(size_t));
+    if (nodeEntity == NULL || offsets == NULL || layout->ownBlocks == NULL
+        || layout->ownOrder == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for the node blocks of %zu nodes\n",
+            mesh->nNodes);
+        result = 0;
+        goto out_free_arrays;
+    }
+    for (size_t i = 0; i < mesh->nNodes; ++i) nodeEntity[i] = layout->nEntities - 1;
+
+    const Entity* entity = NULL;
+    for (size_t i = 0; i < mesh->nElems; ++i)
+    {
+        int dim = elementTypes[mesh->elemTypes[i]].dim;
+        int tag = (int)mesh->elemRegElem[i];
+        if (entity == NULL || entity->dim != dim || entity->tag != tag)
+        {
+            entity = findEntity(layout->entities, layout->nEntities, dim, tag);
+        }
+
+        size_t index = (size_t)(entity - layout->entities);
+        for (size_t j = mesh->elemOffsets[i]; j < mesh->elemOffsets[i + 1]; ++j)
+        {
+            size_t node = mesh->elemNodes[j];
+            if (node >= mesh->nNodes)
+            {
+                fprintf(stderr, "Node index %zu of element %zu out of bounds\n",
+                    node + 1, mesh->elemIndex[i] + 1);
+                result = 0;
+                goto out_free_arrays;
+            }
+            const Entity* current = &layout->entities[nodeEntity[node]];
+            if (dim < current->dim || (dim == current->dim && index < nodeEntity[node]))
+            {
+                nodeEntity[node] = index;
+            }
+        }
+    }
+
+    // Group the node records by entity, keeping their relative order
+    for (size_t i = 0; i < mesh->nNodes; ++i) ++offsets[nodeEntity[mesh->nodeIndex[i]] + 1];
+    layout->nBlocks = 0;
+    for (size_t i = 0; i < layout->nEntities; ++i)
+    {
+        size_t count = offsets[i + 1];
+        if (count > 0)
+        {
+            NodeBlock* block = &layout->ownBlocks[layout->nBlocks++];
+            block->dim = layout->entities[i].dim;
+            block->tag = layout->entities[i].tag;
+            block->count = count;
+        }
+        offsets[i + 1] += offsets[i];
+    }
+    for (size_t i = 0; i < mesh->nNodes; ++i)
+    {
+        size_t node = mesh->nodeIndex[i];
+        layout->ownOrder[offsets[nodeEntity[node]]++] = node;
+    }
+    layout->blocks = layout->ownBlocks;
+    layout->order = layout->ownOrder;
+
+out_free_arrays:
+    free(offsets);
+    free(nodeEntity);
+    return result;
+}
+
+static void expandBox(double* box, const Node* node)
+{
+    if (node->x < box[0]) box[0] = node->x;
+    if (node->y < box[1]) box[1] = node->y;
+    if (node->z < box[2]) box[2] = node->z;
+    if (node->x > box[3]) box[3] = node->x;
+    if (node->y > box[4]) box[4] = node->y;
+    if (node->z > box[5]) box[5] = node->z;
+}
+
+static int computeBoxes(const Mesh* mesh, Layout* layout)
+{
+    // The nodes may have moved since the mesh was read, so the boxes are
+    // computed again from the nodes and the elements of each entity
+    layout->boxes = (double(*)[6])malloc((layout->nEntities + 1) * sizeof(double[6]));
+    if (layout->boxes == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu bounding boxes\n", layout->nEntities);
+        return 0;
+    }
+    for (size_t i = 0; i < layout->nEntities; ++i)
+    {
+        for (size_t k = 0; k < 3; ++k)
+        {
+            layout->boxes[i][k] = HUGE_VAL;
+            layout->boxes[i][k + 3] = -HUGE_VAL;
+        }
+    }
+
+    size_t record = 0;
+    for (size_t i = 0; i < layout->nBlocks; ++i)
+    {
+        const NodeBlock* block = &layout->blocks[i];
+        const Entity* entity = findEntity(layout->entities, layout->nEntities,
+            block->dim, block->tag);
+        for (size_t j = 0; entity != NULL && j < block->count; ++j)
+        {
+            expandBox(layout->boxes[entity - layout->entities],
+                &mesh->nodes[layout->order[record + j]]);
+        }
+        record += block->count;
+    }
+
+    const Entity* entity = NULL;
+    for (size_t i = 0; i < mesh->nElems; ++i)
+    {
+        int dim = elementTypeDim(mesh->elemTypes[i]);
+        int tag = (int)mesh->elemRegElem[i];
+        if (entity == NULL || entity->dim != dim || entity->tag != tag)
+        {
+            entity = findEntity(layout->entities, layout->nEntities, dim, tag);
+            if (entity == NULL) continue;
+        }
+        double* box = layout->boxes[entity - layout->entities];
+        for (size_t j = mesh->elemOffsets[i]; j < mesh->elemOffsets[i + 1]; ++j)
+        {
+            size_t node = mesh->elemNodes[j];
+            if (node < mesh->nNodes) expandBox(box, &mesh->nodes[node]);
+        }
+    }
+
+    // Entities without nodes keep the box they were read with
+    for (size_t i = 0; i < layout->nEntities; ++i)
+    {
+        if (layout->boxes[i][0] > layout->boxes[i][3])
+        {
+            memcpy(layout->boxes[i], layout->entities[i].box, sizeof(double[6]));
+        }
+    }
+
+    return 1;
+}
+
+static int buildLayout(const Mesh* mesh, Layout* layout)
+{
+    memset(layout, 0, sizeof(Layout));
+    if (mesh->nodeBlocks != NULL)
+    {
+        // Write back the layout of the MSH 4.1 file the mesh was read from
+        layout->nEntities = mesh->nEntities;
+        layout->entities = mesh->entities;
+        layout->nBlocks = mesh->nNodeBlocks;
+        layout->blocks = mesh->nodeBlocks;
+        layout->order = mesh->nodeIndex;
+    }
+    else
+    {
+        if (!buildEntities(mesh, layout)) return 0;
+        if (!buildNodeBlocks(mesh, layout)) return 0;
+    }
+
+    return computeBoxes(mesh, layout);
+}
+
+static void writeTags(WriteBuffer* buffer, size_t count, const int* tags)
+{
+    appendChar(buffer, ' ');
+    appendSize(buffer, count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        appendChar(buffer, ' ');
+        appendInt(buffer, tags[i]);
+    }
+}
+
+static void writeEntities(WriteBuffer* buffer, const Layout* layout, int precision)
+{
+    size_t counts[4] = { 0 };
+    for (size_t i = 0; i < layout->nEntities; ++i)
+    {
+        ++counts[layout->entities[i].dim];
+    }
+
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_ENTITIES_START));
+    for (int dim = 0; dim < 4; ++dim)
+    {
+        appendSize(buffer, counts[dim]);
+        appendChar(buffer, dim < 3 ? ' ' : '\n');
+    }
+    for (size_t i = 0; i < layout->nEntities; ++i)
+    {
+        // Points have a position, the other entities a bounding box
+        const Entity* entity = &layout->entities[i];
+        size_t nCoords = entity->dim == 0 ? 3 : 6;
+        appendInt(buffer, entity->tag);
+        for (size_t k = 0; k < nCoords; ++k)
+        {
+            appendChar(buffer, ' ');
+            appendDouble(buffer, layout->boxes[i][k], precision);
+        }
+        writeTags(buffer, entity->nPhysicals, entity->physicals);
+        if (entity->dim > 0) writeTags(buffer, entity->nBounding, entity->bounding);
+        appendChar(buffer, '\n');
+    }
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_ENTITIES_END));
+}
+
+static void tagRange(size_t count, const size_t* indexes, const size_t* tags, size_t range[2])
+{
+    // Without tags, the tag of an index is the index plus 1
+    range[0] = 0;
+    range[1] = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t tag = tags != NULL ? tags[indexes[i]] : indexes[i] + 1;
+        if (i == 0 || tag < range[0]) range[0] = tag;
+        if (tag > range[1]) range[1] = tag;
+    }
+}
+
+static void writeTagsHeader(WriteBuffer* buffer, size_t nBlocks, size_t count,
+    const size_t* indexes, const size_t* tags)
+{
+    // Number of blocks and of records, then the range of their tags
+    size_t range[2];
+    tagRange(count, indexes, tags, range);
+    appendSize(buffer, nBlocks);
+    appendChar(buffer, ' ');
+    appendSize(buffer, count);
+    appendChar(buffer, ' ');
+    appendSize(buffer, range[0]);
+    appendChar(buffer, ' ');
+    appendSize(buffer, range[1]);
+    appendChar(buffer, '\n');
+}
+
+static void writeNodeTagV41(WriteBuffer* buffer, const WriteContext* context, size_t record)
+{
+    appendSize(buffer, nodeTag(context->mesh, context->indexes[record]));
+    appendChar(buffer, '\n');
+}
+
+static void writeNodeV41(WriteBuffer* buffer, const WriteContext* context, size_t record)
+{
+    const Node* node = &context->mesh->nodes[context->indexes[record]];
+    appendDouble(buffer, node->x, context->precision);
+    appendChar(buffer, ' ');
+    appendDouble(buffer, node->y, context->precision);
+    appendChar(buffer, ' ');
+    appendDouble(buffer, node->z, context->precision);
+    appendChar(buffer, '\n');
+}
+
+static int writeNodes(WriteBuffer* buffer, const Mesh* mesh, const Layout* layout, int precision)
+{
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_NODES_START));
+    writeTagsHeader(buffer, layout->nBlocks, mesh->nNodes, mesh->nodeIndex, mesh->nodeTags);
+    WriteContext context = { mesh, layout->order, 0, precision, NULL };
+    for (size_t i = 0; i < layout->nBlocks; ++i)
+    {
+        // Tags of the block followed by their coordinates
+        const NodeBlock* block = &layout->blocks[i];
+        appendInt(buffer, block->dim);
+        appendChar(buffer, ' ');
+        appendInt(buffer, block->tag);
+        appendString(buffer, " 0 ");
+        writeCountLine(buffer, block->count);
+        if (!writeRecords(buffer, &context, block->count, writeNodeTagV41)) return 0;
+        if (!writeRecords(buffer, &context, block->count, writeNodeV41)) return 0;
+        context.indexes += block->count;
+    }
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_NODES_END));
+
+    return 1;
+}
+
+static size_t elementBlockEnd(const Mesh* mesh, size_t start)
+{
+    // A block is a run of consecutive elements with the same type and region
+    size_t end = start + 1;
+    while (end < mesh->nElems && mesh->elemTypes[end] == mesh->elemTypes[start]
+        && mesh->elemRegElem[end] == mesh->elemRegElem[start])
+    {
+        ++end;
+    }
+
+    return end;
+}
+
+static void writeElementV41(WriteBuffer* buffer, const WriteContext* context, size_t record)
+{
+    const Mesh* mesh = context->mesh;
+    size_t elem = context->firstElement + record;
+    appendSize(buffer, mesh->elemIndex[elem] + 1);
+    for (size_t j = mesh->elemOffsets[elem]; j < mesh->elemOffsets[elem + 1]; ++j)
+    {
+        appendChar(buffer, ' ');
+        appendSize(buffer, nodeTag(mesh, mesh->elemNodes[j]));
+    }
+    appendChar(buffer, '\n');
+}
+
+static int writeElements(WriteBuffer* buffer, const Mesh* mesh)
+{
+    size_t nBlocks = 0;
+    for (size_t i = 0; i < mesh->nElems; i = elementBlockEnd(mesh, i)) ++nBlocks;
+
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_ELEMENTS_START));
+    writeTagsHeader(buffer, nBlocks, mesh->nElems, mesh->elemIndex, NULL);
+    WriteContext context = { mesh, NULL, 0, 0, NULL };
+    for (size_t start = 0; start < mesh->nElems;)
+    {
+        size_t end = elementBlockEnd(mesh, start);
+        appendInt(buffer, elementTypeDim(mesh->elemTypes[start]));
+        appendChar(buffer, ' ');
+        appendSize(buffer, mesh->elemRegElem[start]);
+        appendChar(buffer, ' ');
+        appendSize(buffer, mesh->elemTypes[start]);
+        appendChar(buffer, ' ');
+        writeCountLine(buffer, end - start);
+
+        context.firstElement = start;
+        if (!writeRecords(buffer, &context, end - start, writeElementV41)) return 0;
+        start = end;
+    }
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_ELEMENTS_END));
+
+    return 1;
+}
+
+static void writeBinary(WriteBuffer* buffer, const void* values, size_t size, size_t count)
+{
+    appendBytes(buffer, (const char*)values, size * count);
+}
+
+static void writeEntitiesBinary(WriteBuffer* buffer, const Layout* layout)
+{
+    size_t counts[4] = { 0 };
+    for (size_t i = 0; i < layout->nEntities; ++i)
+    {
+        ++counts[layout->entities[i].dim];
+    }
+
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_ENTITIES_START));
+    writeBinary(buffer, counts, sizeof(size_t), 4);
+    for (size_t i = 0; i < layout->nEntities; ++i)
+    {
+        // Points have a position, the other entities a bounding box
+        const Entity* entity = &layout->entities[i];
+        writeBinary(buffer, &entity->tag, sizeof(int), 1);
+        writeBinary(buffer, layout->boxes[i], sizeof(double), entity->dim == 0 ? 3 : 6);
+        writeBinary(buffer, &entity->nPhysicals, sizeof(size_t), 1);
+        writeBinary(buffer, entity->physicals, sizeof(int), entity->nPhysicals);
+        if (entity->dim > 0)
+        {
+            writeBinary(buffer, &entity->nBounding, sizeof(size_t), 1);
+            writeBinary(buffer, entity->bounding, sizeof(int), entity->nBounding);
+        }
+    }
+    appendChar(buffer, '\n');
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_ENTITIES_END));
+}
+
+static void writeBinaryHeader(WriteBuffer* buffer, size_t nBlocks, size_t count,
+    const size_t* indexes, const size_t* tags)
+{
+    // Number of blocks and of records, then the range of their tags
+    size_t header[4] = { nBlocks, count, 0, 0 };
+    tagRange(count, indexes, tags, &header[2]);
+    writeBinary(buffer, header, sizeof(size_t), 4);
+}
+
+static int writeNodesBinary(WriteBuffer* buffer, const Mesh* mesh, const Layout* layout)
+{
+    size_t maxCount = 0;
+    for (size_t i = 0; i < layout->nBlocks; ++i)
+    {
+        if (layout->blocks[i].count > maxCount) maxCount = layout->blocks[i].count;
+    }
+
+    // Tags and coordinates of a block are gathered to write each of them at once
+    size_t* tags = (size_t*)malloc((maxCount + 1) * sizeof(size_t));
+    Node* nodes = (Node*)malloc((maxCount + 1) * sizeof(Node));
+    if (tags == NULL || nodes == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a block of %zu nodes\n", maxCount);
+        free(tags);
+        free(nodes);
+        return 0;
+    }
+
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_NODES_START));
+    writeBinaryHeader(buffer, layout->nBlocks, mesh->nNodes, mesh->nodeIndex, mesh->nodeTags);
+    const size_t* order = layout->order;
+    for (size_t i = 0; i < layout->nBlocks; ++i)
+    {
+        const NodeBlock* block = &layout->blocks[i];
+        int blockHeader[3] = { block->dim, block->tag, 0 };
+        writeBinary(buffer, blockHeader, sizeof(int), 3);
+        writeBinary(buffer, &block->count, sizeof(size_t), 1);
+        for (size_t j = 0; j < block->count; ++j)
+        {
+            tags[j] = nodeTag(mesh, order[j]);
+            nodes[j] = mesh->nodes[order[j]];
+        }
+        writeBinary(buffer, tags, sizeof(size_t), block->count);
+        writeBinary(buffer, nodes, sizeof(Node), block->count);
+        order += block->count;
+    }
+    appendChar(buffer, '\n');
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_NODES_END));
+
+    free(nodes);
+    free(tags);
+    return 1;
+}
+
+static int writeElementsBinary(WriteBuffer* buffer, const Mesh* mesh)
+{
+    size_t nBlocks = 0;
+    size_t maxCount = 0;
+    for (size_t i = 0; i < mesh->nElems;)
+    {
+        size_t end = elementBlockEnd(mesh, i);
+        if (end - i > maxCount) maxCount = end - i;
+        ++nBlocks;
+        i = end;
+    }
+
+    // Each element is its tag followed by its node tags, a block is gathered
+    // to write it at once
+    size_t* values = (size_t*)malloc((maxCount * (MAX_ELEM_NODES + 1) + 1) * sizeof(size_t));
+    if (values == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a block of %zu elements\n", maxCount);
+        return 0;
+    }
+
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_ELEMENTS_START));
+    writeBinaryHeader(buffer, nBlocks, mesh->nElems, mesh->elemIndex, NULL);
+    for (size_t start = 0; start < mesh->nElems;)
+    {
+        size_t end = elementBlockEnd(mesh, start);
+        int blockHeader[3] = { elementTypeDim(mesh->elemTypes[start]),
+            (int)mesh->elemRegElem[start], (int)mesh->elemTypes[start] };
+        size_t count = end - start;
+        writeBinary(buffer, blockHeader, sizeof(int), 3);
+        writeBinary(buffer, &count, sizeof(size_t), 1);
+
+        size_t nValues = 0;
+        for (size_t i = start; i < end; ++i)
+        {
+            values[nValues++] = mesh->elemIndex[i] + 1;
+            for (size_t j = mesh->elemOffsets[i]; j < mesh->elemOffsets[i + 1]; ++j)
+            {
+                values[nValues++] = nodeTag(mesh, mesh->elemNodes[j]);
+            }
+        }
+        writeBinary(buffer, values, sizeof(size_t), nValues);
+        start = end;
+    }
+    appendChar(buffer, '\n');
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_ELEMENTS_END));
+
+    free(values);
+    return 1;
+}
+
+static int writeMshV41(WriteBuffer* buffer, const Mesh* mesh, int binary, int precision)
+{
+    if (mesh->nRawElems > 0)
+    {
+        fprintf(stderr, "The %zu elements kept as MSH 1 text can only be written as MSH 1\n",
+            mesh->nRawElems);
+        return 0;
+    }
+
+    Layout layout;
+    if (!buildLayout(mesh, &layout))
+    {
+        freeLayout(&layout);
+        return 0;
+    }
+
+    // Binary files store the integer 1 after the header so the reader can
+    // detect the byte order
+    int result = 1;
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_MESH_FORMAT_START));
+    appendString(buffer, binary ? "4.1 1 " : "4.1 0 ");
+    writeCountLine(buffer, binary ? sizeof(size_t) : sizeof(double));
+    if (binary)
+    {
+        int one = 1;
+        writeBinary(buffer, &one, sizeof(int), 1);
+        appendChar(buffer, '\n');
+    }
+    writeLine(buffer, tokenTypeToValue(TOKEN_V4_MESH_FORMAT_END));
+    if (mesh->physicalNames != NULL)
+    {
+        writeLine(buffer, tokenTypeToValue(TOKEN_V4_PHYSICAL_NAMES_START));
+        appendString(buffer, mesh->physicalNames);
+        writeLine(buffer, tokenTypeToValue(TOKEN_V4_PHYSICAL_NAMES_END));
+    }
+    if (binary)
+    {
+        writeEntitiesBinary(buffer, &layout);
+        result = writeNodesBinary(buffer, mesh, &layout) && writeElementsBinary(buffer, mesh);
+    }
+    else
+    {
+        writeEntities(buffer, &layout, precision);
+        result = writeNodes(buffer, mesh, &layout, precision) && writeElements(buffer, mesh);
+    }
+
+    freeLayout(&layout);
+    return result && !buffer->failed;
+}
+
+static int parseMsh(Tokenizer* tokenizer, const char* name, Mesh* mesh,
+    const ElementFilter* elementFilter)
+{
+    // The version is read ahead from the start of the input, which a stream
+    // holds in its buffer
+    Tokenizer probe;
+    initTokenizerBuffer(&probe, tokenizer->current, (size_t)(tokenizer->end - tokenizer->current));
+    Parser parser = { 0 };
+    parser.tokenizer = tokenizer;
+    parser.version = detectMshVersion(&probe);
+    freeTokenizer(&probe);
+
+    // Only MSH 1 elements are one per line, so only they can be kept as text.
+    // The raw text of a stream is gone once read, so it decodes everything
+    if (parser.version == MSH_V1 && tokenizer->fd == -1) parser.elementFilter = elementFilter;
+    int result = 0;
+    switch (parser.version)
+    {
+    case MSH_V1:
+        result = parseMshV1(&parser, mesh);
+        break;
+    case MSH_V41_BINARY:
+        if (tokenizer->fd != -1)
+        {
+            fprintf(stderr, "Binary MSH 4.1 '%s' can only be read from a regular file\n", name);
+            break;
+        }
+        result = parseMshV41(&parser, mesh);
+        break;
+    case MSH_V41:
+        result = parseMshV41(&parser, mesh);
+        break;
+    case MSH_UNKNOWN_VERSION:
+    default:
+        fprintf(stderr, "Unsupported or unknown MSH version in file '%s'\n", name);
+    }
+
+    if (result) mesh->version = parser.version;
+    freeConnectivity(&parser.connectivity);
+    freeRawSpans(&parser.rawSpans);
+    freeTagMap(&parser.nodeMap);
+    return result;
+}
+
+static void printParseRate(const char* name, size_t size, double startTime)
+{
+    double elapsed = wallClock() - startTime;
+    double megabytes = (double)size / (1024.0 * 1024.0);
+    printf("Parsed .msh file '%s': %.1f MB in %.3f s (%.1f MB/s)\n",
+        name, megabytes, elapsed, elapsed > 0.0 ? megabytes / elapsed : 0.0);
+}
+
+static int parseMshFile(const char* filename, Mesh* mesh, const ElementFilter* elementFilter)
+{
+    // The tokenizer reads straight from the mapped pages, so the file content
+    // is never copied into a separate buffer
+    MappedFile file;
+    if (!openMappedFile(filename, &file))
+    {
+        fprintf(stderr, "Could not read .msh file '%s'\n", filename);
+        return 0;
+    }
+
+    double startTime = wallClock();
+    Tokenizer tokenizer;
+    initTokenizerBuffer(&tokenizer, file.data, file.size);
+    int result = parseMsh(&tokenizer, filename, mesh, elementFilter);
+    if (result)
+    {
+        // The raw elements point into the mapped file, which the mesh now owns
+        if (mesh->nRawSpans > 0)
+        {
+            mesh->rawSource = file;
+            file.data = NULL;
+        }
+        printParseRate(filename, file.size, startTime);
+    }
+    else
+    {
+        freeMesh(mesh);
+    }
+    closeMappedFile(&file);
+    freeTokenizer(&tokenizer);
+    return result;
+}
+
+int readMshStream(int fd, const char* name, Mesh* mesh)
+{
+    double startTime = wallClock();
+    Tokenizer tokenizer;
+    if (!initTokenizerStream(&tokenizer, fd, TOKENIZER_STREAM_SIZE)) return 0;
+
+    int result = parseMsh(&tokenizer, name, mesh, NULL);
+    if (result)
+    {
+        printParseRate(name, tokenizer.position + (size_t)(tokenizer.end - tokenizer.source),
+            startTime);
+    }
+    else
+    {
+        freeMesh(mesh);
+    }
+    freeTokenizer(&tokenizer);
+    return result;
+}
+
+int isMshStream(const char* filename)
+{
+    struct stat st;
+    if (strcmp(filename, MSH_STREAM_PATH) == 0) return 1;
+    return stat(filename, &st) == 0 && !S_ISREG(st.st_mode);
+}
+
+static int readMshPath(const char* filename, Mesh* mesh, const ElementFilter* elementFilter)
+{
+    if (!isMshStream(filename)) return parseMshFile(filename, mesh, elementFilter);
+    if (strcmp(filename, MSH_STREAM_PATH) == 0)
+    {
+        return readMshStream(STDIN_FILENO, "standard input", mesh);
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not open .msh file '%s': %s\n", filename, strerror(errno));
+        return 0;
+    }
+    int result = readMshStream(fd, filename, mesh);
+    close(fd);
+    return result;
+}
+
+int readMshFile(const char* filename, Mesh* mesh)
+{
+    MshReadOptions options = { 0, NULL };
+    return readMshFileWithOptions(filename, mesh, &options);
+}
+
+int readMshFileWithOptions(const char* filename, Mesh* mesh, const MshReadOptions* options)
+{
+    // A stream can only be read once, it never has a snapshot
+    if (!options->useSnapshot || isMshStream(filename))
+    {
+        return readMshPath(filename, mesh, options->elementFilter);
+    }
+
+    // Without a snapshot path or an identified source, the file is only parsed
+    char snapshotFile[MAX_PATH_LENGTH + sizeof(SNAPSHOT_EXTENSION)];
+    SnapshotSource source;
+    double startTime = wallClock();
+    if (snprintf(snapshotFile, sizeof(snapshotFile), "%s%s", filename, SNAPSHOT_EXTENSION)
+        >= (int)sizeof(snapshotFile) || !getSnapshotSource(filename, &source))
+    {
+        return readMshPath(filename, mesh, options->elementFilter);
+    }
+
+    if (loadMeshSnapshot(snapshotFile, &source, mesh))
+    {
+        printf("Loaded .msh file '%s' from snapshot '%s' in %.3f s\n",
+            filename, snapshotFile, wallClock() - startTime);
+        return 1;
+    }
+
+    // The snapshot holds the whole mesh, so every element is decoded for it
+    if (!parseMshFile(filename, mesh, NULL)) return 0;
+
+    // The snapshot only saves time on the next runs, the mesh is valid without it
+    if (!saveMeshSnapshot(snapshotFile, &source, mesh))
+    {
+        fprintf(stderr, "Could not write mesh snapshot '%s', continuing without it\n",
+            snapshotFile);
+    }
+    return 1;
+}
+
+static int writeMsh(int fd, const char* name, const Mesh* mesh, const MshWriteOptions* options,
+    size_t* written)
+{
+    // The text is formatted in memory and written with large write calls
+    WriteBuffer buffer;
+    if (!initWriteBuffer(&buffer, fd, WRITE_BUFFER_SIZE)) return 0;
+
+    int result = 0;
+    if (options->patchSource != NULL && options->version != MSH_V1)
+    {
+        fprintf(stderr, "Only MSH 1 files can be written by patching their nodes\n");
+    }
+    else if (options->fixedWidth && options->version != MSH_V1)
+    {
+        fprintf(stderr, "Only MSH 1 files can be written with fixed-width records\n");
+    }
+    else switch (options->version)
+    {
+    case MSH_V1:
+        if (options->patchSource != NULL)
+        {
+            result = writeMshV1Patch(&buffer, mesh, options->precision, options->patchSource);
+        }
+        else if (options->fixedWidth)
+        {
+            result = writeMshV1Fixed(&buffer, mesh, options->precision);
+        }
+        else
+        {
+            result = writeMshV1(&buffer, mesh, options->precision, NULL);
+        }
+        break;
+    case MSH_V41:
+        result = writeMshV41(&buffer, mesh, 0, options->precision);
+        break;
+    case MSH_V41_BINARY:
+        result = writeMshV41(&buffer, mesh, 1, options->precision);
+        break;
+    case MSH_UNKNOWN_VERSION:
+    default:
+        fprintf(stderr, "Unsupported or unknown MSH version for writing file '%s'\n", name);
+    }
+    if (!flushWriteBuffer(&buffer)) result = 0;
+    *written = buffer.written;
+    freeWriteBuffer(&buffer);
+    return result;
+}
+
+static void printWriteResult(const char* name, int result, size_t written, double startTime)
+{
+    if (result)
+    {
+        double elapsed = wallClock() - startTime;
+        double megabytes = (double)written / (1024.0 * 1024.0);
+        printf("Wrote .msh file '%s': %.1f MB in %.3f s (%.1f MB/s)\n",
+            name, megabytes, elapsed, elapsed > 0.0 ? megabytes / elapsed : 0.0);
+    }
+    else
+    {
+        fprintf(stderr, "Could not write .msh file '%s'\n", name);
+    }
+}
+
+int writeMshStream(int fd, const char* name, const Mesh* mesh, const MshWriteOptions* options)
+{
+    double startTime = wallClock();
+    size_t written = 0;
+    int result = writeMsh(fd, name, mesh, options, &written);
+    printWriteResult(name, result, written, startTime);
+    return result;
+}
+
+int writeMshFileWithOptions(const char* filename, const Mesh* mesh,
+    const MshWriteOptions* options)
+{
+    if (strcmp(filename, MSH_STREAM_PATH) == 0)
+    {
+        return writeMshStream(STDOUT_FILENO, "standard output", mesh, options);
+    }
+
+    // A file that copies parts of the input is written next to the output and
+    // renamed once complete, so the output can replace the input itself. A
+    // stream, e.g. a FIFO, is written in place
+    int replace = (options->patchSource != NULL || mesh->nRawElems > 0)
+        && !isMshStream(filename);
+    size_t length = strlen(filename) + 64;
+    char* outputFilename = (char*)malloc(length);
+    if (outputFilename == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for the path of '%s'\n", filename);
+        return 0;
+    }
+    if (replace) temporaryPath(outputFilename, length, filename);
+    else snprintf(outputFilename, length, "%s", filename);
+
+    int result = 0;
+    size_t written = 0;
+    double startTime = wallClock();
+    // Fixed-width records are written through a shared mapping of the file,
+    // which needs it open for reading too
+    int access = options->fixedWidth && !isMshStream(filename) ? O_RDWR : O_WRONLY;
+    int fd = open(outputFilename, access | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not create or open .msh file '%s': %s\n",
+            outputFilename, strerror(errno));
+        goto out_free_filename;
+    }
+
+    result = writeMsh(fd, filename, mesh, options, &written);
+    if (close(fd) != 0)
+    {
+        fprintf(stderr, "Could not close .msh file '%s': %s\n", outputFilename, strerror(errno));
+        result = 0;
+    }
+    if (result && replace && rename(outputFilename, filename) != 0)
+    {
+        fprintf(stderr, "Could not replace .msh file '%s': %s\n", filename, strerror(errno));
+        result = 0;
+    }
+    if (!result && replace) remove(outputFilename);
+
+out_free_filename:
+    free(outputFilename);
+    printWriteResult(filename, result, written, startTime);
+    return result;
+}
+
+int writeMshFile(const char* filename, const Mesh* mesh, MSHVersion version)
+{
+    MshWriteOptions options = { version, SHORTEST_PRECISION, NULL, 0 };
+    return writeMshFileWithOptions(filename, mesh, &options);
+}
+
+typedef struct
+{
+    const WriteContext* context;
+    char* records;              // first node record in the mapped file
+    size_t recordLength;        // bytes of a node record, line break included
+    size_t tagWidth;            // characters of the node tags
+    int update;                 // 0 checks the records, 1 formats their coordinates
+} NodeUpdate;
+
+static int isFixedNodeRecord(const NodeUpdate* update, const char* record, size_t tag)
+{
+    // Blanks, then the digits of the tag, then a blank or a line break after
+    // each coordinate field
+    size_t i = 0;
+    while (i < update->tagWidth && record[i] == ' ') ++i;
+    if (i == update->tagWidth) return 0;
+    size_t value = 0;
+    for (; i < update->tagWidth; ++i)
+    {
+        if (!isdigit((unsigned char)record[i])) return 0;
+        value = value * 10 + (size_t)(record[i] - '0');
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+        char separator = record[update->tagWidth + (size_t)k * (FIXED_DOUBLE_WIDTH + 1)];
+        if (separator != ' ') return 0;
+    }
+
+    return record[update->recordLength - 1] == '\n' && value == tag;
+}
+
+static int updateNodesTask(void* context, size_t task)
+{
+    const NodeUpdate* update = (const NodeUpdate*)context;
+    const Mesh* mesh = update->context->mesh;
+    size_t first = task * RECORDS_PER_CHUNK;
+    size_t last = first + RECORDS_PER_CHUNK < mesh->nNodes
+        ? first + RECORDS_PER_CHUNK
+        : mesh->nNodes;
+    for (size_t i = first; i < last; ++i)
+    {
+        char* record = update->records + i * update->recordLength;
+        size_t nodeIndex = mesh->nodeIndex[i];
+        if (!update->update)
+        {
+            if (!isFixedNodeRecord(update, record, nodeTag(mesh, nodeIndex))) return 0;
+            continue;
+        }
+        const Node* node = &mesh->nodes[nodeIndex];
+        char* field = record + update->tagWidth + 1;
+        formatPaddedDouble(field, node->x, update->context->precision);
+        formatPaddedDouble(field + FIXED_DOUBLE_WIDTH + 1, node->y, update->context->precision);
+        formatPaddedDouble(field + 2 * (FIXED_DOUBLE_WIDTH + 1), node->z,
+            update->context->precision);
+    }
+
+    return 1;
+}
+
+int updateMshNodes(const char* filename, const Mesh* mesh, int precision)
+{
+    double startTime = wallClock();
+    int fd = open(filename, O_RDWR);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not open .msh file '%s': %s\n", filename, strerror(errno));
+        return 0;
+    }
+
+    int result = 0;
+    struct stat status;
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode) || status.st_size == 0)
+    {
+        fprintf(stderr, "File '%s' is not a regular non-empty file\n", filename);
+        goto out_close_file;
+    }
+    size_t size = (size_t)status.st_size;
+    char* data = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map .msh file '%s': %s\n", filename, strerror(errno));
+        goto out_close_file;
+    }
+
+    // The layout is inferred from the first node record and checked on all
+    // of them before any byte is written
+    const char* end = data + size;
+    const char* nodKeyword = tokenTypeToValue(TOKEN_V1_NOD_START);
+    const char* endNodKeyword = tokenTypeToValue(TOKEN_V1_NOD_END);
+    const char* nodStart = findKeyword(data, end, nodKeyword);
+    const char* countLine = nodStart != NULL
+        ? (const char*)memchr(nodStart, '\n', (size_t)(end - nodStart))
+        : NULL;
+    const char* records = countLine != NULL
+        ? (const char*)memchr(countLine + 1, '\n', (size_t)(end - countLine - 1))
+        : NULL;
+    const char* firstEnd = records != NULL && records + 1 < end
+        ? (const char*)memchr(records + 1, '\n', (size_t)(end - records - 1))
+        : NULL;
+    size_t nNodes = countLine != NULL ? (size_t)strtoull(countLine + 1, NULL, 10) : 0;
+    size_t recordLength = firstEnd != NULL ? (size_t)(firstEnd - records) : 0;
+    size_t coordinates = 3 * (FIXED_DOUBLE_WIDTH + 1) + 1;
+    int valid = firstEnd != NULL && nNodes == mesh->nNodes && recordLength > coordinates
+        && nNodes <= (size_t)(end - records - 1) / recordLength;
+    const char* nodEnd = valid ? records + 1 + nNodes * recordLength : NULL;
+    if (!valid || findKeyword(nodEnd, end, endNodKeyword) != nodEnd)
+    {
+        fprintf(stderr, "File '%s' does not hold %zu fixed-width MSH 1 node records\n",
+            filename, mesh->nNodes);
+        goto out_unmap_file;
+    }
+
+    WriteContext context = { mesh, NULL, 0, precision, NULL };
+    NodeUpdate update = { &context, data + (size_t)(records + 1 - data), recordLength,
+        recordLength - coordinates, 0 };
+    size_t nTasks = (nNodes + RECORDS_PER_CHUNK - 1) / RECORDS_PER_CHUNK;
+    if (!parallelFor(nTasks, updateNodesTask, &update))
+    {
+        fprintf(stderr, "The node records of '%s' do not match the %zu nodes of the mesh\n",
+            filename, mesh->nNodes);
+        goto out_unmap_file;
+    }
+    update.update = 1;
+    result = parallelFor(nTasks, updateNodesTask, &update);
+
+out_unmap_file:
+    if (munmap(data, size) != 0)
+    {
+        fprintf(stderr, "Could not unmap .msh file '%s': %s\n", filename, strerror(errno));
+        result = 0;
+    }
+out_close_file:
+    close(fd);
+    if (result)
+    {
+        printf("Updated the %zu nodes of .msh file '%s' in place in %.3f s\n",
+            mesh->nNodes, filename, wallClock() - startTime);
+    }
+    return result;
+}
@@ -7,52 +7,75 @@
     This file contains the definition of functions to tokenize a stream
 */
 
-#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "msh_tokenizer.h"
 
-char errorBuffer[256];
-
 typedef struct
 {
     TokenType type;
-    char* pattern;
-} Spec;
-
-Spec spec[] = {
-    { TOKEN_V1_NOD_START,  "^\\$NOD" },
-    { TOKEN_V1_NOD_END, "^\\$ENDNOD" },
-    { TOKEN_V1_ELM_START, "^\\$ELM" },
-    { TOKEN_V1_ELM_END, "^\\$ENDELM" },
-    { TOKEN_NUMBER, "^[-+]?[0-9]*\\.?[0-9]+([eE][-+]?[0-9]+)?" },
+    const char* keyword;
+    size_t length;
+} Keyword;
+
+// Keywords are matched by direct byte comparison against the input. The table
+// is only read, every other state lives in the Tokenizer
+static const Keyword keywords[] = {
+    { TOKEN_V1_NOD_START, "$NOD", sizeof("$NOD") - 1 },
+    { TOKEN_V1_NOD_END, "$ENDNOD", sizeof("$ENDNOD") - 1 },
+    { TOKEN_V1_ELM_START, "$ELM", sizeof("$ELM") - 1 },
+    { TOKEN_V1_ELM_END, "$ENDELM", sizeof("$ENDELM") - 1 },
+    { TOKEN_V4_MESH_FORMAT_START, "$MeshFormat", sizeof("$MeshFormat") - 1 },
+    { TOKEN_V4_MESH_FORMAT_END, "$EndMeshFormat", sizeof("$EndMeshFormat") - 1 },
+    { TOKEN_V4_PHYSICAL_NAMES_START, "$PhysicalNames", sizeof("$PhysicalNames") - 1 },
+    { TOKEN_V4_PHYSICAL_NAMES_END, "$EndPhysicalNames", sizeof("$EndPhysicalNames") - 1 },
+    { TOKEN_V4_ENTITIES_START, "$Entities", sizeof("$Entities") - 1 },
+    { TOKEN_V4_ENTITIES_END, "$EndEntities", sizeof("$EndEntities") - 1 },
+    { TOKEN_V4_NODES_START, "$Nodes", sizeof("$Nodes") - 1 },
+    { TOKEN_V4_NODES_END, "$EndNodes", sizeof("$EndNodes") - 1 },
+    { TOKEN_V4_ELEMENTS_START, "$Elements", sizeof("$Elements") - 1 },
+    { TOKEN_V4_ELEMENTS_END, "$EndElements", sizeof("$EndElements") - 1 },
 };
 
+#define KEYWORD_COUNT (sizeof(keywords) / sizeof(keywords[0]))
+#define TOKENIZER_WINDOW 64     // bytes ahead of a token read from a stream
+
 
 static int endOfFile(Tokenizer* tokenizer)
 {
-    return *tokenizer->current == '\0';
+    return tokenizer->current >= tokenizer->end;
 }
 
-static char advance(Tokenizer* tokenizer)
+static char peek(Tokenizer* tokenizer)
 {
-    ++tokenizer->current;
-    return tokenizer->current[-1];
+    return endOfFile(tokenizer) ? '\0' : *tokenizer->current;
 }
 
-static char peek(Tokenizer* tokenizer)
+static int isSpace(char c)
 {
-    return *tokenizer->current;
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
 }
 
 static void skipWhitespace(Tokenizer* tokenizer)
 {
-    while (isspace(peek(tokenizer)))
+    for (;;)
     {
-        if (peek(tokenizer) == '\n') ++tokenizer->line;
-        advance(tokenizer);
+        const char* current = tokenizer->current;
+        while (current < tokenizer->end && isSpace(*current))
+        {
+            if (*current == '\n') ++tokenizer->line;
+            ++current;
+        }
+        tokenizer->current = current;
+        if (current < tokenizer->end) return;
+
+        // The whitespace read so far is dropped when a stream is refilled
+        tokenizer->start = current;
+        if (!refillTokenizer(tokenizer)) return;
     }
 }
 
@@ -63,6 +86,7 @@ static Token makeToken(const Tokenizer* tokenizer, TokenType type)
     token.start = tokenizer->start;
     token.length = (size_t)(tokenizer->current - tokenizer->start);
     token.line = tokenizer->line;
+    token.number = (Number){ 0 };
     return token;
 }
 
@@ -73,103 +97,264 @@ static Token errorToken(const Tokenizer* tokenizer, const char* msg)
     token.start = msg;
     token.length = strlen(msg);
     token.line = tokenizer->line;
+    token.number = (Number){ 0 };
     return token;
 }
 
 static Token unexpectedCharacter(Tokenizer* tokenizer, const char c)
 {
+    // The message is kept in the tokenizer, so each instance has its own
     int res = snprintf(
-        errorBuffer,
-        sizeof(errorBuffer),
-        "Unexpected character '%c' at line %zd", c, tokenizer->line);
-    if (res > 0) return errorToken(tokenizer, errorBuffer);
+        tokenizer->error,
+        sizeof(tokenizer->error),
+        "Unexpected character '%c' at line %zu", c, tokenizer->line);
+    if (res > 0) return errorToken(tokenizer, tokenizer->error);
     else return errorToken(tokenizer, "Unexpected character");
 }
 
+static int isSectionCharacter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static int matchKeyword(const Tokenizer* tokenizer, const Keyword* keyword)
+{
+    return (size_t)(tokenizer->end - tokenizer->start) >= keyword->length
+        && memcmp(tokenizer->start, keyword->keyword, keyword->length) == 0;
+}
+
+static Token keywordToken(Tokenizer* tokenizer, TokenType hint)
+{
+    // Try the expected keyword first, otherwise take the longest match
+    const Keyword* match = NULL;
+    for (size_t i = 0; i < KEYWORD_COUNT; ++i)
+    {
+        if (keywords[i].type == hint && matchKeyword(tokenizer, &keywords[i]))
+        {
+            match = &keywords[i];
+            break;
+        }
+    }
+    for (size_t i = 0; match == NULL && i < KEYWORD_COUNT; ++i)
+    {
+        if (matchKeyword(tokenizer, &keywords[i])
+            && (match == NULL || keywords[i].length > match->length))
+        {
+            match = &keywords[i];
+        }
+    }
+
+    if (match != NULL)
+    {
+        tokenizer->current = tokenizer->start + match->length;
+        return makeToken(tokenizer, match->type);
+    }
+
+    // Any other section keyword, e.g. $NodeData, that the parser can skip
+    const char* current = tokenizer->start + 1;
+    while (current < tokenizer->end && isSectionCharacter(*current)) ++current;
+    if (current == tokenizer->start + 1) return unexpectedCharacter(tokenizer, peek(tokenizer));
+
+    tokenizer->current = current;
+    return makeToken(tokenizer, TOKEN_SECTION);
+}
+
 
 void initTokenizer(Tokenizer* tokenizer, const char* source)
+{
+    initTokenizerBuffer(tokenizer, source, strlen(source));
+}
+
+void initTokenizerBuffer(Tokenizer* tokenizer, const char* source, size_t length)
 {
     tokenizer->source = source;
     tokenizer->start = source;
     tokenizer->current = source;
+    tokenizer->end = source + length;
     tokenizer->line = 1;
-    for (int i = 0; i < MSH_SPEC_SIZE; ++i)
+    tokenizer->error[0] = '\0';
+    tokenizer->fd = -1;
+    tokenizer->buffer = NULL;
+    tokenizer->capacity = 0;
+    tokenizer->position = 0;
+    tokenizer->ended = 1;
+}
+
+int initTokenizerStream(Tokenizer* tokenizer, int fd, size_t capacity)
+{
+    // One more byte keeps the text followed by a '\0', as in a mapped file
+    char* buffer = (char*)malloc(capacity + 1);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Could not allocate %zu bytes to read a stream\n", capacity);
+        return 0;
+    }
+
+    buffer[0] = '\0';
+    initTokenizerBuffer(tokenizer, buffer, 0);
+    tokenizer->fd = fd;
+    tokenizer->buffer = buffer;
+    tokenizer->capacity = capacity;
+    tokenizer->ended = 0;
+    refillTokenizer(tokenizer);
+    return 1;
+}
+
+int refillTokenizer(Tokenizer* tokenizer)
+{
+    if (tokenizer->fd == -1 || tokenizer->ended) return 0;
+
+    // The text from the start of the last token moves to the front, the
+    // buffer only grows when that text fills it
+    size_t shift = (size_t)(tokenizer->start - tokenizer->buffer);
+    size_t current = (size_t)(tokenizer->current - tokenizer->start);
+    size_t size = (size_t)(tokenizer->end - tokenizer->start);
+    memmove(tokenizer->buffer, tokenizer->start, size);
+    if (size == tokenizer->capacity)
+    {
+        char* buffer = (char*)realloc(tokenizer->buffer, 2 * tokenizer->capacity + 1);
+        if (buffer == NULL)
+        {
+            fprintf(stderr, "Could not allocate %zu bytes to read a stream\n",
+                2 * tokenizer->capacity);
+            tokenizer->ended = 1;
+            return 0;
+        }
+        tokenizer->buffer = buffer;
+        tokenizer->capacity *= 2;
+    }
+    tokenizer->position += shift;
+
+    // Reading until the buffer is full keeps the number of refills low
+    size_t kept = size;
+    while (size < tokenizer->capacity)
+    {
+        ssize_t count = read(tokenizer->fd, tokenizer->buffer + size, tokenizer->capacity - size);
+        if (count > 0)
+        {
+            size += (size_t)count;
+        }
+        else if (count == 0)
+        {
+            tokenizer->ended = 1;
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            fprintf(stderr, "Could not read the input stream: %s\n", strerror(errno));
+            tokenizer->ended = 1;
+            break;
+        }
+    }
+    tokenizer->buffer[size] = '\0';
+
+    tokenizer->source = tokenizer->buffer;
+    tokenizer->start = tokenizer->buffer;
+    tokenizer->current = tokenizer->buffer + current;
+    tokenizer->end = tokenizer->buffer + size;
+    return size > kept;
+}
+
+int skipToLine(Tokenizer* tokenizer, const char* keyword, int keep)
+{
+    size_t length = strlen(keyword);
+    int lineStart = 1;
+    for (;;)
     {
-        int index = spec[i].type;
-        if (regcomp(&tokenizer->specRegex[index], spec[i].pattern, REG_EXTENDED))
+        if (lineStart)
         {
-            fprintf(stderr, "Could not compile regex %s", spec[i].pattern);
-            exit(EXIT_FAILURE);
+            // The keyword may continue past the buffer of a stream
+            if (!keep) tokenizer->start = tokenizer->current;
+            while ((size_t)(tokenizer->end - tokenizer->current) < length
+                && refillTokenizer(tokenizer))
+            {
+            }
+            if ((size_t)(tokenizer->end - tokenizer->current) >= length
+                && memcmp(tokenizer->current, keyword, length) == 0)
+            {
+                return 1;
+            }
+        }
+
+        const char* newLine = (const char*)memchr(tokenizer->current, '\n',
+            (size_t)(tokenizer->end - tokenizer->current));
+        if (newLine == NULL)
+        {
+            tokenizer->current = tokenizer->end;
+            if (!keep) tokenizer->start = tokenizer->current;
+            if (!refillTokenizer(tokenizer)) return 0;
+            lineStart = 0;
+            continue;
         }
+        ++tokenizer->line;
+        tokenizer->current = newLine + 1;
+        lineStart = 1;
     }
 }
 
 void freeTokenizer(Tokenizer* tokenizer)
 {
+    free(tokenizer->buffer);
+    tokenizer->buffer = NULL;
     tokenizer->source = NULL;
     tokenizer->start = NULL;
     tokenizer->current = NULL;
-    for (int i = 0; i < MSH_SPEC_SIZE; ++i)
-    {
-        regfree(&tokenizer->specRegex[i]);
-    }
+    tokenizer->end = NULL;
 }
 
 void resetTokenizer(Tokenizer* tokenizer, const char* source)
 {
-    tokenizer->source = source;
-    tokenizer->start = source;
-    tokenizer->current = source;
-    tokenizer->line = 1;
+    free(tokenizer->buffer);
+    initTokenizer(tokenizer, source);
 }
 
-Token nextToken(Tokenizer* tokenizer, TokenType hint)
+static Token scanToken(Tokenizer* tokenizer, TokenType hint)
 {
-    skipWhitespace(tokenizer);
-    tokenizer->start = tokenizer->current;
-
     if (endOfFile(tokenizer))
     {
         return makeToken(tokenizer, TOKEN_END_OF_FILE);
     }
 
-    if (hint > TOKEN_NULL && hint < MSH_SPEC_SIZE)
+    if (peek(tokenizer) == '$')
     {
-        if (hint == TOKEN_NUMBER)
-        {
-            char* end = NULL;
-            strtod(tokenizer->start, &end);
-            if (end != tokenizer->start)
-            {
-                tokenizer->current = end;
-                return makeToken(tokenizer, TOKEN_NUMBER);
-            }
-        }
-        else
-        {
-            regmatch_t match[1];
-            if (regexec(&tokenizer->specRegex[hint], tokenizer->start, 1, match, 0) == 0)
-            {
-                tokenizer->current = tokenizer->start + match[0].rm_eo;
-                return makeToken(tokenizer, hint);
-            }
-        }
+        return keywordToken(tokenizer, hint);
     }
 
-    regmatch_t match[1];
-    for (int i = 0; i < MSH_SPEC_SIZE; ++i)
+    // Numbers are decoded while they are scanned, so the parser never has to
+    // convert the token text a second time
+    Number number;
+    const char* end = scanNumber(tokenizer->start, tokenizer->end, &number);
+    if (end != tokenizer->start)
     {
-        int index = spec[i].type;
-        if (regexec(&tokenizer->specRegex[index], tokenizer->start, 1, match, 0) == 0)
-        {
-            tokenizer->current = tokenizer->start + match[0].rm_eo;
-            return makeToken(tokenizer, spec[i].type);
-        }
+        tokenizer->current = end;
+        Token token = makeToken(tokenizer, TOKEN_NUMBER);
+        token.number = number;
+        return token;
     }
 
     return unexpectedCharacter(tokenizer, peek(tokenizer));
 }
 
+Token nextToken(Tokenizer* tokenizer, TokenType hint)
+{
+    skipWhitespace(tokenizer);
+    tokenizer->start = tokenizer->current;
+
+    // In a stream, a token is scanned with a few bytes ahead, so a keyword or
+    // a number cut by the end of the buffer is not taken for an error. A
+    // longer token that reaches the end is scanned again once more is read
+    while ((size_t)(tokenizer->end - tokenizer->start) < TOKENIZER_WINDOW
+        && refillTokenizer(tokenizer))
+    {
+    }
+    for (;;)
+    {
+        Token token = scanToken(tokenizer, hint);
+        if (tokenizer->current < tokenizer->end || !refillTokenizer(tokenizer)) return token;
+        tokenizer->current = tokenizer->start;
+    }
+}
+
 char* tokenTypeToValue(TokenType type)
 {
     switch (type)
@@ -184,6 +369,28 @@ char* tokenTypeToValue(TokenType type)
         return "$ENDELM";
     case TOKEN_NUMBER:
         return "number";
+    case TOKEN_V4_MESH_FORMAT_START:
+        return "$MeshFormat";
+    case TOKEN_V4_MESH_FORMAT_END:
+        return "$EndMeshFormat";
+    case TOKEN_V4_PHYSICAL_NAMES_START:
+        return "$PhysicalNames";
+    case TOKEN_V4_PHYSICAL_NAMES_END:
+        return "$EndPhysicalNames";
+    case TOKEN_V4_ENTITIES_START:
+        return "$Entities";
+    case TOKEN_V4_ENTITIES_END:
+        return "$EndEntities";
+    case TOKEN_V4_NODES_START:
+        return "$Nodes";
+    case TOKEN_V4_NODES_END:
+        return "$EndNodes";
+    case TOKEN_V4_ELEMENTS_START:
+        return "$Elements";
+    case TOKEN_V4_ELEMENTS_END:
+        return "$EndElements";
+    case TOKEN_SECTION:
+        return "section";
     case TOKEN_END_OF_FILE:
         return "end of file";
     case TOKEN_ERROR:
@@ -0,0 +1,163 @@
+/*
+    Filename: number_parser.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the functions to scan numbers from
+    text buffers in a single pass
+*/
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number_parser.h"
+
+#define MAX_MANTISSA_DIGITS 19      // decimal digits that always fit in 64 bits
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+#define MAX_EXACT_POW10 22          // largest power of 10 exactly representable
+#define MAX_EXPONENT 100000         // larger exponents overflow to inf or 0 anyway
+
+static const double pow10Table[MAX_EXACT_POW10 + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int isDigit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+static double slowPath(const char* start, size_t length)
+{
+    // Rare numbers (more than 15-16 significant digits or large exponents)
+    // are converted by strtod on a NUL terminated copy of the token
+    char buffer[128];
+    char* copy = buffer;
+    if (length >= sizeof(buffer))
+    {
+        copy = (char*)malloc(length + 1);
+        if (copy == NULL) return strtod(start, NULL);
+    }
+    memcpy(copy, start, length);
+    copy[length] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != buffer) free(copy);
+    return value;
+}
+
+const char* scanNumber(const char* start, const char* end, Number* number)
+{
+    const char* p = start;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+    const char* digits = p;
+
+    unsigned long long mantissa = 0;
+    int nDigits = 0;        // significant digits stored in the mantissa
+    int exponent = 0;       // decimal exponent applied to the mantissa
+    int truncated = 0;      // 1 if non-zero digits did not fit in the mantissa
+    int anyDigit = 0;
+    int integral = 1;
+
+    while (p < end && isDigit(*p))
+    {
+        int digit = *p - '0';
+        if (nDigits < MAX_MANTISSA_DIGITS)
+        {
+            mantissa = mantissa * 10 + digit;
+            if (mantissa != 0) ++nDigits;
+        }
+        else
+        {
+            ++exponent;
+            truncated |= digit != 0;
+        }
+        anyDigit = 1;
+        ++p;
+    }
+
+    if (p < end && *p == '.')
+    {
+        const char* q = p + 1;
+        while (q < end && isDigit(*q))
+        {
+            int digit = *q - '0';
+            if (nDigits < MAX_MANTISSA_DIGITS)
+            {
+                mantissa = mantissa * 10 + digit;
+                if (mantissa != 0) ++nDigits;
+                --exponent;
+            }
+            else
+            {
+                truncated |= digit != 0;
+            }
+            anyDigit = 1;
+            ++q;
+        }
+        if (anyDigit)
+        {
+            p = q;
+            integral = 0;
+        }
+    }
+
+    if (!anyDigit) return start;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        int negativeExponent = 0;
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            negativeExponent = *q == '-';
+            ++q;
+        }
+        if (q < end && isDigit(*q))
+        {
+            int value = 0;
+            while (q < end && isDigit(*q))
+            {
+                if (value < MAX_EXPONENT) value = value * 10 + (*q - '0');
+                ++q;
+            }
+            exponent += negativeExponent ? -value : value;
+            integral = 0;
+            p = q;
+        }
+    }
+
+    number->isInteger = integral && !truncated && exponent == 0
+        && mantissa <= (unsigned long long)LLONG_MAX;
+    number->integer = number->isInteger
+        ? (negative ? -(long long)mantissa : (long long)mantissa)
+        : 0;
+
+    // Both the mantissa and the power of 10 are exact doubles, so a single
+    // multiplication or division gives the correctly rounded result
+    double value;
+    if (mantissa == 0 && !truncated)
+    {
+        value = 0.0;
+    }
+    else if (!truncated && mantissa <= MAX_EXACT_MANTISSA
+        && exponent >= -MAX_EXACT_POW10 && exponent <= MAX_EXACT_POW10)
+    {
+        value = (double)mantissa;
+        if (exponent < 0) value /= pow10Table[-exponent];
+        else value *= pow10Table[exponent];
+    }
+    else
+    {
+        value = slowPath(digits, (size_t)(p - digits));
+    }
+    number->value = negative ? -value : value;
+
+    return p;
+}
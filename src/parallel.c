@@ -0,0 +1,109 @@
+/*
+    Filename: parallel.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the functions to run independent
+    tasks on a pool of worker threads
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+// Read by every parallel loop, possibly from several threads at a time
+static atomic_size_t threadCount = 0;
+
+// Cap of the loops started by each thread, 0 for none
+static _Thread_local size_t threadLimit = 0;
+
+typedef struct
+{
+    ParallelTask task;
+    void* context;
+    size_t nTasks;
+    atomic_size_t next;         // next task to be taken by a worker
+    atomic_int failed;          // set when a task fails, pending tasks are skipped
+} Pool;
+
+static void* worker(void* arg)
+{
+    Pool* pool = (Pool*)arg;
+    while (!atomic_load_explicit(&pool->failed, memory_order_relaxed))
+    {
+        size_t task = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+        if (task >= pool->nTasks) break;
+        if (!pool->task(pool->context, task))
+        {
+            atomic_store_explicit(&pool->failed, 1, memory_order_relaxed);
+        }
+    }
+
+    return NULL;
+}
+
+
+void setThreadCount(size_t nThreads)
+{
+    atomic_store(&threadCount, nThreads);
+}
+
+void setThreadLimit(size_t nThreads)
+{
+    threadLimit = nThreads;
+}
+
+size_t getThreadCount(void)
+{
+    size_t nThreads = atomic_load(&threadCount);
+    if (nThreads > 0) return nThreads;
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (size_t)online : 1;
+}
+
+int parallelFor(size_t nTasks, ParallelTask task, void* context)
+{
+    Pool pool;
+    pool.task = task;
+    pool.context = context;
+    pool.nTasks = nTasks;
+    atomic_init(&pool.next, 0);
+    atomic_init(&pool.failed, 0);
+
+    size_t nWorkers = getThreadCount();
+    if (threadLimit > 0 && nWorkers > threadLimit) nWorkers = threadLimit;
+    if (nWorkers > nTasks) nWorkers = nTasks;
+
+    pthread_t* threads = NULL;
+    size_t nThreads = 0;
+    if (nWorkers > 1)
+    {
+        threads = (pthread_t*)malloc((nWorkers - 1) * sizeof(pthread_t));
+        if (threads == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory for %zu threads\n", nWorkers - 1);
+        }
+        // If the threads cannot be created the calling thread runs the tasks alone
+        for (size_t i = 0; threads != NULL && i < nWorkers - 1; ++i)
+        {
+            if (pthread_create(&threads[i], NULL, worker, &pool) != 0) break;
+            ++nThreads;
+        }
+    }
+
+    worker(&pool);
+
+    for (size_t i = 0; i < nThreads; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    return !atomic_load(&pool.failed);
+}
@@ -0,0 +1,168 @@
+/*
+    Filename: section_file.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the binary files made of a header
+    followed by sections at aligned offsets. A file is loaded by a single
+    mapping, and its sections are used in place
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "section_file.h"
+#include "utils.h"
+#include "write_buffer.h"
+
+#define SECTION_BYTE_ORDER 0x01020304u
+
+static size_t alignOffset(size_t offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+void initSectionFileHeader(SectionFileHeader* header, const char* magic,
+    uint32_t formatVersion)
+{
+    memcpy(header->magic, magic, sizeof(header->magic));
+    header->formatVersion = formatVersion;
+    header->byteOrder = SECTION_BYTE_ORDER;
+    header->size = 0;
+}
+
+size_t placeSections(size_t headerSize, const FileSection* sections, int nSections,
+    uint64_t* offsets)
+{
+    size_t offset = headerSize;
+    for (int i = 0; i < nSections; ++i)
+    {
+        offsets[i] = 0;
+        if (!sections[i].present) continue;
+        offset = alignOffset(offset);
+        offsets[i] = offset;
+        offset += sections[i].size;
+    }
+
+    return offset;
+}
+
+int validSectionFile(const SectionFileHeader* header, const char* magic,
+    uint32_t formatVersion, size_t fileSize, size_t headerSize, const uint64_t* offsets,
+    const size_t* sizes, int nSections)
+{
+    if (memcmp(header->magic, magic, sizeof(header->magic)) != 0
+        || header->formatVersion != formatVersion
+        || header->byteOrder != SECTION_BYTE_ORDER
+        || header->size != fileSize)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < nSections; ++i)
+    {
+        uint64_t offset = offsets[i];
+        if (offset == 0) continue;
+        if (offset < headerSize || offset % SECTION_ALIGNMENT != 0
+            || offset > fileSize || sizes[i] > fileSize - offset)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int mapSectionFile(const char* filename, int writable, size_t headerSize, char** data,
+    size_t* size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return 0;
+
+    int result = 0;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (size_t)st.st_size < headerSize)
+    {
+        goto out_close_file;
+    }
+
+    *size = (size_t)st.st_size;
+    int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    *data = (char*)mmap(NULL, *size, protection, MAP_PRIVATE, fd, 0);
+    if (*data == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map '%s': %s\n", filename, strerror(errno));
+        *data = NULL;
+        goto out_close_file;
+    }
+
+    // Only an advice, the mapping is still valid if it is ignored
+    madvise(*data, *size, MADV_WILLNEED);
+    result = 1;
+
+out_close_file:
+    close(fd);
+    return result;
+}
+
+int writeSectionFile(const char* filename, const void* header, size_t headerSize,
+    const FileSection* sections, const uint64_t* offsets, int nSections)
+{
+    char tempFilename[MAX_PATH_LENGTH + 64];
+    if (!temporaryPath(tempFilename, sizeof(tempFilename), filename))
+    {
+        fprintf(stderr, "Path '%s' is too long\n", filename);
+        return 0;
+    }
+    int fd = open(tempFilename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not create '%s': %s\n", tempFilename, strerror(errno));
+        return 0;
+    }
+
+    int result = 0;
+    WriteBuffer buffer;
+    if (!initWriteBuffer(&buffer, fd, WRITE_BUFFER_SIZE))
+    {
+        close(fd);
+        goto out_remove_file;
+    }
+    static const char padding[SECTION_ALIGNMENT] = { 0 };
+    appendBytes(&buffer, (const char*)header, headerSize);
+    size_t position = headerSize;
+    for (int i = 0; i < nSections; ++i)
+    {
+        if (!sections[i].present) continue;
+        appendBytes(&buffer, padding, offsets[i] - position);
+        if (sections[i].size > 0)
+        {
+            appendBytes(&buffer, (const char*)sections[i].data, sections[i].size);
+        }
+        position = offsets[i] + sections[i].size;
+    }
+    result = flushWriteBuffer(&buffer);
+    freeWriteBuffer(&buffer);
+    if (close(fd) != 0) result = 0;
+
+    if (result && rename(tempFilename, filename) != 0)
+    {
+        fprintf(stderr, "Could not replace '%s': %s\n", filename, strerror(errno));
+        result = 0;
+    }
+
+out_remove_file:
+    if (!result)
+    {
+        fprintf(stderr, "Could not write '%s'\n", filename);
+        remove(tempFilename);
+    }
+    return result;
+}
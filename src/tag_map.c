@@ -0,0 +1,87 @@
+/*
+    Filename: tag_map.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the hash map from the tags of a
+    .msh file to the position of their records in the mesh arrays
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tag_map.h"
+
+#define MIN_CAPACITY 16
+#define FIBONACCI_MULTIPLIER 11400714819323198485ULL    // 2^64 divided by the golden ratio
+
+static size_t hashTag(const TagMap* map, size_t tag)
+{
+    // Fibonacci hashing spreads runs of consecutive tags over the whole table
+    return (size_t)(((uint64_t)tag * FIBONACCI_MULTIPLIER) >> map->shift);
+}
+
+
+int initTagMap(TagMap* map, size_t count)
+{
+    size_t capacity = MIN_CAPACITY;
+    int bits = 4;
+    while (capacity < 2 * count)
+    {
+        capacity *= 2;
+        ++bits;
+    }
+
+    map->entries = (TagEntry*)calloc(capacity, sizeof(TagEntry));
+    if (map->entries == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a map of %zu tags\n", count);
+        map->capacity = 0;
+        return 0;
+    }
+    map->capacity = capacity;
+    map->shift = 64 - bits;
+    return 1;
+}
+
+void freeTagMap(TagMap* map)
+{
+    free(map->entries);
+    map->entries = NULL;
+    map->capacity = 0;
+}
+
+int insertTag(TagMap* map, size_t tag, size_t index)
+{
+    size_t mask = map->capacity - 1;
+    for (size_t i = hashTag(map, tag);; i = (i + 1) & mask)
+    {
+        TagEntry* entry = &map->entries[i];
+        if (entry->tag == tag) return 0;
+        if (entry->tag == 0)
+        {
+            entry->tag = tag;
+            entry->index = index;
+            return 1;
+        }
+    }
+}
+
+int findTag(const TagMap* map, size_t tag, size_t* index)
+{
+    if (map->capacity == 0 || tag == 0) return 0;
+
+    size_t mask = map->capacity - 1;
+    for (size_t i = hashTag(map, tag);; i = (i + 1) & mask)
+    {
+        const TagEntry* entry = &map->entries[i];
+        if (entry->tag == tag)
+        {
+            *index = entry->index;
+            return 1;
+        }
+        if (entry->tag == 0) return 0;
+    }
+}
@@ -9,51 +9,131 @@
 
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_spline2d.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 
+#include "bicubic.h"
+#include "kd_tree.h"
+#include "parallel.h"
+#include "topography_cache.h"
 #include "topography_parser.h"
 #include "topography.h"
 #include "utils.h"
 
-static int compareNodes(const void* a, const void* b)
+#define POINTS_PER_TASK 4096        // points evaluated by a task of a parallel loop
+#define TASKS_PER_THREAD 4          // tasks per thread of the grid copy and radix sort passes
+#define RADIX_BUCKETS 256           // one byte of a sort key per radix sort pass
+#define IDW_NEIGHBOURS 8            // scattered points weighted into each grid value
+#define CROP_MARGIN 8               // grid points kept around a window for the spline fit
+#define MIN_SPLINE_POINTS 4         // grid points along each axis of a bicubic spline
+
+typedef struct
+{
+    int xFast;                  // 1 when x varies fastest along the points, 0 for y
+    int reverseFast;            // 1 when the fastest coordinate decreases
+    int reverseSlow;            // 1 when the slowest coordinate decreases
+    size_t nFast;               // number of points along a line of the fastest coordinate
+    size_t nSlow;               // number of lines
+} GridLayout;
+
+typedef struct
 {
-    const Node* nodeA = (const Node*)a;
-    const Node* nodeB = (const Node*)b;
+    const Node* nodes;
+    const GridLayout* layout;
+    Topography* topo;
+    size_t linesPerTask;
+} GridCopy;
 
-    if (nodeA->y < nodeB->y) return -1;
-    else if (nodeA->y > nodeB->y) return 1;
-    else if (nodeA->x < nodeB->x) return -1;
-    else if (nodeA->x > nodeB->x) return 1;
-    return 0;
+static double fastCoordinate(const Node* node, const GridLayout* layout)
+{
+    return layout->xFast ? node->x : node->y;
+}
+
+static double slowCoordinate(const Node* node, const GridLayout* layout)
+{
+    return layout->xFast ? node->y : node->x;
 }
 
-static int findStep(const Node* nodes, size_t nNodes, size_t* step)
+static int isStep(double from, double to, int reverse)
 {
-    double x = nodes[0].x;
-    for (size_t i = 1; i < nNodes; ++i)
+    return reverse ? to < from : to > from;
+}
+
+static int detectGridLayout(const Node* nodes, size_t nNodes, GridLayout* layout)
+{
+    // The first two points tell which coordinate varies fastest, the first
+    // change of the other one gives the length of a line
+    if (nNodes < 4) return 0;
+    if (nodes[1].y == nodes[0].y && nodes[1].x != nodes[0].x) layout->xFast = 1;
+    else if (nodes[1].x == nodes[0].x && nodes[1].y != nodes[0].y) layout->xFast = 0;
+    else return 0;
+
+    double slow = slowCoordinate(&nodes[0], layout);
+    size_t nFast = 1;
+    while (nFast < nNodes && slowCoordinate(&nodes[nFast], layout) == slow) ++nFast;
+    if (nFast == nNodes || nNodes % nFast != 0) return 0;
+
+    layout->nFast = nFast;
+    layout->nSlow = nNodes / nFast;
+    layout->reverseFast = fastCoordinate(&nodes[1], layout) < fastCoordinate(&nodes[0], layout);
+    layout->reverseSlow = slowCoordinate(&nodes[nFast], layout) < slow;
+    for (size_t i = 1; i < nFast; ++i)
     {
-        if (nodes[i].x == x)
+        if (!isStep(fastCoordinate(&nodes[i - 1], layout), fastCoordinate(&nodes[i], layout),
+            layout->reverseFast))
         {
-            *step = i;
-            return 1;
+            return 0;
         }
     }
-    return 0;
+
+    return 1;
 }
 
-static int buildOriginalTopography(Node* nodes, size_t nNodes, Topography* topo)
+static int copyGridTask(void* context, size_t task)
 {
-    // Sort nodes by y, then by x
-    qsort(nodes, nNodes, sizeof(Node), compareNodes);
-
-    size_t nx = 0;
-    if (!findStep(nodes, nNodes, &nx))
+    // Every line must repeat the fastest coordinates of the first one, at a
+    // single slowest coordinate that moves on from the previous line
+    const GridCopy* copy = (const GridCopy*)context;
+    const GridLayout* layout = copy->layout;
+    Topography* topo = copy->topo;
+    size_t nFast = layout->nFast;
+    size_t first = task * copy->linesPerTask;
+    size_t last = first + copy->linesPerTask < layout->nSlow
+        ? first + copy->linesPerTask
+        : layout->nSlow;
+    for (size_t s = first; s < last; ++s)
     {
-        fprintf(stderr, "Could not determine step size in topography data\n");
-        return 0;
+        const Node* line = copy->nodes + s * nFast;
+        double slow = slowCoordinate(&line[0], layout);
+        if (s > 0 && !isStep(slowCoordinate(&line[-1], layout), slow, layout->reverseSlow))
+        {
+            return 0;
+        }
+        size_t slowIndex = layout->reverseSlow ? layout->nSlow - 1 - s : s;
+        for (size_t f = 0; f < nFast; ++f)
+        {
+            if (slowCoordinate(&line[f], layout) != slow
+                || fastCoordinate(&line[f], layout) != fastCoordinate(&copy->nodes[f], layout))
+            {
+                return 0;
+            }
+            size_t fastIndex = layout->reverseFast ? nFast - 1 - f : f;
+            size_t index = layout->xFast
+                ? slowIndex * topo->nx + fastIndex
+                : fastIndex * topo->nx + slowIndex;
+            topo->values[index] = line[f].z;
+        }
     }
 
-    size_t ny = nNodes / nx;
+    return 1;
+}
+
+static int copyGrid(const Node* nodes, const GridLayout* layout, Topography* topo)
+{
+    size_t nx = layout->xFast ? layout->nFast : layout->nSlow;
+    size_t ny = layout->xFast ? layout->nSlow : layout->nFast;
     topo->nx = nx;
     topo->ny = ny;
     topo->xGrid = (double*)malloc(nx * sizeof(double));
@@ -66,29 +146,350 @@ static int buildOriginalTopography(Node* nodes, size_t nNodes, Topography* topo)
         return 0;
     }
 
-    for (size_t i = 0; i < nx; ++i)
+    // The grid coordinates are stored increasing, whatever the order of the points
+    double* fastGrid = layout->xFast ? topo->xGrid : topo->yGrid;
+    double* slowGrid = layout->xFast ? topo->yGrid : topo->xGrid;
+    for (size_t f = 0; f < layout->nFast; ++f)
     {
-        topo->xGrid[i] = nodes[i].x;
+        size_t index = layout->reverseFast ? layout->nFast - 1 - f : f;
+        fastGrid[index] = fastCoordinate(&nodes[f], layout);
     }
-    for (size_t i = 0; i < ny; ++i)
+    for (size_t s = 0; s < layout->nSlow; ++s)
+    {
+        size_t index = layout->reverseSlow ? layout->nSlow - 1 - s : s;
+        slowGrid[index] = slowCoordinate(&nodes[s * layout->nFast], layout);
+    }
+
+    size_t nTasks = getThreadCount() * TASKS_PER_THREAD;
+    GridCopy copy = { nodes, layout, topo, (layout->nSlow + nTasks - 1) / nTasks };
+    if (!parallelFor((layout->nSlow + copy.linesPerTask - 1) / copy.linesPerTask,
+        copyGridTask, &copy))
+    {
+        freeTopography(topo);
+        return 0;
+    }
+
+    return 1;
+}
+
+typedef struct
+{
+    const Node* source;
+    Node* target;
+    size_t nNodes;
+    size_t nodesPerTask;
+    size_t (*counts)[RADIX_BUCKETS];    // count, then first target, of each digit per task
+    int y;                              // 1 to sort on y, 0 on x
+    int shift;                          // bit position of the digit in the key
+} RadixPass;
+
+static unsigned long long sortKey(double value)
+{
+    // Flipping the sign bit of positive values and every bit of negative
+    // ones orders the keys as the values, with -0 taken as 0
+    if (value == 0.0) value = 0.0;
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits >> 63 ? ~bits : bits | (1ULL << 63);
+}
+
+static size_t radixDigit(const RadixPass* pass, const Node* node)
+{
+    return (size_t)(sortKey(pass->y ? node->y : node->x) >> pass->shift) & (RADIX_BUCKETS - 1);
+}
+
+static int countDigitsTask(void* context, size_t task)
+{
+    RadixPass* pass = (RadixPass*)context;
+    size_t* counts = pass->counts[task];
+    memset(counts, 0, RADIX_BUCKETS * sizeof(size_t));
+    size_t first = task * pass->nodesPerTask;
+    size_t last = first + pass->nodesPerTask < pass->nNodes
+        ? first + pass->nodesPerTask
+        : pass->nNodes;
+    for (size_t k = first; k < last; ++k)
+    {
+        ++counts[radixDigit(pass, &pass->source[k])];
+    }
+
+    return 1;
+}
+
+static int scatterDigitsTask(void* context, size_t task)
+{
+    RadixPass* pass = (RadixPass*)context;
+    size_t* targets = pass->counts[task];
+    size_t first = task * pass->nodesPerTask;
+    size_t last = first + pass->nodesPerTask < pass->nNodes
+        ? first + pass->nodesPerTask
+        : pass->nNodes;
+    for (size_t k = first; k < last; ++k)
+    {
+        pass->target[targets[radixDigit(pass, &pass->source[k])]++] = pass->source[k];
+    }
+
+    return 1;
+}
+
+static int sortNodes(Node* nodes, size_t nNodes)
+{
+    // Stable LSD radix sort on the x keys, then on the y keys, one byte per
+    // pass. A pass whose digit is the same for every point moves nothing
+    size_t nTasks = getThreadCount() * TASKS_PER_THREAD;
+    RadixPass pass = { nodes, NULL, nNodes, (nNodes + nTasks - 1) / nTasks, NULL, 0, 0 };
+    if (pass.nodesPerTask == 0) return 1;
+    nTasks = (nNodes + pass.nodesPerTask - 1) / pass.nodesPerTask;
+    Node* buffer = (Node*)malloc(nNodes * sizeof(Node));
+    pass.counts = (size_t(*)[RADIX_BUCKETS])malloc(nTasks * sizeof(*pass.counts));
+    if (buffer == NULL || pass.counts == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory to sort %zu topography points\n", nNodes);
+        free(buffer);
+        free(pass.counts);
+        return 0;
+    }
+
+    pass.target = buffer;
+    for (int key = 0; key < 2; ++key)
     {
-        topo->yGrid[i] = nodes[i * nx].y;
+        pass.y = key;
+        for (pass.shift = 0; pass.shift < 64; pass.shift += 8)
+        {
+            parallelFor(nTasks, countDigitsTask, &pass);
+            int trivial = 0;
+            size_t next = 0;
+            for (size_t digit = 0; digit < RADIX_BUCKETS; ++digit)
+            {
+                size_t total = 0;
+                for (size_t t = 0; t < nTasks; ++t)
+                {
+                    size_t count = pass.counts[t][digit];
+                    pass.counts[t][digit] = next;
+                    next += count;
+                    total += count;
+                }
+                trivial |= total == nNodes;
+            }
+            if (trivial) continue;
+
+            parallelFor(nTasks, scatterDigitsTask, &pass);
+            Node* sorted = pass.target;
+            pass.target = (Node*)pass.source;
+            pass.source = sorted;
+        }
+    }
+    if (pass.source != nodes) memcpy(nodes, pass.source, nNodes * sizeof(Node));
+
+    free(buffer);
+    free(pass.counts);
+    return 1;
+}
+
+typedef struct
+{
+    const KdTree* tree;
+    Topography* topo;
+    size_t rowsPerTask;
+} ScatteredRows;
+
+static int gridScatteredRowsTask(void* context, size_t task)
+{
+    // Inverse squared distance weights of the nearest points, a grid point
+    // on top of a survey point takes its value
+    const ScatteredRows* rows = (const ScatteredRows*)context;
+    Topography* topo = rows->topo;
+    size_t indexes[IDW_NEIGHBOURS];
+    double distances[IDW_NEIGHBOURS];
+    size_t first = task * rows->rowsPerTask;
+    size_t last = first + rows->rowsPerTask < topo->ny ? first + rows->rowsPerTask : topo->ny;
+    for (size_t j = first; j < last; ++j)
+    {
+        for (size_t i = 0; i < topo->nx; ++i)
+        {
+            size_t count = findNearestPoints(rows->tree, topo->xGrid[i], topo->yGrid[j],
+                IDW_NEIGHBOURS, indexes, distances);
+            double sum = 0.0;
+            double weights = 0.0;
+            for (size_t k = 0; k < count; ++k)
+            {
+                double z = rows->tree->points[indexes[k]].z;
+                if (distances[k] == 0.0)
+                {
+                    sum = z;
+                    weights = 1.0;
+                    break;
+                }
+                sum += z / distances[k];
+                weights += 1.0 / distances[k];
+            }
+            topo->values[j * topo->nx + i] = sum / weights;
+        }
+    }
+
+    return 1;
+}
+
+static int gridScatteredPoints(Node* nodes, size_t nNodes, Topography* topo)
+{
+    // The grid spans the points with about one grid point per survey point
+    if (nNodes < 4)
+    {
+        fprintf(stderr, "%zu topography points are too few to build a grid\n", nNodes);
+        return 0;
+    }
+    double minX = nodes[0].x;
+    double maxX = nodes[0].x;
+    double minY = nodes[0].y;
+    double maxY = nodes[0].y;
+    for (size_t k = 1; k < nNodes; ++k)
+    {
+        minX = fmin(minX, nodes[k].x);
+        maxX = fmax(maxX, nodes[k].x);
+        minY = fmin(minY, nodes[k].y);
+        maxY = fmax(maxY, nodes[k].y);
+    }
+    double width = maxX - minX;
+    double height = maxY - minY;
+    if (!(width > 0.0) || !(height > 0.0))
+    {
+        fprintf(stderr, "The %zu topography points do not span an area\n", nNodes);
+        return 0;
+    }
+    double spacing = sqrt(width * height / (double)nNodes);
+    size_t nx = (size_t)(width / spacing + 0.5) + 1;
+    size_t ny = (size_t)(height / spacing + 0.5) + 1;
+
+    topo->nx = nx;
+    topo->ny = ny;
+    topo->xGrid = (double*)malloc(nx * sizeof(double));
+    topo->yGrid = (double*)malloc(ny * sizeof(double));
+    topo->values = (double*)malloc(nx * ny * sizeof(double));
+    KdTree tree = { 0 };
+    if (topo->xGrid == NULL || topo->yGrid == NULL || topo->values == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a %zu x %zu topography grid\n", nx, ny);
+        freeTopography(topo);
+        return 0;
+    }
+    for (size_t i = 0; i < nx; ++i)
+    {
+        topo->xGrid[i] = minX + width * (double)i / (double)(nx - 1);
     }
     for (size_t j = 0; j < ny; ++j)
     {
-        for (size_t i = 0; i < nx; ++i)
+        topo->yGrid[j] = minY + height * (double)j / (double)(ny - 1);
+    }
+
+    size_t nTasks = getThreadCount() * TASKS_PER_THREAD;
+    ScatteredRows rows = { &tree, topo, (ny + nTasks - 1) / nTasks };
+    if (!buildKdTree(nodes, nNodes, &tree)
+        || !parallelFor((ny + rows.rowsPerTask - 1) / rows.rowsPerTask, gridScatteredRowsTask,
+            &rows))
+    {
+        freeKdTree(&tree);
+        freeTopography(topo);
+        return 0;
+    }
+
+    freeKdTree(&tree);
+    return 1;
+}
+
+static int buildOriginalTopography(const char* filename, Node* nodes, size_t nNodes,
+    Topography* topo)
+{
+    // Survey exports are usually written line by line, so their layout is
+    // recognized and copied as is. Only unordered points are sorted by y,
+    // then x, keeping the first of duplicate points. Points that still do not
+    // form a grid are scattered soundings, which are gridded. A damaged grid
+    // lands there too, so the new resolution is reported
+    GridLayout layout;
+    if (detectGridLayout(nodes, nNodes, &layout) && copyGrid(nodes, &layout, topo)) return 1;
+
+    if (!sortNodes(nodes, nNodes)) return 0;
+    size_t count = nNodes > 0;
+    for (size_t k = 1; k < nNodes; ++k)
+    {
+        if (nodes[k].x != nodes[count - 1].x || nodes[k].y != nodes[count - 1].y)
         {
-            topo->values[j * nx + i] = nodes[j * nx + i].z;
+            nodes[count++] = nodes[k];
         }
     }
 
+    if (detectGridLayout(nodes, count, &layout) && layout.xFast
+        && copyGrid(nodes, &layout, topo))
+    {
+        return 1;
+    }
+
+    if (!gridScatteredPoints(nodes, count, topo)) return 0;
+    fprintf(stderr, "The %zu points of topography file %s do not form a regular grid, "
+        "they are gridded by inverse distance weighting on %zu x %zu points\n",
+        nNodes, filename, topo->nx, topo->ny);
     return 1;
 }
 
-static int buildHiResTopography(const Topography* orig, size_t nx, size_t ny, Topography* topo)
+static void findWindowCells(const double* grid, size_t n, double min, double max,
+    size_t* first, size_t* last)
+{
+    // The cells of an increasing grid holding [min, max], at least one
+    *first = 0;
+    while (*first + 1 < n && grid[*first + 1] <= min) ++*first;
+    *last = n - 1;
+    while (*last > 0 && grid[*last - 1] >= max) --*last;
+    if (*last <= *first)
+    {
+        if (*first + 1 < n) *last = *first + 1;
+        else *first = *last - 1;
+    }
+}
+
+static void widenCells(size_t n, size_t margin, size_t minCount, size_t* first, size_t* last)
+{
+    *first = *first > margin ? *first - margin : 0;
+    *last = *last + margin < n - 1 ? *last + margin : n - 1;
+    while (*last - *first + 1 < minCount && *last - *first + 1 < n)
+    {
+        if (*first > 0) --*first;
+        if (*last < n - 1 && *last - *first + 1 < minCount) ++*last;
+    }
+}
+
+static int overlapsWindow(const Topography* grid, const TopographyWindow* window)
+{
+    return window->xMax >= grid->xGrid[0] && window->xMin <= grid->xGrid[grid->nx - 1]
+        && window->yMax >= grid->yGrid[0] && window->yMin <= grid->yGrid[grid->ny - 1];
+}
+
+void cropTopography(Topography* grid, const TopographyWindow* window)
+{
+    // The rows move down in place, each one to an index below its own
+    if (grid->nx < 2 || grid->ny < 2 || !overlapsWindow(grid, window)) return;
+    size_t firstX, lastX, firstY, lastY;
+    findWindowCells(grid->xGrid, grid->nx, window->xMin, window->xMax, &firstX, &lastX);
+    findWindowCells(grid->yGrid, grid->ny, window->yMin, window->yMax, &firstY, &lastY);
+    widenCells(grid->nx, CROP_MARGIN, MIN_SPLINE_POINTS, &firstX, &lastX);
+    widenCells(grid->ny, CROP_MARGIN, MIN_SPLINE_POINTS, &firstY, &lastY);
+
+    size_t nx = lastX - firstX + 1;
+    size_t ny = lastY - firstY + 1;
+    for (size_t j = 0; j < ny; ++j)
+    {
+        memmove(grid->values + j * nx, grid->values + (firstY + j) * grid->nx + firstX,
+            nx * sizeof(double));
+    }
+    memmove(grid->xGrid, grid->xGrid + firstX, nx * sizeof(double));
+    memmove(grid->yGrid, grid->yGrid + firstY, ny * sizeof(double));
+    grid->nx = nx;
+    grid->ny = ny;
+}
+
+static int buildHiResTopography(const Topography* orig, const TopographyWindow* window,
+    size_t nx, size_t ny, Topography* topo)
 {
     topo->nx = nx;
     topo->ny = ny;
+    topo->uniform = 1;
     topo->xGrid = (double*)malloc(nx * sizeof(double));
     topo->yGrid = (double*)malloc(ny * sizeof(double));
     topo->values = (double*)malloc(nx * ny * sizeof(double));
@@ -99,9 +500,23 @@ static int buildHiResTopography(const Topography* orig, size_t nx, size_t ny, To
         return 0;
     }
 
+    // Within a window, the grid spans the original cells holding it
     double xMin, xMax, yMin, yMax;
-    minMaxElement(orig->xGrid, orig->nx, &xMin, &xMax);
-    minMaxElement(orig->yGrid, orig->ny, &yMin, &yMax);
+    if (window != NULL && orig->nx > 1 && orig->ny > 1 && overlapsWindow(orig, window))
+    {
+        size_t first, last;
+        findWindowCells(orig->xGrid, orig->nx, window->xMin, window->xMax, &first, &last);
+        xMin = orig->xGrid[first];
+        xMax = orig->xGrid[last];
+        findWindowCells(orig->yGrid, orig->ny, window->yMin, window->yMax, &first, &last);
+        yMin = orig->yGrid[first];
+        yMax = orig->yGrid[last];
+    }
+    else
+    {
+        minMaxElement(orig->xGrid, orig->nx, &xMin, &xMax);
+        minMaxElement(orig->yGrid, orig->ny, &yMin, &yMax);
+    }
 
     for (size_t i = 0; i < nx; ++i)
     {
@@ -115,54 +530,102 @@ static int buildHiResTopography(const Topography* orig, size_t nx, size_t ny, To
     return 1;
 }
 
-static int interpolate2dSpline(const Topography* orig, Topography* topo)
+typedef struct
+{
+    const TopographySpline* spline;
+    size_t nPoints;
+    const double* x;
+    const double* y;
+    double* z;
+} SplinePoints;
+
+static int evaluatePointsTask(void* context, size_t task)
 {
-    gsl_spline2d* spline = gsl_spline2d_alloc(gsl_interp2d_bicubic, orig->nx, orig->ny);
-    int status = gsl_spline2d_init(spline, orig->xGrid, orig->yGrid,
-        orig->values, orig->nx, orig->ny);
-    if (status != GSL_SUCCESS)
+    // Each task has its own accelerators, they only speed up the search of
+    // the grid cells and never change the values
+    const SplinePoints* points = (const SplinePoints*)context;
+    const gsl_spline2d* spline = (const gsl_spline2d*)points->spline->spline;
+    const Topography* grid = &points->spline->grid;
+    gsl_interp_accel* xAccel = gsl_interp_accel_alloc();
+    gsl_interp_accel* yAccel = gsl_interp_accel_alloc();
+    if (xAccel == NULL || yAccel == NULL)
     {
-        fprintf(stderr, "Error initializing 2D spline interpolation\n");
-        gsl_spline2d_free(spline);
+        fprintf(stderr, "Could not allocate memory for the spline accelerators\n");
+        gsl_interp_accel_free(xAccel);
+        gsl_interp_accel_free(yAccel);
         return 0;
     }
 
-    gsl_interp_accel* xAccel = gsl_interp_accel_alloc();
-    gsl_interp_accel* yAccel = gsl_interp_accel_alloc();
-    size_t nx = topo->nx;
-    size_t ny = topo->ny;
-    for (size_t j = 0; j < ny; ++j)
+    size_t first = task * POINTS_PER_TASK;
+    size_t last = first + POINTS_PER_TASK < points->nPoints
+        ? first + POINTS_PER_TASK
+        : points->nPoints;
+    for (size_t i = first; i < last; ++i)
     {
-        for (size_t i = 0; i < nx; ++i)
+        double x = points->x[i];
+        double y = points->y[i];
+        if (x < grid->xGrid[0] || x > grid->xGrid[grid->nx - 1]
+            || y < grid->yGrid[0] || y > grid->yGrid[grid->ny - 1])
         {
-            double x = topo->xGrid[i];
-            double y = topo->yGrid[j];
-            double z = gsl_spline2d_eval(spline, x, y, xAccel, yAccel);
-            topo->values[j * nx + i] = z;
+            points->z[i] = NAN;
+            continue;
         }
+        points->z[i] = gsl_spline2d_eval(spline, x, y, xAccel, yAccel);
     }
 
     gsl_interp_accel_free(xAccel);
     gsl_interp_accel_free(yAccel);
-    gsl_spline2d_free(spline);
-
     return 1;
 }
 
-
-
 void freeTopography(Topography* topo)
 {
-    free(topo->xGrid);
+    if (topo->mapping != NULL)
+    {
+        munmap(topo->mapping, topo->mappingSize);
+        topo->mapping = NULL;
+        topo->mappingSize = 0;
+    }
+    else
+    {
+        free(topo->xGrid);
+        free(topo->yGrid);
+        free(topo->values);
+    }
     topo->xGrid = NULL;
-    free(topo->yGrid);
     topo->yGrid = NULL;
-    free(topo->values);
     topo->values = NULL;
 }
 
-int increaseTopographyResolution(const ConfigFile* config,
-    const char* filename, Topography* topo)
+void freeTopographySpline(TopographySpline* spline)
+{
+    gsl_spline2d_free((gsl_spline2d*)spline->spline);
+    spline->spline = NULL;
+    freeTopography(&spline->grid);
+}
+
+int buildTopographySpline(TopographySpline* spline)
+{
+    const Topography* grid = &spline->grid;
+    gsl_spline2d* bicubic = gsl_spline2d_alloc(gsl_interp2d_bicubic, grid->nx, grid->ny);
+    spline->spline = bicubic;
+    if (bicubic == NULL || gsl_spline2d_init(bicubic, grid->xGrid, grid->yGrid,
+        grid->values, grid->nx, grid->ny) != GSL_SUCCESS)
+    {
+        fprintf(stderr, "Error initializing 2D spline interpolation\n");
+        freeTopographySpline(spline);
+        return 0;
+    }
+
+    return 1;
+}
+
+int readTopographySpline(const char* filename, TopographySpline* spline)
+{
+    return readTopographySplineInWindow(filename, NULL, spline);
+}
+
+int readTopographyGrid(const char* filename, const TopographyWindow* window, Topography* grid)
 {
     int result = 1;
     Node* nodes = NULL;
@@ -173,34 +636,76 @@ int increaseTopographyResolution(const ConfigFile* config,
         return 0;
     }
 
-    Topography origTopo = { 0 };
-    if (!buildOriginalTopography(nodes, nNodes, &origTopo))
+    if (!buildOriginalTopography(filename, nodes, nNodes, grid))
     {
         fprintf(stderr, "Error building original topography from file: %s\n", filename);
         result = 0;
         goto out_free_nodes;
     }
 
-    if (!buildHiResTopography(&origTopo, config->nx, config->ny, topo))
+    if (window != NULL) cropTopography(grid, window);
+
+out_free_nodes:
+    free(nodes);
+
+    return result;
+}
+
+int readTopographySplineInWindow(const char* filename, const TopographyWindow* window,
+    TopographySpline* spline)
+{
+    if (!readTopographyGrid(filename, window, &spline->grid)) return 0;
+    return buildTopographySpline(spline);
+}
+
+int evaluateTopographySpline(const TopographySpline* spline, size_t nPoints,
+    const double* x, const double* y, double* z)
+{
+    SplinePoints points = { spline, nPoints, x, y, z };
+    size_t nTasks = (nPoints + POINTS_PER_TASK - 1) / POINTS_PER_TASK;
+    return parallelFor(nTasks, evaluatePointsTask, &points);
+}
+
+int resampleTopography(const Topography* grid, const TopographyWindow* window,
+    size_t nx, size_t ny, Topography* topo)
+{
+    // The grid is regular, so the separable kernel evaluates it without GSL
+    BicubicSurface surface;
+    if (!initBicubicSurface(grid, &surface)) return 0;
+    int result = buildHiResTopography(grid, window, nx, ny, topo);
+    if (result && !sampleBicubicSurface(&surface, BICUBIC_KERNEL_AUTO, topo))
     {
-        fprintf(stderr, "Error building high-resolution topography for file: %s\n",
-            filename);
+        freeTopography(topo);
         result = 0;
-        goto out_free_Topography;
     }
+    freeBicubicSurface(&surface);
 
-    if (!interpolate2dSpline(&origTopo, topo))
+    return result;
+}
+
+int increaseTopographyResolution(const ConfigFile* config, const char* filename,
+    const TopographyWindow* window, Topography* topo)
+{
+    // A failure of the cache only costs the resampling, never the run
+    TopographyCacheKey key;
+    int cached = config->topoCacheDir[0] != '\0'
+        && getTopographyCacheKey(filename, config, window, &key);
+    if (cached && loadCachedTopography(config->topoCacheDir, &key, topo)) return 1;
+
+    // The kernel samples the grid itself, the GSL spline is never needed here
+    Topography grid = { 0 };
+    if (!readTopographyGrid(filename, window, &grid)) return 0;
+
+    int result = resampleTopography(&grid, window, config->nx, config->ny, topo);
+    if (!result)
     {
         fprintf(stderr, "Error interpolating topography for file: %s\n", filename);
-        freeTopography(topo);
-        result = 0;
-        goto out_free_Topography;
     }
-
-out_free_Topography:
-    freeTopography(&origTopo);
-out_free_nodes:
-    free(nodes);
+    freeTopography(&grid);
+    if (result && cached)
+    {
+        saveCachedTopography(config->topoCacheDir, config->topoCacheMB << 20, &key, topo);
+    }
 
     return result;
 }
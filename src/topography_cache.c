@@ -0,0 +1,275 @@
+/*
+    Filename: topography_cache.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the persistent cache of resampled
+    topographies. An entry is a section file holding the grid arrays, named
+    after the hash of its key. The modification time of an entry is its last
+    use, the oldest entries are evicted first
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mesh_snapshot.h"
+#include "section_file.h"
+#include "topography_cache.h"
+
+#define CACHE_MAGIC "AMGTOPO1"
+#define CACHE_FORMAT_VERSION 3
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+enum CacheArray
+{
+    ARRAY_X_GRID,
+    ARRAY_Y_GRID,
+    ARRAY_VALUES,
+    ARRAY_COUNT
+};
+
+typedef struct
+{
+    SectionFileHeader file;     // CACHE_MAGIC, CACHE_FORMAT_VERSION and the size
+    TopographyCacheKey key;     // full key, the file name is only its hash
+    uint64_t nx;
+    uint64_t ny;
+    uint64_t uniform;           // evenly spaced grids
+    uint64_t offsets[ARRAY_COUNT];
+} CacheHeader;
+
+typedef struct
+{
+    char* path;
+    size_t size;
+    struct timespec lastUse;
+} CacheEntry;
+
+static int entryPath(char* dest, size_t size, const char* directory,
+    const TopographyCacheKey* key)
+{
+    // FNV-1a of the key, which has no padding bytes
+    const unsigned char* bytes = (const unsigned char*)key;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < sizeof(TopographyCacheKey); ++i)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    int res = snprintf(dest, size, "%s/%016llx%s", directory, (unsigned long long)hash,
+        TOPOGRAPHY_CACHE_EXTENSION);
+    return res > 0 && (size_t)res < size;
+}
+
+static void getArraySizes(uint64_t nx, uint64_t ny, size_t sizes[ARRAY_COUNT])
+{
+    sizes[ARRAY_X_GRID] = nx * sizeof(double);
+    sizes[ARRAY_Y_GRID] = ny * sizeof(double);
+    sizes[ARRAY_VALUES] = nx * ny * sizeof(double);
+}
+
+static int validHeader(const CacheHeader* header, size_t fileSize, const TopographyCacheKey* key)
+{
+    if (memcmp(&header->key, key, sizeof(TopographyCacheKey)) != 0) return 0;
+
+    // The counts are bounded by the file size before their product is computed
+    if (header->nx < 2 || header->ny < 2 || header->nx > fileSize || header->ny > fileSize
+        || header->nx * header->ny > fileSize)
+    {
+        return 0;
+    }
+    size_t sizes[ARRAY_COUNT];
+    getArraySizes(header->nx, header->ny, sizes);
+    if (!validSectionFile(&header->file, CACHE_MAGIC, CACHE_FORMAT_VERSION, fileSize,
+        sizeof(CacheHeader), header->offsets, sizes, ARRAY_COUNT))
+    {
+        return 0;
+    }
+
+    // Every array is stored
+    return header->offsets[ARRAY_X_GRID] != 0 && header->offsets[ARRAY_Y_GRID] != 0
+        && header->offsets[ARRAY_VALUES] != 0;
+}
+
+int getTopographyCacheKey(const char* filename, const ConfigFile* config,
+    const TopographyWindow* window, TopographyCacheKey* key)
+{
+    SnapshotSource source;
+    if (!getSnapshotSource(filename, &source)) return 0;
+
+    memset(key, 0, sizeof(TopographyCacheKey));
+    key->fileHash = source.hash;
+    key->fileSize = source.size;
+    key->nx = config->nx;
+    key->ny = config->ny;
+    key->method = (uint32_t)config->topoInterpolation;
+    if (window != NULL)
+    {
+        key->hasWindow = 1;
+        key->window[0] = window->xMin;
+        key->window[1] = window->xMax;
+        key->window[2] = window->yMin;
+        key->window[3] = window->yMax;
+    }
+
+    return 1;
+}
+
+int loadCachedTopography(const char* directory, const TopographyCacheKey* key, Topography* topo)
+{
+    char path[MAX_PATH_LENGTH + 32];
+    if (!entryPath(path, sizeof(path), directory, key)) return 0;
+    char* data;
+    size_t size;
+    if (!mapSectionFile(path, 0, sizeof(CacheHeader), &data, &size)) return 0;
+    const CacheHeader* header = (const CacheHeader*)data;
+    if (!validHeader(header, size, key))
+    {
+        munmap(data, size);
+        return 0;
+    }
+
+    topo->nx = header->nx;
+    topo->ny = header->ny;
+    topo->uniform = header->uniform != 0;
+    topo->xGrid = (double*)&data[header->offsets[ARRAY_X_GRID]];
+    topo->yGrid = (double*)&data[header->offsets[ARRAY_Y_GRID]];
+    topo->values = (double*)&data[header->offsets[ARRAY_VALUES]];
+    topo->mapping = data;
+    topo->mappingSize = size;
+
+    // The last use of an entry is its modification time
+    utimensat(AT_FDCWD, path, NULL, 0);
+    return 1;
+}
+
+static int compareLastUse(const void* a, const void* b)
+{
+    const struct timespec* timeA = &((const CacheEntry*)a)->lastUse;
+    const struct timespec* timeB = &((const CacheEntry*)b)->lastUse;
+    if (timeA->tv_sec != timeB->tv_sec) return timeA->tv_sec < timeB->tv_sec ? -1 : 1;
+    return (timeA->tv_nsec > timeB->tv_nsec) - (timeA->tv_nsec < timeB->tv_nsec);
+}
+
+static int evictEntries(const char* directory, size_t maxSize, size_t incoming)
+{
+    // Removes the least recently used entries until the new one fits. Other
+    // files of the directory are never touched
+    DIR* dir = opendir(directory);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Could not open topography cache '%s': %s\n", directory, strerror(errno));
+        return 0;
+    }
+
+    int result = 1;
+    CacheEntry* entries = NULL;
+    size_t nEntries = 0;
+    size_t capacity = 0;
+    size_t total = 0;
+    size_t extension = strlen(TOPOGRAPHY_CACHE_EXTENSION);
+    struct dirent* item;
+    while ((item = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(item->d_name);
+        if (length <= extension
+            || strcmp(item->d_name + length - extension, TOPOGRAPHY_CACHE_EXTENSION) != 0)
+        {
+            continue;
+        }
+        if (nEntries == capacity)
+        {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            CacheEntry* grown = (CacheEntry*)realloc(entries, capacity * sizeof(CacheEntry));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Could not allocate memory for %zu cache entries\n", capacity);
+                result = 0;
+                break;
+            }
+            entries = grown;
+        }
+        CacheEntry* entry = &entries[nEntries];
+        entry->path = (char*)malloc(strlen(directory) + length + 2);
+        if (entry->path == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory for cache entry '%s'\n", item->d_name);
+            result = 0;
+            break;
+        }
+        sprintf(entry->path, "%s/%s", directory, item->d_name);
+        struct stat st;
+        if (stat(entry->path, &st) == -1 || !S_ISREG(st.st_mode))
+        {
+            free(entry->path);
+            continue;
+        }
+        entry->size = (size_t)st.st_size;
+        entry->lastUse = st.st_mtim;
+        total += entry->size;
+        ++nEntries;
+    }
+    closedir(dir);
+
+    if (result && nEntries > 0)
+    {
+        qsort(entries, nEntries, sizeof(CacheEntry), compareLastUse);
+        for (size_t i = 0; i < nEntries && total + incoming > maxSize; ++i)
+        {
+            if (remove(entries[i].path) == 0) total -= entries[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < nEntries; ++i)
+    {
+        free(entries[i].path);
+    }
+    free(entries);
+    return result;
+}
+
+int saveCachedTopography(const char* directory, size_t maxSize, const TopographyCacheKey* key,
+    const Topography* topo)
+{
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    initSectionFileHeader(&header.file, CACHE_MAGIC, CACHE_FORMAT_VERSION);
+    header.key = *key;
+    header.nx = topo->nx;
+    header.ny = topo->ny;
+    header.uniform = (uint64_t)topo->uniform;
+    size_t sizes[ARRAY_COUNT];
+    getArraySizes(header.nx, header.ny, sizes);
+    FileSection sections[ARRAY_COUNT] = {
+        [ARRAY_X_GRID] = { topo->xGrid, sizes[ARRAY_X_GRID], 1 },
+        [ARRAY_Y_GRID] = { topo->yGrid, sizes[ARRAY_Y_GRID], 1 },
+        [ARRAY_VALUES] = { topo->values, sizes[ARRAY_VALUES], 1 }
+    };
+    header.file.size = placeSections(sizeof(CacheHeader), sections, ARRAY_COUNT,
+        header.offsets);
+    if (header.file.size > maxSize) return 1;
+
+    char path[MAX_PATH_LENGTH + 32];
+    if (!entryPath(path, sizeof(path), directory, key))
+    {
+        fprintf(stderr, "Topography cache path '%s' is too long\n", directory);
+        return 0;
+    }
+    if (mkdir(directory, 0777) == -1 && errno != EEXIST)
+    {
+        fprintf(stderr, "Could not create topography cache '%s': %s\n",
+            directory, strerror(errno));
+        return 0;
+    }
+    if (!evictEntries(directory, maxSize, header.file.size)) return 0;
+
+    return writeSectionFile(path, &header, sizeof(header), sections, header.offsets,
+        ARRAY_COUNT);
+}
@@ -11,9 +11,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "mapped_file.h"
+#include "number_parser.h"
+#include "parallel.h"
 #include "topography_parser.h"
 #include "utils.h"
 
+#define CHUNKS_PER_THREAD 4          // chunks per thread to balance uneven lines
+#define MIN_CHUNK_SIZE (64 * 1024)    // minimum number of bytes of a chunk
+
 int readTopographyFile(const char* filename, Topography* topo)
 {
     int result = 1;
@@ -103,72 +109,190 @@ out_close_file:
     return result;
 }
 
-int readXYZFile(const char* filename, Node** nodes, size_t* nNodes)
+typedef struct
 {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL)
+    const char* start;          // first character of the chunk
+    const char* end;            // past the last character of the chunk
+    size_t line;                // line number of the first line of the chunk
+    size_t nLines;              // number of line breaks in the chunk
+    size_t firstNode;           // index of the first node of the chunk
+    size_t nNodes;              // number of node lines of the chunk
+} XYZChunk;
+
+typedef struct
+{
+    const char* filename;
+    XYZChunk* chunks;
+    Node* nodes;
+} XYZFile;
+
+static int isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char* skipBlanks(const char* p, const char* end)
+{
+    while (p < end && isBlank(*p)) ++p;
+    return p;
+}
+
+static int countXYZTask(void* context, size_t task)
+{
+    // A node is a line whose first non whitespace character is not a '#'
+    XYZChunk* chunk = &((XYZFile*)context)->chunks[task];
+    size_t nLines = 0;
+    size_t nNodes = 0;
+    const char* p = chunk->start;
+    while (p < chunk->end)
     {
-        fprintf(stderr, "Could not open topography file: %s\n", filename);
-        return 0;
+        p = skipBlanks(p, chunk->end);
+        if (p < chunk->end && *p != '\n' && *p != '#') ++nNodes;
+        const char* newLine = (const char*)memchr(p, '\n', (size_t)(chunk->end - p));
+        if (newLine == NULL) break;
+        ++nLines;
+        p = newLine + 1;
     }
 
-    size_t capacity = 256;
-    *nodes = (Node*)malloc(capacity * sizeof(Node));
-    if (*nodes == NULL)
+    chunk->nLines = nLines;
+    chunk->nNodes = nNodes;
+    return 1;
+}
+
+static const char* scanCoordinate(const char* start, const char* end, double* value)
+{
+    // Special values such as nan and inf are left to strtod, which cannot
+    // go past the line since none of them contains a line break
+    Number number;
+    const char* p = scanNumber(start, end, &number);
+    if (p != start)
     {
-        fprintf(stderr, "Could not allocate memory for %zu nodes\n", capacity);
-        fclose(file);
-        return 0;
+        *value = number.value;
+        return p;
     }
+    char* last;
+    *value = strtod(start, &last);
+    return last > end ? start : last;
+}
 
-    int result = 1;
-    size_t count = 0;
-    char line[1024];
-    while (fgets(line, sizeof(line), file))
-    {
-        char *ptr = line;
-        ptr = skipLeadingSpaces(ptr);
-        if (*ptr == '#' || *ptr == '\0') continue;
-        if (sscanf(ptr, "%lf %lf %lf",
-            &(*nodes)[count].x,
-            &(*nodes)[count].y,
-            &(*nodes)[count].z) == 3)
+static int parseXYZTask(void* context, size_t task)
+{
+    const XYZFile* file = (const XYZFile*)context;
+    const XYZChunk* chunk = &file->chunks[task];
+    Node* node = file->nodes + chunk->firstNode;
+    size_t line = chunk->line;
+    const char* p = chunk->start;
+    while (p < chunk->end)
+    {
+        const char* lineStart = p;
+        const char* lineEnd = (const char*)memchr(p, '\n', (size_t)(chunk->end - p));
+        if (lineEnd == NULL) lineEnd = chunk->end;
+
+        // As with sscanf, the coordinates can be followed by anything
+        p = skipBlanks(p, lineEnd);
+        if (p < lineEnd && *p != '#')
         {
-            ++count;
-            if (count >= capacity)
+            double xyz[3];
+            for (int k = 0; k < 3 && p != NULL; ++k)
+            {
+                const char* q = skipBlanks(p, lineEnd);
+                p = q < lineEnd ? scanCoordinate(q, lineEnd, &xyz[k]) : q;
+                if (p == q) p = NULL;
+            }
+            if (p == NULL)
             {
-                capacity *= 2;
-                Node* temp = (Node*)realloc(*nodes, capacity * sizeof(Node));
-                if (temp == NULL)
-                {
-                    fprintf(stderr, "Could not reallocate memory for %zu nodes\n", capacity);
-                    result = 0;
-                    goto out_free_nodes;
-                }
-                *nodes = temp;
+                fprintf(stderr, "Format error, cannot parse line %zu of %s: %.*s\n",
+                    line, file->filename, (int)(lineEnd - lineStart), lineStart);
+                return 0;
             }
+            node->x = xyz[0];
+            node->y = xyz[1];
+            node->z = xyz[2];
+            ++node;
         }
-        else
+
+        p = lineEnd + 1;
+        ++line;
+    }
+
+    return 1;
+}
+
+int readXYZFile(const char* filename, Node** nodes, size_t* nNodes)
+{
+    *nodes = NULL;
+    *nNodes = 0;
+    MappedFile mapped;
+    if (!openMappedFile(filename, &mapped))
+    {
+        fprintf(stderr, "Could not open topography file: %s\n", filename);
+        return 0;
+    }
+
+    int result = 1;
+    size_t nChunks = getThreadCount() * CHUNKS_PER_THREAD;
+    if (nChunks > mapped.size / MIN_CHUNK_SIZE) nChunks = mapped.size / MIN_CHUNK_SIZE;
+    if (nChunks == 0) nChunks = 1;
+    XYZFile file = { filename, NULL, NULL };
+    file.chunks = (XYZChunk*)calloc(nChunks, sizeof(XYZChunk));
+    if (file.chunks == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for %zu chunks\n", nChunks);
+        result = 0;
+        goto out_close_file;
+    }
+
+    // Align the chunk boundaries to the start of a line
+    const char* end = mapped.data + mapped.size;
+    const char* chunkStart = mapped.data;
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        const char* chunkEnd = end;
+        if (i + 1 < nChunks)
         {
-            fprintf(stderr, "Format error, cannot parse line: %s\n", line);
-            result = 0;
-            goto out_free_nodes;
+            chunkEnd = mapped.data + (i + 1) * (mapped.size / nChunks);
+            if (chunkEnd < chunkStart) chunkEnd = chunkStart;
+            const char* newLine = (const char*)memchr(chunkEnd, '\n', (size_t)(end - chunkEnd));
+            chunkEnd = newLine == NULL ? end : newLine + 1;
         }
+        file.chunks[i].start = chunkStart;
+        file.chunks[i].end = chunkEnd;
+        chunkStart = chunkEnd;
     }
 
-    goto out_close_file;
+    // The nodes are counted first, so they are allocated once and every
+    // chunk parses straight into its own range
+    parallelFor(nChunks, countXYZTask, &file);
+    size_t count = 0;
+    size_t line = 1;
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        file.chunks[i].firstNode = count;
+        file.chunks[i].line = line;
+        count += file.chunks[i].nNodes;
+        line += file.chunks[i].nLines;
+    }
+    if (count == 0) goto out_free_chunks;
 
-out_free_nodes:
-    free(*nodes);
-    *nodes = NULL;
-out_close_file:
-    fclose(file);
-    *nNodes = count;
-    if (count == 0)
+    file.nodes = (Node*)malloc(count * sizeof(Node));
+    if (file.nodes == NULL)
     {
-        free(*nodes);
-        *nodes = NULL;
+        fprintf(stderr, "Could not allocate memory for %zu nodes\n", count);
+        result = 0;
+        goto out_free_chunks;
     }
+    if (!parallelFor(nChunks, parseXYZTask, &file))
+    {
+        free(file.nodes);
+        result = 0;
+        goto out_free_chunks;
+    }
+    *nodes = file.nodes;
+    *nNodes = count;
 
+out_free_chunks:
+    free(file.chunks);
+out_close_file:
+    closeMappedFile(&mapped);
     return result;
 }
@@ -0,0 +1,762 @@
+/*
+    Filename: topography_tiles.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the tiled topography store used for
+    DEMs larger than the memory. A tile file is a header followed by the
+    values of its points, row by row, as native doubles
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "topography_tiles.h"
+
+#define TILE_MAGIC "AMGTILE1"
+#define TILE_HANDLES 4              // tiles a task keeps in use, enough for the corners of a cell
+#define POINTS_PER_TASK 4096        // points evaluated by a task of a parallel loop
+#define LATTICE_TOLERANCE 1e-6      // distance to the lattice, relative to its spacing
+#define MAX_INDEX_LINE 4096
+#define NO_TILE SIZE_MAX
+
+typedef struct
+{
+    char magic[8];
+    uint64_t nx;                // number of points along x
+    uint64_t ny;                // number of points along y
+    double x0;                  // coordinates of the first point
+    double y0;
+    double dx;                  // spacing of the points
+    double dy;
+} TileHeader;
+
+typedef struct
+{
+    char* path;
+    size_t ix;                  // lattice index of the first point of the tile
+    size_t iy;
+    size_t nx;
+    size_t ny;
+    double* values;             // cached values, NULL when the tile is not in the cache
+    int loading;                // 1 while a task reads the values outside of the lock
+    size_t pins;                // number of tasks using the cached values
+    unsigned long long lastUse; // clock of the last use, the oldest unpinned tile is evicted
+} Tile;
+
+typedef struct
+{
+    Tile* tiles;
+    size_t nx;                  // lattice points spanned by the tiles
+    size_t ny;
+    size_t blockX;              // lattice points of a directory block, those of the largest tile
+    size_t blockY;
+    size_t nBlocksX;
+    size_t nBlocksY;
+    size_t* blockStarts;        // first entry of each block in blockTiles
+    size_t* blockTiles;         // tiles overlapping each block
+    pthread_mutex_t lock;       // guards the cache
+    pthread_cond_t loaded;      // signaled when a tile is no longer loading
+    size_t cachedBytes;         // cached values, and those being read
+    unsigned long long clock;
+} TileStore;
+
+typedef struct
+{
+    size_t tile;
+    const double* values;
+    unsigned long long lastUse;
+} TileHandle;
+
+typedef struct
+{
+    TiledTopography* tiles;
+    const size_t* order;        // covered points grouped by tile
+    size_t nPoints;
+    const double* x;
+    const double* y;
+    double* z;
+} TileQueries;
+
+int isTiledTopographyFile(const char* filename)
+{
+    size_t length = strlen(filename);
+    size_t extension = strlen(TILES_EXTENSION);
+    return length > extension && strcmp(filename + length - extension, TILES_EXTENSION) == 0;
+}
+
+static int readTileHeader(const char* path, TileHeader* header)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open topography tile '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    int result = fread(header, sizeof(TileHeader), 1, file) == 1
+        && memcmp(header->magic, TILE_MAGIC, sizeof(header->magic)) == 0
+        && header->nx > 0 && header->ny > 0 && header->dx > 0.0 && header->dy > 0.0;
+    if (!result) fprintf(stderr, "Invalid topography tile '%s'\n", path);
+    fclose(file);
+    return result;
+}
+
+static int latticeIndex(double origin, double coordinate, double spacing, long long* index)
+{
+    double position = (coordinate - origin) / spacing;
+    double rounded = round(position);
+    *index = (long long)rounded;
+    return fabs(position - rounded) <= LATTICE_TOLERANCE;
+}
+
+static void freeTileStore(TileStore* store, size_t nTiles)
+{
+    if (store->tiles != NULL)
+    {
+        for (size_t t = 0; t < nTiles; ++t)
+        {
+            free(store->tiles[t].path);
+            free(store->tiles[t].values);
+        }
+    }
+    free(store->tiles);
+    free(store->blockStarts);
+    free(store->blockTiles);
+    free(store);
+}
+
+static int readTileIndex(const char* filename, TiledTopography* tiles, TileStore* store,
+    long long** origins)
+{
+    // The tile paths are relative to the directory of the index
+    FILE* index = fopen(filename, "r");
+    if (index == NULL)
+    {
+        fprintf(stderr, "Could not open tile index '%s': %s\n", filename, strerror(errno));
+        return 0;
+    }
+    const char* slash = strrchr(filename, '/');
+    size_t directoryLength = slash == NULL ? 0 : (size_t)(slash - filename) + 1;
+
+    int result = 1;
+    size_t capacity = 0;
+    char line[MAX_INDEX_LINE];
+    while (result && fgets(line, sizeof(line), index))
+    {
+        size_t length = strlen(line);
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'
+            || line[length - 1] == ' ' || line[length - 1] == '\t'))
+        {
+            line[--length] = '\0';
+        }
+        const char* name = line;
+        while (*name == ' ' || *name == '\t') ++name;
+        if (*name == '\0' || *name == '#') continue;
+
+        if (tiles->nTiles == capacity)
+        {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            Tile* grown = (Tile*)realloc(store->tiles, capacity * sizeof(Tile));
+            long long* grownOrigins = (long long*)realloc(*origins,
+                2 * capacity * sizeof(long long));
+            if (grown != NULL) store->tiles = grown;
+            if (grownOrigins != NULL) *origins = grownOrigins;
+            if (grown == NULL || grownOrigins == NULL)
+            {
+                fprintf(stderr, "Could not allocate memory for %zu tiles\n", capacity);
+                result = 0;
+                break;
+            }
+        }
+        Tile* tile = &store->tiles[tiles->nTiles];
+        memset(tile, 0, sizeof(Tile));
+        size_t nameLength = strlen(name);
+        tile->path = (char*)malloc(directoryLength + nameLength + 1);
+        if (tile->path == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory for the path of tile '%s'\n", name);
+            result = 0;
+            break;
+        }
+        ++tiles->nTiles;
+        memcpy(tile->path, filename, directoryLength);
+        memcpy(tile->path + directoryLength, name, nameLength + 1);
+
+        // The first tile sets the lattice, the others must fall on it
+        TileHeader header;
+        long long* origin = *origins + 2 * (tiles->nTiles - 1);
+        if (!readTileHeader(tile->path, &header))
+        {
+            result = 0;
+            break;
+        }
+        if (tiles->nTiles == 1)
+        {
+            tiles->x0 = header.x0;
+            tiles->y0 = header.y0;
+            tiles->dx = header.dx;
+            tiles->dy = header.dy;
+        }
+        if (fabs(header.dx - tiles->dx) > LATTICE_TOLERANCE * tiles->dx
+            || fabs(header.dy - tiles->dy) > LATTICE_TOLERANCE * tiles->dy
+            || !latticeIndex(tiles->x0, header.x0, tiles->dx, &origin[0])
+            || !latticeIndex(tiles->y0, header.y0, tiles->dy, &origin[1]))
+        {
+            fprintf(stderr, "Topography tile '%s' is not on the lattice of the first tile\n",
+                tile->path);
+            result = 0;
+            break;
+        }
+        tile->nx = (size_t)header.nx;
+        tile->ny = (size_t)header.ny;
+    }
+    if (result && tiles->nTiles == 0)
+    {
+        fprintf(stderr, "Tile index '%s' lists no tile\n", filename);
+        result = 0;
+    }
+
+    fclose(index);
+    return result;
+}
+
+static int buildTileDirectory(TileStore* store, size_t nTiles)
+{
+    // The lattice is cut in blocks the size of the largest tile, so the
+    // directory has about one block per tile. Narrow tiles, such as those at
+    // the end of the rows written from a grid, only make a block overlap a
+    // few more tiles, the smallest tile would give a block per lattice point
+    store->blockX = store->tiles[0].nx;
+    store->blockY = store->tiles[0].ny;
+    for (size_t t = 0; t < nTiles; ++t)
+    {
+        const Tile* tile = &store->tiles[t];
+        if (tile->nx > store->blockX) store->blockX = tile->nx;
+        if (tile->ny > store->blockY) store->blockY = tile->ny;
+        if (tile->ix + tile->nx > store->nx) store->nx = tile->ix + tile->nx;
+        if (tile->iy + tile->ny > store->ny) store->ny = tile->iy + tile->ny;
+    }
+    store->nBlocksX = (store->nx + store->blockX - 1) / store->blockX;
+    store->nBlocksY = (store->ny + store->blockY - 1) / store->blockY;
+    size_t nBlocks = store->nBlocksX * store->nBlocksY;
+    store->blockStarts = (size_t*)calloc(nBlocks + 1, sizeof(size_t));
+    if (store->blockStarts == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a directory of %zu blocks\n", nBlocks);
+        return 0;
+    }
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (size_t t = 0; t < nTiles; ++t)
+        {
+            const Tile* tile = &store->tiles[t];
+            for (size_t by = tile->iy / store->blockY;
+                by <= (tile->iy + tile->ny - 1) / store->blockY; ++by)
+            {
+                for (size_t bx = tile->ix / store->blockX;
+                    bx <= (tile->ix + tile->nx - 1) / store->blockX; ++bx)
+                {
+                    size_t block = by * store->nBlocksX + bx;
+                    if (pass == 0) ++store->blockStarts[block + 1];
+                    else store->blockTiles[store->blockStarts[block]++] = t;
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            for (size_t b = 0; b < nBlocks; ++b)
+            {
+                store->blockStarts[b + 1] += store->blockStarts[b];
+            }
+            store->blockTiles = (size_t*)malloc(store->blockStarts[nBlocks] * sizeof(size_t));
+            if (store->blockTiles == NULL)
+            {
+                fprintf(stderr, "Could not allocate memory for the tile directory\n");
+                return 0;
+            }
+        }
+    }
+
+    // The second pass moved every start to the next block
+    for (size_t b = nBlocks; b > 0; --b)
+    {
+        store->blockStarts[b] = store->blockStarts[b - 1];
+    }
+    store->blockStarts[0] = 0;
+    return 1;
+}
+
+int openTiledTopography(const char* filename, size_t cacheSize, TiledTopography* tiles)
+{
+    memset(tiles, 0, sizeof(TiledTopography));
+    tiles->cacheSize = cacheSize;
+    TileStore* store = (TileStore*)calloc(1, sizeof(TileStore));
+    if (store == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for the tiles of '%s'\n", filename);
+        return 0;
+    }
+
+    long long* origins = NULL;
+    int result = readTileIndex(filename, tiles, store, &origins);
+    if (result)
+    {
+        // The lattice is shifted so that the first point of the tiles is (0, 0)
+        long long minX = origins[0];
+        long long minY = origins[1];
+        for (size_t t = 1; t < tiles->nTiles; ++t)
+        {
+            if (origins[2 * t] < minX) minX = origins[2 * t];
+            if (origins[2 * t + 1] < minY) minY = origins[2 * t + 1];
+        }
+        tiles->x0 += (double)minX * tiles->dx;
+        tiles->y0 += (double)minY * tiles->dy;
+        for (size_t t = 0; t < tiles->nTiles; ++t)
+        {
+            store->tiles[t].ix = (size_t)(origins[2 * t] - minX);
+            store->tiles[t].iy = (size_t)(origins[2 * t + 1] - minY);
+        }
+        result = buildTileDirectory(store, tiles->nTiles);
+    }
+    free(origins);
+    if (result && pthread_mutex_init(&store->lock, NULL) != 0)
+    {
+        fprintf(stderr, "Could not initialize the lock of the tile cache\n");
+        result = 0;
+    }
+    if (result && pthread_cond_init(&store->loaded, NULL) != 0)
+    {
+        fprintf(stderr, "Could not initialize the condition of the tile cache\n");
+        pthread_mutex_destroy(&store->lock);
+        result = 0;
+    }
+    if (!result)
+    {
+        fprintf(stderr, "Could not open tiled topography '%s'\n", filename);
+        freeTileStore(store, tiles->nTiles);
+        tiles->nTiles = 0;
+        return 0;
+    }
+
+    tiles->nBlocks = store->nBlocksX * store->nBlocksY;
+    tiles->store = store;
+    return 1;
+}
+
+void closeTiledTopography(TiledTopography* tiles)
+{
+    TileStore* store = (TileStore*)tiles->store;
+    if (store == NULL) return;
+    pthread_cond_destroy(&store->loaded);
+    pthread_mutex_destroy(&store->lock);
+    freeTileStore(store, tiles->nTiles);
+    tiles->store = NULL;
+    tiles->nTiles = 0;
+}
+
+static size_t findTile(const TileStore* store, size_t gx, size_t gy)
+{
+    if (gx >= store->nx || gy >= store->ny) return NO_TILE;
+    size_t block = (gy / store->blockY) * store->nBlocksX + gx / store->blockX;
+    for (size_t k = store->blockStarts[block]; k < store->blockStarts[block + 1]; ++k)
+    {
+        const Tile* tile = &store->tiles[store->blockTiles[k]];
+        if (gx >= tile->ix && gx < tile->ix + tile->nx
+            && gy >= tile->iy && gy < tile->iy + tile->ny)
+        {
+            return store->blockTiles[k];
+        }
+    }
+
+    return NO_TILE;
+}
+
+static double* readTile(const Tile* tile)
+{
+    size_t bytes = tile->nx * tile->ny * sizeof(double);
+    double* values = (double*)malloc(bytes);
+    if (values == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for topography tile '%s'\n", tile->path);
+        return NULL;
+    }
+    int fd = open(tile->path, O_RDONLY);
+    size_t done = 0;
+    while (fd != -1 && done < bytes)
+    {
+        ssize_t count = pread(fd, (char*)values + done, bytes - done,
+            (off_t)(sizeof(TileHeader) + done));
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) break;
+        done += (size_t)count;
+    }
+    if (fd != -1) close(fd);
+    if (done < bytes)
+    {
+        fprintf(stderr, "Could not read topography tile '%s'\n", tile->path);
+        free(values);
+        return NULL;
+    }
+
+    return values;
+}
+
+static const double* acquireTile(TiledTopography* tiles, size_t t)
+{
+    // The cache only holds whole tiles. A missing tile is marked as loading
+    // and its room is made under the lock, but it is read outside of it, so
+    // the other tasks keep using the cached tiles meanwhile. A task needing a
+    // tile being loaded waits for it
+    TileStore* store = (TileStore*)tiles->store;
+    pthread_mutex_lock(&store->lock);
+    Tile* tile = &store->tiles[t];
+    while (tile->loading)
+    {
+        pthread_cond_wait(&store->loaded, &store->lock);
+    }
+    if (tile->values == NULL)
+    {
+        size_t bytes = tile->nx * tile->ny * sizeof(double);
+        while (store->cachedBytes + bytes > tiles->cacheSize)
+        {
+            Tile* oldest = NULL;
+            for (size_t k = 0; k < tiles->nTiles; ++k)
+            {
+                Tile* cached = &store->tiles[k];
+                if (cached->values == NULL || cached->pins > 0) continue;
+                if (oldest == NULL || cached->lastUse < oldest->lastUse) oldest = cached;
+            }
+            if (oldest == NULL) break;
+            free(oldest->values);
+            oldest->values = NULL;
+            store->cachedBytes -= oldest->nx * oldest->ny * sizeof(double);
+        }
+        tile->loading = 1;
+        store->cachedBytes += bytes;
+        pthread_mutex_unlock(&store->lock);
+
+        double* values = readTile(tile);
+
+        pthread_mutex_lock(&store->lock);
+        tile->loading = 0;
+        pthread_cond_broadcast(&store->loaded);
+        if (values == NULL)
+        {
+            store->cachedBytes -= bytes;
+            pthread_mutex_unlock(&store->lock);
+            return NULL;
+        }
+        tile->values = values;
+        ++tiles->nLoads;
+    }
+    ++tile->pins;
+    tile->lastUse = ++store->clock;
+    const double* values = tile->values;
+    pthread_mutex_unlock(&store->lock);
+    return values;
+}
+
+static void releaseTile(TiledTopography* tiles, size_t t)
+{
+    TileStore* store = (TileStore*)tiles->store;
+    pthread_mutex_lock(&store->lock);
+    --store->tiles[t].pins;
+    pthread_mutex_unlock(&store->lock);
+}
+
+static int latticeValue(TiledTopography* tiles, TileHandle* handles, unsigned long long* clock,
+    size_t gx, size_t gy, double* value)
+{
+    // The tiles of the task are kept in use until another one replaces the
+    // least recently used of them
+    const TileStore* store = (const TileStore*)tiles->store;
+    size_t t = findTile(store, gx, gy);
+    if (t == NO_TILE)
+    {
+        *value = NAN;
+        return 1;
+    }
+
+    TileHandle* handle = NULL;
+    for (int k = 0; k < TILE_HANDLES; ++k)
+    {
+        if (handles[k].tile == t) handle = &handles[k];
+    }
+    if (handle == NULL)
+    {
+        handle = &handles[0];
+        for (int k = 1; k < TILE_HANDLES; ++k)
+        {
+            if (handles[k].lastUse < handle->lastUse) handle = &handles[k];
+        }
+        if (handle->tile != NO_TILE) releaseTile(tiles, handle->tile);
+        handle->tile = NO_TILE;
+        handle->values = acquireTile(tiles, t);
+        if (handle->values == NULL) return 0;
+        handle->tile = t;
+    }
+    handle->lastUse = ++*clock;
+
+    const Tile* tile = &store->tiles[t];
+    *value = handle->values[(gy - tile->iy) * tile->nx + (gx - tile->ix)];
+    return 1;
+}
+
+static int cellOf(double coordinate, double origin, double spacing, size_t n,
+    size_t* index, double* fraction)
+{
+    // The last lattice line belongs to the cell before it
+    double position = (coordinate - origin) / spacing;
+    if (!(position >= 0.0) || position > (double)(n - 1)) return 0;
+    size_t cell = (size_t)position;
+    if (cell + 1 >= n) cell = n > 1 ? n - 2 : 0;
+    *index = cell;
+    *fraction = position - (double)cell;
+    return 1;
+}
+
+static int sampleTilesTask(void* context, size_t task)
+{
+    const TileQueries* queries = (const TileQueries*)context;
+    TiledTopography* tiles = queries->tiles;
+    const TileStore* store = (const TileStore*)tiles->store;
+    TileHandle handles[TILE_HANDLES];
+    for (int k = 0; k < TILE_HANDLES; ++k)
+    {
+        handles[k].tile = NO_TILE;
+        handles[k].values = NULL;
+        handles[k].lastUse = 0;
+    }
+
+    int result = 1;
+    unsigned long long clock = 0;
+    size_t first = task * POINTS_PER_TASK;
+    size_t last = first + POINTS_PER_TASK < queries->nPoints
+        ? first + POINTS_PER_TASK
+        : queries->nPoints;
+    for (size_t k = first; result && k < last; ++k)
+    {
+        // Corners with a zero weight are not read, so points on the last
+        // line of a tile do not need the tile after it
+        size_t i = queries->order[k];
+        size_t gx = 0, gy = 0;
+        double tx = 0.0, ty = 0.0;
+        cellOf(queries->x[i], tiles->x0, tiles->dx, store->nx, &gx, &tx);
+        cellOf(queries->y[i], tiles->y0, tiles->dy, store->ny, &gy, &ty);
+        double weights[4] = { (1.0 - tx) * (1.0 - ty), tx * (1.0 - ty), (1.0 - tx) * ty, tx * ty };
+        double height = 0.0;
+        for (int c = 0; result && c < 4; ++c)
+        {
+            if (weights[c] == 0.0) continue;
+            double value = 0.0;
+            result = latticeValue(tiles, handles, &clock, gx + (size_t)(c & 1),
+                gy + (size_t)(c >> 1), &value);
+            height += weights[c] * value;
+        }
+        queries->z[i] = height;
+    }
+
+    for (int k = 0; k < TILE_HANDLES; ++k)
+    {
+        if (handles[k].tile != NO_TILE) releaseTile(tiles, handles[k].tile);
+    }
+    return result;
+}
+
+int sampleTiledTopography(TiledTopography* tiles, size_t nPoints,
+    const double* x, const double* y, double* z)
+{
+    // The points are grouped by the tile of their cell with a counting sort,
+    // so the tasks read few tiles and the cache keeps them while they are used
+    const TileStore* store = (const TileStore*)tiles->store;
+    size_t nTiles = tiles->nTiles;
+    size_t* home = (size_t*)malloc(nPoints * sizeof(size_t));
+    size_t* order = (size_t*)malloc(nPoints * sizeof(size_t));
+    size_t* starts = (size_t*)calloc(nTiles + 1, sizeof(size_t));
+    if ((nPoints > 0 && (home == NULL || order == NULL)) || starts == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory to sample %zu points on tiles\n", nPoints);
+        free(home);
+        free(order);
+        free(starts);
+        return 0;
+    }
+
+    for (size_t i = 0; i < nPoints; ++i)
+    {
+        size_t gx, gy;
+        double tx, ty;
+        home[i] = NO_TILE;
+        if (cellOf(x[i], tiles->x0, tiles->dx, store->nx, &gx, &tx)
+            && cellOf(y[i], tiles->y0, tiles->dy, store->ny, &gy, &ty))
+        {
+            home[i] = findTile(store, gx, gy);
+        }
+        if (home[i] == NO_TILE) z[i] = NAN;
+        else ++starts[home[i] + 1];
+    }
+    for (size_t t = 0; t < nTiles; ++t)
+    {
+        starts[t + 1] += starts[t];
+    }
+    size_t nCovered = starts[nTiles];
+    for (size_t i = 0; i < nPoints; ++i)
+    {
+        if (home[i] != NO_TILE) order[starts[home[i]]++] = i;
+    }
+
+    TileQueries queries = { tiles, order, nCovered, x, y, z };
+    int result = parallelFor((nCovered + POINTS_PER_TASK - 1) / POINTS_PER_TASK,
+        sampleTilesTask, &queries);
+
+    free(home);
+    free(order);
+    free(starts);
+    return result;
+}
+
+static int isRegular(const double* grid, size_t n, double* spacing)
+{
+    *spacing = (grid[n - 1] - grid[0]) / (double)(n - 1);
+    if (!(*spacing > 0.0)) return 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (fabs(grid[i] - (grid[0] + (double)i * *spacing)) > LATTICE_TOLERANCE * *spacing)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int writeTile(const char* path, const TileHeader* header, const double* band,
+    size_t rowStride)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not create topography tile '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    int result = fwrite(header, sizeof(TileHeader), 1, file) == 1;
+    for (size_t j = 0; result && j < header->ny; ++j)
+    {
+        result = fwrite(band + j * rowStride, sizeof(double), header->nx, file) == header->nx;
+    }
+    if (fclose(file) != 0) result = 0;
+    if (!result) fprintf(stderr, "Could not write topography tile '%s'\n", path);
+    return result;
+}
+
+int writeTopographyTiles(const char* gridFile, size_t tileSize, const char* indexFile)
+{
+    if (tileSize < 2)
+    {
+        fprintf(stderr, "Topography tiles need at least 2 points along each side\n");
+        return 0;
+    }
+    FILE* grid = fopen(gridFile, "r");
+    if (grid == NULL)
+    {
+        fprintf(stderr, "Could not open topography file: %s\n", gridFile);
+        return 0;
+    }
+
+    int result = 0;
+    size_t nx, ny;
+    double* xGrid = NULL;
+    double* yGrid = NULL;
+    double* band = NULL;
+    char* tilePath = NULL;
+    FILE* index = NULL;
+    if (fscanf(grid, "%zu %zu", &nx, &ny) != 2 || nx < 2 || ny < 2)
+    {
+        fprintf(stderr, "Error reading dimensions from topography file: %s\n", gridFile);
+        goto out_close_files;
+    }
+    xGrid = (double*)malloc(nx * sizeof(double));
+    yGrid = (double*)malloc(ny * sizeof(double));
+    band = (double*)malloc(tileSize * nx * sizeof(double));
+    tilePath = (char*)malloc(strlen(indexFile) + 64);
+    if (xGrid == NULL || yGrid == NULL || band == NULL || tilePath == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a band of %zu x %zu points\n",
+            nx, tileSize);
+        goto out_close_files;
+    }
+    for (size_t i = 0; i < nx; ++i)
+    {
+        if (fscanf(grid, "%lf", &xGrid[i]) != 1) goto out_format_error;
+    }
+    for (size_t j = 0; j < ny; ++j)
+    {
+        if (fscanf(grid, "%lf", &yGrid[j]) != 1) goto out_format_error;
+    }
+    double dx, dy;
+    if (!isRegular(xGrid, nx, &dx) || !isRegular(yGrid, ny, &dy))
+    {
+        fprintf(stderr, "Topography file %s is not a regular increasing grid\n", gridFile);
+        goto out_close_files;
+    }
+
+    index = fopen(indexFile, "w");
+    if (index == NULL)
+    {
+        fprintf(stderr, "Could not create tile index '%s': %s\n", indexFile, strerror(errno));
+        goto out_close_files;
+    }
+    fprintf(index, "# %zu x %zu topography points of %s in tiles of %zu x %zu\n",
+        nx, ny, gridFile, tileSize, tileSize);
+
+    // A band of tile rows is read, then written as a row of tiles
+    const char* slash = strrchr(indexFile, '/');
+    const char* indexName = slash == NULL ? indexFile : slash + 1;
+    for (size_t ty = 0; ty * tileSize < ny; ++ty)
+    {
+        size_t rows = ny - ty * tileSize < tileSize ? ny - ty * tileSize : tileSize;
+        for (size_t k = 0; k < rows * nx; ++k)
+        {
+            if (fscanf(grid, "%lf", &band[k]) != 1) goto out_format_error;
+        }
+        for (size_t tx = 0; tx * tileSize < nx; ++tx)
+        {
+            size_t columns = nx - tx * tileSize < tileSize ? nx - tx * tileSize : tileSize;
+            TileHeader header;
+            memcpy(header.magic, TILE_MAGIC, sizeof(header.magic));
+            header.nx = columns;
+            header.ny = rows;
+            header.x0 = xGrid[0] + (double)(tx * tileSize) * dx;
+            header.y0 = yGrid[0] + (double)(ty * tileSize) * dy;
+            header.dx = dx;
+            header.dy = dy;
+            sprintf(tilePath, "%s.%zu_%zu", indexFile, tx, ty);
+            if (!writeTile(tilePath, &header, band + tx * tileSize, nx)) goto out_close_files;
+            fprintf(index, "%s.%zu_%zu\n", indexName, tx, ty);
+        }
+    }
+    result = ferror(index) == 0;
+    if (!result) fprintf(stderr, "Could not write tile index '%s'\n", indexFile);
+    goto out_close_files;
+
+out_format_error:
+    fprintf(stderr, "Error reading topography file %s\n", gridFile);
+out_close_files:
+    if (index != NULL && fclose(index) != 0) result = 0;
+    fclose(grid);
+    free(xGrid);
+    free(yGrid);
+    free(band);
+    free(tilePath);
+    return result;
+}
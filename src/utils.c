@@ -9,8 +9,12 @@
 */
 
 #include <ctype.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "utils.h"
 
@@ -74,3 +78,25 @@ float clampf(float value, float min, float max)
 {
     return value < min ? min : (value > max ? max : value);
 }
+
+double wallClock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int temporaryPath(char* dest, size_t size, const char* filename)
+{
+    static atomic_ulong counter = 0;
+    unsigned long id = atomic_fetch_add(&counter, 1);
+    int res = snprintf(dest, size, "%s.%ld.%lu.tmp", filename, (long)getpid(), id);
+    return res > 0 && (size_t)res < size;
+}
+
+int isSameFile(const char* a, const char* b)
+{
+    struct stat statusA, statusB;
+    if (stat(a, &statusA) != 0 || stat(b, &statusB) != 0) return 0;
+    return statusA.st_dev == statusB.st_dev && statusA.st_ino == statusB.st_ino;
+}
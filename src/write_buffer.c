@@ -0,0 +1,400 @@
+/*
+    Filename: write_buffer.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the definition of the buffers used to format text in
+    memory and write it to files with a few large write calls
+*/
+
+#define _GNU_SOURCE                 // copy_file_range
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "write_buffer.h"
+
+#define MAX_INTEGER_LENGTH 24               // digits and sign of a 64 bits integer
+#define MAX_EXACT_INTEGER 4503599627370496.0 // 2^52, halves are still exact below it
+#define MAX_LONG_LONG 9223372036854775808.0  // 2^63
+
+static const double pow10Table[MAX_PRECISION + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+};
+
+static const unsigned long long pow10IntTable[MAX_PRECISION + 1] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL
+};
+
+// Two digits at a time halves the number of divisions
+static const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static size_t formatUnsigned(char* text, unsigned long long value)
+{
+    char digits[MAX_INTEGER_LENGTH];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    while (value >= 100)
+    {
+        const char* pair = &digitPairs[(value % 100) * 2];
+        value /= 100;
+        *--start = pair[1];
+        *--start = pair[0];
+    }
+    if (value >= 10)
+    {
+        const char* pair = &digitPairs[value * 2];
+        *--start = pair[1];
+        *--start = pair[0];
+    }
+    else
+    {
+        *--start = (char)('0' + value);
+    }
+
+    size_t length = (size_t)(end - start);
+    memcpy(text, start, length);
+    return length;
+}
+
+static size_t formatFixed(char* text, int negative, unsigned long long digits, int precision)
+{
+    // digits holds the value scaled by 10^precision
+    size_t length = 0;
+    if (negative) text[length++] = '-';
+    length += formatUnsigned(&text[length], digits / pow10IntTable[precision]);
+    if (precision > 0)
+    {
+        text[length++] = '.';
+        unsigned long long fraction = digits % pow10IntTable[precision];
+        for (int i = precision - 1; i >= 0; --i)
+        {
+            text[length + (size_t)i] = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        length += (size_t)precision;
+    }
+
+    return length;
+}
+
+static size_t formatRounded(char* text, double value, int precision)
+{
+    // Same result as printf("%.*f"): the exact binary value is rounded half
+    // to even. The product is exact as a sum of scaled and error, and the
+    // error only matters when scaled is exactly halfway between two integers
+    double magnitude = fabs(value);
+    double scaled = magnitude * pow10Table[precision];
+    if (scaled >= MAX_EXACT_INTEGER)
+    {
+        return (size_t)snprintf(text, MAX_DOUBLE_LENGTH, "%.*f", precision, value);
+    }
+
+    double error = fma(magnitude, pow10Table[precision], -scaled);
+    double integral = floor(scaled);
+    double fraction = scaled - integral;
+    unsigned long long digits = (unsigned long long)integral;
+    if (fraction > 0.5 || (fraction == 0.5 && (error > 0.0 || (error == 0.0 && (digits & 1)))))
+    {
+        ++digits;
+    }
+
+    return formatFixed(text, value < 0.0, digits, precision);
+}
+
+static size_t formatShortest(char* text, double value)
+{
+    // Take the fewest decimals whose integer, divided by the power of ten,
+    // gives back the value. Both are exact doubles, so the division is the
+    // correctly rounded conversion that any reader performs
+    double magnitude = fabs(value);
+    for (int precision = 1; precision <= MAX_PRECISION; ++precision)
+    {
+        double scaled = magnitude * pow10Table[precision];
+        if (scaled >= MAX_EXACT_INTEGER) break;
+
+        double candidate = nearbyint(scaled);
+        if (candidate / pow10Table[precision] == magnitude)
+        {
+            size_t length = formatFixed(text, value < 0.0, (unsigned long long)candidate,
+                precision);
+            while (text[length - 1] == '0') --length;
+            return length;
+        }
+    }
+
+    // Very small or very large values use the exponent notation
+    return (size_t)snprintf(text, MAX_DOUBLE_LENGTH, "%.17g", value);
+}
+
+
+int initWriteBuffer(WriteBuffer* buffer, int fd, size_t capacity)
+{
+    buffer->fd = fd;
+    buffer->size = 0;
+    buffer->written = 0;
+    buffer->capacity = capacity > MAX_DOUBLE_LENGTH ? capacity : MAX_DOUBLE_LENGTH;
+    buffer->failed = 0;
+    buffer->data = (char*)malloc(buffer->capacity);
+    if (buffer->data == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a write buffer of %zu bytes\n",
+            buffer->capacity);
+        buffer->capacity = 0;
+        buffer->failed = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+void freeWriteBuffer(WriteBuffer* buffer)
+{
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+static void writeAll(WriteBuffer* buffer, const char* bytes, size_t length)
+{
+    while (length > 0 && !buffer->failed)
+    {
+        ssize_t written = write(buffer->fd, bytes, length);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Could not write %zu bytes: %s\n", length, strerror(errno));
+            buffer->failed = 1;
+            return;
+        }
+        bytes += written;
+        length -= (size_t)written;
+        buffer->written += (size_t)written;
+    }
+}
+
+int flushWriteBuffer(WriteBuffer* buffer)
+{
+    if (buffer->fd >= 0)
+    {
+        writeAll(buffer, buffer->data, buffer->size);
+        buffer->size = 0;
+    }
+
+    return !buffer->failed;
+}
+
+static char* reserve(WriteBuffer* buffer, size_t length)
+{
+    if (buffer->size + length <= buffer->capacity) return &buffer->data[buffer->size];
+    if (buffer->failed) return NULL;
+
+    if (buffer->fd >= 0)
+    {
+        flushWriteBuffer(buffer);
+        if (length <= buffer->capacity) return buffer->data;
+    }
+
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : WRITE_BUFFER_SIZE;
+    while (capacity < buffer->size + length) capacity *= 2;
+    char* data = (char*)realloc(buffer->data, capacity);
+    if (data == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for a write buffer of %zu bytes\n", capacity);
+        buffer->failed = 1;
+        return NULL;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return &buffer->data[buffer->size];
+}
+
+void appendBytes(WriteBuffer* buffer, const char* bytes, size_t length)
+{
+    // Empty arrays, such as the tags of an untagged entity, can be NULL
+    if (length == 0) return;
+
+    // Large blocks skip the copy when they go to a file anyway
+    if (buffer->fd >= 0 && length >= buffer->capacity)
+    {
+        flushWriteBuffer(buffer);
+        writeAll(buffer, bytes, length);
+        return;
+    }
+
+    char* text = reserve(buffer, length);
+    if (text == NULL) return;
+    memcpy(text, bytes, length);
+    buffer->size += length;
+}
+
+static int readRange(WriteBuffer* buffer, int fd, off_t* offset, size_t length)
+{
+    while (length > 0)
+    {
+        size_t count = length < WRITE_BUFFER_SIZE ? length : WRITE_BUFFER_SIZE;
+        char* bytes = reserve(buffer, count);
+        if (bytes == NULL) return 0;
+        ssize_t nRead = pread(fd, bytes, count, *offset);
+        if (nRead < 0 && errno == EINTR) continue;
+        if (nRead <= 0)
+        {
+            fprintf(stderr, "Could not read %zu bytes at offset %lld: %s\n", count,
+                (long long)*offset, nRead < 0 ? strerror(errno) : "unexpected end of file");
+            return 0;
+        }
+        buffer->size += (size_t)nRead;
+        *offset += nRead;
+        length -= (size_t)nRead;
+        if (buffer->fd >= 0 && !flushWriteBuffer(buffer)) return 0;
+    }
+
+    return 1;
+}
+
+void appendFileRange(WriteBuffer* buffer, int fd, size_t offset, size_t length)
+{
+    if (buffer->fd >= 0 && !flushWriteBuffer(buffer)) return;
+
+    // Either call may be unsupported between the two files, e.g. on older
+    // kernels or for pipes, the next method then copies what is left
+    off_t inOffset = (off_t)offset;
+    while (buffer->fd >= 0 && length > 0)
+    {
+        ssize_t copied = copy_file_range(fd, &inOffset, buffer->fd, NULL, length, 0);
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied <= 0) break;
+        buffer->written += (size_t)copied;
+        length -= (size_t)copied;
+    }
+    while (buffer->fd >= 0 && length > 0)
+    {
+        ssize_t copied = sendfile(buffer->fd, fd, &inOffset, length);
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied <= 0) break;
+        buffer->written += (size_t)copied;
+        length -= (size_t)copied;
+    }
+
+    if (length > 0 && !readRange(buffer, fd, &inOffset, length)) buffer->failed = 1;
+}
+
+char* appendUninitialized(WriteBuffer* buffer, size_t length)
+{
+    char* text = reserve(buffer, length);
+    if (text == NULL) return NULL;
+    buffer->size += length;
+    return text;
+}
+
+void appendString(WriteBuffer* buffer, const char* string)
+{
+    appendBytes(buffer, string, strlen(string));
+}
+
+void appendChar(WriteBuffer* buffer, char c)
+{
+    char* text = reserve(buffer, 1);
+    if (text == NULL) return;
+    *text = c;
+    buffer->size += 1;
+}
+
+void appendSize(WriteBuffer* buffer, size_t value)
+{
+    char* text = reserve(buffer, MAX_INTEGER_LENGTH);
+    if (text == NULL) return;
+    buffer->size += formatUnsigned(text, value);
+}
+
+void appendInt(WriteBuffer* buffer, long long value)
+{
+    char* text = reserve(buffer, MAX_INTEGER_LENGTH);
+    if (text == NULL) return;
+    size_t length = 0;
+    unsigned long long magnitude = (unsigned long long)value;
+    if (value < 0)
+    {
+        text[length++] = '-';
+        magnitude = 0ULL - magnitude;
+    }
+    buffer->size += length + formatUnsigned(&text[length], magnitude);
+}
+
+void appendDouble(WriteBuffer* buffer, double value, int precision)
+{
+    char* text = reserve(buffer, MAX_DOUBLE_LENGTH);
+    if (text == NULL) return;
+    buffer->size += formatDouble(text, value, precision);
+}
+
+size_t formatDouble(char* text, double value, int precision)
+{
+    if (isnan(value)) return (size_t)snprintf(text, MAX_DOUBLE_LENGTH, "%f", value);
+
+    // Integral values, including infinities, as printf("%.0f")
+    if (value == trunc(value))
+    {
+        if (fabs(value) >= MAX_LONG_LONG)
+        {
+            return (size_t)snprintf(text, MAX_DOUBLE_LENGTH, "%.0f", value);
+        }
+        size_t length = 0;
+        if (signbit(value)) text[length++] = '-';
+        return length + formatUnsigned(&text[length], (unsigned long long)fabs(value));
+    }
+
+    if (precision < 0) return formatShortest(text, value);
+    if (precision > MAX_PRECISION) precision = MAX_PRECISION;
+    return formatRounded(text, value, precision);
+}
+
+size_t countDigits(size_t value)
+{
+    size_t digits = 1;
+    while (value >= 10)
+    {
+        value /= 10;
+        ++digits;
+    }
+
+    return digits;
+}
+
+void formatPaddedSize(char* text, size_t value, size_t width)
+{
+    char* c = text + width;
+    do
+    {
+        *--c = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0 && c > text);
+    memset(text, ' ', (size_t)(c - text));
+}
+
+void formatPaddedDouble(char* text, double value, int precision)
+{
+    char number[MAX_DOUBLE_LENGTH];
+    size_t length = formatDouble(number, value, precision);
+    if (length > FIXED_DOUBLE_WIDTH)
+    {
+        length = (size_t)snprintf(number, sizeof(number), "%.16e", value);
+    }
+    memset(text, ' ', FIXED_DOUBLE_WIDTH - length);
+    memcpy(text + FIXED_DOUBLE_WIDTH - length, number, length);
+}
@@ -8,12 +8,15 @@
 */
 
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "constants.h"
 #include "mesh.h"
 #include "msh_parser.h"
+#include "parallel.h"
+#include "topography.h"
 #include "topography_parser.h"
 #include "utils.h"
 
@@ -233,6 +236,231 @@ out_free_mesh:
 }
 
 
+static int testInterpolateOnNodes(char* projectRootDir)
+{
+    // The spline evaluated at the nodes matches the bilinear interpolation of
+    // a fine grid sampled from it, and gives the same nodes with one and four
+    // threads
+    int result = 0;
+    Mesh meshes[2] = { 0 };
+    Mesh resultMesh = { 0 };
+    char meshFile[MAX_PATH_LENGTH];
+    combinePaths(meshFile, projectRootDir, "tests/test_skin.msh");
+    ConfigFile config = { 0 };
+    config.surfaceMeshFaces[0] = 6; // face region to apply topography
+    config.nx = 1500;
+    config.ny = 1800;
+    combinePaths(config.topoFiles[0], projectRootDir, "tests/test_skin_topography_raw");
+    if (!readMshFile(meshFile, &resultMesh) || !interpolate(&config, &resultMesh))
+    {
+        printf("Failed to interpolate topography on a fine grid\n");
+        freeMesh(&resultMesh);
+        return 1;
+    }
+
+    config.topoInterpolation = TOPO_INTERPOLATION_NODES;
+    size_t threadCounts[2] = { 1, 4 };
+    for (int t = 0; t < 2; ++t)
+    {
+        setThreadCount(threadCounts[t]);
+        if (!readMshFile(meshFile, &meshes[t]) || !interpolate(&config, &meshes[t]))
+        {
+            printf("Failed to interpolate topography on the nodes with %zu threads\n",
+                threadCounts[t]);
+            result = 1;
+            goto out_free_meshes;
+        }
+    }
+
+    for (size_t i = 0; i < resultMesh.nNodes; ++i)
+    {
+        const Node* node = &meshes[0].nodes[i];
+        if (memcmp(node, &meshes[1].nodes[i], sizeof(Node)) != 0)
+        {
+            printf("Node %zu differs between one and four threads\n", i + 1);
+            result = 1;
+            goto out_free_meshes;
+        }
+        if (fabs(node->z - resultMesh.nodes[i].z) > 0.5)
+        {
+            printf("Node %zu z-coordinate mismatch: expected %lf but found %lf\n",
+                i + 1, resultMesh.nodes[i].z, node->z);
+            result = 1;
+            goto out_free_meshes;
+        }
+    }
+
+out_free_meshes:
+    setThreadCount(0);
+    freeMesh(&meshes[0]);
+    freeMesh(&meshes[1]);
+    freeMesh(&resultMesh);
+    return result;
+}
+
+static int testInterpolateSeveralSurfaces(char* projectRootDir)
+{
+    // Topographies loaded while the previous face moves give the nodes of
+    // faces interpolated one at a time, with one file per face or with the
+    // last file reused by the remaining faces
+    int result = 0;
+    Mesh meshes[3] = { 0 };
+    char meshFile[MAX_PATH_LENGTH];
+    combinePaths(meshFile, projectRootDir, "tests/test_skin.msh");
+    ConfigFile config = { 0 };
+    config.surfaceMeshFaces[0] = 6; // face region to apply topography
+    config.nx = 150;
+    config.ny = 180;
+    combinePaths(config.topoFiles[0], projectRootDir, "tests/test_skin_topography_raw");
+    if (!readMshFile(meshFile, &meshes[0]))
+    {
+        printf("Failed to read MSH file %s\n", meshFile);
+        return 1;
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+        if (!interpolate(&config, &meshes[0]))
+        {
+            printf("Failed to interpolate topography\n");
+            result = 1;
+            goto out_free_meshes;
+        }
+    }
+
+    config.surfaceMeshFaces[1] = 6;
+    config.surfaceMeshFaces[2] = 6;
+    for (int m = 1; m < 3; ++m)
+    {
+        // Three files on four threads, then a single file for the three
+        // faces on one thread, which loads the files in turn
+        setThreadCount(m == 1 ? 4 : 1);
+        for (int k = 1; k < 3; ++k)
+        {
+            if (m == 1) strcpy(config.topoFiles[k], config.topoFiles[0]);
+            else config.topoFiles[k][0] = '\0';
+        }
+        if (!readMshFile(meshFile, &meshes[m]) || !interpolate(&config, &meshes[m]))
+        {
+            printf("Failed to interpolate topography on several surfaces\n");
+            result = 1;
+            goto out_free_meshes;
+        }
+        if (meshes[m].nNodes != meshes[0].nNodes
+            || memcmp(meshes[m].nodes, meshes[0].nodes, meshes[0].nNodes * sizeof(Node)) != 0)
+        {
+            printf("Several surfaces with %d topography files differ from one at a time\n",
+                m == 1 ? 3 : 1);
+            result = 1;
+            goto out_free_meshes;
+        }
+    }
+
+out_free_meshes:
+    setThreadCount(0);
+    for (int m = 0; m < 3; ++m)
+    {
+        freeMesh(&meshes[m]);
+    }
+    return result;
+}
+
+#define LIMIT_TASKS 256
+
+typedef struct
+{
+    pthread_t workers[LIMIT_TASKS];
+} WorkerRecord;
+
+static int recordWorkerTask(void* context, size_t task)
+{
+    WorkerRecord* record = (WorkerRecord*)context;
+    record->workers[task] = pthread_self();
+    return 1;
+}
+
+static int testThreadLimit(void)
+{
+    // The loops started by a thread with a cap never run on more workers
+    // than the cap, whatever the thread count
+    WorkerRecord record;
+    setThreadCount(8);
+    setThreadLimit(2);
+    int ran = parallelFor(LIMIT_TASKS, recordWorkerTask, &record);
+    setThreadLimit(0);
+    setThreadCount(0);
+    if (!ran)
+    {
+        printf("Failed to run a capped parallel loop\n");
+        return 1;
+    }
+
+    size_t nWorkers = 0;
+    pthread_t workers[LIMIT_TASKS];
+    for (size_t t = 0; t < LIMIT_TASKS; ++t)
+    {
+        size_t k = 0;
+        while (k < nWorkers && !pthread_equal(workers[k], record.workers[t])) ++k;
+        if (k == nWorkers) workers[nWorkers++] = record.workers[t];
+    }
+    if (nWorkers > 2)
+    {
+        printf("Parallel loop capped at 2 workers ran on %zu\n", nWorkers);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int testInterpolateUniformGrid(char* projectRootDir)
+{
+    // Cells found by a multiply in the evenly spaced grid move the nodes as
+    // the binary searches do, with one and four threads
+    int result = 0;
+    Mesh meshes[2] = { 0 };
+    Topography topo = { 0 };
+    char meshFile[MAX_PATH_LENGTH];
+    combinePaths(meshFile, projectRootDir, "tests/test_skin.msh");
+    ConfigFile config = { 0 };
+    config.surfaceMeshFaces[0] = 6; // face region to apply topography
+    config.nx = 150;
+    config.ny = 180;
+    char topoFile[MAX_PATH_LENGTH];
+    combinePaths(topoFile, projectRootDir, "tests/test_skin_topography_raw");
+    if (!increaseTopographyResolution(&config, topoFile, NULL, &topo) || !topo.uniform)
+    {
+        printf("Failed to resample topography file %s on an evenly spaced grid\n", topoFile);
+        freeTopography(&topo);
+        return 1;
+    }
+
+    size_t threadCounts[2] = { 4, 1 };
+    for (int t = 0; t < 2; ++t)
+    {
+        setThreadCount(threadCounts[t]);
+        topo.uniform = t == 0;
+        if (!readMshFile(meshFile, &meshes[t])
+            || !interpolateTopography(&config, &topo, &meshes[t]))
+        {
+            printf("Failed to interpolate topography with %zu threads\n", threadCounts[t]);
+            result = 1;
+            goto out_free_meshes;
+        }
+    }
+    if (meshes[0].nFaceNodes == 0
+        || memcmp(meshes[0].nodes, meshes[1].nodes, meshes[0].nNodes * sizeof(Node)) != 0)
+    {
+        printf("Nodes moved through the uniform grid differ from the binary searches\n");
+        result = 1;
+    }
+
+out_free_meshes:
+    setThreadCount(0);
+    freeMesh(&meshes[0]);
+    freeMesh(&meshes[1]);
+    freeTopography(&topo);
+    return result;
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 2)
@@ -243,6 +471,10 @@ int main(int argc, char** argv)
 
     if (testInterpolateTopography(argv[1]) != 0) return 1;
     if (testInterpolate(argv[1]) != 0) return 1;
+    if (testInterpolateOnNodes(argv[1]) != 0) return 1;
+    if (testThreadLimit() != 0) return 1;
+    if (testInterpolateSeveralSurfaces(argv[1]) != 0) return 1;
+    if (testInterpolateUniformGrid(argv[1]) != 0) return 1;
     if (testSmoothMesh(argv[1]) != 0) return 1;
 
     return 0;
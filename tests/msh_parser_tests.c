@@ -7,12 +7,118 @@
     This file contains the tests for the msh parser
 */
 
+#include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "mapped_file.h"
 #include "msh_parser.h"
+#include "parallel.h"
 #include "utils.h"
 
+static size_t elementNodeCount(const Mesh* mesh, size_t elem)
+{
+    return mesh->elemOffsets[elem + 1] - mesh->elemOffsets[elem];
+}
+
+static const size_t* elementNodes(const Mesh* mesh, size_t elem)
+{
+    return &mesh->elemNodes[mesh->elemOffsets[elem]];
+}
+
+static int sameElement(const Mesh* mesh, const Mesh* other, size_t elem)
+{
+    size_t nNodes = elementNodeCount(mesh, elem);
+    return mesh->elemTypes[elem] == other->elemTypes[elem]
+        && mesh->elemRegPhys[elem] == other->elemRegPhys[elem]
+        && mesh->elemRegElem[elem] == other->elemRegElem[elem]
+        && nNodes == elementNodeCount(other, elem)
+        && memcmp(elementNodes(mesh, elem), elementNodes(other, elem),
+            nNodes * sizeof(size_t)) == 0;
+}
+
+static size_t nodeTag(const Mesh* mesh, size_t node)
+{
+    return mesh->nodeTags != NULL ? mesh->nodeTags[node] : node + 1;
+}
+
+static int sameElementByTags(const Mesh* mesh, const Mesh* other, size_t elem)
+{
+    // Meshes with sparse tags may store their nodes in a different order, so
+    // the nodes of the elements are compared through their tags
+    size_t nNodes = elementNodeCount(mesh, elem);
+    if (mesh->elemIndex[elem] != other->elemIndex[elem]
+        || mesh->elemTypes[elem] != other->elemTypes[elem]
+        || nNodes != elementNodeCount(other, elem))
+    {
+        return 0;
+    }
+    const size_t* nodes = elementNodes(mesh, elem);
+    const size_t* otherNodes = elementNodes(other, elem);
+    for (size_t j = 0; j < nNodes; ++j)
+    {
+        if (nodeTag(mesh, nodes[j]) != nodeTag(other, otherNodes[j])
+            || memcmp(&mesh->nodes[nodes[j]], &other->nodes[otherNodes[j]], sizeof(Node)) != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int sameMesh(const Mesh* mesh, const Mesh* other)
+{
+    if (mesh->version != other->version || mesh->nNodes != other->nNodes
+        || mesh->nElems != other->nElems || (mesh->nodeTags == NULL) != (other->nodeTags == NULL)
+        || mesh->nEntities != other->nEntities || mesh->nNodeBlocks != other->nNodeBlocks
+        || (mesh->physicalNames == NULL) != (other->physicalNames == NULL))
+    {
+        return 0;
+    }
+    if (memcmp(mesh->nodeIndex, other->nodeIndex, mesh->nNodes * sizeof(size_t)) != 0
+        || memcmp(mesh->nodes, other->nodes, mesh->nNodes * sizeof(Node)) != 0
+        || (mesh->nodeTags != NULL
+            && memcmp(mesh->nodeTags, other->nodeTags, mesh->nNodes * sizeof(size_t)) != 0)
+        || memcmp(mesh->elemIndex, other->elemIndex, mesh->nElems * sizeof(size_t)) != 0
+        || memcmp(mesh->elemOffsets, other->elemOffsets, (mesh->nElems + 1) * sizeof(size_t)) != 0)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < mesh->nElems; ++i)
+    {
+        if (!sameElement(mesh, other, i)) return 0;
+    }
+    for (size_t i = 0; i < mesh->nEntities; ++i)
+    {
+        const Entity* entity = &mesh->entities[i];
+        const Entity* otherEntity = &other->entities[i];
+        if (entity->dim != otherEntity->dim || entity->tag != otherEntity->tag
+            || memcmp(entity->box, otherEntity->box, sizeof(entity->box)) != 0
+            || entity->nPhysicals != otherEntity->nPhysicals
+            || entity->nBounding != otherEntity->nBounding
+            || (entity->nPhysicals > 0 && memcmp(entity->physicals, otherEntity->physicals,
+                entity->nPhysicals * sizeof(int)) != 0)
+            || (entity->nBounding > 0 && memcmp(entity->bounding, otherEntity->bounding,
+                entity->nBounding * sizeof(int)) != 0))
+        {
+            return 0;
+        }
+    }
+    if (mesh->nNodeBlocks > 0
+        && memcmp(mesh->nodeBlocks, other->nodeBlocks, mesh->nNodeBlocks * sizeof(NodeBlock)) != 0)
+    {
+        return 0;
+    }
+
+    return mesh->physicalNames == NULL || strcmp(mesh->physicalNames, other->physicalNames) == 0;
+}
+
 static int testReadMshFileV1(char* projectRootDir)
 {
     int result = 0;
@@ -73,40 +179,42 @@ static int testReadMshFileV1(char* projectRootDir)
     }
     for (size_t i = 0; i < 4; ++i)
     {
-        if (mesh.elements[i].type != expectedElems[i][1])
+        if (mesh.elemTypes[i] != expectedElems[i][1])
         {
             printf("Element %zu type mismatch: expected %zu but found %u\n",
-                i + 1, expectedElems[i][1], mesh.elements[i].type);
+                i + 1, expectedElems[i][1], mesh.elemTypes[i]);
             result = 1;
             goto out_free_mesh;
         }
-        if (mesh.elements[i].regPhys != expectedElems[i][2])
+        if (mesh.elemRegPhys[i] != expectedElems[i][2])
         {
             printf("Element %zu regPhys mismatch: expected %zu but found %u\n",
-                i + 1, expectedElems[i][2], mesh.elements[i].regPhys);
+                i + 1, expectedElems[i][2], mesh.elemRegPhys[i]);
             result = 1;
             goto out_free_mesh;
         }
-        if (mesh.elements[i].regElem != expectedElems[i][3])
+        if (mesh.elemRegElem[i] != expectedElems[i][3])
         {
             printf("Element %zu regElem mismatch: expected %zu but found %u\n",
-                i + 1, expectedElems[i][3], mesh.elements[i].regElem);
+                i + 1, expectedElems[i][3], mesh.elemRegElem[i]);
             result = 1;
             goto out_free_mesh;
         }
-        if (mesh.elements[i].nNodes != expectedElems[i][4])
+        size_t nNodes = elementNodeCount(&mesh, i);
+        if (nNodes != expectedElems[i][4])
         {
             printf("Element %zu nNodes mismatch: expected %zu but found %zu\n",
-                i + 1, expectedElems[i][4], mesh.elements[i].nNodes);
+                i + 1, expectedElems[i][4], nNodes);
             result = 1;
             goto out_free_mesh;
         }
-        for (size_t j = 0; j < mesh.elements[i].nNodes; ++j)
+        const size_t* nodes = elementNodes(&mesh, i);
+        for (size_t j = 0; j < nNodes; ++j)
         {
-            if (mesh.elements[i].nodes[j] != (size_t)expectedElems[i][5 + j])
+            if (nodes[j] != (size_t)expectedElems[i][5 + j])
             {
                 printf("Element %zu node %zu mismatch: expected %zu but found %zu\n",
-                    i + 1, j + 1, expectedElems[i][5 + j], mesh.elements[i].nodes[j]);
+                    i + 1, j + 1, expectedElems[i][5 + j], nodes[j]);
                 result = 1;
                 goto out_free_mesh;
             }
@@ -186,40 +294,43 @@ static int testWriteMshFileV1(char* projectRootDir)
     }
     for (size_t i = 0; i < mesh.nElems; ++i)
     {
-        if (mesh.elements[i].type != resultMesh.elements[i].type)
+        if (mesh.elemTypes[i] != resultMesh.elemTypes[i])
         {
             printf("Element %zu type mismatch: expected %u but found %u\n",
-                i + 1, resultMesh.elements[i].type, mesh.elements[i].type);
+                i + 1, resultMesh.elemTypes[i], mesh.elemTypes[i]);
             result = 1;
             goto out_free_mesh;
         }
-        if (mesh.elements[i].regPhys != resultMesh.elements[i].regPhys)
+        if (mesh.elemRegPhys[i] != resultMesh.elemRegPhys[i])
         {
             printf("Element %zu regPhys mismatch: expected %u but found %u\n",
-                i + 1, resultMesh.elements[i].regPhys, mesh.elements[i].regPhys);
+                i + 1, resultMesh.elemRegPhys[i], mesh.elemRegPhys[i]);
             result = 1;
             goto out_free_mesh;
         }
-        if (mesh.elements[i].regElem != resultMesh.elements[i].regElem)
+        if (mesh.elemRegElem[i] != resultMesh.elemRegElem[i])
         {
             printf("Element %zu regElem mismatch: expected %u but found %u\n",
-                i + 1, resultMesh.elements[i].regElem, mesh.elements[i].regElem);
+                i + 1, resultMesh.elemRegElem[i], mesh.elemRegElem[i]);
             result = 1;
             goto out_free_mesh;
         }
-        if (mesh.elements[i].nNodes != resultMesh.elements[i].nNodes)
+        size_t nNodes = elementNodeCount(&mesh, i);
+        if (nNodes != elementNodeCount(&resultMesh, i))
         {
             printf("Element %zu nNodes mismatch: expected %zu but found %zu\n",
-                i + 1, resultMesh.elements[i].nNodes, mesh.elements[i].nNodes);
+                i + 1, elementNodeCount(&resultMesh, i), nNodes);
             result = 1;
             goto out_free_mesh;
         }
-        for (size_t j = 0; j < mesh.elements[i].nNodes; ++j)
+        const size_t* nodes = elementNodes(&mesh, i);
+        const size_t* resultNodes = elementNodes(&resultMesh, i);
+        for (size_t j = 0; j < nNodes; ++j)
         {
-            if (mesh.elements[i].nodes[j] != resultMesh.elements[i].nodes[j])
+            if (nodes[j] != resultNodes[j])
             {
                 printf("Element %zu node %zu mismatch: expected %zu but found %zu\n",
-                    i + 1, j + 1, resultMesh.elements[i].nodes[j], mesh.elements[i].nodes[j]);
+                    i + 1, j + 1, resultNodes[j], nodes[j]);
                 result = 1;
                 goto out_free_mesh;
             }
@@ -233,6 +344,1453 @@ out_free_result_mesh:
     return result;
 }
 
+static int testReadMshFilePageAligned(void)
+{
+    // A file whose size is a multiple of the page size has no zero bytes
+    // after its content in the last mapped page
+    int result = 0;
+    Mesh mesh = { 0 };
+    char filename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+    {
+        printf("Failed to create temporary MSH file\n");
+        return 1;
+    }
+
+    size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    char* content = (char*)malloc(size);
+    if (content == NULL)
+    {
+        printf("Failed to allocate %zu bytes\n", size);
+        close(fd);
+        result = 1;
+        goto out_remove_file;
+    }
+    // Pad the records with spaces so that $ENDELM ends right at the end of the file
+    const char* records = "$NOD\n1\n1 718600 1152600 -6000\n$ENDNOD\n$ELM\n1\n1 15 0 1 1 1\n";
+    const char* end = "$ENDELM";
+    memset(content, ' ', size);
+    memcpy(content, records, strlen(records));
+    memcpy(content + size - strlen(end), end, strlen(end));
+    ssize_t written = write(fd, content, size);
+    close(fd);
+    free(content);
+    if (written != (ssize_t)size)
+    {
+        printf("Failed to write temporary MSH file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read page aligned MSH file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+    if (mesh.nNodes != 1 || mesh.nElems != 1)
+    {
+        printf("Expected 1 node and 1 element but found %zu and %zu\n",
+            mesh.nNodes, mesh.nElems);
+        result = 1;
+    }
+
+    freeMesh(&mesh);
+out_remove_file:
+    remove(filename);
+    return result;
+}
+
+static int testReadMshFileParallel(char* projectRootDir)
+{
+    // The chunked parser must produce the same mesh as the sequential one
+    int result = 0;
+    Mesh mesh = { 0 };
+    Mesh resultMesh = { 0 };
+    char filename[256];
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+
+    setThreadCount(1);
+    if (!readMshFile(filename, &resultMesh))
+    {
+        printf("Failed to read MSH file %s\n", filename);
+        setThreadCount(0);
+        return 1;
+    }
+    setThreadCount(4);
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read MSH file %s with 4 threads\n", filename);
+        result = 1;
+        goto out_free_result_mesh;
+    }
+
+    if (mesh.nNodes != resultMesh.nNodes || mesh.nElems != resultMesh.nElems)
+    {
+        printf("Mesh size mismatch: expected (%zu, %zu) but found (%zu, %zu)\n",
+            resultMesh.nNodes, resultMesh.nElems, mesh.nNodes, mesh.nElems);
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nNodes; ++i)
+    {
+        if (mesh.nodeIndex[i] != resultMesh.nodeIndex[i]
+            || memcmp(&mesh.nodes[i], &resultMesh.nodes[i], sizeof(Node)) != 0)
+        {
+            printf("Node %zu mismatch between sequential and parallel parsing\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+    for (size_t i = 0; i < mesh.nElems; ++i)
+    {
+        if (mesh.elemIndex[i] != resultMesh.elemIndex[i] || !sameElement(&mesh, &resultMesh, i))
+        {
+            printf("Element %zu mismatch between sequential and parallel parsing\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+
+out_free_mesh:
+    freeMesh(&mesh);
+out_free_result_mesh:
+    freeMesh(&resultMesh);
+    setThreadCount(0);
+    return result;
+}
+
+
+static int writeTemporaryFile(char* filename, const char* content)
+{
+    int fd = mkstemp(filename);
+    if (fd == -1)
+    {
+        printf("Failed to create temporary file %s\n", filename);
+        return 0;
+    }
+
+    size_t size = strlen(content);
+    ssize_t written = write(fd, content, size);
+    close(fd);
+    if (written != (ssize_t)size)
+    {
+        printf("Failed to write temporary file %s\n", filename);
+        remove(filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int testReadMshFileSparseTags(void)
+{
+    // Gappy node and element tags are kept as read and written back
+    const char* content =
+        "$NOD\n4\n10 0 0 -10\n3 1 0 -10\n25 0 1 -9.5\n7 1 1 -9.75\n$ENDNOD\n"
+        "$ELM\n2\n100 2 1 5 3 10 3 25\n5 2 1 5 3 3 7 25\n$ENDELM\n";
+    const char* duplicate =
+        "$NOD\n3\n10 0 0 0\n12 1 0 0\n10 0 1 0\n$ENDNOD\n$ELM\n0\n$ENDELM\n";
+    size_t expectedTags[4] = { 10, 3, 25, 7 };
+    size_t expectedNodes[2][3] = { { 0, 1, 2 }, { 1, 3, 2 } };
+
+    int result = 0;
+    Mesh mesh = { 0 };
+    char filename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char outputFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    if (!writeTemporaryFile(filename, content)) return 1;
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read MSH file %s with sparse tags\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+
+    if (mesh.nNodes != 4 || mesh.nElems != 2 || mesh.nodeTags == NULL)
+    {
+        printf("Expected 4 nodes and 2 elements with sparse tags\n");
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nNodes; ++i)
+    {
+        if (mesh.nodeTags[i] != expectedTags[i] || mesh.nodeIndex[i] != i)
+        {
+            printf("Node %zu tag mismatch: expected %zu but found %zu\n",
+                i + 1, expectedTags[i], mesh.nodeTags[i]);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+    if (mesh.elemIndex[0] != 99 || mesh.elemIndex[1] != 4)
+    {
+        printf("Element tags mismatch: expected 100 and 5 but found %zu and %zu\n",
+            mesh.elemIndex[0] + 1, mesh.elemIndex[1] + 1);
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nElems; ++i)
+    {
+        if (memcmp(elementNodes(&mesh, i), expectedNodes[i], sizeof(expectedNodes[i])) != 0)
+        {
+            printf("Element %zu nodes mismatch\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+
+    // The written file is the same as the input
+    int fd = mkstemp(outputFilename);
+    if (fd == -1 || close(fd) != 0 || !writeMshFile(outputFilename, &mesh, MSH_V1))
+    {
+        printf("Failed to write MSH file %s with sparse tags\n", outputFilename);
+        result = 1;
+        goto out_free_mesh;
+    }
+    char written[512] = { 0 };
+    FILE* file = fopen(outputFilename, "r");
+    size_t size = file != NULL ? fread(written, 1, sizeof(written) - 1, file) : 0;
+    if (file != NULL) fclose(file);
+    if (size != strlen(content) || memcmp(written, content, size) != 0)
+    {
+        printf("Written MSH file with sparse tags differs from the input:\n%s\n", written);
+        result = 1;
+        goto out_free_mesh;
+    }
+
+    // Duplicate sparse tags are rejected
+    freeMesh(&mesh);
+    remove(filename);
+    strcpy(filename, "/tmp/amgem_msh_parser_XXXXXX");
+    if (!writeTemporaryFile(filename, duplicate))
+    {
+        result = 1;
+        goto out_free_mesh;
+    }
+    if (readMshFile(filename, &mesh))
+    {
+        printf("Expected duplicate node tags to fail\n");
+        result = 1;
+    }
+
+out_free_mesh:
+    freeMesh(&mesh);
+out_remove_file:
+    remove(filename);
+    remove(outputFilename);
+    return result;
+}
+
+static int testReadMshFileSparseParallel(char* projectRootDir)
+{
+    // The test skin mesh is written with sparse node tags, read back with
+    // several threads and written again as binary MSH 4.1, then as MSH 4.1
+    int result = 0;
+    Mesh mesh = { 0 };
+    Mesh sparseMesh = { 0 };
+    Mesh binaryMesh = { 0 };
+    Mesh resultMesh = { 0 };
+    char filename[256];
+    char sparseFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char resultFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read MSH file %s\n", filename);
+        return 1;
+    }
+
+    int sparseFd = mkstemp(sparseFilename);
+    int resultFd = mkstemp(resultFilename);
+    if (sparseFd != -1) close(sparseFd);
+    if (resultFd != -1) close(resultFd);
+    mesh.nodeTags = (size_t*)malloc(mesh.nNodes * sizeof(size_t));
+    if (sparseFd == -1 || resultFd == -1 || mesh.nodeTags == NULL)
+    {
+        printf("Failed to prepare the sparse MSH files\n");
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nNodes; ++i) mesh.nodeTags[i] = 3 * i + 7;
+
+    setThreadCount(4);
+    if (!writeMshFile(sparseFilename, &mesh, MSH_V1) || !readMshFile(sparseFilename, &sparseMesh)
+        || !writeMshFile(resultFilename, &sparseMesh, MSH_V41_BINARY)
+        || !readMshFile(resultFilename, &binaryMesh)
+        || !writeMshFile(resultFilename, &binaryMesh, MSH_V41)
+        || !readMshFile(resultFilename, &resultMesh))
+    {
+        printf("Failed to write and read back the sparse MSH file %s\n", sparseFilename);
+        result = 1;
+        goto out_free_mesh;
+    }
+
+    if (sparseMesh.nodeTags == NULL || binaryMesh.nodeTags == NULL || resultMesh.nodeTags == NULL
+        || sparseMesh.nNodes != mesh.nNodes || resultMesh.nNodes != mesh.nNodes
+        || sparseMesh.nElems != mesh.nElems || resultMesh.nElems != mesh.nElems)
+    {
+        printf("Sparse mesh size mismatch\n");
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nNodes; ++i)
+    {
+        size_t node = mesh.nodeIndex[i];
+        if (sparseMesh.nodeTags[i] != mesh.nodeTags[node]
+            || memcmp(&sparseMesh.nodes[i], &mesh.nodes[node], sizeof(Node)) != 0)
+        {
+            printf("Node %zu mismatch after reading sparse tags\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+    for (size_t i = 0; i < mesh.nElems; ++i)
+    {
+        if (!sameElementByTags(&mesh, &sparseMesh, i) || !sameElementByTags(&mesh, &binaryMesh, i)
+            || !sameElementByTags(&mesh, &resultMesh, i))
+        {
+            printf("Element %zu mismatch after reading sparse tags\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+
+out_free_mesh:
+    setThreadCount(0);
+    freeMesh(&resultMesh);
+    freeMesh(&binaryMesh);
+    freeMesh(&sparseMesh);
+    freeMesh(&mesh);
+    remove(sparseFilename);
+    remove(resultFilename);
+    return result;
+}
+
+static int testReadMshFileSnapshot(char* projectRootDir)
+{
+    // The test skin mesh is written as MSH 1 and MSH 4.1, each file is parsed
+    // once, then mapped from its snapshot until its content changes
+    int result = 0;
+    Mesh mesh = { 0 };
+    char filename[256];
+    char inputFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char snapshotFilename[sizeof(inputFilename) + sizeof(".amgem")];
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read MSH file %s\n", filename);
+        return 1;
+    }
+    int fd = mkstemp(inputFilename);
+    if (fd == -1)
+    {
+        printf("Failed to create temporary file\n");
+        freeMesh(&mesh);
+        return 1;
+    }
+    close(fd);
+    snprintf(snapshotFilename, sizeof(snapshotFilename), "%s.amgem", inputFilename);
+
+    MshReadOptions options = { 1, NULL };
+    MSHVersion versions[2] = { MSH_V1, MSH_V41 };
+    for (int v = 0; v < 2 && result == 0; ++v)
+    {
+        Mesh parsedMesh = { 0 };
+        Mesh snapshotMesh = { 0 };
+        remove(snapshotFilename);
+        if (!writeMshFile(inputFilename, &mesh, versions[v])
+            || !readMshFileWithOptions(inputFilename, &parsedMesh, &options)
+            || parsedMesh.snapshot != NULL || access(snapshotFilename, R_OK) != 0)
+        {
+            printf("Failed to parse %s and write its snapshot\n", inputFilename);
+            result = 1;
+            goto out_free_meshes;
+        }
+
+        if (!readMshFileWithOptions(inputFilename, &snapshotMesh, &options)
+            || snapshotMesh.snapshot == NULL || !sameMesh(&parsedMesh, &snapshotMesh))
+        {
+            printf("Mesh mapped from snapshot %s does not match the parsed mesh\n",
+                snapshotFilename);
+            result = 1;
+            goto out_free_meshes;
+        }
+
+        // Moving the nodes of a mapped mesh must leave the snapshot unchanged
+        snapshotMesh.nodes[0].z += 100.0;
+        freeMesh(&snapshotMesh);
+        if (!readMshFileWithOptions(inputFilename, &snapshotMesh, &options)
+            || snapshotMesh.snapshot == NULL || snapshotMesh.nodes[0].z != parsedMesh.nodes[0].z)
+        {
+            printf("Snapshot %s changed with the mapped mesh\n", snapshotFilename);
+            result = 1;
+            goto out_free_meshes;
+        }
+        freeMesh(&snapshotMesh);
+
+        // A modified input is parsed again and its snapshot is replaced
+        parsedMesh.nodes[0].z += 0.5;
+        if (!writeMshFile(inputFilename, &parsedMesh, versions[v])) result = 1;
+        freeMesh(&parsedMesh);
+        if (result != 0
+            || !readMshFileWithOptions(inputFilename, &parsedMesh, &options)
+            || parsedMesh.snapshot != NULL
+            || !readMshFileWithOptions(inputFilename, &snapshotMesh, &options)
+            || snapshotMesh.snapshot == NULL || !sameMesh(&parsedMesh, &snapshotMesh)
+            || snapshotMesh.nodes[0].z != mesh.nodes[mesh.nodeIndex[0]].z + 0.5)
+        {
+            printf("Stale snapshot %s was used for a modified mesh\n", snapshotFilename);
+            result = 1;
+        }
+
+    out_free_meshes:
+        freeMesh(&snapshotMesh);
+        freeMesh(&parsedMesh);
+    }
+
+    freeMesh(&mesh);
+    remove(inputFilename);
+    remove(snapshotFilename);
+    return result;
+}
+
+static int sameFiles(const char* filename, const char* otherFilename)
+{
+    MappedFile file;
+    MappedFile otherFile;
+    if (!openMappedFile(filename, &file)) return 0;
+    if (!openMappedFile(otherFilename, &otherFile))
+    {
+        closeMappedFile(&file);
+        return 0;
+    }
+    int result = file.size == otherFile.size && memcmp(file.data, otherFile.data, file.size) == 0;
+    closeMappedFile(&otherFile);
+    closeMappedFile(&file);
+    return result;
+}
+
+static int testReadMshFileElementFilter(char* projectRootDir)
+{
+    // Only the tri elements of faces 2 and 5 are decoded, the others are kept
+    // as text and the file is written back byte for byte, with one thread and
+    // with the parallel parser
+    int result = 0;
+    Mesh mesh = { 0 };
+    char filename[256];
+    char inputFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char outputFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+    int inputFd = mkstemp(inputFilename);
+    int outputFd = mkstemp(outputFilename);
+    if (inputFd != -1) close(inputFd);
+    if (outputFd != -1) close(outputFd);
+    if (inputFd == -1 || outputFd == -1 || !readMshFile(filename, &mesh)
+        || !writeMshFile(inputFilename, &mesh, MSH_V1))
+    {
+        printf("Failed to prepare the MSH file from %s\n", filename);
+        result = 1;
+        goto out_free_mesh;
+    }
+
+    ElementFilter filter = { 1ULL << MSH_TRI_3, 2, { 2, 5 } };
+    MshReadOptions options = { 0, &filter };
+    size_t threadCounts[2] = { 1, 4 };
+    for (int t = 0; t < 2 && result == 0; ++t)
+    {
+        setThreadCount(threadCounts[t]);
+        Mesh filtered = { 0 };
+        if (!readMshFileWithOptions(inputFilename, &filtered, &options))
+        {
+            printf("Failed to read %s with an element filter\n", inputFilename);
+            result = 1;
+            goto out_free_filtered;
+        }
+
+        size_t nRawElems = 0;
+        for (size_t i = 0; i < filtered.nRawSpans; ++i) nRawElems += filtered.rawSpans[i].count;
+        if (filtered.nElems != 2944 + 2280 || filtered.nRawElems != mesh.nElems - filtered.nElems
+            || nRawElems != filtered.nRawElems)
+        {
+            printf("Expected %d decoded and %zu raw elements but found %zu and %zu\n",
+                2944 + 2280, mesh.nElems - 2944 - 2280, filtered.nElems, filtered.nRawElems);
+            result = 1;
+            goto out_free_filtered;
+        }
+        for (size_t i = 0, j = 0; i < mesh.nElems; ++i)
+        {
+            if (mesh.elemTypes[i] != MSH_TRI_3
+                || (mesh.elemRegElem[i] != 2 && mesh.elemRegElem[i] != 5))
+            {
+                continue;
+            }
+            size_t nNodes = elementNodeCount(&mesh, i);
+            if (filtered.elemIndex[j] != mesh.elemIndex[i]
+                || filtered.elemRegElem[j] != mesh.elemRegElem[i]
+                || filtered.elemRegPhys[j] != mesh.elemRegPhys[i]
+                || elementNodeCount(&filtered, j) != nNodes
+                || memcmp(elementNodes(&filtered, j), elementNodes(&mesh, i),
+                    nNodes * sizeof(size_t)) != 0)
+            {
+                printf("Decoded element %zu does not match element %zu\n", j + 1, i + 1);
+                result = 1;
+                goto out_free_filtered;
+            }
+            ++j;
+        }
+
+        if (!writeMshFile(outputFilename, &filtered, MSH_V1)
+            || !sameFiles(inputFilename, outputFilename))
+        {
+            printf("Filtered mesh written to %s differs from %s\n",
+                outputFilename, inputFilename);
+            result = 1;
+            goto out_free_filtered;
+        }
+        if (writeMshFile(outputFilename, &filtered, MSH_V41))
+        {
+            printf("Raw MSH 1 elements were written as MSH 4.1\n");
+            result = 1;
+        }
+
+    out_free_filtered:
+        freeMesh(&filtered);
+    }
+
+out_free_mesh:
+    setThreadCount(0);
+    freeMesh(&mesh);
+    remove(inputFilename);
+    remove(outputFilename);
+    return result;
+}
+
+static int testWriteMshFilePatch(char* projectRootDir)
+{
+    // The nodes of the test skin mesh are moved and written by patching the
+    // input, which must give the same file as writing the whole mesh, also
+    // when the input itself is replaced
+    int result = 0;
+    Mesh mesh = { 0 };
+    Mesh resultMesh = { 0 };
+    char filename[256];
+    char otherFilename[256];
+    char inputFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char patchFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char fullFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+    combinePaths(otherFilename, projectRootDir, "tests/test.msh");
+    int inputFd = mkstemp(inputFilename);
+    int patchFd = mkstemp(patchFilename);
+    int fullFd = mkstemp(fullFilename);
+    if (inputFd != -1) close(inputFd);
+    if (patchFd != -1) close(patchFd);
+    if (fullFd != -1) close(fullFd);
+    if (inputFd == -1 || patchFd == -1 || fullFd == -1 || !readMshFile(filename, &mesh)
+        || !writeMshFile(inputFilename, &mesh, MSH_V1))
+    {
+        printf("Failed to prepare the MSH file from %s\n", filename);
+        result = 1;
+        goto out_free_mesh;
+    }
+
+    for (size_t i = 0; i < mesh.nNodes; i += 7) mesh.nodes[i].z -= 12.5;
+    MshWriteOptions options = { MSH_V1, SHORTEST_PRECISION, inputFilename, 0 };
+    if (!writeMshFileWithOptions(patchFilename, &mesh, &options)
+        || !writeMshFile(fullFilename, &mesh, MSH_V1) || !sameFiles(patchFilename, fullFilename))
+    {
+        printf("Patched file %s differs from %s\n", patchFilename, fullFilename);
+        result = 1;
+        goto out_free_mesh;
+    }
+
+    if (!writeMshFileWithOptions(inputFilename, &mesh, &options)
+        || !sameFiles(inputFilename, fullFilename) || !readMshFile(inputFilename, &resultMesh)
+        || !sameMesh(&mesh, &resultMesh))
+    {
+        printf("Patching %s in place failed\n", inputFilename);
+        result = 1;
+        goto out_free_mesh;
+    }
+
+    // The source must hold as many nodes as the mesh
+    options.patchSource = otherFilename;
+    if (writeMshFileWithOptions(patchFilename, &mesh, &options))
+    {
+        printf("Mesh was patched into %s with a different number of nodes\n", otherFilename);
+        result = 1;
+    }
+
+out_free_mesh:
+    freeMesh(&resultMesh);
+    freeMesh(&mesh);
+    remove(inputFilename);
+    remove(patchFilename);
+    remove(fullFilename);
+    return result;
+}
+
+#define CONCURRENT_FILES 4
+#define CONCURRENT_LOADS 12
+
+typedef struct
+{
+    const char* filename;
+    MshReadOptions options;
+    Mesh mesh;
+    int loaded;
+} ConcurrentLoad;
+
+static void* concurrentLoad(void* arg)
+{
+    ConcurrentLoad* load = (ConcurrentLoad*)arg;
+    load->loaded = readMshFileWithOptions(load->filename, &load->mesh, &load->options);
+    return NULL;
+}
+
+static int testReadMshFileConcurrent(char* projectRootDir)
+{
+    // The test skin mesh is written as MSH 1, MSH 4.1, binary MSH 4.1 and as
+    // a malformed file, then every file is loaded by several threads at once.
+    // Each load, with or without snapshot, must match the sequential one
+    int result = 0;
+    Mesh mesh = { 0 };
+    Mesh references[CONCURRENT_FILES] = { 0 };
+    ConcurrentLoad loads[CONCURRENT_LOADS] = { 0 };
+    pthread_t threads[CONCURRENT_LOADS];
+    size_t nThreads = 0;
+    char filename[256];
+    char filenames[CONCURRENT_FILES][32];
+    char snapshotFilename[sizeof(filenames) + sizeof(".amgem")];
+    MSHVersion versions[CONCURRENT_FILES - 1] = { MSH_V1, MSH_V41, MSH_V41_BINARY };
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+    for (size_t f = 0; f < CONCURRENT_FILES; ++f)
+    {
+        snprintf(filenames[f], sizeof(filenames[f]), "/tmp/amgem_msh_parser_XXXXXX");
+    }
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read MSH file %s\n", filename);
+        return 1;
+    }
+
+    for (size_t f = 0; f < CONCURRENT_FILES - 1; ++f)
+    {
+        int fd = mkstemp(filenames[f]);
+        if (fd != -1) close(fd);
+        if (fd == -1 || !writeMshFile(filenames[f], &mesh, versions[f])
+            || !readMshFile(filenames[f], &references[f]))
+        {
+            printf("Failed to write and read back %s\n", filenames[f]);
+            result = 1;
+            goto out_remove_files;
+        }
+    }
+    if (!writeTemporaryFile(filenames[CONCURRENT_FILES - 1], "$NOD\n2\n1 0 0 0\n2 0 # 0\n"))
+    {
+        result = 1;
+        goto out_remove_files;
+    }
+
+    // Nested parallel loops run in every load at the same time
+    setThreadCount(2);
+    for (size_t i = 0; i < CONCURRENT_LOADS; ++i)
+    {
+        loads[i].filename = filenames[i % CONCURRENT_FILES];
+        loads[i].options = (MshReadOptions){ (int)(i / CONCURRENT_FILES) % 2, NULL };
+        if (pthread_create(&threads[i], NULL, concurrentLoad, &loads[i]) != 0)
+        {
+            printf("Failed to start load thread %zu\n", i);
+            result = 1;
+            break;
+        }
+        ++nThreads;
+    }
+    for (size_t i = 0; i < nThreads; ++i) pthread_join(threads[i], NULL);
+    setThreadCount(0);
+
+    for (size_t i = 0; i < nThreads && result == 0; ++i)
+    {
+        size_t f = i % CONCURRENT_FILES;
+        if (f == CONCURRENT_FILES - 1)
+        {
+            if (loads[i].loaded)
+            {
+                printf("Malformed file %s was loaded by thread %zu\n", loads[i].filename, i);
+                result = 1;
+            }
+        }
+        else if (!loads[i].loaded || !sameMesh(&references[f], &loads[i].mesh))
+        {
+            printf("Concurrent load %zu of %s does not match the sequential one\n",
+                i, loads[i].filename);
+            result = 1;
+        }
+    }
+
+out_remove_files:
+    for (size_t i = 0; i < CONCURRENT_LOADS; ++i) freeMesh(&loads[i].mesh);
+    for (size_t f = 0; f < CONCURRENT_FILES; ++f)
+    {
+        freeMesh(&references[f]);
+        snprintf(snapshotFilename, sizeof(snapshotFilename), "%s.amgem", filenames[f]);
+        remove(filenames[f]);
+        remove(snapshotFilename);
+    }
+    freeMesh(&mesh);
+    return result;
+}
+
+typedef struct
+{
+    const char* path;           // FIFO to open, NULL to use fd
+    int fd;
+    const char* data;
+    size_t size;
+} StreamWriter;
+
+static void* writeStream(void* arg)
+{
+    // Uneven writes cut the records and the keywords at any byte
+    StreamWriter* writer = (StreamWriter*)arg;
+    int fd = writer->path != NULL ? open(writer->path, O_WRONLY) : writer->fd;
+    size_t offset = 0;
+    size_t length = 1;
+    while (fd != -1 && offset < writer->size)
+    {
+        if (length > writer->size - offset) length = writer->size - offset;
+        ssize_t count = write(fd, writer->data + offset, length);
+        if (count <= 0) break;
+        offset += (size_t)count;
+        length = length * 7 % 65521 + 1;
+    }
+    if (fd != -1) close(fd);
+    return NULL;
+}
+
+typedef struct
+{
+    const char* path;           // FIFO to read
+    const char* outputPath;     // file that receives the content of the FIFO
+    int result;
+} StreamReader;
+
+static void* readStream(void* arg)
+{
+    StreamReader* reader = (StreamReader*)arg;
+    int fd = open(reader->path, O_RDONLY);
+    int outputFd = open(reader->outputPath, O_WRONLY | O_TRUNC);
+    char buffer[4096];
+    ssize_t count = 0;
+    reader->result = fd != -1 && outputFd != -1;
+    while (reader->result && (count = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        reader->result = write(outputFd, buffer, (size_t)count) == count;
+    }
+    if (count < 0) reader->result = 0;
+    if (fd != -1) close(fd);
+    if (outputFd != -1) close(outputFd);
+    return NULL;
+}
+
+static char* generateMshV1(size_t nNodes, size_t firstSparseNode, size_t* size)
+{
+    // Dense node tags up to firstSparseNode, sparse ones after, and a strip
+    // of triangles over the nodes
+    size_t capacity = 100 * nNodes + 64;
+    char* text = (char*)malloc(capacity);
+    if (text == NULL) return NULL;
+    size_t length = (size_t)snprintf(text, capacity, "$NOD\n%zu\n", nNodes);
+    for (size_t i = 0; i < nNodes; ++i)
+    {
+        size_t tag = i < firstSparseNode ? i + 1 : 3 * i + 7;
+        length += (size_t)snprintf(text + length, capacity - length, "%zu %.3f %g -%zu.5\n",
+            tag, (double)i * 0.25, (double)(i % 977), i % 131);
+    }
+    length += (size_t)snprintf(text + length, capacity - length, "$ENDNOD\n$ELM\n%zu\n",
+        nNodes - 2);
+    for (size_t i = 0; i + 2 < nNodes; ++i)
+    {
+        size_t tags[3];
+        for (size_t j = 0; j < 3; ++j)
+        {
+            tags[j] = i + j < firstSparseNode ? i + j + 1 : 3 * (i + j) + 7;
+        }
+        length += (size_t)snprintf(text + length, capacity - length, "%zu 2 %zu 1 3 %zu %zu %zu\n",
+            i + 1, i % 3 + 1, tags[0], tags[1], tags[2]);
+    }
+    length += (size_t)snprintf(text + length, capacity - length, "$ENDELM\n");
+    *size = length;
+    return text;
+}
+
+static int testReadMshStream(void)
+{
+    // A generated mesh larger than the stream buffer, with sparse tags from
+    // its second buffer on, is read from a pipe with one and four threads
+    int result = 0;
+    Mesh mesh = { 0 };
+    char filename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    size_t size;
+    char* text = generateMshV1(300000, 200000, &size);
+    if (text == NULL || size < 2 * TOKENIZER_STREAM_SIZE)
+    {
+        printf("Failed to generate a MSH file larger than two stream buffers\n");
+        free(text);
+        return 1;
+    }
+    text[size] = '\0';
+    if (!writeTemporaryFile(filename, text) || !readMshFile(filename, &mesh))
+    {
+        printf("Failed to read the generated MSH file %s\n", filename);
+        free(text);
+        return 1;
+    }
+
+    size_t threads[2] = { 1, 4 };
+    for (size_t t = 0; t < 2 && result == 0; ++t)
+    {
+        Mesh streamMesh = { 0 };
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            printf("Failed to create a pipe\n");
+            result = 1;
+            break;
+        }
+        StreamWriter writer = { NULL, fds[1], text, size };
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, writeStream, &writer) != 0)
+        {
+            printf("Failed to start the stream writer\n");
+            close(fds[0]);
+            close(fds[1]);
+            result = 1;
+            break;
+        }
+        setThreadCount(threads[t]);
+        if (!readMshStream(fds[0], "pipe", &streamMesh) || streamMesh.nodeTags == NULL
+            || !sameMesh(&mesh, &streamMesh))
+        {
+            printf("Mesh read from a pipe with %zu threads does not match the file\n",
+                threads[t]);
+            result = 1;
+        }
+        setThreadCount(0);
+        close(fds[0]);
+        pthread_join(thread, NULL);
+        freeMesh(&streamMesh);
+    }
+
+    freeMesh(&mesh);
+    free(text);
+    remove(filename);
+    return result;
+}
+
+static int testMshFifo(char* projectRootDir)
+{
+    // The test skin mesh is written as MSH 4.1 with physical names and read
+    // back from a FIFO, then written to a FIFO as MSH 1, whole and patched
+    int result = 0;
+    Mesh mesh = { 0 };
+    Mesh fileMesh = { 0 };
+    Mesh fifoMesh = { 0 };
+    MappedFile file = { 0 };
+    char filename[256];
+    char inputFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char outputFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char fifoFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+    int inputFd = mkstemp(inputFilename);
+    int outputFd = mkstemp(outputFilename);
+    int fifoFd = mkstemp(fifoFilename);
+    if (inputFd != -1) close(inputFd);
+    if (outputFd != -1) close(outputFd);
+    if (fifoFd != -1) close(fifoFd);
+    remove(fifoFilename);
+    if (inputFd == -1 || outputFd == -1 || fifoFd == -1 || mkfifo(fifoFilename, 0600) != 0
+        || !isMshStream(fifoFilename) || isMshStream(inputFilename) || !isMshStream("-"))
+    {
+        printf("Failed to create the FIFO %s\n", fifoFilename);
+        result = 1;
+        goto out_remove_files;
+    }
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read MSH file %s\n", filename);
+        result = 1;
+        goto out_remove_files;
+    }
+    mesh.physicalNames = strdup("2\n2 1 \"top $EndPhysical\"\n2 2 \"bottom\"\n");
+    if (mesh.physicalNames == NULL || !writeMshFile(inputFilename, &mesh, MSH_V41)
+        || !readMshFile(inputFilename, &fileMesh) || !openMappedFile(inputFilename, &file))
+    {
+        printf("Failed to write and read back %s\n", inputFilename);
+        result = 1;
+        goto out_remove_files;
+    }
+
+    StreamWriter writer = { fifoFilename, -1, file.data, file.size };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, writeStream, &writer) != 0)
+    {
+        printf("Failed to start the FIFO writer\n");
+        result = 1;
+        goto out_remove_files;
+    }
+    MshReadOptions options = { 1, NULL };
+    if (!readMshFileWithOptions(fifoFilename, &fifoMesh, &options)
+        || !sameMesh(&fileMesh, &fifoMesh))
+    {
+        printf("Mesh read from the FIFO %s does not match the file\n", fifoFilename);
+        result = 1;
+    }
+    pthread_join(thread, NULL);
+    if (result != 0) goto out_remove_files;
+
+    // The FIFO is written in place, never replaced by a temporary file
+    freeMesh(&fifoMesh);
+    if (!writeMshFile(inputFilename, &mesh, MSH_V1) || !readMshFile(inputFilename, &fifoMesh))
+    {
+        printf("Failed to write and read back %s\n", inputFilename);
+        result = 1;
+        goto out_remove_files;
+    }
+    MshWriteOptions writeOptions[2] = {
+        { MSH_V1, SHORTEST_PRECISION, NULL, 0 },
+        { MSH_V1, SHORTEST_PRECISION, inputFilename, 0 }
+    };
+    for (int i = 0; i < 2 && result == 0; ++i)
+    {
+        StreamReader reader = { fifoFilename, outputFilename, 0 };
+        if (pthread_create(&thread, NULL, readStream, &reader) != 0)
+        {
+            printf("Failed to start the FIFO reader\n");
+            result = 1;
+            break;
+        }
+        int written = writeMshFileWithOptions(fifoFilename, &fifoMesh, &writeOptions[i]);
+        pthread_join(thread, NULL);
+        struct stat st;
+        if (!written || !reader.result || stat(fifoFilename, &st) != 0 || !S_ISFIFO(st.st_mode)
+            || !sameFiles(inputFilename, outputFilename))
+        {
+            printf("MSH 1 file written to the FIFO %s does not match the file\n", fifoFilename);
+            result = 1;
+        }
+    }
+
+out_remove_files:
+    freeMesh(&fifoMesh);
+    freeMesh(&fileMesh);
+    freeMesh(&mesh);
+    if (file.data != NULL) closeMappedFile(&file);
+    remove(inputFilename);
+    remove(outputFilename);
+    remove(fifoFilename);
+    return result;
+}
+
+static int checkFixedWidth(const char* inputFilename, const ElementFilter* filter,
+    const char* fifoFilename)
+{
+    // The mesh is written with fixed-width records to a file, with one and
+    // four threads, and to a FIFO in one pass, then its nodes are updated in
+    // place. Each file must read back as the mesh and match a fresh write
+    int result = 0;
+    Mesh mesh = { 0 };
+    Mesh normalMesh = { 0 };
+    Mesh fixedMesh = { 0 };
+    char normalFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char fixedFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char expectedFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    int normalFd = mkstemp(normalFilename);
+    int fixedFd = mkstemp(fixedFilename);
+    int expectedFd = mkstemp(expectedFilename);
+    if (normalFd != -1) close(normalFd);
+    if (fixedFd != -1) close(fixedFd);
+    if (expectedFd != -1) close(expectedFd);
+    MshReadOptions readOptions = { 0, filter };
+    if (normalFd == -1 || fixedFd == -1 || expectedFd == -1
+        || !readMshFileWithOptions(inputFilename, &mesh, &readOptions))
+    {
+        printf("Failed to read MSH file %s\n", inputFilename);
+        result = 1;
+        goto out_remove_files;
+    }
+
+    // Values too long for the fixed width fall back to the exponent notation
+    mesh.nodes[0].x = 1e300;
+    mesh.nodes[1].y = -2.2250738585072014e-308;
+    mesh.nodes[2].z = -1234567.890625;
+    MshWriteOptions options = { MSH_V1, SHORTEST_PRECISION, NULL, 1 };
+    if (!writeMshFile(normalFilename, &mesh, MSH_V1) || !readMshFile(normalFilename, &normalMesh))
+    {
+        printf("Failed to write and read back %s\n", normalFilename);
+        result = 1;
+        goto out_remove_files;
+    }
+    size_t threadCounts[2] = { 1, 4 };
+    for (int t = 0; t < 2 && result == 0; ++t)
+    {
+        setThreadCount(threadCounts[t]);
+        freeMesh(&fixedMesh);
+        if (!writeMshFileWithOptions(fixedFilename, &mesh, &options)
+            || !readMshFile(fixedFilename, &fixedMesh) || !sameMesh(&normalMesh, &fixedMesh))
+        {
+            printf("Fixed-width file %s written with %zu threads does not match %s\n",
+                fixedFilename, threadCounts[t], normalFilename);
+            result = 1;
+        }
+    }
+    setThreadCount(0);
+    if (result != 0) goto out_remove_files;
+
+    StreamReader reader = { fifoFilename, expectedFilename, 0 };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, readStream, &reader) != 0)
+    {
+        printf("Failed to start the FIFO reader\n");
+        result = 1;
+        goto out_remove_files;
+    }
+    int written = writeMshFileWithOptions(fifoFilename, &mesh, &options);
+    pthread_join(thread, NULL);
+    if (!written || !reader.result || !sameFiles(fixedFilename, expectedFilename))
+    {
+        printf("Fixed-width file written to the FIFO %s does not match %s\n",
+            fifoFilename, fixedFilename);
+        result = 1;
+        goto out_remove_files;
+    }
+
+    for (size_t i = 0; i < mesh.nNodes; i += 5) mesh.nodes[i].z -= 0.125;
+    setThreadCount(4);
+    if (!updateMshNodes(fixedFilename, &mesh, SHORTEST_PRECISION)
+        || !writeMshFileWithOptions(expectedFilename, &mesh, &options)
+        || !sameFiles(fixedFilename, expectedFilename))
+    {
+        printf("Nodes of %s updated in place do not match %s\n", fixedFilename,
+            expectedFilename);
+        result = 1;
+    }
+    setThreadCount(0);
+
+    // Files without the fixed layout are left alone
+    if (updateMshNodes(normalFilename, &mesh, SHORTEST_PRECISION))
+    {
+        printf("Nodes of %s were updated without fixed-width records\n", normalFilename);
+        result = 1;
+    }
+
+out_remove_files:
+    freeMesh(&fixedMesh);
+    freeMesh(&normalMesh);
+    freeMesh(&mesh);
+    remove(normalFilename);
+    remove(fixedFilename);
+    remove(expectedFilename);
+    return result;
+}
+
+static int testWriteMshFileFixedWidth(char* projectRootDir)
+{
+    // A generated mesh with sparse tags, larger than a write task, and the
+    // test skin mesh with most of its elements kept as raw text
+    int result = 0;
+    char skinFilename[256];
+    char generatedFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char fifoFilename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    combinePaths(skinFilename, projectRootDir, "tests/test_skin.msh");
+    size_t size;
+    char* text = generateMshV1(40000, 30000, &size);
+    if (text == NULL)
+    {
+        printf("Failed to generate a MSH file\n");
+        return 1;
+    }
+    text[size] = '\0';
+    int written = writeTemporaryFile(generatedFilename, text);
+    free(text);
+    if (!written) return 1;
+    int fifoFd = mkstemp(fifoFilename);
+    if (fifoFd != -1) close(fifoFd);
+    remove(fifoFilename);
+    if (fifoFd == -1 || mkfifo(fifoFilename, 0600) != 0)
+    {
+        printf("Failed to create the FIFO %s\n", fifoFilename);
+        remove(generatedFilename);
+        return 1;
+    }
+
+    ElementFilter filter = { 1ULL << MSH_TRI_3, 2, { 2, 5 } };
+    if (checkFixedWidth(generatedFilename, NULL, fifoFilename) != 0
+        || checkFixedWidth(skinFilename, &filter, fifoFilename) != 0)
+    {
+        result = 1;
+    }
+
+    remove(generatedFilename);
+    remove(fifoFilename);
+    return result;
+}
+
+static int testReadMshFileV41(void)
+{
+    // Two surface blocks, a parametric node block and a section amgem does
+    // not use, which is skipped
+    const char* content =
+        "$MeshFormat\n4.1 0 8\n$EndMeshFormat\n"
+        "$PhysicalNames\n1\n2 7 \"Sea $ floor\"\n$EndPhysicalNames\n"
+        "$Entities\n1 0 1 0\n"
+        "3 0 0 -10 0\n"
+        "5 0 0 -10 1 1 -9.5 1 7 1 -3\n"
+        "$EndEntities\n"
+        "$Nodes\n2 4 1 4\n"
+        "0 3 0 1\n1\n0 0 -10\n"
+        "2 5 1 3\n2\n4\n3\n1 0 -10 0.5 0.5\n0 1 -9.5 0.5 0.5\n1 1 -9.75 0.5 0.5\n"
+        "$EndNodes\n"
+        "$NodeData\n1\n\"Depth\"\n$EndNodeData\n"
+        "$Elements\n2 3 1 3\n"
+        "2 5 2 2\n2 1 2 3\n1 2 4 3\n"
+        "0 3 15 1\n3 1\n"
+        "$EndElements\n";
+    double expectedZ[4] = { -10.0, -10.0, -9.75, -9.5 };
+    unsigned int expectedTypes[3] = { MSH_TRI_3, MSH_TRI_3, MSH_PNT };
+    unsigned int expectedRegPhys[3] = { 7, 7, 0 };
+    unsigned int expectedRegElem[3] = { 5, 5, 3 };
+    size_t expectedElemIndex[3] = { 1, 0, 2 };
+
+    int result = 0;
+    Mesh mesh = { 0 };
+    char filename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    if (!writeTemporaryFile(filename, content)) return 1;
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read MSH 4.1 file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+
+    if (mesh.version != MSH_V41 || mesh.nNodes != 4 || mesh.nElems != 3
+        || mesh.nEntities != 2 || mesh.nNodeBlocks != 2)
+    {
+        printf("Unexpected MSH 4.1 mesh: version %d, %zu nodes, %zu elements, "
+            "%zu entities and %zu node blocks\n", mesh.version, mesh.nNodes, mesh.nElems,
+            mesh.nEntities, mesh.nNodeBlocks);
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nNodes; ++i)
+    {
+        if (mesh.nodes[i].z != expectedZ[i])
+        {
+            printf("Node %zu z-coordinate mismatch: expected %lf but found %lf\n",
+                i + 1, expectedZ[i], mesh.nodes[i].z);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+    for (size_t i = 0; i < mesh.nElems; ++i)
+    {
+        if (mesh.elemIndex[i] != expectedElemIndex[i] || mesh.elemTypes[i] != expectedTypes[i]
+            || mesh.elemRegPhys[i] != expectedRegPhys[i]
+            || mesh.elemRegElem[i] != expectedRegElem[i])
+        {
+            printf("Element %zu mismatch: expected (%u, %u, %u) but found (%u, %u, %u)\n",
+                i + 1, expectedTypes[i], expectedRegPhys[i], expectedRegElem[i],
+                mesh.elemTypes[i], mesh.elemRegPhys[i], mesh.elemRegElem[i]);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+    // Elements are kept in file order, the element with tag 1 is the second one
+    const size_t* nodes = elementNodes(&mesh, 1);
+    if (elementNodeCount(&mesh, 1) != 3 || nodes[0] != 1 || nodes[1] != 3 || nodes[2] != 2)
+    {
+        printf("Element 1 nodes mismatch\n");
+        result = 1;
+        goto out_free_mesh;
+    }
+    if (mesh.physicalNames == NULL || strcmp(mesh.physicalNames, "1\n2 7 \"Sea $ floor\"\n") != 0)
+    {
+        printf("Physical names mismatch: found '%s'\n",
+            mesh.physicalNames != NULL ? mesh.physicalNames : "(null)");
+        result = 1;
+    }
+
+out_free_mesh:
+    freeMesh(&mesh);
+out_remove_file:
+    remove(filename);
+    return result;
+}
+
+static int testWriteMshFileV41(char* projectRootDir)
+{
+    // A v1 mesh written as 4.1 must be read back unchanged, and writing the
+    // 4.1 mesh again must keep its entities and node blocks
+    int result = 0;
+    Mesh mesh = { 0 };
+    Mesh resultMesh = { 0 };
+    char filename[256];
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+    char writeFile[] = "/tmp/amgem_msh_parser_XXXXXX";
+    char rewriteFile[] = "/tmp/amgem_msh_parser_XXXXXX";
+    if (!writeTemporaryFile(writeFile, "")) return 1;
+    if (!writeTemporaryFile(rewriteFile, ""))
+    {
+        remove(writeFile);
+        return 1;
+    }
+
+    if (!readMshFile(filename, &resultMesh))
+    {
+        printf("Failed to read MSH file %s\n", filename);
+        result = 1;
+        goto out_remove_files;
+    }
+    if (!writeMshFile(writeFile, &resultMesh, MSH_V41))
+    {
+        printf("Failed to write MSH 4.1 file %s\n", writeFile);
+        result = 1;
+        goto out_free_result_mesh;
+    }
+    if (!readMshFile(writeFile, &mesh))
+    {
+        printf("Failed to read MSH 4.1 file %s\n", writeFile);
+        result = 1;
+        goto out_free_result_mesh;
+    }
+
+    if (mesh.version != MSH_V41 || mesh.nNodes != resultMesh.nNodes
+        || mesh.nElems != resultMesh.nElems)
+    {
+        printf("Mesh size mismatch: expected (%zu, %zu) but found (%zu, %zu)\n",
+            resultMesh.nNodes, resultMesh.nElems, mesh.nNodes, mesh.nElems);
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nNodes; ++i)
+    {
+        if (fabs(mesh.nodes[i].x - resultMesh.nodes[i].x) > 1e-6
+            || fabs(mesh.nodes[i].y - resultMesh.nodes[i].y) > 1e-6
+            || fabs(mesh.nodes[i].z - resultMesh.nodes[i].z) > 1e-6)
+        {
+            printf("Node %zu mismatch after writing MSH 4.1\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+    for (size_t i = 0; i < mesh.nElems; ++i)
+    {
+        if (!sameElement(&mesh, &resultMesh, i))
+        {
+            printf("Element %zu mismatch after writing MSH 4.1\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+
+    if (!writeMshFile(rewriteFile, &mesh, MSH_V41))
+    {
+        printf("Failed to write MSH 4.1 file %s\n", rewriteFile);
+        result = 1;
+        goto out_free_mesh;
+    }
+    freeMesh(&resultMesh);
+    if (!readMshFile(rewriteFile, &resultMesh))
+    {
+        printf("Failed to read MSH 4.1 file %s\n", rewriteFile);
+        result = 1;
+        goto out_free_mesh;
+    }
+    if (resultMesh.nEntities != mesh.nEntities || resultMesh.nNodeBlocks != mesh.nNodeBlocks
+        || memcmp(resultMesh.nodeIndex, mesh.nodeIndex, mesh.nNodes * sizeof(size_t)) != 0)
+    {
+        printf("Layout of MSH 4.1 files %s and %s differs\n", writeFile, rewriteFile);
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nNodeBlocks; ++i)
+    {
+        const NodeBlock* block = &mesh.nodeBlocks[i];
+        const NodeBlock* resultBlock = &resultMesh.nodeBlocks[i];
+        if (block->dim != resultBlock->dim || block->tag != resultBlock->tag
+            || block->count != resultBlock->count)
+        {
+            printf("Node block %zu mismatch after writing MSH 4.1 again\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+
+out_free_mesh:
+    freeMesh(&mesh);
+out_free_result_mesh:
+    freeMesh(&resultMesh);
+out_remove_files:
+    remove(writeFile);
+    remove(rewriteFile);
+    return result;
+}
+
+
+static int testWriteMshFileV41Binary(char* projectRootDir)
+{
+    // Binary files store the coordinates exactly
+    int result = 0;
+    Mesh mesh = { 0 };
+    Mesh resultMesh = { 0 };
+    char filename[256];
+    combinePaths(filename, projectRootDir, "tests/test_skin.msh");
+    char writeFile[] = "/tmp/amgem_msh_parser_XXXXXX";
+    if (!writeTemporaryFile(writeFile, "")) return 1;
+
+    if (!readMshFile(filename, &resultMesh))
+    {
+        printf("Failed to read MSH file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+    if (!writeMshFile(writeFile, &resultMesh, MSH_V41_BINARY))
+    {
+        printf("Failed to write binary MSH 4.1 file %s\n", writeFile);
+        result = 1;
+        goto out_free_result_mesh;
+    }
+    if (!readMshFile(writeFile, &mesh))
+    {
+        printf("Failed to read binary MSH 4.1 file %s\n", writeFile);
+        result = 1;
+        goto out_free_result_mesh;
+    }
+
+    if (mesh.version != MSH_V41_BINARY || mesh.nNodes != resultMesh.nNodes
+        || mesh.nElems != resultMesh.nElems
+        || memcmp(mesh.nodes, resultMesh.nodes, mesh.nNodes * sizeof(Node)) != 0)
+    {
+        printf("Nodes mismatch after writing binary MSH 4.1\n");
+        result = 1;
+        goto out_free_mesh;
+    }
+    for (size_t i = 0; i < mesh.nElems; ++i)
+    {
+        if (!sameElement(&mesh, &resultMesh, i))
+        {
+            printf("Element %zu mismatch after writing binary MSH 4.1\n", i + 1);
+            result = 1;
+            goto out_free_mesh;
+        }
+    }
+
+out_free_mesh:
+    freeMesh(&mesh);
+out_free_result_mesh:
+    freeMesh(&resultMesh);
+out_remove_file:
+    remove(writeFile);
+    return result;
+}
+
+static char* putSwapped(char* buffer, const void* value, size_t size)
+{
+    // Store the value with the opposite byte order of the machine
+    for (size_t i = 0; i < size; ++i)
+    {
+        buffer[i] = ((const char*)value)[size - 1 - i];
+    }
+    return buffer + size;
+}
+
+static char* putInts(char* buffer, const int* values, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) buffer = putSwapped(buffer, &values[i], sizeof(int));
+    return buffer;
+}
+
+static char* putSizes(char* buffer, const size_t* values, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) buffer = putSwapped(buffer, &values[i], sizeof(size_t));
+    return buffer;
+}
+
+static char* putText(char* buffer, const char* text)
+{
+    memcpy(buffer, text, strlen(text));
+    return buffer + strlen(text);
+}
+
+static int testReadMshFileV41BinarySwapped(void)
+{
+    // A binary file written on a machine with the other byte order
+    char content[1024];
+    char* end = putText(content, "$MeshFormat\n4.1 1 8\n");
+    int one = 1;
+    end = putInts(end, &one, 1);
+    end = putText(end, "\n$EndMeshFormat\n$Nodes\n");
+    size_t nodesHeader[4] = { 1, 3, 1, 3 };
+    int blockHeader[3] = { 2, 1, 0 };
+    size_t count = 3;
+    size_t nodeTags[3] = { 3, 1, 2 };
+    double coords[9] = { 0.0, 1.0, -9.5, 0.0, 0.0, -10.0, 1.0, 0.0, -10.25 };
+    end = putSizes(end, nodesHeader, 4);
+    end = putInts(end, blockHeader, 3);
+    end = putSizes(end, &count, 1);
+    end = putSizes(end, nodeTags, 3);
+    for (size_t i = 0; i < 9; ++i) end = putSwapped(end, &coords[i], sizeof(double));
+    end = putText(end, "\n$EndNodes\n$Elements\n");
+    size_t elementsHeader[4] = { 1, 1, 1, 1 };
+    int elementBlockHeader[3] = { 2, 1, MSH_TRI_3 };
+    size_t elementCount = 1;
+    size_t element[4] = { 1, 1, 2, 3 };
+    end = putSizes(end, elementsHeader, 4);
+    end = putInts(end, elementBlockHeader, 3);
+    end = putSizes(end, &elementCount, 1);
+    end = putSizes(end, element, 4);
+    end = putText(end, "\n$EndElements\n");
+    *end = '\0';
+
+    int result = 0;
+    Mesh mesh = { 0 };
+    char filename[] = "/tmp/amgem_msh_parser_XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+    {
+        printf("Failed to create temporary MSH file\n");
+        return 1;
+    }
+    ssize_t written = write(fd, content, (size_t)(end - content));
+    close(fd);
+    if (written != end - content)
+    {
+        printf("Failed to write temporary MSH file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+
+    if (!readMshFile(filename, &mesh))
+    {
+        printf("Failed to read byte swapped binary MSH 4.1 file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+    if (mesh.nNodes != 3 || mesh.nElems != 1 || mesh.nodes[0].z != -10.0
+        || mesh.nodes[1].x != 1.0 || mesh.nodes[1].z != -10.25 || mesh.nodes[2].y != 1.0
+        || mesh.elemTypes[0] != MSH_TRI_3 || elementNodes(&mesh, 0)[2] != 2)
+    {
+        printf("Byte swapped binary MSH 4.1 mesh mismatch\n");
+        result = 1;
+    }
+
+    freeMesh(&mesh);
+out_remove_file:
+    remove(filename);
+    return result;
+}
+
 
 int main(int argc, char** argv)
 {
@@ -244,6 +1802,21 @@ int main(int argc, char** argv)
 
     if (testReadMshFileV1(argv[1]) != 0) return 1;
     if (testWriteMshFileV1(argv[1]) != 0) return 1;
+    if (testReadMshFilePageAligned() != 0) return 1;
+    if (testReadMshFileParallel(argv[1]) != 0) return 1;
+    if (testReadMshFileSparseTags() != 0) return 1;
+    if (testReadMshFileSparseParallel(argv[1]) != 0) return 1;
+    if (testReadMshFileV41() != 0) return 1;
+    if (testWriteMshFileV41(argv[1]) != 0) return 1;
+    if (testWriteMshFileV41Binary(argv[1]) != 0) return 1;
+    if (testReadMshFileV41BinarySwapped() != 0) return 1;
+    if (testReadMshFileSnapshot(argv[1]) != 0) return 1;
+    if (testReadMshFileElementFilter(argv[1]) != 0) return 1;
+    if (testWriteMshFilePatch(argv[1]) != 0) return 1;
+    if (testReadMshFileConcurrent(argv[1]) != 0) return 1;
+    if (testReadMshStream() != 0) return 1;
+    if (testMshFifo(argv[1]) != 0) return 1;
+    if (testWriteMshFileFixedWidth(argv[1]) != 0) return 1;
 
     return 0;
 }
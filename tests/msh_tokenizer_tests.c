@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "msh_tokenizer.h"
 
@@ -228,6 +229,54 @@ static int tokenizerTests()
         }
         freeTokenizer(&tokenizer);
     }
+    {
+        // Test decoded number values
+        Tokenizer tokenizer;
+        char* file = "12 -14.5 0.1152600E+07 -0.2365566E+04 718930.4347826086 "
+            "0.30000000000000004441 1e-400 -0";
+        double r[] = { 12.0, -14.5, 1152600.0, -2365.566, 718930.4347826086,
+            0.30000000000000004441, 0.0, 0.0 };
+        int isInteger[] = { 1, 0, 0, 0, 0, 0, 0, 1 };
+        initTokenizer(&tokenizer, file);
+        for (size_t i = 0; i < sizeof(r) / sizeof(r[0]); ++i)
+        {
+            Token t = nextToken(&tokenizer, TOKEN_NUMBER);
+            if (t.type != TOKEN_NUMBER || t.number.value != r[i]
+                || t.number.isInteger != isInteger[i])
+            {
+                printf("Decoded %.*s as %.17g (integer %d) while expecting %.17g (integer %d)",
+                    (int)t.length, t.start, t.number.value, t.number.isInteger,
+                    r[i], isInteger[i]);
+                freeTokenizer(&tokenizer);
+                return 1;
+            }
+            if (t.number.isInteger && t.number.integer != (long long)r[i])
+            {
+                printf("Decoded %.*s as integer %lld while expecting %lld",
+                    (int)t.length, t.start, t.number.integer, (long long)r[i]);
+                freeTokenizer(&tokenizer);
+                return 1;
+            }
+        }
+        freeTokenizer(&tokenizer);
+    }
+    {
+        // Test tokenizer does not read past the end of the buffer
+        Tokenizer tokenizer;
+        char* file = "$NOD 123456";
+        initTokenizerBuffer(&tokenizer, file, 8);
+        Token t1 = nextToken(&tokenizer, TOKEN_V1_NOD_START);
+        Token t2 = nextToken(&tokenizer, TOKEN_NUMBER);
+        Token t3 = nextToken(&tokenizer, TOKEN_NULL);
+        if (t1.type != TOKEN_V1_NOD_START || t2.type != TOKEN_NUMBER
+            || t2.number.integer != 123 || t3.type != TOKEN_END_OF_FILE)
+        {
+            printf("Tokenizer read past the end of the buffer");
+            freeTokenizer(&tokenizer);
+            return 1;
+        }
+        freeTokenizer(&tokenizer);
+    }
     {
         // Test token to type value mapping
         if (strcmp(tokenTypeToValue(TOKEN_V1_NOD_START), "$NOD") != 0)
@@ -270,7 +319,102 @@ static int tokenizerTests()
     return 0;
 }
 
+static int openStream(const char* text, Tokenizer* tokenizer, size_t capacity)
+{
+    // The text fits in the pipe, so it can be written before it is read
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    size_t length = strlen(text);
+    int result = write(fds[1], text, length) == (ssize_t)length;
+    close(fds[1]);
+    result = result && initTokenizerStream(tokenizer, fds[0], capacity);
+    if (!result) close(fds[0]);
+    return result;
+}
+
+static int streamTests()
+{
+    // Tokens read from a stream through buffers of any size, even smaller
+    // than a token, match the tokens of the whole text
+    const char* file = "\n $NOD12 -14.5 15$ENDNOD-0.2365566E+04  \n$ELM$ENDELM 0.1152600E+07\n"
+        "$MeshFormat 4.1 0 8 $EndMeshFormat\n$EndPhysicalNames 718930.4347826086 # 1";
+    size_t capacities[] = { 1, 3, 7, 16, 4096 };
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); ++c)
+    {
+        Tokenizer tokenizer;
+        Tokenizer stream;
+        if (!openStream(file, &stream, capacities[c]))
+        {
+            printf("Could not open a stream with a buffer of %zu bytes", capacities[c]);
+            return 1;
+        }
+        initTokenizer(&tokenizer, file);
+        Token t;
+        Token s;
+        int result = 0;
+        do
+        {
+            t = nextToken(&tokenizer, TOKEN_NULL);
+            s = nextToken(&stream, TOKEN_NULL);
+            if (s.type != t.type || s.line != t.line || s.length != t.length
+                || !compare(s.start, t.start, t.length)
+                || (t.type == TOKEN_NUMBER && s.number.value != t.number.value))
+            {
+                printf("Streamed %s %.*s at line %zu while expecting %s %.*s at line %zu"
+                    " with a buffer of %zu bytes",
+                    typeToString(s.type), (int)s.length, s.start, s.line,
+                    typeToString(t.type), (int)t.length, t.start, t.line, capacities[c]);
+                result = 1;
+            }
+            if (t.type == TOKEN_ERROR) t = nextToken(&tokenizer, TOKEN_NUMBER);
+            if (s.type == TOKEN_ERROR) s = nextToken(&stream, TOKEN_NUMBER);
+        }
+        while (result == 0 && t.type != TOKEN_END_OF_FILE && t.type != TOKEN_ERROR);
+        close(stream.fd);
+        freeTokenizer(&stream);
+        freeTokenizer(&tokenizer);
+        if (result != 0) return 1;
+    }
+
+    {
+        // Test the text of a section is kept whole while its end is found
+        Tokenizer stream;
+        if (!openStream("$Names\n2 \"a $EndNames\"\n$EndNamesX\n$EndNames 12", &stream, 4))
+        {
+            printf("Could not open a stream");
+            return 1;
+        }
+        Token t = nextToken(&stream, TOKEN_NULL);
+        stream.start = stream.current;
+        int found = t.type == TOKEN_SECTION && skipToLine(&stream, "$EndNames ", 1);
+        const char* text = "\n2 \"a $EndNames\"\n$EndNamesX\n";
+        if (!found || (size_t)(stream.current - stream.start) != strlen(text)
+            || !compare(stream.start, text, strlen(text)) || stream.line != 4)
+        {
+            printf("Section text not kept whole in a stream");
+            close(stream.fd);
+            freeTokenizer(&stream);
+            return 1;
+        }
+        stream.start = stream.current;
+        t = nextToken(&stream, TOKEN_NULL);
+        Token n = nextToken(&stream, TOKEN_NUMBER);
+        close(stream.fd);
+        freeTokenizer(&stream);
+        if (t.type != TOKEN_SECTION || n.type != TOKEN_NUMBER || n.number.integer != 12)
+        {
+            printf("Tokens after a skipped section not found in a stream");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 int main()
 {
-    return tokenizerTests();
+    if (tokenizerTests() != 0) return 1;
+    if (streamTests() != 0) return 1;
+
+    return 0;
 }
@@ -9,7 +9,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "parallel.h"
 #include "topography_parser.h"
 #include "utils.h"
 
@@ -134,6 +137,110 @@ out_free_nodes:
     return result;
 }
 
+#define XYZ_LINES 200000
+
+static int testReadXYZFileParallel(void)
+{
+    // Chunks of a large file are parsed by several threads, across comments,
+    // blank lines, Windows line endings and trailing columns
+    int result = 0;
+    char filename[] = "/tmp/amgem_xyz_parser_XXXXXX";
+    int fd = mkstemp(filename);
+    FILE* file = fd == -1 ? NULL : fdopen(fd, "w");
+    if (file == NULL)
+    {
+        printf("Failed to create temporary XYZ file\n");
+        return 1;
+    }
+    size_t expected = 0;
+    for (size_t i = 0; i < XYZ_LINES; ++i)
+    {
+        if (i % 1000 == 0) fprintf(file, "# survey line %zu\n", i / 1000);
+        if (i % 777 == 0) fprintf(file, "   \n");
+        fprintf(file, "%s%.2f\t%.3f %.4f%s", i % 3 == 0 ? "  " : "", 700000.0 + 0.25 * (double)i,
+            1150000.0 - 0.5 * (double)i, -3000.0 + 0.0625 * (double)(i % 4096),
+            i % 5 == 0 ? "\r\n" : i % 7 == 0 ? " 1 0.5\n" : "\n");
+        ++expected;
+    }
+    int written = ferror(file) == 0;
+    fclose(file);
+    if (!written)
+    {
+        printf("Failed to write temporary XYZ file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+
+    size_t threadCounts[2] = { 1, 4 };
+    for (int t = 0; t < 2 && result == 0; ++t)
+    {
+        setThreadCount(threadCounts[t]);
+        Node* nodes = NULL;
+        size_t nNodes = 0;
+        if (!readXYZFile(filename, &nodes, &nNodes) || nNodes != expected)
+        {
+            printf("Expected %zu nodes with %zu threads but found %zu\n",
+                expected, threadCounts[t], nNodes);
+            free(nodes);
+            result = 1;
+            break;
+        }
+        for (size_t i = 0; i < nNodes; ++i)
+        {
+            if (nodes[i].x != 700000.0 + 0.25 * (double)i
+                || nodes[i].y != 1150000.0 - 0.5 * (double)i
+                || nodes[i].z != -3000.0 + 0.0625 * (double)(i % 4096))
+            {
+                printf("Node %zu mismatch with %zu threads: found (%f, %f, %f)\n",
+                    i, threadCounts[t], nodes[i].x, nodes[i].y, nodes[i].z);
+                result = 1;
+                break;
+            }
+        }
+        free(nodes);
+    }
+    setThreadCount(0);
+
+out_remove_file:
+    remove(filename);
+    return result;
+}
+
+static int testReadXYZFileErrors(void)
+{
+    // A line with less than three coordinates fails the whole file
+    int result = 0;
+    char filename[] = "/tmp/amgem_xyz_parser_XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+    {
+        printf("Failed to create temporary XYZ file\n");
+        return 1;
+    }
+    const char* content = "# x y z\n1 2 3\n4 5\n6 7 8\n";
+    ssize_t length = (ssize_t)strlen(content);
+    ssize_t written = write(fd, content, (size_t)length);
+    close(fd);
+    if (written != length)
+    {
+        printf("Failed to write temporary XYZ file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+
+    Node* nodes = NULL;
+    size_t nNodes = 0;
+    if (readXYZFile(filename, &nodes, &nNodes) || nodes != NULL || nNodes != 0)
+    {
+        printf("Expected XYZ file %s with a missing coordinate to fail\n", filename);
+        free(nodes);
+        result = 1;
+    }
+
+out_remove_file:
+    remove(filename);
+    return result;
+}
 
 int main(int argc, char** argv)
 {
@@ -145,6 +252,8 @@ int main(int argc, char** argv)
 
     if (testReadTopographyFile(argv[1]) != 0) return 1;
     if (testReadXYZFile(argv[1]) != 0) return 1;
+    if (testReadXYZFileParallel() != 0) return 1;
+    if (testReadXYZFileErrors() != 0) return 1;
 
     return 0;
 }
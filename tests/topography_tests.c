@@ -7,11 +7,20 @@
     This file contains the tests for the topography functions
 */
 
+#include <dirent.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "bicubic.h"
+#include "kd_tree.h"
+#include "parallel.h"
 #include "topography_parser.h"
 #include "topography.h"
+#include "topography_cache.h"
+#include "topography_tiles.h"
 #include "utils.h"
 
 static int testIncreaseTopographyResolution(char* projectRootDir)
@@ -27,7 +36,7 @@ static int testIncreaseTopographyResolution(char* projectRootDir)
     ConfigFile config = { 0 };
     config.nx = 150;
     config.ny = 180;
-    if (!increaseTopographyResolution(&config, topoFile, &topo))
+    if (!increaseTopographyResolution(&config, topoFile, NULL, &topo))
     {
         printf("Failed to increase topography resolution for file %s\n", topoFile);
         return 1;
@@ -91,6 +100,879 @@ out_free_topo:
     return result;
 }
 
+#define BICUBIC_TOLERANCE 1e-9
+
+static int isCloseToSpline(const double* values, const double* expected, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        double scale = fabs(expected[i]) > 1.0 ? fabs(expected[i]) : 1.0;
+        if (!(fabs(values[i] - expected[i]) <= BICUBIC_TOLERANCE * scale)) return 0;
+    }
+
+    return 1;
+}
+
+static int testEvaluateTopographySpline(char* projectRootDir)
+{
+    // The GSL spline evaluated at the points of the high-resolution grid
+    // gives its values, whatever the number of threads
+    int result = 0;
+    Topography topo = { 0 };
+    TopographySpline spline = { 0 };
+    char topoFile[256];
+    combinePaths(topoFile, projectRootDir, "tests/test_skin_topography_raw");
+    ConfigFile config = { 0 };
+    config.nx = 150;
+    config.ny = 180;
+    if (!increaseTopographyResolution(&config, topoFile, NULL, &topo)
+        || !readTopographySpline(topoFile, &spline))
+    {
+        printf("Failed to read the topography spline of file %s\n", topoFile);
+        result = 1;
+        goto out_free_topo;
+    }
+
+    size_t nPoints = topo.nx * topo.ny + 1;
+    double* x = (double*)malloc(3 * nPoints * sizeof(double));
+    if (x == NULL)
+    {
+        printf("Failed to allocate %zu points\n", nPoints);
+        result = 1;
+        goto out_free_topo;
+    }
+    double* y = x + nPoints;
+    double* z = y + nPoints;
+    for (size_t j = 0; j < topo.ny; ++j)
+    {
+        for (size_t i = 0; i < topo.nx; ++i)
+        {
+            x[j * topo.nx + i] = topo.xGrid[i];
+            y[j * topo.nx + i] = topo.yGrid[j];
+        }
+    }
+    x[nPoints - 1] = topo.xGrid[0] - 1.0;
+    y[nPoints - 1] = topo.yGrid[0];
+
+    size_t threadCounts[2] = { 1, 4 };
+    for (int t = 0; t < 2 && result == 0; ++t)
+    {
+        setThreadCount(threadCounts[t]);
+        if (!evaluateTopographySpline(&spline, nPoints, x, y, z)
+            || !isCloseToSpline(topo.values, z, nPoints - 1)
+            || !isnan(z[nPoints - 1]))
+        {
+            printf("Spline evaluated with %zu threads differs from the grid\n",
+                threadCounts[t]);
+            result = 1;
+        }
+    }
+    setThreadCount(0);
+    free(x);
+
+out_free_topo:
+    freeTopographySpline(&spline);
+    freeTopography(&topo);
+    return result;
+}
+
+static int testResampleTopographyParallel(char* projectRootDir)
+{
+    // Bands of rows evaluated by four threads give the serial values bit for bit
+    int result = 0;
+    Topography topos[2] = { 0 };
+    Topography grid = { 0 };
+    char topoFile[256];
+    combinePaths(topoFile, projectRootDir, "tests/test_skin_topography_raw");
+    if (!readTopographyGrid(topoFile, NULL, &grid))
+    {
+        printf("Failed to read the topography grid of file %s\n", topoFile);
+        return 1;
+    }
+
+    size_t threadCounts[2] = { 1, 4 };
+    for (int t = 0; t < 2; ++t)
+    {
+        setThreadCount(threadCounts[t]);
+        if (!resampleTopography(&grid, NULL, 301, 257, &topos[t]))
+        {
+            printf("Failed to resample topography with %zu threads\n", threadCounts[t]);
+            result = 1;
+            goto out_free_topo;
+        }
+    }
+    if (memcmp(topos[0].values, topos[1].values, 301 * 257 * sizeof(double)) != 0)
+    {
+        printf("Topography resampled with four threads differs from the serial one\n");
+        result = 1;
+    }
+
+out_free_topo:
+    setThreadCount(0);
+    freeTopography(&topos[0]);
+    freeTopography(&topos[1]);
+    freeTopography(&grid);
+    return result;
+}
+
+static int testBicubicKernels(char* projectRootDir)
+{
+    // Every kernel gives the values of gsl_interp2d_bicubic, on a grid whose
+    // rows are not a multiple of the vector width
+    int result = 0;
+    TopographySpline spline = { 0 };
+    BicubicSurface surface = { 0 };
+    Topography topo = { 0 };
+    char topoFile[256];
+    combinePaths(topoFile, projectRootDir, "tests/test_skin_topography_raw");
+    if (!readTopographySpline(topoFile, &spline) || !initBicubicSurface(&spline.grid, &surface))
+    {
+        printf("Failed to build the bicubic surface of file %s\n", topoFile);
+        result = 1;
+        goto out_free_spline;
+    }
+
+    topo.nx = 203;
+    topo.ny = 97;
+    size_t nPoints = topo.nx * topo.ny;
+    topo.xGrid = (double*)malloc(topo.nx * sizeof(double));
+    topo.yGrid = (double*)malloc(topo.ny * sizeof(double));
+    topo.values = (double*)malloc(nPoints * sizeof(double));
+    double* x = (double*)malloc(3 * nPoints * sizeof(double));
+    if (topo.xGrid == NULL || topo.yGrid == NULL || topo.values == NULL || x == NULL)
+    {
+        printf("Failed to allocate %zu points\n", nPoints);
+        result = 1;
+        goto out_free_points;
+    }
+    double* y = x + nPoints;
+    double* z = y + nPoints;
+    const Topography* grid = &spline.grid;
+    double width = grid->xGrid[grid->nx - 1] - grid->xGrid[0];
+    double height = grid->yGrid[grid->ny - 1] - grid->yGrid[0];
+    for (size_t i = 0; i < topo.nx; ++i)
+    {
+        topo.xGrid[i] = grid->xGrid[0] + width * (double)i / (double)(topo.nx - 1);
+    }
+    for (size_t j = 0; j < topo.ny; ++j)
+    {
+        topo.yGrid[j] = grid->yGrid[0] + height * (double)j / (double)(topo.ny - 1);
+        for (size_t i = 0; i < topo.nx; ++i)
+        {
+            x[j * topo.nx + i] = topo.xGrid[i];
+            y[j * topo.nx + i] = topo.yGrid[j];
+        }
+    }
+    if (!evaluateTopographySpline(&spline, nPoints, x, y, z))
+    {
+        printf("Failed to evaluate the GSL spline\n");
+        result = 1;
+        goto out_free_points;
+    }
+
+    BicubicKernel kernels[2] = { BICUBIC_KERNEL_SCALAR, BICUBIC_KERNEL_AVX2 };
+    for (int k = 0; k < 2 && result == 0; ++k)
+    {
+        if (!isBicubicKernelAvailable(kernels[k])) continue;
+        if (!sampleBicubicSurface(&surface, kernels[k], &topo)
+            || !isCloseToSpline(topo.values, z, nPoints))
+        {
+            printf("Bicubic kernel %d differs from the GSL spline\n", k);
+            result = 1;
+        }
+    }
+
+out_free_points:
+    free(x);
+    freeTopography(&topo);
+out_free_spline:
+    freeBicubicSurface(&surface);
+    freeTopographySpline(&spline);
+    return result;
+}
+
+static int testCropTopography(char* projectRootDir)
+{
+    // The spline fitted to a window of the grid, with its margin, stays
+    // close to the one of the whole grid within the window, and the grid
+    // sampled from it spans only the cells holding the window
+    int result = 0;
+    TopographySpline reference = { 0 };
+    TopographySpline cropped = { 0 };
+    Topography topo = { 0 };
+    char topoFile[256];
+    combinePaths(topoFile, projectRootDir, "tests/test_skin_topography_raw");
+    if (!readTopographySpline(topoFile, &reference))
+    {
+        printf("Failed to read the topography spline of file %s\n", topoFile);
+        return 1;
+    }
+    const Topography* grid = &reference.grid;
+    TopographyWindow window = {
+        0.6 * grid->xGrid[grid->nx / 3] + 0.4 * grid->xGrid[grid->nx / 3 + 1],
+        0.5 * grid->xGrid[grid->nx / 2] + 0.5 * grid->xGrid[grid->nx / 2 + 1],
+        grid->yGrid[grid->ny / 4],
+        0.3 * grid->yGrid[grid->ny / 2] + 0.7 * grid->yGrid[grid->ny / 2 + 1]
+    };
+    if (!readTopographySplineInWindow(topoFile, &window, &cropped)
+        || !resampleTopography(&cropped.grid, &window, 50, 60, &topo))
+    {
+        printf("Failed to read the topography spline of file %s in a window\n", topoFile);
+        result = 1;
+        goto out_free_splines;
+    }
+    if (cropped.grid.nx >= grid->nx || cropped.grid.ny >= grid->ny
+        || topo.xGrid[0] > window.xMin || topo.xGrid[topo.nx - 1] < window.xMax
+        || topo.yGrid[0] > window.yMin || topo.yGrid[topo.ny - 1] < window.yMax
+        || topo.xGrid[0] < grid->xGrid[grid->nx / 3]
+        || topo.xGrid[topo.nx - 1] > grid->xGrid[grid->nx / 2 + 1]
+        || topo.yGrid[0] < grid->yGrid[grid->ny / 4]
+        || topo.yGrid[topo.ny - 1] > grid->yGrid[grid->ny / 2 + 1])
+    {
+        printf("Window cropped to %zu x %zu points and sampled over [%f, %f] x [%f, %f]\n",
+            cropped.grid.nx, cropped.grid.ny, topo.xGrid[0], topo.xGrid[topo.nx - 1],
+            topo.yGrid[0], topo.yGrid[topo.ny - 1]);
+        result = 1;
+        goto out_free_splines;
+    }
+
+    size_t nPoints = topo.nx * topo.ny;
+    double* x = (double*)malloc(4 * nPoints * sizeof(double));
+    if (x == NULL)
+    {
+        printf("Failed to allocate %zu points\n", nPoints);
+        result = 1;
+        goto out_free_splines;
+    }
+    double* y = x + nPoints;
+    double* z = y + nPoints;
+    double* expected = z + nPoints;
+    for (size_t j = 0; j < topo.ny; ++j)
+    {
+        for (size_t i = 0; i < topo.nx; ++i)
+        {
+            x[j * topo.nx + i] = topo.xGrid[i];
+            y[j * topo.nx + i] = topo.yGrid[j];
+        }
+    }
+    double minZ, maxZ;
+    minMaxElement(grid->values, grid->nx * grid->ny, &minZ, &maxZ);
+    if (!evaluateTopographySpline(&reference, nPoints, x, y, expected)
+        || !evaluateTopographySpline(&cropped, nPoints, x, y, z))
+    {
+        printf("Failed to evaluate the splines in the window\n");
+        result = 1;
+    }
+    for (size_t k = 0; result == 0 && k < nPoints; ++k)
+    {
+        if (!(fabs(topo.values[k] - z[k]) <= 1e-9 * fmax(fabs(z[k]), 1.0))
+            || !(fabs(z[k] - expected[k]) <= 1e-5 * (maxZ - minZ)))
+        {
+            printf("Cropped spline gives %f at (%f, %f) instead of %f\n", z[k], x[k], y[k],
+                expected[k]);
+            result = 1;
+        }
+    }
+    free(x);
+
+out_free_splines:
+    freeTopography(&topo);
+    freeTopographySpline(&cropped);
+    freeTopographySpline(&reference);
+    return result;
+}
+
+static int countCacheEntries(const char* directory)
+{
+    int count = 0;
+    DIR* dir = opendir(directory);
+    if (dir == NULL) return -1;
+    struct dirent* item;
+    while ((item = readdir(dir)) != NULL)
+    {
+        if (strstr(item->d_name, TOPOGRAPHY_CACHE_EXTENSION) != NULL) ++count;
+    }
+    closedir(dir);
+    return count;
+}
+
+static int testTopographyCache(char* projectRootDir)
+{
+    // The second resampling of a file is mapped from the cache with the same
+    // values, another resolution is another entry, and the oldest entries are
+    // evicted to keep the cache within its limit
+    int result = 0;
+    char topoFile[256];
+    combinePaths(topoFile, projectRootDir, "tests/test_skin_topography_raw");
+    char directory[] = "/tmp/amgem_cache_XXXXXX";
+    if (mkdtemp(directory) == NULL)
+    {
+        printf("Failed to create temporary cache directory\n");
+        return 1;
+    }
+    ConfigFile config = { 0 };
+    config.nx = 60;
+    config.ny = 50;
+    config.topoCacheMB = 1;
+    strcpy(config.topoCacheDir, directory);
+    Topography computed = { 0 };
+    Topography cached = { 0 };
+    Topography other = { 0 };
+    if (!increaseTopographyResolution(&config, topoFile, NULL, &computed)
+        || !increaseTopographyResolution(&config, topoFile, NULL, &cached))
+    {
+        printf("Failed to resample topography file %s through the cache\n", topoFile);
+        result = 1;
+        goto out_remove_directory;
+    }
+    if (computed.mapping != NULL || cached.mapping == NULL || cached.nx != computed.nx
+        || cached.ny != computed.ny || countCacheEntries(directory) != 1
+        || memcmp(cached.xGrid, computed.xGrid, computed.nx * sizeof(double)) != 0
+        || memcmp(cached.yGrid, computed.yGrid, computed.ny * sizeof(double)) != 0
+        || memcmp(cached.values, computed.values, computed.nx * computed.ny * sizeof(double)) != 0)
+    {
+        printf("Cached topography differs from the resampled one\n");
+        result = 1;
+        goto out_remove_directory;
+    }
+
+    config.nx = 61;
+    TopographyCacheKey first, second;
+    if (!increaseTopographyResolution(&config, topoFile, NULL, &other)
+        || other.mapping != NULL || countCacheEntries(directory) != 2
+        || !getTopographyCacheKey(topoFile, &config, NULL, &second))
+    {
+        printf("Another resolution did not add a cache entry\n");
+        result = 1;
+        goto out_remove_directory;
+    }
+
+    // Room for one entry only: storing one removes the other
+    config.nx = 60;
+    getTopographyCacheKey(topoFile, &config, NULL, &first);
+    size_t entrySize = sizeof(double) * (computed.nx + computed.ny + computed.nx * computed.ny);
+    if (!saveCachedTopography(directory, entrySize + 1024, &first, &computed)
+        || countCacheEntries(directory) != 1
+        || loadCachedTopography(directory, &second, &other))
+    {
+        printf("Oldest cache entry was not evicted\n");
+        result = 1;
+    }
+
+out_remove_directory:
+    freeTopography(&computed);
+    freeTopography(&cached);
+    freeTopography(&other);
+    DIR* dir = opendir(directory);
+    struct dirent* item;
+    while (dir != NULL && (item = readdir(dir)) != NULL)
+    {
+        char path[300];
+        snprintf(path, sizeof(path), "%s/%s", directory, item->d_name);
+        if (item->d_name[0] != '.') remove(path);
+    }
+    if (dir != NULL) closedir(dir);
+    rmdir(directory);
+    return result;
+}
+
+enum { LAYOUT_REVERSED, LAYOUT_COLUMNS, LAYOUT_SHUFFLED, LAYOUT_INCOMPLETE, N_LAYOUTS };
+
+static int writeXYZLayout(const Topography* grid, int layout, const char* filename)
+{
+    // The points of the grid in another order, the shuffled ones with a
+    // duplicate of every tenth point and the incomplete ones without the last.
+    // The last ones are not a grid any more, so they are gridded as scattered points
+    size_t nPoints = grid->nx * grid->ny;
+    size_t* order = (size_t*)malloc(2 * nPoints * sizeof(size_t));
+    FILE* file = fopen(filename, "w");
+    if (order == NULL || file == NULL)
+    {
+        free(order);
+        if (file != NULL) fclose(file);
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t k = 0; k < nPoints; ++k)
+    {
+        size_t i = k / grid->ny;
+        size_t j = k % grid->ny;
+        switch (layout)
+        {
+        case LAYOUT_REVERSED: order[count++] = nPoints - 1 - k; break;
+        case LAYOUT_COLUMNS: order[count++] = j * grid->nx + i; break;
+        default: order[count++] = k; break;
+        }
+        if (layout == LAYOUT_SHUFFLED && k % 10 == 0) order[count++] = k;
+    }
+    if (layout == LAYOUT_SHUFFLED)
+    {
+        unsigned long long state = 12345;
+        for (size_t k = count - 1; k > 0; --k)
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            size_t other = (size_t)(state >> 33) % (k + 1);
+            size_t swap = order[k];
+            order[k] = order[other];
+            order[other] = swap;
+        }
+    }
+    if (layout == LAYOUT_INCOMPLETE) --count;
+    for (size_t k = 0; k < count; ++k)
+    {
+        size_t index = order[k];
+        fprintf(file, "%.17g %.17g %.17g\n", grid->xGrid[index % grid->nx],
+            grid->yGrid[index / grid->nx], grid->values[index]);
+    }
+
+    int result = ferror(file) == 0;
+    fclose(file);
+    free(order);
+    return result;
+}
+
+static int testReadTopographyLayouts(char* projectRootDir)
+{
+    // Reversed and column-major points are copied, shuffled ones are sorted,
+    // and all of them give the grid of the row-major file. An incomplete grid
+    // is gridded within the range of its values
+    int result = 0;
+    TopographySpline reference = { 0 };
+    char topoFile[256];
+    combinePaths(topoFile, projectRootDir, "tests/test_skin_topography_raw");
+    if (!readTopographySpline(topoFile, &reference))
+    {
+        printf("Failed to read the topography spline of file %s\n", topoFile);
+        return 1;
+    }
+
+    const Topography* grid = &reference.grid;
+    char filename[] = "/tmp/amgem_topography_XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+    {
+        printf("Failed to create temporary XYZ file\n");
+        result = 1;
+        goto out_free_reference;
+    }
+    close(fd);
+    setThreadCount(4);
+    for (int layout = 0; layout < N_LAYOUTS && result == 0; ++layout)
+    {
+        TopographySpline spline = { 0 };
+        if (!writeXYZLayout(grid, layout, filename))
+        {
+            printf("Failed to write temporary XYZ file %s\n", filename);
+            result = 1;
+            break;
+        }
+        int read = readTopographySpline(filename, &spline);
+        if (layout == LAYOUT_INCOMPLETE)
+        {
+            double minZ = grid->values[0];
+            double maxZ = grid->values[0];
+            for (size_t k = 1; k < grid->nx * grid->ny; ++k)
+            {
+                minZ = fmin(minZ, grid->values[k]);
+                maxZ = fmax(maxZ, grid->values[k]);
+            }
+            for (size_t k = 0; read && k < spline.grid.nx * spline.grid.ny; ++k)
+            {
+                read = spline.grid.values[k] >= minZ && spline.grid.values[k] <= maxZ;
+            }
+            if (!read || spline.grid.xGrid[0] != grid->xGrid[0]
+                || spline.grid.yGrid[spline.grid.ny - 1] != grid->yGrid[grid->ny - 1])
+            {
+                printf("Incomplete grid was not gridded within the range of its points\n");
+                result = 1;
+            }
+        }
+        else if (!read || spline.grid.nx != grid->nx || spline.grid.ny != grid->ny
+            || memcmp(spline.grid.xGrid, grid->xGrid, grid->nx * sizeof(double)) != 0
+            || memcmp(spline.grid.yGrid, grid->yGrid, grid->ny * sizeof(double)) != 0
+            || memcmp(spline.grid.values, grid->values, grid->nx * grid->ny * sizeof(double)) != 0)
+        {
+            printf("Grid of layout %d differs from the row-major one\n", layout);
+            result = 1;
+        }
+        freeTopographySpline(&spline);
+    }
+    setThreadCount(0);
+    remove(filename);
+
+out_free_reference:
+    freeTopographySpline(&reference);
+    return result;
+}
+
+#define SCATTERED_POINTS 20000
+#define NEIGHBOURS 8
+
+static double nextRandom(unsigned long long* state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (double)(*state >> 11) / 9007199254740992.0;
+}
+
+static int compareDistances(const void* a, const void* b)
+{
+    double distanceA = *(const double*)a;
+    double distanceB = *(const double*)b;
+    return distanceA < distanceB ? -1 : distanceA > distanceB;
+}
+
+static int testFindNearestPoints(void)
+{
+    // The tree finds the distances of a brute force search, on survey lines
+    // sharing their x-coordinates and on random points
+    int result = 0;
+    Node* points = (Node*)malloc(SCATTERED_POINTS * sizeof(Node));
+    if (points == NULL)
+    {
+        printf("Failed to allocate %d points\n", SCATTERED_POINTS);
+        return 1;
+    }
+    unsigned long long state = 42;
+    for (size_t k = 0; k < SCATTERED_POINTS; ++k)
+    {
+        points[k].x = k % 2 == 0 ? 1000.0 * (double)(k % 40) : 40000.0 * nextRandom(&state);
+        points[k].y = 30000.0 * nextRandom(&state);
+        points[k].z = (double)k;
+    }
+
+    size_t threadCounts[2] = { 1, 4 };
+    for (int t = 0; t < 2 && result == 0; ++t)
+    {
+        setThreadCount(threadCounts[t]);
+        KdTree tree = { 0 };
+        if (!buildKdTree(points, SCATTERED_POINTS, &tree))
+        {
+            printf("Failed to build a k-d tree with %zu threads\n", threadCounts[t]);
+            result = 1;
+            break;
+        }
+        for (int query = 0; query < 200 && result == 0; ++query)
+        {
+            double x = 42000.0 * nextRandom(&state) - 1000.0;
+            double y = 32000.0 * nextRandom(&state) - 1000.0;
+            size_t indexes[NEIGHBOURS];
+            double found[NEIGHBOURS];
+            double expected[NEIGHBOURS];
+            size_t count = findNearestPoints(&tree, x, y, NEIGHBOURS, indexes, found);
+            for (int k = 0; k < NEIGHBOURS; ++k) expected[k] = INFINITY;
+            for (size_t k = 0; k < SCATTERED_POINTS; ++k)
+            {
+                double dx = x - points[k].x;
+                double dy = y - points[k].y;
+                double distance = dx * dx + dy * dy;
+                if (distance < expected[NEIGHBOURS - 1])
+                {
+                    expected[NEIGHBOURS - 1] = distance;
+                    qsort(expected, NEIGHBOURS, sizeof(double), compareDistances);
+                }
+            }
+            qsort(found, count, sizeof(double), compareDistances);
+            if (count != NEIGHBOURS || memcmp(found, expected, sizeof(expected)) != 0)
+            {
+                printf("Nearest points of (%f, %f) differ from a brute force search\n", x, y);
+                result = 1;
+            }
+        }
+        freeKdTree(&tree);
+    }
+    setThreadCount(0);
+    free(points);
+    return result;
+}
+
+static double surveyDepth(double x, double y)
+{
+    return -2000.0 + 100.0 * sin(x / 1500.0) * cos(y / 2000.0);
+}
+
+static int testGridScatteredPoints(void)
+{
+    // Random soundings of a seabed with 100 m hills are gridded within a few
+    // meters of it, the error of inverse distance weights on such a slope
+    int result = 0;
+    char filename[] = "/tmp/amgem_topography_XXXXXX";
+    int fd = mkstemp(filename);
+    FILE* file = fd == -1 ? NULL : fdopen(fd, "w");
+    if (file == NULL)
+    {
+        printf("Failed to create temporary XYZ file\n");
+        return 1;
+    }
+    unsigned long long state = 7;
+    for (size_t k = 0; k < SCATTERED_POINTS; ++k)
+    {
+        double x = 10000.0 * nextRandom(&state);
+        double y = 8000.0 * nextRandom(&state);
+        fprintf(file, "%.17g %.17g %.17g\n", x, y, surveyDepth(x, y));
+    }
+    int written = ferror(file) == 0;
+    fclose(file);
+
+    TopographySpline spline = { 0 };
+    if (!written || !readTopographySpline(filename, &spline))
+    {
+        printf("Failed to grid scattered XYZ file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+    const Topography* grid = &spline.grid;
+    double maxError = 0.0;
+    for (size_t j = 0; j < grid->ny; ++j)
+    {
+        for (size_t i = 0; i < grid->nx; ++i)
+        {
+            double error = fabs(grid->values[j * grid->nx + i]
+                - surveyDepth(grid->xGrid[i], grid->yGrid[j]));
+            if (error > maxError) maxError = error;
+        }
+    }
+    if (grid->nx * grid->ny < SCATTERED_POINTS / 2 || maxError > 10.0)
+    {
+        printf("Scattered points gridded on %zu x %zu points with an error of %f\n",
+            grid->nx, grid->ny, maxError);
+        result = 1;
+    }
+    freeTopographySpline(&spline);
+
+out_remove_file:
+    remove(filename);
+    return result;
+}
+
+#define LATTICE_NX 20
+#define LATTICE_NY 15
+
+static int readGridWithReport(const char* filename, size_t skipped, Topography* grid,
+    char* report, size_t size)
+{
+    // Writes a lattice without one of its points, then reads it with the
+    // standard error going to the report
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) return 0;
+    for (size_t k = 0; k < LATTICE_NX * LATTICE_NY; ++k)
+    {
+        if (k == skipped) continue;
+        double x = 500.0 + 25.0 * (double)(k % LATTICE_NX);
+        double y = 800.0 + 25.0 * (double)(k / LATTICE_NX);
+        fprintf(file, "%.17g %.17g %.17g\n", x, y, surveyDepth(x, y));
+    }
+    int result = ferror(file) == 0;
+    fclose(file);
+
+    char reportFile[] = "/tmp/amgem_report_XXXXXX";
+    int reportFd = mkstemp(reportFile);
+    int savedFd = dup(STDERR_FILENO);
+    if (!result || reportFd == -1 || savedFd == -1)
+    {
+        if (reportFd != -1) close(reportFd);
+        if (savedFd != -1) close(savedFd);
+        remove(reportFile);
+        return 0;
+    }
+    fflush(stderr);
+    dup2(reportFd, STDERR_FILENO);
+    result = readTopographyGrid(filename, NULL, grid);
+    fflush(stderr);
+    dup2(savedFd, STDERR_FILENO);
+    close(savedFd);
+
+    ssize_t length = pread(reportFd, report, size - 1, 0);
+    report[length > 0 ? length : 0] = '\0';
+    close(reportFd);
+    remove(reportFile);
+    return result;
+}
+
+static int testReportGriddedLattice(void)
+{
+    // A lattice one point short is gridded as scattered points, which is
+    // reported with the new resolution, while a whole lattice is read as is
+    int result = 0;
+    char filename[] = "/tmp/amgem_topography_XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+    {
+        printf("Failed to create temporary XYZ file\n");
+        return 1;
+    }
+    close(fd);
+
+    char report[1024];
+    Topography whole = { 0 };
+    Topography damaged = { 0 };
+    if (!readGridWithReport(filename, LATTICE_NX * LATTICE_NY, &whole, report, sizeof(report))
+        || whole.nx != LATTICE_NX || whole.ny != LATTICE_NY || report[0] != '\0')
+    {
+        printf("Whole lattice read on %zu x %zu points, reporting '%s'\n",
+            whole.nx, whole.ny, report);
+        result = 1;
+        goto out_free_grids;
+    }
+    if (!readGridWithReport(filename, 7 * LATTICE_NX + 3, &damaged, report, sizeof(report)))
+    {
+        printf("Failed to read a lattice one point short\n");
+        result = 1;
+        goto out_free_grids;
+    }
+    char expected[256];
+    snprintf(expected, sizeof(expected), "The %d points of topography file %s do not form a "
+        "regular grid, they are gridded by inverse distance weighting on %zu x %zu points",
+        LATTICE_NX * LATTICE_NY - 1, filename, damaged.nx, damaged.ny);
+    if (strstr(report, expected) == NULL)
+    {
+        printf("Lattice one point short reported '%s'\n", report);
+        result = 1;
+    }
+
+out_free_grids:
+    freeTopography(&whole);
+    freeTopography(&damaged);
+    remove(filename);
+    return result;
+}
+
+#define TILE_SIZE 32
+#define TILED_POINTS 50000
+
+static double tiledHeight(size_t i, size_t j)
+{
+    return 500.0 + 40.0 * sin(0.11 * (double)i) + 25.0 * cos(0.07 * (double)j)
+        + 0.5 * (double)(i * j % 7);
+}
+
+static double bilinearHeight(double x, double y, size_t nx, size_t ny)
+{
+    // The reference interpolation on the whole grid of origin (1000, 2000)
+    // and spacing (10, 20)
+    double fx = (x - 1000.0) / 10.0;
+    double fy = (y - 2000.0) / 20.0;
+    size_t i = fx >= (double)(nx - 1) ? nx - 2 : (size_t)fx;
+    size_t j = fy >= (double)(ny - 1) ? ny - 2 : (size_t)fy;
+    double tx = fx - (double)i;
+    double ty = fy - (double)j;
+    return (1.0 - tx) * (1.0 - ty) * tiledHeight(i, j) + tx * (1.0 - ty) * tiledHeight(i + 1, j)
+        + (1.0 - tx) * ty * tiledHeight(i, j + 1) + tx * ty * tiledHeight(i + 1, j + 1);
+}
+
+static int writeTiledGrid(const char* filename, size_t nx, size_t ny)
+{
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) return 0;
+    fprintf(file, "%zu %zu\n", nx, ny);
+    for (size_t i = 0; i < nx; ++i) fprintf(file, "%.17g\n", 1000.0 + 10.0 * (double)i);
+    for (size_t j = 0; j < ny; ++j) fprintf(file, "%.17g\n", 2000.0 + 20.0 * (double)j);
+    for (size_t j = 0; j < ny; ++j)
+    {
+        for (size_t i = 0; i < nx; ++i) fprintf(file, "%.17g\n", tiledHeight(i, j));
+    }
+    int result = ferror(file) == 0;
+    fclose(file);
+    return result;
+}
+
+static int testTiledTopography(size_t nx, size_t ny)
+{
+    // A grid split into tiles gives the bilinear interpolation of the whole
+    // grid, across the borders of the tiles too, and NAN outside of it. The
+    // points inside a tile only read that tile, and the directory has a block
+    // per tile whatever the width of the last tiles of the rows
+    int result = 0;
+    char directory[] = "/tmp/amgem_tiles_XXXXXX";
+    if (mkdtemp(directory) == NULL)
+    {
+        printf("Failed to create temporary tile directory\n");
+        return 1;
+    }
+    char gridFile[256];
+    char indexFile[256];
+    combinePaths(gridFile, directory, "grid");
+    combinePaths(indexFile, directory, "grid" TILES_EXTENSION);
+    double* coordinates = (double*)malloc(3 * TILED_POINTS * sizeof(double));
+    TiledTopography tiles = { 0 };
+    if (coordinates == NULL || !writeTiledGrid(gridFile, nx, ny)
+        || !writeTopographyTiles(gridFile, TILE_SIZE, indexFile)
+        || !openTiledTopography(indexFile, 2 * TILE_SIZE * TILE_SIZE * sizeof(double), &tiles))
+    {
+        printf("Failed to split %s into tiles\n", gridFile);
+        result = 1;
+        goto out_remove_files;
+    }
+    if (tiles.nBlocks != tiles.nTiles)
+    {
+        printf("Directory of %zu tiles has %zu blocks\n", tiles.nTiles, tiles.nBlocks);
+        result = 1;
+        goto out_close_tiles;
+    }
+
+    double* x = coordinates;
+    double* y = coordinates + TILED_POINTS;
+    double* z = coordinates + 2 * TILED_POINTS;
+    unsigned long long state = 11;
+    for (size_t k = 0; k < TILED_POINTS; ++k)
+    {
+        x[k] = 1000.0 + 10.0 * (1.0 + (TILE_SIZE - 3) * nextRandom(&state));
+        y[k] = 2000.0 + 20.0 * (1.0 + (TILE_SIZE - 3) * nextRandom(&state));
+    }
+    if (!sampleTiledTopography(&tiles, TILED_POINTS, x, y, z) || tiles.nLoads != 1)
+    {
+        printf("Points inside a tile read %zu tiles\n", tiles.nLoads);
+        result = 1;
+        goto out_close_tiles;
+    }
+
+    // Random points, the lattice lines, including the borders of the tiles,
+    // and points outside the grid
+    for (size_t k = 0; k < TILED_POINTS; ++k)
+    {
+        x[k] = 990.0 + 10.0 * (double)(nx + 1) * nextRandom(&state);
+        y[k] = 1980.0 + 20.0 * (double)(ny + 1) * nextRandom(&state);
+        if (k % 5 == 0) x[k] = 1000.0 + 10.0 * (double)(k / 5 % nx);
+        if (k % 7 == 0) y[k] = 2000.0 + 20.0 * (double)(k / 7 % ny);
+    }
+    setThreadCount(4);
+    int sampled = sampleTiledTopography(&tiles, TILED_POINTS, x, y, z);
+    setThreadCount(0);
+    for (size_t k = 0; sampled && k < TILED_POINTS && result == 0; ++k)
+    {
+        int inside = x[k] >= 1000.0 && x[k] <= 1000.0 + 10.0 * (double)(nx - 1)
+            && y[k] >= 2000.0 && y[k] <= 2000.0 + 20.0 * (double)(ny - 1);
+        double expected = inside ? bilinearHeight(x[k], y[k], nx, ny) : NAN;
+        if (inside ? !(fabs(z[k] - expected) <= 1e-9) : !isnan(z[k]))
+        {
+            printf("Tiled height at (%f, %f) is %f instead of %f\n", x[k], y[k], z[k], expected);
+            result = 1;
+        }
+    }
+    if (!sampled)
+    {
+        printf("Failed to sample the tiles of %s\n", indexFile);
+        result = 1;
+    }
+
+out_close_tiles:
+    closeTiledTopography(&tiles);
+out_remove_files:
+    free(coordinates);
+    for (size_t ty = 0; ty * TILE_SIZE < ny; ++ty)
+    {
+        for (size_t tx = 0; tx * TILE_SIZE < nx; ++tx)
+        {
+            char tileFile[300];
+            snprintf(tileFile, sizeof(tileFile), "%s.%zu_%zu", indexFile, tx, ty);
+            remove(tileFile);
+        }
+    }
+    remove(indexFile);
+    remove(gridFile);
+    rmdir(directory);
+    return result;
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 2)
@@ -98,5 +980,19 @@ int main(int argc, char** argv)
         printf("Usage: %s <project_root_directory>\n", argv[0]);
         return 1;
     }
-    return testIncreaseTopographyResolution(argv[1]);
+    if (testIncreaseTopographyResolution(argv[1]) != 0) return 1;
+    if (testEvaluateTopographySpline(argv[1]) != 0) return 1;
+    if (testResampleTopographyParallel(argv[1]) != 0) return 1;
+    if (testBicubicKernels(argv[1]) != 0) return 1;
+    if (testReadTopographyLayouts(argv[1]) != 0) return 1;
+    if (testCropTopography(argv[1]) != 0) return 1;
+    if (testTopographyCache(argv[1]) != 0) return 1;
+    if (testFindNearestPoints() != 0) return 1;
+    if (testGridScatteredPoints() != 0) return 1;
+    if (testReportGriddedLattice() != 0) return 1;
+    if (testTiledTopography(130, 90) != 0) return 1;
+    // Tiles of a single point at the end of the rows and columns
+    if (testTiledTopography(2 * TILE_SIZE + 1, TILE_SIZE + 1) != 0) return 1;
+
+    return 0;
 }
@@ -0,0 +1,324 @@
+/*
+    Filename: write_buffer_tests.c
+    Author: David F. Meretzki
+    Date: 2026-10-16
+
+    Description:
+    This file contains the tests for the write buffers and the number formatting
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "write_buffer.h"
+
+#define RANDOM_VALUES 200000
+
+static double randomValue(unsigned long long* state)
+{
+    // xorshift64, the values cover coordinates, small fractions and halves
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    double unit = (double)(*state >> 11) / 9007199254740992.0;
+    switch (*state % 4)
+    {
+    case 0:
+        return (unit - 0.5) * 2.0e6;
+    case 1:
+        return (unit - 0.5) * 2.0e-3;
+    case 2:
+        return floor((unit - 0.5) * 2.0e7) / 8.0;
+    default:
+        return floor((unit - 0.5) * 2.0e10) / 1000.0;
+    }
+}
+
+static int testFormatIntegral(void)
+{
+    double values[] = { 0.0, -0.0, 1.0, -6000.0, 718600.0, 1152600.0, 4503599627370496.0,
+        -9007199254740993.0, 1e19, -1e300, INFINITY, -INFINITY };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+    {
+        char text[MAX_DOUBLE_LENGTH];
+        char expected[MAX_DOUBLE_LENGTH];
+        size_t length = formatDouble(text, values[i], SHORTEST_PRECISION);
+        snprintf(expected, sizeof(expected), "%.0f", values[i]);
+        if (length != strlen(expected) || memcmp(text, expected, length) != 0)
+        {
+            printf("Integral value formatted as '%.*s' instead of '%s'\n",
+                (int)length, text, expected);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int testFormatFixedPrecision(void)
+{
+    // Fixed precision must match printf, including the halfway cases
+    unsigned long long state = 88172645463325252ULL;
+    for (int i = 0; i < RANDOM_VALUES; ++i)
+    {
+        double value = randomValue(&state);
+        if (value == trunc(value)) continue;
+        int precision = i % (MAX_PRECISION + 1);
+
+        char text[MAX_DOUBLE_LENGTH];
+        char expected[MAX_DOUBLE_LENGTH];
+        size_t length = formatDouble(text, value, precision);
+        snprintf(expected, sizeof(expected), "%.*f", precision, value);
+        if (length != strlen(expected) || memcmp(text, expected, length) != 0)
+        {
+            printf("Value %.17g with precision %d formatted as '%.*s' instead of '%s'\n",
+                value, precision, (int)length, text, expected);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int testFormatShortest(void)
+{
+    // The shortest text must read back as the same value
+    unsigned long long state = 2463534242ULL;
+    double values[] = { 0.1, -0.3, 1.0 / 3.0, 2.5e-8, 1e-300, 1.7976931348623157e308 / 3.0 };
+    for (int i = 0; i < RANDOM_VALUES; ++i)
+    {
+        double value = i < (int)(sizeof(values) / sizeof(values[0]))
+            ? values[i]
+            : randomValue(&state);
+
+        char text[MAX_DOUBLE_LENGTH + 1];
+        size_t length = formatDouble(text, value, SHORTEST_PRECISION);
+        text[length] = '\0';
+        if (strtod(text, NULL) != value)
+        {
+            printf("Value %.17g formatted as '%s' does not read back\n", value, text);
+            return 1;
+        }
+    }
+
+    char text[MAX_DOUBLE_LENGTH];
+    size_t length = formatDouble(text, -1152600.25, SHORTEST_PRECISION);
+    if (length != 11 || memcmp(text, "-1152600.25", length) != 0)
+    {
+        printf("Value -1152600.25 formatted as '%.*s'\n", (int)length, text);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int testFormatPadded(void)
+{
+    // Every padded value fills its width and reads back as the same value
+    unsigned long long state = 88172645463325252ULL;
+    double values[] = { 0.0, -1e300, 1e19, -2.2250738585072014e-308, 4.9e-324, NAN };
+    for (int i = 0; i < RANDOM_VALUES; ++i)
+    {
+        double value = i < (int)(sizeof(values) / sizeof(values[0]))
+            ? values[i]
+            : randomValue(&state);
+
+        char text[FIXED_DOUBLE_WIDTH + 1];
+        formatPaddedDouble(text, value, i % 2 == 0 ? SHORTEST_PRECISION : MAX_PRECISION);
+        text[FIXED_DOUBLE_WIDTH] = '\0';
+        double readBack = strtod(text, NULL);
+        if (text[FIXED_DOUBLE_WIDTH - 1] == ' '
+            || (i % 2 == 0 && readBack != value && !(isnan(readBack) && isnan(value))))
+        {
+            printf("Value %.17g padded as '%s'\n", value, text);
+            return 1;
+        }
+    }
+
+    char text[8];
+    formatPaddedSize(text, 1234, 7);
+    if (memcmp(text, "   1234", 7) != 0 || countDigits(0) != 1 || countDigits(9) != 1
+        || countDigits(10) != 2 || countDigits(18446744073709551615ULL) != 20)
+    {
+        printf("Size 1234 padded as '%.7s'\n", text);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int testWriteBufferFile(void)
+{
+    // A small buffer is flushed many times, the file must still hold every byte
+    int result = 0;
+    char filename[] = "/tmp/amgem_write_buffer_XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+    {
+        printf("Failed to create temporary file\n");
+        return 1;
+    }
+
+    WriteBuffer buffer;
+    if (!initWriteBuffer(&buffer, fd, 1024))
+    {
+        close(fd);
+        result = 1;
+        goto out_remove_file;
+    }
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        appendSize(&buffer, i);
+        appendChar(&buffer, ' ');
+        appendInt(&buffer, -(long long)i);
+        appendChar(&buffer, ' ');
+        appendDouble(&buffer, (double)i + 0.5, 1);
+        appendChar(&buffer, '\n');
+    }
+    int flushed = flushWriteBuffer(&buffer);
+    size_t written = buffer.written;
+    freeWriteBuffer(&buffer);
+    close(fd);
+    if (!flushed)
+    {
+        printf("Failed to flush the write buffer\n");
+        result = 1;
+        goto out_remove_file;
+    }
+
+    FILE* file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        printf("Failed to open file %s\n", filename);
+        result = 1;
+        goto out_remove_file;
+    }
+    size_t expectedSize = 0;
+    for (size_t i = 0; i < 10000 && result == 0; ++i)
+    {
+        size_t index;
+        long long negative;
+        double value;
+        char expected[64];
+        expectedSize += (size_t)snprintf(expected, sizeof(expected), "%zu %lld %.1f\n",
+            i, -(long long)i, (double)i + 0.5);
+        if (fscanf(file, "%zu %lld %lf", &index, &negative, &value) != 3
+            || index != i || negative != -(long long)i || value != (double)i + 0.5)
+        {
+            printf("Line %zu mismatch in file %s\n", i + 1, filename);
+            result = 1;
+        }
+    }
+    fclose(file);
+    if (result == 0 && written != expectedSize)
+    {
+        printf("Expected %zu bytes written but found %zu\n", expectedSize, written);
+        result = 1;
+    }
+
+out_remove_file:
+    remove(filename);
+    return result;
+}
+
+static int testAppendFileRange(void)
+{
+    // A range of a file between formatted text, copied to a file and to memory
+    int result = 0;
+    char sourceFilename[] = "/tmp/amgem_write_buffer_XXXXXX";
+    char filename[] = "/tmp/amgem_write_buffer_XXXXXX";
+    int sourceFd = mkstemp(sourceFilename);
+    int fd = mkstemp(filename);
+    if (sourceFd == -1 || fd == -1)
+    {
+        printf("Failed to create temporary files\n");
+        if (sourceFd != -1) close(sourceFd);
+        if (fd != -1) close(fd);
+        result = 1;
+        goto out_remove_files;
+    }
+
+    // The range is larger than a buffer so every copy method loops
+    size_t sourceSize = 3 * WRITE_BUFFER_SIZE + 17;
+    char* source = (char*)malloc(sourceSize);
+    char* expected = (char*)malloc(sourceSize + 2);
+    char* content = (char*)malloc(sourceSize + 2);
+    if (source == NULL || expected == NULL || content == NULL)
+    {
+        printf("Failed to allocate memory for the file range\n");
+        result = 1;
+        goto out_free_memory;
+    }
+    for (size_t i = 0; i < sourceSize; ++i) source[i] = (char)('a' + i % 26);
+    if (write(sourceFd, source, sourceSize) != (ssize_t)sourceSize)
+    {
+        printf("Failed to write file %s\n", sourceFilename);
+        result = 1;
+        goto out_free_memory;
+    }
+    size_t offset = 5;
+    size_t length = sourceSize - 9;
+    expected[0] = '<';
+    memcpy(&expected[1], &source[offset], length);
+    expected[length + 1] = '>';
+
+    WriteBuffer buffer;
+    WriteBuffer memory;
+    int initialized = initWriteBuffer(&buffer, fd, 1024);
+    initialized = initWriteBuffer(&memory, -1, 1024) && initialized;
+    if (!initialized)
+    {
+        freeWriteBuffer(&memory);
+        freeWriteBuffer(&buffer);
+        result = 1;
+        goto out_free_memory;
+    }
+    WriteBuffer* buffers[2] = { &buffer, &memory };
+    for (int i = 0; i < 2; ++i)
+    {
+        appendChar(buffers[i], '<');
+        appendFileRange(buffers[i], sourceFd, offset, length);
+        appendChar(buffers[i], '>');
+    }
+    int flushed = flushWriteBuffer(&buffer) && !memory.failed;
+    size_t written = buffer.written;
+    if (!flushed || written != length + 2 || memory.size != length + 2
+        || memcmp(memory.data, expected, length + 2) != 0
+        || pread(fd, content, length + 2, 0) != (ssize_t)(length + 2)
+        || memcmp(content, expected, length + 2) != 0)
+    {
+        printf("File range of %zu bytes was not copied as expected\n", length);
+        result = 1;
+    }
+    freeWriteBuffer(&memory);
+    freeWriteBuffer(&buffer);
+
+out_free_memory:
+    free(content);
+    free(expected);
+    free(source);
+    close(sourceFd);
+    close(fd);
+
+out_remove_files:
+    remove(sourceFilename);
+    remove(filename);
+    return result;
+}
+
+
+int main(void)
+{
+    if (testFormatIntegral() != 0) return 1;
+    if (testFormatFixedPrecision() != 0) return 1;
+    if (testFormatShortest() != 0) return 1;
+    if (testFormatPadded() != 0) return 1;
+    if (testWriteBufferFile() != 0) return 1;
+    if (testAppendFileRange() != 0) return 1;
+
+    return 0;
+}